@@ -0,0 +1,133 @@
+#include "apic.h"
+#include "../lib.h"
+#include "../paging.h"
+#include "../idt.h"
+#include "pit.h"
+#include "../sched/tick.h"
+
+// Where this CPU's local APIC registers are, 0 until lapic_init found one
+static volatile uint8_t* lapic_base;
+// Timer counts in a jiffy, 0 until lapic_timer_init measured it. Every CPU's timer runs off the
+// same bus clock, so one measurement does for all of them.
+static uint32_t lapic_timer_counts;
+
+static uint32_t lapic_read(uint32_t reg);
+static void lapic_write(uint32_t reg, uint32_t value);
+
+// Finds the boot processor's local APIC and maps its registers
+// Every CPU sees its own local APIC at the same address, so this only has to happen once.
+// Inputs: None
+// Outputs: 0 on success, -1 if the CPU has no local APIC
+// Side effects: Identity maps the APIC's 4MB (uncached) in both page directories
+int32_t lapic_init() {
+    uint32_t eax, ebx, ecx, edx, lo, hi;
+    if (!cpu_has_cpuid()) return -1;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_FEATURE_APIC)) return -1;
+
+    rdmsr(IA32_APIC_BASE_MSR, &lo, &hi);
+    if (!(lo & APIC_BASE_ENABLE)) wrmsr(IA32_APIC_BASE_MSR, lo | APIC_BASE_ENABLE, hi);
+    if (map_kernel_identity_4mb((lo & APIC_BASE_ADDR_MASK) & ~(SIZEOF_PROGRAMPAGE - 1))) return -1;
+    lapic_base = (volatile uint8_t*)(lo & APIC_BASE_ADDR_MASK);
+    return 0;
+}
+
+// Turns on this CPU's local APIC, for the application processors as they come up
+// The boot processor's is left as the BIOS set it up, its interrupts come through the PIC.
+// Inputs: None
+// Outputs: None
+// Side effects: Spurious interrupts go to LAPIC_SPURIOUS_VECTOR. The timer is set up for
+//      lapic_timer_arm but doesn't count yet.
+void lapic_enable() {
+    if (!lapic_base) return;
+    lapic_write(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+    lapic_write(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED | IDT_LAPIC_TIMER);
+    lapic_write(LAPIC_REG_TIMER_INIT, 0);
+}
+
+// Reads this CPU's local APIC ID
+// Inputs: None
+// Outputs: The ID, 0 if there's no local APIC
+uint32_t lapic_id() {
+    if (!lapic_base) return 0;
+    return lapic_read(LAPIC_REG_ID) >> LAPIC_ID_SHIFT;
+}
+
+// Sends an inter-processor interrupt to every other CPU
+// Inputs: command -- delivery mode, level and vector bits for the ICR (LAPIC_ICR_*)
+// Outputs: None
+// Side effects: Waits for the APIC to take it
+void lapic_ipi_all_but_self(uint32_t command) {
+    if (!lapic_base) return;
+    lapic_write(LAPIC_REG_ICR_HIGH, 0);
+    lapic_write(LAPIC_REG_ICR_LOW, command | LAPIC_ICR_ALL_BUT_SELF);
+    while (lapic_read(LAPIC_REG_ICR_LOW) & LAPIC_ICR_PENDING);
+}
+
+// Sends an inter-processor interrupt to one CPU
+// Inputs: apic_id -- its local APIC ID, command -- delivery mode, level and vector bits for the ICR
+// Outputs: None
+// Side effects: Waits for the APIC to take it
+void lapic_ipi(uint32_t apic_id, uint32_t command) {
+    if (!lapic_base) return;
+    lapic_write(LAPIC_REG_ICR_HIGH, apic_id << LAPIC_ICR_DEST_SHIFT);
+    lapic_write(LAPIC_REG_ICR_LOW, command);
+    while (lapic_read(LAPIC_REG_ICR_LOW) & LAPIC_ICR_PENDING);
+}
+
+// Tells this CPU's local APIC the interrupt it delivered was handled
+// Inputs: None
+// Outputs: None
+void lapic_eoi() {
+    if (!lapic_base) return;
+    lapic_write(LAPIC_REG_EOI, 0);
+}
+
+// Measures how fast the local APIC timers count, against a jiffy of the PIT's channel 2
+// Inputs: None
+// Outputs: 0 if this CPU's timer can be armed (see lapic_timer_arm), -1 if it has none that counts
+// Side effects: The first call busy-waits a jiffy. Channel 2 isn't shared with anything that runs
+//      at the same time, as long as it's called from the kernel (see kernel_lock_enter).
+int32_t lapic_timer_init() {
+    uint32_t left;
+    if (!lapic_base) return -1;
+    if (lapic_timer_counts) return 0;
+    lapic_write(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED | IDT_LAPIC_TIMER);
+    lapic_write(LAPIC_REG_TIMER_INIT, 0xFFFFFFFF);
+    pit_udelay(1000000 / TICK_HZ);
+    left = lapic_read(LAPIC_REG_TIMER_CURRENT);
+    lapic_write(LAPIC_REG_TIMER_INIT, 0);
+    lapic_timer_counts = 0xFFFFFFFF - left;
+    return lapic_timer_counts ? 0 : -1;
+}
+
+// Makes this CPU's local APIC timer interrupt once, on IDT_LAPIC_TIMER
+// Inputs: n -- jiffies from now, at least 1
+// Outputs: None
+// Side effects: Replaces whatever it was counting down
+void lapic_timer_arm(uint32_t n) {
+    if (!lapic_base || !lapic_timer_counts) return;
+    if (!n) n = 1;
+    if (n > 0xFFFFFFFF / lapic_timer_counts) n = 0xFFFFFFFF / lapic_timer_counts;
+    lapic_write(LAPIC_REG_LVT_TIMER, IDT_LAPIC_TIMER);
+    lapic_write(LAPIC_REG_TIMER_INIT, n * lapic_timer_counts);
+}
+
+// Stops this CPU's local APIC timer
+// Inputs: None
+// Outputs: None
+void lapic_timer_stop() {
+    if (!lapic_base) return;
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED | IDT_LAPIC_TIMER);
+    lapic_write(LAPIC_REG_TIMER_INIT, 0);
+}
+
+static uint32_t lapic_read(uint32_t reg) {
+    return *(volatile uint32_t*)(lapic_base + reg);
+}
+
+static void lapic_write(uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(lapic_base + reg) = value;
+}
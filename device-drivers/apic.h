@@ -0,0 +1,50 @@
+#ifndef _APIC_H
+#define _APIC_H
+
+#include "../types.h"
+
+#define IA32_APIC_BASE_MSR      0x1B
+#define APIC_BASE_ENABLE        0x800           //global enable bit of the MSR
+#define APIC_BASE_ADDR_MASK     0xFFFFF000
+#define CPUID_FEATURE_APIC      0x200           //CPUID leaf 1, EDX
+
+// Local APIC registers, offsets from its base
+#define LAPIC_REG_ID            0x020
+#define LAPIC_REG_EOI           0x0B0
+#define LAPIC_REG_SVR           0x0F0           //spurious interrupt vector register
+#define LAPIC_REG_ICR_LOW       0x300
+#define LAPIC_REG_ICR_HIGH      0x310
+#define LAPIC_REG_LVT_TIMER     0x320
+#define LAPIC_REG_TIMER_INIT    0x380           //initial count, writing it starts the timer
+#define LAPIC_REG_TIMER_CURRENT 0x390
+#define LAPIC_REG_TIMER_DIVIDE  0x3E0
+#define LAPIC_ID_SHIFT          24
+#define LAPIC_SVR_ENABLE        0x100
+#define LAPIC_SPURIOUS_VECTOR   0xFF
+
+// Interrupt command register bits, for IPIs
+#define LAPIC_ICR_INIT          0x00000500
+#define LAPIC_ICR_STARTUP       0x00000600
+#define LAPIC_ICR_PENDING       0x00001000
+#define LAPIC_ICR_ASSERT        0x00004000
+#define LAPIC_ICR_ALL_BUT_SELF  0x000C0000
+#define LAPIC_ICR_DEST_SHIFT    24              //in ICR_HIGH
+
+// Timer: one-shot counting down at the bus clock divided by 16, masked while it's unused
+#define LAPIC_LVT_MASKED        0x00010000
+#define LAPIC_TIMER_DIVIDE_16   0x3
+
+#ifndef ASM
+
+int32_t lapic_init();
+void lapic_enable();
+uint32_t lapic_id();
+void lapic_ipi_all_but_self(uint32_t command);
+void lapic_ipi(uint32_t apic_id, uint32_t command);
+void lapic_eoi();
+int32_t lapic_timer_init();
+void lapic_timer_arm(uint32_t n);
+void lapic_timer_stop();
+
+#endif /* ASM */
+#endif /* _APIC_H */
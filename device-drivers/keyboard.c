@@ -78,10 +78,13 @@ void keyboard_init() {
  */
 void keyboard_interrupt_handler_wrapped();
 void keyboard_interrupt_handler() {
-	uint32_t old_tid = active_tid;
-	set_active_terminal(displayed_tid);
-	keyboard_interrupt_handler_wrapped();
-	set_active_terminal(old_tid);
+	uint32_t flags, garbage;
+	SPIN_LOCK_IRQSAVE(&terminal_lock, flags, garbage) {
+		uint32_t old_tid = active_tid;
+		set_active_terminal(displayed_tid);
+		keyboard_interrupt_handler_wrapped();
+		set_active_terminal(old_tid);
+	}
 }
 
 /*
@@ -136,6 +139,7 @@ void keyboard_interrupt_handler_wrapped() {
 	// enter pressed
 	case SCODE_P_ENTER:
 		displayed_terminal->is_reading = 0;
+		wake_up(&displayed_terminal->read_waiters, WAKE_ALL);
 		break;
 	// backspace pressed
 	case SCODE_P_BACKSPACE:
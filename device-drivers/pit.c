@@ -3,25 +3,68 @@
 #include "../lib.h"
 #include "../common.h"
 
-// Sets the PIT frequency in hertz.
-// Inputs: hz
+// Makes the PIT interrupt once, after some number of its input clock cycles
+// Nothing happens after that until this is called again (see tick_arm).
+// Inputs: count -- cycles of FREQ to wait, at most PIT_MAX_COUNT
 // Outputs: None
-// Side effects: Sets the PIT hardware
-void pit_set_freq(uint32_t hz) {
-    const uint32_t MAGIC_PIT = 119180;
-    uint32_t div = MAGIC_PIT / hz;
-    outb(PIT_MODE_3, PIT_MODE_REG);
-    outb(NTH_BYTE(0, div), PIT_CHANNEL_ZERO_PORT);
-    outb(NTH_BYTE(1, div), PIT_CHANNEL_ZERO_PORT);
+// Side effects: Sets the PIT hardware, cancelling the count in progress if there is one
+void pit_oneshot(uint32_t count) {
+    if (count > PIT_MAX_COUNT) count = PIT_MAX_COUNT;
+    if (!count) count = 1;
+    outb(PIT_MODE_ONESHOT, PIT_MODE_REG);
+    outb(NTH_BYTE(0, count), PIT_CHANNEL_ZERO_PORT);
+    outb(NTH_BYTE(1, count), PIT_CHANNEL_ZERO_PORT);
+}
+
+// Reads how far channel 0 still has to count
+// Inputs: None
+// Outputs: Cycles left. Once it ran out the counter wraps around and keeps going from PIT_MAX_COUNT.
+// Side effects: Must be called with interrupts off
+uint32_t pit_read_count() {
+    uint32_t low, high;
+    outb(PIT_LATCH_CHANNEL_ZERO, PIT_MODE_REG);
+    low = inb(PIT_CHANNEL_ZERO_PORT);
+    high = inb(PIT_CHANNEL_ZERO_PORT);
+    return (high << 8) | low;
+}
+
+// Busy-waits for a while on channel 2, which works with interrupts off and leaves the tick alone
+// Inputs: us -- microseconds to wait
+// Outputs: None
+// Side effects: Silences the speaker
+void pit_udelay(uint32_t us) {
+    while (us) {
+        uint32_t chunk = us > PIT_MAX_UDELAY ? PIT_MAX_UDELAY : us;
+        uint32_t count = chunk * (FREQ / 1000) / 1000;
+        pit_wait(count ? count : 1);
+        us -= chunk;
+    }
+}
+
+// Busy-waits for channel 2 to count down, for callers that need to know exactly how long it took
+// Inputs: count -- PIT cycles (of FREQ per second) to wait, 1 to PIT_MAX_COUNT
+// Outputs: None
+// Side effects: Silences the speaker
+void pit_wait(uint32_t count) {
+    uint32_t gate = inb(PIT_GATE_PORT) & ~(PIT_GATE_SPEAKER | PIT_GATE_CH2);
+    // Load the count with the gate low, then raise it to start counting
+    outb(gate, PIT_GATE_PORT);
+    outb(PIT_MODE_CH2_ONESHOT, PIT_MODE_REG);
+    outb(NTH_BYTE(0, count), PIT_CHANNEL_TWO_PORT);
+    outb(NTH_BYTE(1, count), PIT_CHANNEL_TWO_PORT);
+    outb(gate | PIT_GATE_CH2, PIT_GATE_PORT);
+    while (!(inb(PIT_GATE_PORT) & PIT_GATE_OUT_CH2));
 }
 
 // Initalizes the PIT
 // Inputs/Outputs: None
-// Side effects: Initializes the PIT but does not start it.
+// Side effects: Puts the PIT in one-shot mode without starting it, the scheduler arms it when it
+//      needs a tick (see tick_arm)
 void pit_init() {
     uint32_t flags, garbage;
     CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
-        pit_set_freq(TIME_SLICE_FREQUENCY);
+        // A control word on its own stops the channel until a count is written
+        outb(PIT_MODE_ONESHOT, PIT_MODE_REG);
         enable_irq(PIT_IRQ);
     }
 }
@@ -2,12 +2,24 @@
 
 #define PIT_IRQ                 0               //pit channel 0 uses IRQ 0
 #define PIT_CHANNEL_ZERO_PORT   0x40            //channel 0 data port
-#define PIT_MODE_REG            0x43            //needed to access mode 3
-#define PIT_MODE_3              0x36        
+#define PIT_MODE_REG            0x43            //needed to access mode 0
+#define PIT_MODE_ONESHOT        0x30            //channel 0, low then high byte, mode 0: interrupt on terminal count
+#define PIT_LATCH_CHANNEL_ZERO  0x00            //latch channel 0's count so it can be read
+#define PIT_MAX_COUNT           0xFFFF
+#define PIT_CHANNEL_TWO_PORT    0x42            //channel 2 data port, which isn't wired to an IRQ
+#define PIT_MODE_CH2_ONESHOT    0xB0            //channel 2, low then high byte, mode 0
+#define PIT_GATE_PORT           0x61            //channel 2 gate and output, and the speaker
+#define PIT_GATE_CH2            0x01
+#define PIT_GATE_SPEAKER        0x02
+#define PIT_GATE_OUT_CH2        0x20
+#define PIT_MAX_UDELAY          50000           //microseconds channel 2 can count in one go
 #define FREQ                    1193182
 #define LOWER_BITS              0xFF
-#define TIME_SLICE_FREQUENCY    20
 
 extern void pit_init();
+void pit_oneshot(uint32_t count);
+uint32_t pit_read_count();
+void pit_udelay(uint32_t us);
+void pit_wait(uint32_t count);
 void pit_interrupt_handler();
 void idt_asm_wrapper_pit();
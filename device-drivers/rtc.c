@@ -17,6 +17,16 @@ file_operations_t rtc_ops = {
 
 /* flag that interrupt rtc interrupt occurred */
 uint32_t virt_rtc_clock;
+/* users that need the interrupt (see rtc_hold), it stays masked while there are none */
+static uint32_t rtc_holds;
+
+static const uint8_t cmos_time_regs[CMOS_NUM_TIME_REGS] = {
+    CMOS_SECONDS, CMOS_MINUTES, CMOS_HOURS, CMOS_DAY, CMOS_MONTH, CMOS_YEAR
+};
+
+static uint8_t cmos_read(uint8_t reg);
+static void cmos_read_time(uint8_t* values);
+static uint32_t days_since_epoch(uint32_t year, uint32_t month, uint32_t day);
 
 /*
  * rtc_init
@@ -24,7 +34,8 @@ uint32_t virt_rtc_clock;
  *     the IRQ number 8. 
  *     INPUTS: none
  *     RETURN VALUE: none
- *     SIDE EFFECTS: modifies the state of PIC and turns on the periodic interrupt.
+ *     SIDE EFFECTS: turns on the periodic interrupt. The IRQ stays masked at the PIC
+ *                   until something needs it, see rtc_hold.
  */
 void rtc_init() {
     uint32_t flags, garbage;
@@ -46,9 +57,43 @@ void rtc_init() {
     for (i = 0; i < NUM_SIMULTANEOUS_PROCS; i++) {
         process_clocks[i].freq = 2;
         process_clocks[i].clock_strike_flag = 0;
+        wait_queue_init(&process_clocks[i].waiters);
+    }
+}
+
+/*
+ * rtc_hold
+ *     DESCRIPTION: Unmasks the RTC interrupt until the matching rtc_release. Nothing
+ *                  else needs 8192 wakeups a second, so it's only held by readers
+ *                  waiting in rtc_read, and by the tick code keeping time without a TSC.
+ *     INPUTS: none
+ *     RETURN VALUE: none
+ *     SIDE EFFECTS: virt_rtc_clock only counts while the interrupt is held
+ */
+void rtc_hold() {
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        if (!rtc_holds++) {
+            // An interrupt left unacknowledged when it was masked keeps the line from rising again
+            outb(REGISTER_C, RTC_PORT);
+            inb(CMOS_PORT);
+            enable_irq(RTC_IRQ);
+        }
+    }
+}
+
+/*
+ * rtc_release
+ *     DESCRIPTION: Drops a hold taken by rtc_hold, masking the interrupt after the last one.
+ *     INPUTS: none
+ *     RETURN VALUE: none
+ *     SIDE EFFECTS: modifies the state of PIC
+ */
+void rtc_release() {
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        if (rtc_holds && !--rtc_holds) disable_irq(RTC_IRQ);
     }
-    
-    enable_irq(RTC_IRQ);            //enable irq
 }
 
 /*
@@ -72,6 +117,7 @@ void rtc_interrupt_handler() {
         if (!timer_modulo) timer_modulo = 1;
         if ((virt_rtc_clock % timer_modulo) == 0) {
             process_clocks[i].clock_strike_flag = 1;
+            wake_up(&process_clocks[i].waiters, WAKE_ALL);
         }
     }
 
@@ -119,8 +165,13 @@ int rtc_close(void) {return 0;}
 int rtc_read(file_context* fc, uint8_t* buf, int32_t nbytes){
     // block until the next rtc interrupt happens
     uint32_t clock_idx = get_canonical_pid(get_current_pid()) - 1;
-    process_clocks[clock_idx].clock_strike_flag = 0;
-    while (!process_clocks[clock_idx].clock_strike_flag);
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        rtc_hold();
+        process_clocks[clock_idx].clock_strike_flag = 0;
+        while (!process_clocks[clock_idx].clock_strike_flag) sleep_on(&process_clocks[clock_idx].waiters);
+        rtc_release();
+    }
     // printf("Unblocked RTC at frequency %d for PID %d\n", process_clocks[clock_idx].freq, get_current_pid());
     return 0;
 }
@@ -159,9 +210,85 @@ int rtc_write(file_context* fc, const uint8_t* buf, int32_t nbytes){
  */
 void rtc_set_freq(int freq) {
     if (freq == 0) return;
+    // Only this process's own clock changes, and the interrupt handler reads it in one load
+    uint32_t clock_idx = get_canonical_pid(get_current_pid()) - 1;
+    process_clocks[clock_idx].freq = freq;
+}
+
+/*
+ * rtc_read_epoch
+ *     DESCRIPTION: Reads the date and time off the CMOS clock, which is taken to run on UTC.
+ *                  The registers change for a moment every second, so they're read until
+ *                  two reads in a row agree.
+ *     INPUTS: none
+ *     RETURN VALUE: seconds since 1970-01-01 00:00:00
+ *     SIDE EFFECTS: none
+ */
+uint32_t rtc_read_epoch() {
+    uint8_t values[CMOS_NUM_TIME_REGS], again[CMOS_NUM_TIME_REGS];
+    uint8_t status_b, pm;
+    uint32_t i, same;
     uint32_t flags, garbage;
     CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
-        uint32_t clock_idx = get_canonical_pid(get_current_pid()) - 1;
-        process_clocks[clock_idx].freq = freq;
+        cmos_read_time(again);
+        do {
+            for (i = 0; i < CMOS_NUM_TIME_REGS; i++) values[i] = again[i];
+            cmos_read_time(again);
+            same = 1;
+            for (i = 0; i < CMOS_NUM_TIME_REGS; i++) same &= values[i] == again[i];
+        } while (!same);
+        status_b = cmos_read(REGISTER_B);
+    }
+
+    pm = values[2] & RTC_HOUR_PM;
+    values[2] &= ~RTC_HOUR_PM;
+    if (!(status_b & RTC_B_BINARY)) {
+        for (i = 0; i < CMOS_NUM_TIME_REGS; i++) values[i] = (values[i] & 0x0F) + (values[i] >> 4) * 10;
+    }
+    // 12 AM is midnight, 12 PM is noon
+    if (!(status_b & RTC_B_24HOUR)) values[2] = values[2] % 12 + (pm ? 12 : 0);
+
+    // Two-digit years, taken to be 1970-2069
+    uint32_t year = values[5] + (values[5] < 70 ? 2000 : 1900);
+    return days_since_epoch(year, values[4], values[3]) * SECONDS_PER_DAY
+        + values[2] * 3600 + values[1] * 60 + values[0];
+}
+
+/*
+ * cmos_read
+ *     DESCRIPTION: Reads a CMOS register
+ *     INPUTS: reg -- register index, with the NMI disable bit as wanted
+ *     RETURN VALUE: its value
+ */
+static uint8_t cmos_read(uint8_t reg) {
+    outb(reg, RTC_PORT);
+    return inb(CMOS_PORT);
+}
+
+/*
+ * cmos_read_time
+ *     DESCRIPTION: Reads every clock register once the clock isn't in the middle of an update
+ *     INPUTS: values -- filled in the order of cmos_time_regs
+ *     RETURN VALUE: none
+ */
+static void cmos_read_time(uint8_t* values) {
+    uint32_t i;
+    while (cmos_read(REGISTER_A) & RTC_A_UPDATING);
+    for (i = 0; i < CMOS_NUM_TIME_REGS; i++) values[i] = cmos_read(cmos_time_regs[i]);
+}
+
+/*
+ * days_since_epoch
+ *     DESCRIPTION: Counts the days from 1970-01-01 to a date of the Gregorian calendar
+ *     INPUTS: year, month (1-12), day (1-31)
+ *     RETURN VALUE: number of days
+ */
+static uint32_t days_since_epoch(uint32_t year, uint32_t month, uint32_t day) {
+    // Years counted from March, so the leap day is the last day of the year
+    if (month <= 2) {
+        year--;
+        month += 12;
     }
+    // 719468 is 1970-01-01 counted the same way from 0000-03-01
+    return 365 * year + year / 4 - year / 100 + year / 400 + (153 * (month - 3) + 2) / 5 + day - 1 - 719468;
 }
@@ -4,6 +4,7 @@
 // #include "../lib.h"
 #include "../types.h"
 #include "../process/file.h"
+#include "../sched/wait.h"
 
 #define RTC_IRQ     8               //rtc irq number is defined as 8
 #define RTC_PORT    0x70            //RTC port to specify index and disable NMI
@@ -14,6 +15,20 @@
 #define REGISTER_B 0x8B
 #define REGISTER_C 0xC
 
+//CMOS clock registers, selected with NMI disabled like A and B
+#define CMOS_SECONDS    0x80
+#define CMOS_MINUTES    0x82
+#define CMOS_HOURS      0x84
+#define CMOS_DAY        0x87
+#define CMOS_MONTH      0x88
+#define CMOS_YEAR       0x89
+#define CMOS_NUM_TIME_REGS  6
+#define RTC_A_UPDATING  0x80        //register A: the clock registers are changing
+#define RTC_B_24HOUR    0x02        //register B: hours run 0-23 rather than 1-12 with RTC_HOUR_PM
+#define RTC_B_BINARY    0x04        //register B: binary rather than BCD
+#define RTC_HOUR_PM     0x80
+#define SECONDS_PER_DAY 86400
+
 #define OPEN_FREQ 0x2
 #define MAX_FREQ 1024
 
@@ -23,9 +38,16 @@
 /* operation struct for rtc */
 extern file_operations_t rtc_ops;
 
+/* RTC interrupts so far, at MAX_PHYSICAL_FREQ */
+extern uint32_t virt_rtc_clock;
+
 /*Initializes keyboard interrupt*/
 extern void rtc_init();
 
+/*Unmasks the rtc interrupt while something needs it*/
+extern void rtc_hold();
+extern void rtc_release();
+
 /*Handles rtc interrupt*/
 extern void rtc_interrupt_handler();
 
@@ -38,9 +60,13 @@ extern int rtc_write (file_context* fc, const uint8_t* buf, int nbytes);
 /*Helper function to write frequency value to the RTC */
 void rtc_set_freq(int freq);
 
+/* Date and time off the CMOS clock, in seconds since 1970 */
+uint32_t rtc_read_epoch();
+
 typedef struct rtc_state_t {
     int freq;
     volatile int clock_strike_flag;
+    wait_queue_t waiters;   // Tasks in rtc_read, woken by the strike
 } rtc_state_t;
 #endif
 #endif
@@ -20,6 +20,8 @@ file_operations_t stdout_ops = {
 int32_t displayed_tid;
 int32_t active_tid;
 terminal_t terminals[MAX_NUM_TERMINAL];
+spinlock_t terminal_lock;
+static lock_stats_t terminal_lock_stats;
 
 void vmem_save(int32_t tid);
 void vmem_load(int32_t tid);
@@ -47,8 +49,12 @@ int32_t terminal_read(file_context* fc, uint8_t* buf, int32_t nbytes) {
 
     // clear keyboard buffer, and set terminal_reading flag
     kb_buf_clear(kb_context);
-    active_terminal->is_reading = 1;
-    while (active_terminal->is_reading) {/* waiting for ENTER key */};
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        active_terminal->is_reading = 1;
+        /* waiting for ENTER key, off the run queue */
+        while (active_terminal->is_reading) sleep_on(&active_terminal->read_waiters);
+    }
     return kb_buf_read(buf, nbytes, kb_context);
 }
 
@@ -66,10 +72,13 @@ int32_t terminal_write(file_context* fc, const uint8_t* buf, int32_t nbytes) {
     // null check
     if (!buf) {return -1;}
     
-    // print chars in buf to screen
+    // print chars in buf to screen, a character at a time so long writes don't hold off interrupts
     int i;
+    uint32_t flags, garbage;
     for (i = 0; i < nbytes; i++) {
-        putc(*((uint8_t*) buf + i));
+        SPIN_LOCK_IRQSAVE(&terminal_lock, flags, garbage) {
+            putc(*((uint8_t*) buf + i));
+        }
     }
     return nbytes;
 }
@@ -82,12 +91,15 @@ int32_t terminal_write(file_context* fc, const uint8_t* buf, int32_t nbytes) {
  */
 void terminal_init(void) {
     int i;
+    lock_stats_init(&terminal_lock_stats, "terminal");
+    spin_lock_init(&terminal_lock, &terminal_lock_stats);
     for (i = 0; i < MAX_NUM_TERMINAL; i++) {
         terminals[i].tid = i;
         terminals[i].kb_context.kb_buf_idx = 0;
         terminals[i].screen_x = 0;
         terminals[i].screen_y = 0;
         terminals[i].is_reading = 0;
+        wait_queue_init(&terminals[i].read_waiters);
     }
     terminals[TERMIANL1_ID].vmem_begin_addr = (int8_t*) KERN_VMEM_PHYSICAL_BEGIN_ADDR;
     terminals[TERMIANL2_ID].vmem_begin_addr = (int8_t*) BACKGROUND_VMEM_PHYSICAL_BEGIN_ADDR_T2;
@@ -102,6 +114,7 @@ void terminal_init(void) {
  *     DESCRIPTION: This function is responsible for terminal switch when alt+f1/2/3
  *                  is pressed. The function loads the screen contents of terminal being
  *                  switched to.
+ *                  Call with terminal_lock held.
  *     INPUTS: tid -- terminal id of the target terminal
  *     RETURN VALUE: none.
  */
@@ -136,13 +149,18 @@ void set_displayed_terminal(int32_t tid) {
  * set_active_terminal
  *     DESCRIPTION: This function is responsible for terminal switch between
  *                  processes corresponding to different terminals.
+ *                  Call with terminal_lock held.
  *     INPUTS: tid -- terminal id of the target terminal.
  *     RETURN VALUE: 0 upon success, -1 upon failure.
  */
 int32_t set_active_terminal(int32_t tid) {
     // sanity checks
     if (!is_valid_tid(tid)) {return -1;}
-    if (active_tid == tid) {return 0;}
+    if (active_tid == tid) {
+        // Every CPU has a user side vmem mapping of its own, this one may still show another terminal
+        set_user_vmem_base_addr((uint32_t) (get_terminal(tid)->vmem_begin_addr));
+        return 0;
+    }
 
     int32_t curr_tid = active_tid;
     int32_t next_tid = tid;
@@ -6,6 +6,8 @@
 #include "../process/file.h"
 #include "i8259.h"
 #include "keyboard.h"
+#include "../sched/wait.h"
+#include "../sched/spinlock.h"
 
 #define MAX_NUM_TERMINAL    3
 #define TERMIANL1_ID    0
@@ -19,11 +21,14 @@ typedef struct {
     int32_t screen_y;
     int8_t* vmem_begin_addr;
     volatile int32_t is_reading;
+    wait_queue_t read_waiters;      // Tasks in terminal_read, woken by ENTER
 } terminal_t;
 
 extern int32_t displayed_tid;
 extern int32_t active_tid;
 extern terminal_t terminals[MAX_NUM_TERMINAL];
+// Protects the screen: the cursor, where lib.c prints to and which terminal is active and displayed
+extern spinlock_t terminal_lock;
 
 /* stdin & stdout operations */
 extern file_operations_t stdin_ops;
@@ -2,6 +2,8 @@
 #include "lib.h"
 #include "paging.h"
 #include "process/process.h"
+#include "process/uaccess.h"
+#include "process/thread.h"
 #include "types.h"
 
 #define DEATH_BY_EXCEPTION_CODE 256
@@ -14,7 +16,19 @@ void unrecoverable_message(char* msg, hwcontext_t* context);
 // Output: None
 // Side effect: Depends on the vector number of the context.
 void common_exception_handler(hwcontext_t* context) {
-    set_new_cr3((uint32_t)kernel_page_descriptor_table);
+    // First touch of a user window page or a write to a copy-on-write page: fix it up and retry, whoever faulted
+    if (context->vecnum == IDT_PAGEFAULT && !handle_user_page_fault(get_page_fault_addr(), context->errcode)) {
+        return;
+    }
+    // A fault in copy_from_user and friends continues at their fixup code, which reports the failure
+    if (context->iret_context.cs == KERNEL_CS) {
+        uint32_t fixup = search_exception_table(context->iret_context.ret_eip);
+        if (fixup) {
+            context->iret_context.ret_eip = fixup;
+            return;
+        }
+    }
+    set_new_cr3((uint32_t)get_kernel_page_directory());
     if (context->iret_context.cs == KERNEL_CS) {
         unrecoverable_message("Crash from kernel!", context);
     } else {
@@ -28,6 +42,8 @@ void common_exception_handler(hwcontext_t* context) {
         if (is_kernel_pid(this_pid)) {
             unrecoverable_message("PID 0 crashed, giving up!", context);
         }
+        // A thread that faults (or returns from its entry function) ends alone
+        if (is_thread_pid(this_pid)) thread_exit();
         pcb_t* parent_pcb = get_pcb(curr_pcb->parent_pid);
         if (!parent_pcb) {
             unrecoverable_message("No parent to return to, giving up!", context);
@@ -45,15 +61,21 @@ void common_exception_handler(hwcontext_t* context) {
         // Set return value
         context->eax = DEATH_BY_EXCEPTION_CODE; 
 
-        // See note in sys_halt_helper on restoring tss.esp0 
-        tss.esp0 = get_initial_esp0_of_process(return_to_pid);
+        // Map the parent's window before anything of ours goes, see sys_halt_helper
+        activate_existing_user_programpage(
+            return_to_pid
+        );
 
-        // Do cleanup of dead process paging
-        process_free(this_pid);
+        // See note in sys_halt_helper on restoring tss.esp0 
+        update_tss_for_new_stack(KERNEL_DS, get_initial_esp0_of_process(return_to_pid));
 
+        // Do cleanup of dead process paging (before the pcb goes away), threads first
+        thread_kill_others(curr_pcb);
         destroy_user_programpage(
             this_pid
         );
+
+        process_free(this_pid);
         
         // If necessary set up parent vidmap paging
         if (parent_pcb->flag_activated_vidmap) {
@@ -61,17 +83,13 @@ void common_exception_handler(hwcontext_t* context) {
         } else { 
             deactivate_user_vidmem();
         }
-        
-        activate_existing_user_programpage(
-            return_to_pid
-        );
 
         #ifdef DEBUG_MSG
         printf("New context:\n");
         dump_context(*context);
         #endif
 
-        set_new_cr3((uint32_t)user_page_descriptor_table);
+        set_new_cr3((uint32_t)get_user_page_directory());
     }
 }
 
@@ -128,14 +146,7 @@ void unrecoverable_message(char* msg, hwcontext_t* context) {
             break;
         case (IDT_PAGEFAULT):
             printf("Page fault!    \n");
-            uint32_t pf_addr;
-            asm (
-                "movl %%cr2, %%eax;"
-                "movl %%eax, %[addr]"
-                : [addr] "=m" (pf_addr)
-                :
-                : "eax"
-            );
+            uint32_t pf_addr = get_page_fault_addr();
             cr3_register_fmt cr3_value;
             printf("Violating address: %#x\n", pf_addr);
             asm (
@@ -147,9 +158,9 @@ void unrecoverable_message(char* msg, hwcontext_t* context) {
             );
             uint32_t addr = cr3_value.page_directory_base << 12;
             printf("Active Cr3: ");
-            if (addr == GET_20_MSB((uint32_t)user_page_descriptor_table) << 12) {
+            if (addr == GET_20_MSB((uint32_t)get_user_page_directory()) << 12) {
                 printf("User");
-            } else if (addr == GET_20_MSB((uint32_t)kernel_page_descriptor_table) << 12) {
+            } else if (addr == GET_20_MSB((uint32_t)get_kernel_page_directory()) << 12) {
                 printf("Kernel");
             }
             break;
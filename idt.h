@@ -45,6 +45,14 @@
 /* Vector numbers for system calls */
 #define IDT_SYSCALL     0x80
 
+/* Software interrupt the kernel raises to switch tasks, see sched_yield */
+#define IDT_SCHED       0x81
+
+/* The application processors' local APIC timer, and the IPI that gets them to reschedule (see
+ * handle_lapic_interrupt). Spurious local APIC interrupts come in on LAPIC_SPURIOUS_VECTOR. */
+#define IDT_LAPIC_TIMER 0x40
+#define IDT_RESCHED     0x41
+
 // Very useful macros for making pre-made assembly wrappers for functions.
 #define CREATE_RETCODE_EXCEPTION_WRAPPER(VECNUM) \
 IDT_ASM_WRAPPER(VECNUM): \
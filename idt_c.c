@@ -3,9 +3,11 @@
 #include "device-drivers/keyboard.h"
 #include "device-drivers/i8259.h"
 #include "device-drivers/pit.h"
+#include "device-drivers/apic.h"
 #include "paging.h"
 #include "common.h"
 #include "idt.h"
+#include "sched/sched.h"
 #include "types.h"
 
 void idt_init() {
@@ -40,6 +42,13 @@ void idt_init() {
     idt[IDT_SYSCALL].dpl = 0x3;
     idt[IDT_SYSCALL].reserved3 = 1;         // set system call entry as a trap gate
 
+    // kernel-only task switch, an interrupt gate like the PIT's
+    idt[IDT_SCHED] = default_idt_entry;
+    // the application processors' local APIC, interrupt gates too
+    idt[IDT_LAPIC_TIMER] = default_idt_entry;
+    idt[IDT_RESCHED] = default_idt_entry;
+    idt[LAPIC_SPURIOUS_VECTOR] = default_idt_entry;
+
     SET_IDT_ENTRY(idt[IDT_DIVERR], IDT_ASM_WRAPPER(IDT_DIVERR));
     SET_IDT_ENTRY(idt[IDT_INTEL_RESERVED], IDT_ASM_WRAPPER(IDT_INTEL_RESERVED));
     SET_IDT_ENTRY(idt[IDT_NMIINT], IDT_ASM_WRAPPER(IDT_NMIINT));
@@ -65,6 +74,10 @@ void idt_init() {
     SET_IDT_ENTRY(idt[IDT_KEYBOARD], keyboard_interrupt_wrapper);
     SET_IDT_ENTRY(idt[IDT_RTC], rtc_interrupt_wrapper);
     SET_IDT_ENTRY(idt[IDT_PIT], idt_asm_wrapper_pit);
+    SET_IDT_ENTRY(idt[IDT_SCHED], idt_asm_wrapper_sched);
+    SET_IDT_ENTRY(idt[IDT_LAPIC_TIMER], idt_asm_wrapper_lapic);
+    SET_IDT_ENTRY(idt[IDT_RESCHED], idt_asm_wrapper_lapic);
+    SET_IDT_ENTRY(idt[LAPIC_SPURIOUS_VECTOR], idt_asm_wrapper_spurious);
 
     // link wrapper function for sys calls
     SET_IDT_ENTRY(idt[IDT_SYSCALL], idt_asm_wrapper_syscall);
@@ -87,7 +100,7 @@ int32_t was_called_from_kernel(hwcontext_t* context) {
 // Side effect: Depends on the vector number of the context.
 void common_interrupt_handler(hwcontext_t* context) {
     uint32_t interrupted_cr3 = get_cr3();
-    set_new_cr3((uint32_t)kernel_page_descriptor_table);
+    set_new_cr3((uint32_t)get_kernel_page_directory());
     uint32_t flags, garbage;
     switch(context->vecnum) {
         case (IDT_KEYBOARD):
@@ -104,4 +117,6 @@ void common_interrupt_handler(hwcontext_t* context) {
             return;
     }
     set_new_cr3(interrupted_cr3);
+    // A task woken up above may outrank the one we interrupted
+    if (sched_need_resched()) sched_yield();
 }
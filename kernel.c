@@ -14,12 +14,21 @@
 #include "device-drivers/pit.h"
 #include "device-drivers/VGA.h"
 #include "paging.h"
+#include "mm/frame.h"
+#include "mm/kmalloc.h"
+#include "mm/zero_pool.h"
+#include "mm/ksm.h"
+#include "mm/zswap.h"
 #include "idt.h"
 #include "memfs/memfs.h"
 #include "syscalls/syscall_api.h"
 #include "syscalls/sys_execute.h"
 #include "process/process.h"
 #include "sched/sched.h"
+#include "sched/smp.h"
+#include "sched/spinlock.h"
+#include "sched/kernel_lock.h"
+#include "sched/clock.h"
 
 /* Macros. */
 /* Check if the bit BIT in FLAGS is set. */
@@ -176,6 +185,9 @@ void entry(unsigned long magic, unsigned long addr) {
         ltr(KERNEL_TSS);
     }
 
+    /* From here on this CPU is in the kernel, see kernel_lock_enter */
+    kernel_lock_enter();
+
     /* Initialize devices, memory, filesystem, enable device interrupts on the
      * PIC, any other initialization stuff... */
 
@@ -183,6 +195,16 @@ void entry(unsigned long magic, unsigned long addr) {
     idt_init();
     /* Init paging */
     paging_init();
+    /* Init the physical frame allocator, the kernel heap and background memory work */
+    frame_init(mbi);
+    kmem_init();
+    zero_pool_init();
+    ksm_init();
+    zswap_init();
+    paging_huge_init();
+    /* Lock statistics */
+    lock_init();
+    kernel_lock_init();
     /* Init the PIC */
     i8259_init();
     /* Init the PIT */
@@ -199,6 +221,10 @@ void entry(unsigned long magic, unsigned long addr) {
     // Assuming the first module is the filesystem.
     fs_init(fs_mod);
     sched_init();
+    /* Calibrate the TSC and read the wall clock */
+    clock_init();
+    /* Bring up the other CPUs */
+    smp_init();
     printf("devices initialized\n");
     
     /* Enable interrupts */
@@ -215,5 +241,6 @@ void entry(unsigned long magic, unsigned long addr) {
     // printf("Welcome!\n");
     // int32_t val = entrypoint_launch_from_kernel("shell");
     
-    asm volatile (".1: hlt; jmp .1;");
+    // From here on we're the idle task, which hands the CPU to the root shells right away
+    while (1) sched_idle();
 }
@@ -171,4 +171,88 @@ do {                                    \
     );                                  \
 } while (0)
 
+/* Checks whether the CPUID instruction exists by trying to flip the
+ * ID bit (bit 21) of EFLAGS. Returns 1 if it does, 0 if not. */
+static inline uint32_t cpu_has_cpuid(void) {
+    uint32_t before, after;
+    asm volatile ("                   \n\
+            pushfl                    \n\
+            popl %0                   \n\
+            movl %0, %1               \n\
+            xorl $0x200000, %1        \n\
+            pushl %1                  \n\
+            popfl                     \n\
+            pushfl                    \n\
+            popl %1                   \n\
+            pushl %0                  \n\
+            popfl                     \n\
+            "
+            : "=&r"(before), "=&r"(after)
+            :
+            : "memory", "cc"
+    );
+    return ((before ^ after) & 0x200000) ? 1 : 0;
+}
+
+/* Executes CPUID for the given leaf and returns all four result registers */
+static inline void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+    asm volatile ("cpuid"
+            : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+            : "a"(leaf), "c"(0)
+    );
+}
+
+/* Reads a model specific register as two 32-bit halves */
+static inline void rdmsr(uint32_t msr, uint32_t* lo, uint32_t* hi) {
+    asm volatile ("rdmsr"
+            : "=a"(*lo), "=d"(*hi)
+            : "c"(msr)
+    );
+}
+
+/* Writes a model specific register from two 32-bit halves */
+static inline void wrmsr(uint32_t msr, uint32_t lo, uint32_t hi) {
+    asm volatile ("wrmsr"
+            :
+            : "c"(msr), "a"(lo), "d"(hi)
+            : "memory"
+    );
+}
+
+/* Reads the low 32 bits of the time stamp counter. Differences of two
+ * readings are fine as long as the interval is under 2^32 cycles. */
+static inline uint32_t rdtsc_low(void) {
+    uint32_t lo, hi;
+    asm volatile ("rdtsc"
+            : "=a"(lo), "=d"(hi)
+    );
+    (void)hi;
+    return lo;
+}
+
+/* Reads the whole time stamp counter. Only add, subtract and shift the
+ * result: 64-bit division needs libgcc, which the kernel doesn't link. */
+static inline uint64_t rdtsc(void) {
+    uint64_t tsc;
+    asm volatile ("rdtsc"
+            : "=A"(tsc)
+    );
+    return tsc;
+}
+
+/* Divides a 64-bit number by a 32-bit one with two divl, as 64-bit
+ * division proper needs libgcc. Returns the quotient, and the remainder
+ * through rem unless it's NULL. */
+static inline uint64_t div_u64_rem(uint64_t n, uint32_t d, uint32_t* rem) {
+    uint32_t hi = (uint32_t)(n >> 32), lo = (uint32_t)n;
+    uint32_t q_hi = hi / d, q_lo, r;
+    /* hi % d < d, so the quotient of the second step fits in 32 bits */
+    asm ("divl %4"
+            : "=a"(q_lo), "=d"(r)
+            : "a"(lo), "d"(hi % d), "rm"(d)
+    );
+    if (rem) *rem = r;
+    return ((uint64_t)q_hi << 32) | q_lo;
+}
+
 #endif /* _LIB_H */
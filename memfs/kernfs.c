@@ -0,0 +1,145 @@
+#include "kernfs.h"
+#include "../lib.h"
+#include "../mm/kmalloc.h"
+
+/* file-scope variables */
+static kernfs_node_t* kernfs_nodes;
+static uint32_t kernfs_next_id;
+
+/* file-scope functions */
+static int32_t kernfs_open(void);
+static int32_t kernfs_close(void);
+static int32_t kernfs_read(file_context* fc, uint8_t* buf, int32_t nbytes);
+static int32_t kernfs_write(file_context* fc, const uint8_t* buf, int32_t nbytes);
+
+file_operations_t kernfs_file_ops = {
+    .open = kernfs_open,
+    .close = kernfs_close,
+    .read = kernfs_read,
+    .write = kernfs_write
+};
+
+// Finds a node by the id stored in a file context
+// Inputs: id -- node id
+// Outputs: The node, NULL if none
+static kernfs_node_t* kernfs_node_by_id(uint32_t id) {
+    kernfs_node_t* node;
+    for (node = kernfs_nodes; node; node = node->next) {
+        if (node->id == id) return node;
+    }
+    return NULL;
+}
+
+// Registers a new kernel file
+// Inputs:
+//      name -- filename the user opens it with
+//      show -- fills the buffer with the file contents, required
+//      store -- handles writes to the file, NULL if the file is read-only
+// Outputs: id of the node, -1 on failure (bad arguments, duplicate name, out of memory)
+int32_t kernfs_register(const char* name, kernfs_show_t show, kernfs_store_t store) {
+    kernfs_node_t* node;
+    if (!name || !show || strlen((const int8_t*)name) == 0 || strlen((const int8_t*)name) > MAX_FILENAME_LENGTH) return -1;
+    if (kernfs_lookup(name) != -1) return -1;
+
+    node = kmalloc(sizeof(kernfs_node_t));
+    if (!node) return -1;
+    strncpy((int8_t*)node->name, (const int8_t*)name, MAX_FILENAME_LENGTH);
+    node->name[MAX_FILENAME_LENGTH] = '\0';
+    node->show = show;
+    node->store = store;
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        node->id = kernfs_next_id++;
+        node->next = kernfs_nodes;
+        kernfs_nodes = node;
+    }
+    return node->id;
+}
+
+// Looks up a kernel file by name
+// Inputs: name -- filename to search for
+// Outputs: id of the node, -1 if there is no such kernel file
+int32_t kernfs_lookup(const char* name) {
+    kernfs_node_t* node;
+    if (!name) return -1;
+    for (node = kernfs_nodes; node; node = node->next) {
+        if (!strncmp((const int8_t*)node->name, (const int8_t*)name, MAX_FILENAME_LENGTH + 1)) return node->id;
+    }
+    return -1;
+}
+
+// Appends a character to a show buffer
+// Inputs: out -- the buffer, c -- character to append
+// Outputs: None
+void kernfs_putc(kernfs_buf_t* out, char c) {
+    if (!out || out->len >= out->cap) return;
+    out->data[out->len++] = c;
+}
+
+// Appends a string to a show buffer
+// Inputs: out -- the buffer, s -- string to append
+// Outputs: None
+void kernfs_puts(kernfs_buf_t* out, const char* s) {
+    if (!s) return;
+    while (*s) kernfs_putc(out, *s++);
+}
+
+// Appends a decimal number to a show buffer, right aligned
+// Inputs: out -- the buffer, value -- number to print, width -- minimum field width (0 for none)
+// Outputs: None
+void kernfs_putu(kernfs_buf_t* out, uint32_t value, uint32_t width) {
+    int8_t digits[11]; // Enough for 2^32 - 1 and a null terminator
+    uint32_t n;
+    itoa(value, digits, 10);
+    for (n = strlen(digits); n < width; n++) kernfs_putc(out, ' ');
+    kernfs_puts(out, (const char*)digits);
+}
+
+/* dummy function, see generic_open for real functionality */
+static int32_t kernfs_open(void) {return 0;}
+
+/* dummy function, see generic_close for real functionality */
+static int32_t kernfs_close(void) {return 0;}
+
+// Regenerates the file and copies out the part starting at the file offset
+// Inputs: fc -- file context (inode is the node id), buf -- destination, nbytes -- bytes requested
+// Outputs: bytes read, 0 at the end of the file, -1 on failure
+static int32_t kernfs_read(file_context* fc, uint8_t* buf, int32_t nbytes) {
+    kernfs_node_t* node;
+    kernfs_buf_t out;
+    int32_t count;
+    if (!fc || !buf || nbytes < 0) return -1;
+    if (fc->filetype != FILETYPE_KERN) return -1;
+    node = kernfs_node_by_id(fc->inode);
+    if (!node) return -1;
+
+    out.data = kmalloc(KERNFS_SHOW_BUF_SIZE);
+    if (!out.data) return -1;
+    out.len = 0;
+    out.cap = KERNFS_SHOW_BUF_SIZE;
+    node->show(&out);
+
+    if (fc->offset >= out.len) {
+        count = 0;
+    } else {
+        count = out.len - fc->offset;
+        if (count > nbytes) count = nbytes;
+        memcpy(buf, out.data + fc->offset, count);
+        fc->offset += count;
+    }
+    kfree(out.data);
+    return count;
+}
+
+// Hands a write to the node's store callback
+// Inputs: fc -- file context (inode is the node id), buf -- data written, nbytes -- its length
+// Outputs: whatever the store callback returns, -1 if the file is read-only
+static int32_t kernfs_write(file_context* fc, const uint8_t* buf, int32_t nbytes) {
+    kernfs_node_t* node;
+    if (!fc || !buf || nbytes < 0) return -1;
+    if (fc->filetype != FILETYPE_KERN) return -1;
+    node = kernfs_node_by_id(fc->inode);
+    if (!node || !node->store) return -1;
+    return node->store(buf, nbytes);
+}
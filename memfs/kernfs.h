@@ -0,0 +1,43 @@
+#ifndef KERNFS_H
+#define KERNFS_H
+
+#include "../types.h"
+#include "../common.h"
+#include "memfs.h"
+#include "../process/file.h"
+
+// Kernel files are generated on every read and looked up by name at open time,
+// after the memfs directory. They never show up in directory listings.
+#define KERNFS_SHOW_BUF_SIZE (4 * ONE_KB)
+
+#ifndef ASM
+
+// Output buffer handed to show callbacks; writes past cap are dropped
+typedef struct kernfs_buf_t {
+    char* data;
+    uint32_t len;
+    uint32_t cap;
+} kernfs_buf_t;
+
+typedef void (*kernfs_show_t)(kernfs_buf_t* out);
+typedef int32_t (*kernfs_store_t)(const uint8_t* buf, int32_t nbytes);
+
+typedef struct kernfs_node_t {
+    char name[MAX_FILENAME_LENGTH + 1];
+    uint32_t id;
+    kernfs_show_t show;
+    kernfs_store_t store;
+    struct kernfs_node_t* next;
+} kernfs_node_t;
+
+extern file_operations_t kernfs_file_ops;
+
+int32_t kernfs_register(const char* name, kernfs_show_t show, kernfs_store_t store);
+int32_t kernfs_lookup(const char* name);
+
+void kernfs_puts(kernfs_buf_t* out, const char* s);
+void kernfs_putu(kernfs_buf_t* out, uint32_t value, uint32_t width);
+void kernfs_putc(kernfs_buf_t* out, char c);
+
+#endif /* ASM */
+#endif
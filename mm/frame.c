@@ -0,0 +1,235 @@
+#include "frame.h"
+#include "../lib.h"
+#include "../paging.h"
+#include "zero_pool.h"
+#include "zswap.h"
+
+// Everything above the kernel's 4MB page is ours
+#define FRAME_POOL_BEGIN_ADDR (KERN_BEGIN_ADDR + SIZEOF_PROGRAMPAGE)
+#define MULTIBOOT_FLAG_MEM  0
+#define MULTIBOOT_FLAG_MODS 3
+
+/* file-scope variables */
+// One bit per physical frame below FRAME_POOL_LIMIT_ADDR, set means in use (or not ours)
+static uint32_t frame_bitmap[FRAME_BITMAP_WORDS];
+static uint32_t pool_begin_frame;
+static uint32_t pool_end_frame;
+static uint32_t free_frames;
+static uint32_t total_frames;
+// Next-fit hint so single allocations don't rescan the used prefix every time
+static uint32_t search_hint;
+// References beyond the first, for frames mapped in several places (see frame_ref)
+static uint16_t frame_extra_refs[FRAME_MAX_FRAMES];
+
+/* file-scope functions */
+static inline int32_t frame_is_used(uint32_t frame) {
+    return (frame_bitmap[frame >> 5] >> (frame & 31)) & 1;
+}
+
+static inline void frame_mark_used(uint32_t frame) {
+    frame_bitmap[frame >> 5] |= (1U << (frame & 31));
+}
+
+static inline void frame_mark_free(uint32_t frame) {
+    frame_bitmap[frame >> 5] &= ~(1U << (frame & 31));
+}
+
+// Marks a physical range as in use, if it overlaps the pool
+// Inputs: begin, end -- physical byte range [begin, end)
+// Outputs: None
+static void frame_reserve_range(uint32_t begin, uint32_t end) {
+    uint32_t frame;
+    uint32_t first = ADDR_TO_FRAME(begin);
+    uint32_t last = ADDR_TO_FRAME(end + FRAME_SIZE - 1);
+    if (first < pool_begin_frame) first = pool_begin_frame;
+    if (last > pool_end_frame) last = pool_end_frame;
+    for (frame = first; frame < last; frame++) {
+        if (!frame_is_used(frame)) {
+            frame_mark_used(frame);
+            free_frames--;
+        }
+    }
+}
+
+// Initializes the physical frame allocator from what the bootloader told us
+// Inputs: mbi -- multiboot information structure (for mem_upper and modules)
+// Outputs: None
+// Side effects: Maps the whole pool into both page directories as supervisor 4MB pages.
+//      If the bootloader gave no memory size, the pool is left empty and every allocation fails.
+void frame_init(const multiboot_info_t* mbi) {
+    uint32_t i, mem_top;
+
+    for (i = 0; i < FRAME_BITMAP_WORDS; i++) frame_bitmap[i] = ~0;
+    pool_begin_frame = pool_end_frame = ADDR_TO_FRAME(FRAME_POOL_BEGIN_ADDR);
+    free_frames = total_frames = 0;
+    search_hint = pool_begin_frame;
+
+    if (!mbi || !(mbi->flags & (1 << MULTIBOOT_FLAG_MEM))) return;
+
+    // mem_upper counts the KB above 1MB. Only whole 4MB pages are mapped.
+    mem_top = ONE_MB + mbi->mem_upper * ONE_KB;
+    if (mem_top > FRAME_POOL_LIMIT_ADDR) mem_top = FRAME_POOL_LIMIT_ADDR;
+    mem_top &= ~(SIZEOF_PROGRAMPAGE - 1);
+    if (mem_top <= FRAME_POOL_BEGIN_ADDR) return;
+
+    for (i = FRAME_POOL_BEGIN_ADDR; i < mem_top; i += SIZEOF_PROGRAMPAGE) {
+        map_kernel_identity_4mb(i);
+    }
+
+    pool_end_frame = ADDR_TO_FRAME(mem_top);
+    for (i = pool_begin_frame; i < pool_end_frame; i++) frame_mark_free(i);
+    free_frames = total_frames = pool_end_frame - pool_begin_frame;
+
+    // GRUB may have dropped modules (the filesystem) anywhere, don't hand those out
+    if (mbi->flags & (1 << MULTIBOOT_FLAG_MODS)) {
+        const module_t* mod = (const module_t*)mbi->mods_addr;
+        for (i = 0; i < mbi->mods_count; i++, mod++) {
+            frame_reserve_range(mod->mod_start, mod->mod_end);
+        }
+    }
+}
+
+// Allocates one physical frame
+// Inputs: None
+// Outputs: Physical (and identity-mapped virtual) address of the frame, FRAME_NULL if out of memory
+// Side effects: The frame contents are not cleared. When nothing is free, a frame is taken
+//      back from the zero pool, and failing that cold user pages are compressed away.
+uint32_t frame_alloc() {
+    uint32_t frame = frame_try_alloc_contig(1, 1);
+    if (frame == FRAME_NULL) frame = zero_pool_steal();
+    if (frame == FRAME_NULL && zswap_reclaim(ZSWAP_RECLAIM_BATCH)) frame = frame_try_alloc_contig(1, 1);
+    return frame;
+}
+
+// Allocates physically contiguous frames
+// Inputs: count -- number of frames, align_frames -- alignment of the first frame, in frames (power of two)
+// Outputs: Physical address of the first frame, FRAME_NULL on failure
+// Side effects: Compresses cold user pages away when nothing fits
+uint32_t frame_alloc_contig(uint32_t count, uint32_t align_frames) {
+    uint32_t frame = frame_try_alloc_contig(count, align_frames);
+    // The freed frames are scattered, so ask for more than needed
+    if (frame == FRAME_NULL && zswap_reclaim(ZSWAP_RECLAIM_BATCH + count)) frame = frame_try_alloc_contig(count, align_frames);
+    return frame;
+}
+
+// Allocates physically contiguous frames, but only if they're free already
+// For opportunistic allocations that aren't worth compressing anything for.
+// Inputs: count -- number of frames, align_frames -- alignment of the first frame, in frames (power of two)
+// Outputs: Physical address of the first frame, FRAME_NULL if there is no such run
+uint32_t frame_try_alloc_contig(uint32_t count, uint32_t align_frames) {
+    uint32_t ret = FRAME_NULL;
+    uint32_t pass, start, frame, run;
+    if (!count || !align_frames || (align_frames & (align_frames - 1))) return FRAME_NULL;
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        // Two passes: from the hint to the end, then from the beginning
+        for (pass = 0; pass < 2 && ret == FRAME_NULL && free_frames >= count; pass++) {
+            start = (pass == 0) ? search_hint : pool_begin_frame;
+            start = (start + align_frames - 1) & ~(align_frames - 1);
+            while (start + count <= pool_end_frame) {
+                for (run = 0; run < count && !frame_is_used(start + run); run++);
+                if (run == count) {
+                    for (frame = start; frame < start + count; frame++) frame_mark_used(frame);
+                    free_frames -= count;
+                    search_hint = start + count;
+                    ret = FRAME_TO_ADDR(start);
+                    break;
+                }
+                // Skip past the used frame we ran into, keeping alignment
+                start = (start + run + 1 + align_frames - 1) & ~(align_frames - 1);
+            }
+        }
+    }
+    return ret;
+}
+
+// Frees one frame obtained from frame_alloc
+// Inputs: addr -- physical address of the frame
+// Outputs: None
+// Side effects: Asserts on frames outside the pool or double frees
+void frame_free(uint32_t addr) {
+    frame_free_contig(addr, 1);
+}
+
+// Frees frames obtained from frame_alloc_contig
+// Inputs: addr -- physical address of the first frame, count -- number of frames
+// Outputs: None
+void frame_free_contig(uint32_t addr, uint32_t count) {
+    uint32_t frame, first = ADDR_TO_FRAME(addr);
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        // PRINT_ASSERT leaves interrupts off, so only use it in here
+        PRINT_ASSERT(!(addr & (FRAME_SIZE - 1)), "Freeing unaligned frame %#x\n", addr);
+        PRINT_ASSERT(first >= pool_begin_frame && first + count <= pool_end_frame,
+            "Freeing frame %#x outside the pool\n", addr);
+        for (frame = first; frame < first + count; frame++) {
+            PRINT_ASSERT(frame_is_used(frame), "Double free of frame %#x\n", FRAME_TO_ADDR(frame));
+            frame_mark_free(frame);
+        }
+        free_frames += count;
+        if (first < search_hint) search_hint = first;
+    }
+}
+
+// Takes another reference to an allocated frame, for frames mapped in more than one place
+// Inputs: addr -- physical address of the frame
+// Outputs: None
+// Side effects: The frame stays allocated until frame_put is called once more than before
+void frame_ref(uint32_t addr) {
+    uint32_t frame = ADDR_TO_FRAME(addr);
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        PRINT_ASSERT(frame >= pool_begin_frame && frame < pool_end_frame && frame_is_used(frame),
+            "Referencing free frame %#x\n", addr);
+        PRINT_ASSERT(frame_extra_refs[frame] != (uint16_t)~0, "Too many references to frame %#x\n", addr);
+        frame_extra_refs[frame]++;
+    }
+}
+
+// Drops a reference to a frame, freeing it when it was the last one
+// Inputs: addr -- physical address of the frame
+// Outputs: None
+void frame_put(uint32_t addr) {
+    uint32_t frame = ADDR_TO_FRAME(addr);
+    int32_t last = 0;
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        if (frame < FRAME_MAX_FRAMES && frame_extra_refs[frame]) frame_extra_refs[frame]--;
+        else last = 1;
+    }
+    if (last) frame_free(addr);
+}
+
+// Inputs: addr -- physical address of an allocated frame
+// Outputs: Number of references to it (1 unless frame_ref was used)
+uint32_t frame_refcount(uint32_t addr) {
+    uint32_t frame = ADDR_TO_FRAME(addr);
+    if (frame >= FRAME_MAX_FRAMES) return 0;
+    return frame_extra_refs[frame] + 1;
+}
+
+// Inputs: None
+// Outputs: Number of frames currently free
+uint32_t frame_num_free() {
+    return free_frames;
+}
+
+// Inputs: None
+// Outputs: Number of frames managed by the allocator
+uint32_t frame_num_total() {
+    return total_frames;
+}
+
+// Inputs: None
+// Outputs: Physical address where the pool begins
+uint32_t frame_pool_begin() {
+    return FRAME_TO_ADDR(pool_begin_frame);
+}
+
+// Inputs: None
+// Outputs: Physical address where the pool ends (exclusive)
+uint32_t frame_pool_end() {
+    return FRAME_TO_ADDR(pool_end_frame);
+}
@@ -0,0 +1,40 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include "../types.h"
+#include "../common.h"
+#include "../multiboot.h"
+
+#define FRAME_SIZE          (4 * ONE_KB)
+#define FRAME_SHIFT         12
+#define FRAME_NULL          0
+
+// Everything the allocator hands out is identity mapped by 4MB supervisor pages,
+// and the user window starts at 128MB, so nothing above that is ever managed.
+#define FRAME_POOL_LIMIT_ADDR   (128 * ONE_MB)
+#define FRAME_MAX_FRAMES        (FRAME_POOL_LIMIT_ADDR / FRAME_SIZE)
+#define FRAME_BITMAP_WORDS      (FRAME_MAX_FRAMES / 32)
+
+#define FRAME_TO_ADDR(frame_num) ((uint32_t)(frame_num) << FRAME_SHIFT)
+#define ADDR_TO_FRAME(addr)      ((uint32_t)(addr) >> FRAME_SHIFT)
+
+#ifndef ASM
+
+void frame_init(const multiboot_info_t* mbi);
+
+uint32_t frame_alloc(void);
+uint32_t frame_alloc_contig(uint32_t count, uint32_t align_frames);
+uint32_t frame_try_alloc_contig(uint32_t count, uint32_t align_frames);
+void frame_free(uint32_t addr);
+void frame_free_contig(uint32_t addr, uint32_t count);
+void frame_ref(uint32_t addr);
+void frame_put(uint32_t addr);
+uint32_t frame_refcount(uint32_t addr);
+
+uint32_t frame_num_free(void);
+uint32_t frame_num_total(void);
+uint32_t frame_pool_begin(void);
+uint32_t frame_pool_end(void);
+
+#endif /* ASM */
+#endif
@@ -0,0 +1,14 @@
+#include "idle.h"
+#include "zero_pool.h"
+#include "ksm.h"
+#include "../paging.h"
+
+// Background memory work. Called wherever the CPU would otherwise spin or halt,
+// with interrupts enabled; every step is short.
+// Inputs: None
+// Outputs: None
+void mm_idle() {
+    zero_pool_idle();
+    ksm_idle();
+    paging_huge_idle();
+}
@@ -0,0 +1,9 @@
+#ifndef MM_IDLE_H
+#define MM_IDLE_H
+
+#ifndef ASM
+
+void mm_idle(void);
+
+#endif /* ASM */
+#endif
@@ -0,0 +1,339 @@
+#include "kmalloc.h"
+#include "../lib.h"
+#include "../memfs/kernfs.h"
+
+// Objects start at the first aligned address after the slab header
+#define KMEM_SLAB_OBJ_OFFSET (((sizeof(kmem_slab_t)) + KMEM_OBJ_ALIGN - 1) & ~(KMEM_OBJ_ALIGN - 1))
+#define KMEM_FRAME_BASE(ptr) ((uint32_t)(ptr) & ~(FRAME_SIZE - 1))
+
+/* file-scope variables */
+// The cache that kmem_cache_t structs themselves come from. Statically allocated so it can bootstrap.
+static kmem_cache_t cache_cache;
+static kmem_cache_t* all_caches;
+static kmem_cache_t* kmalloc_caches[KMALLOC_NUM_CLASSES];
+static uint32_t large_allocs;
+static uint32_t large_frames;
+
+/* file-scope functions */
+static void kmem_show_slabinfo(kernfs_buf_t* out);
+
+// Unlinks a slab from one of a cache's lists
+// Inputs: head -- the list, slab -- slab to unlink
+// Outputs: None
+static void slab_list_remove(kmem_slab_t** head, kmem_slab_t* slab) {
+    if (slab->prev) slab->prev->next = slab->next;
+    else *head = slab->next;
+    if (slab->next) slab->next->prev = slab->prev;
+    slab->prev = slab->next = NULL;
+}
+
+// Pushes a slab to the front of one of a cache's lists
+// Inputs: head -- the list, slab -- slab to push
+// Outputs: None
+static void slab_list_push(kmem_slab_t** head, kmem_slab_t* slab) {
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head) (*head)->prev = slab;
+    *head = slab;
+}
+
+// Fills out a cache descriptor
+// Inputs: cache -- descriptor to fill, name -- name for reports, obj_size -- size of one object
+// Outputs: None
+static void kmem_cache_setup(kmem_cache_t* cache, const char* name, uint32_t obj_size) {
+    memset(cache, 0, sizeof(kmem_cache_t));
+    strncpy((int8_t*)cache->name, (const int8_t*)name, KMEM_CACHE_NAME_LEN - 1);
+    cache->name[KMEM_CACHE_NAME_LEN - 1] = '\0';
+    // Free objects store the free-list link in their first word
+    if (obj_size < sizeof(void*)) obj_size = sizeof(void*);
+    cache->obj_size = (obj_size + KMEM_OBJ_ALIGN - 1) & ~(KMEM_OBJ_ALIGN - 1);
+    cache->objs_per_slab = (FRAME_SIZE - KMEM_SLAB_OBJ_OFFSET) / cache->obj_size;
+}
+
+// Gets a frame from the frame allocator and carves it into objects
+// Inputs: cache -- cache to grow
+// Outputs: The new slab, NULL if out of memory
+// Side effects: Must be called with interrupts off
+static kmem_slab_t* kmem_slab_create(kmem_cache_t* cache) {
+    uint32_t i;
+    uint8_t* obj;
+    kmem_slab_t* slab = (kmem_slab_t*)frame_alloc();
+    if (!slab) return NULL;
+
+    slab->magic = KMEM_SLAB_MAGIC;
+    slab->cache = cache;
+    slab->prev = slab->next = NULL;
+    slab->inuse = 0;
+    slab->free_list = NULL;
+    // Build the free list back to front so allocations walk the frame in address order
+    obj = (uint8_t*)slab + KMEM_SLAB_OBJ_OFFSET + (cache->objs_per_slab - 1) * cache->obj_size;
+    for (i = 0; i < cache->objs_per_slab; i++, obj -= cache->obj_size) {
+        *(void**)obj = slab->free_list;
+        slab->free_list = obj;
+    }
+    cache->num_slabs++;
+    return slab;
+}
+
+// Initializes the kernel heap: the cache of caches, the kmalloc size classes, and the slabinfo report
+// Inputs: None
+// Outputs: None
+// Side effects: frame_init must already have run
+void kmem_init() {
+    uint32_t i, size;
+    char name[KMEM_CACHE_NAME_LEN];
+    int8_t digits[11];
+
+    kmem_cache_setup(&cache_cache, "kmem_cache", sizeof(kmem_cache_t));
+    all_caches = &cache_cache;
+    large_allocs = large_frames = 0;
+
+    for (i = 0, size = KMALLOC_MIN_SIZE; i < KMALLOC_NUM_CLASSES; i++, size <<= 1) {
+        strcpy((int8_t*)name, (const int8_t*)"kmalloc-");
+        itoa(size, digits, 10);
+        strncpy((int8_t*)name + strlen((const int8_t*)name), digits, sizeof(digits));
+        kmalloc_caches[i] = kmem_cache_create(name, size);
+    }
+
+    kernfs_register("slabinfo", kmem_show_slabinfo, NULL);
+}
+
+// Creates a slab cache for objects of one size
+// Inputs: name -- name shown in slabinfo, obj_size -- object size in bytes (at most what fits in one slab)
+// Outputs: The cache, NULL on failure
+kmem_cache_t* kmem_cache_create(const char* name, uint32_t obj_size) {
+    kmem_cache_t* cache;
+    if (!name || !obj_size || obj_size > FRAME_SIZE - KMEM_SLAB_OBJ_OFFSET) return NULL;
+
+    cache = kmem_cache_alloc(&cache_cache);
+    if (!cache) return NULL;
+    kmem_cache_setup(cache, name, obj_size);
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        cache->next_cache = all_caches;
+        all_caches = cache;
+    }
+    return cache;
+}
+
+// Allocates one object from a cache
+// Inputs: cache -- cache to allocate from
+// Outputs: The object (contents undefined), NULL if out of memory
+void* kmem_cache_alloc(kmem_cache_t* cache) {
+    void* obj = NULL;
+    kmem_slab_t* slab;
+    if (!cache) return NULL;
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        // Prefer partially used slabs so empty ones can be given back
+        slab = cache->partial;
+        if (!slab && cache->empty) {
+            slab = cache->empty;
+            slab_list_remove(&cache->empty, slab);
+            slab_list_push(&cache->partial, slab);
+        }
+        if (!slab) {
+            slab = kmem_slab_create(cache);
+            if (slab) slab_list_push(&cache->partial, slab);
+        }
+        if (slab) {
+            obj = slab->free_list;
+            slab->free_list = *(void**)obj;
+            slab->inuse++;
+            if (!slab->free_list) {
+                slab_list_remove(&cache->partial, slab);
+                slab_list_push(&cache->full, slab);
+            }
+            cache->total_allocs++;
+            cache->active_objs++;
+            if (cache->active_objs > cache->peak_objs) cache->peak_objs = cache->active_objs;
+        } else {
+            cache->failed_allocs++;
+        }
+    }
+    return obj;
+}
+
+// Allocates one zeroed object from a cache
+// Inputs: cache -- cache to allocate from
+// Outputs: The object, NULL if out of memory
+void* kmem_cache_zalloc(kmem_cache_t* cache) {
+    void* obj = kmem_cache_alloc(cache);
+    if (obj) memset(obj, 0, cache->obj_size);
+    return obj;
+}
+
+// Returns an object to its cache
+// Inputs: cache -- cache it came from, obj -- the object (NULL is ignored)
+// Outputs: None
+// Side effects: Gives the slab's frame back if the cache already holds an empty slab
+void kmem_cache_free(kmem_cache_t* cache, void* obj) {
+    kmem_slab_t* slab;
+    if (!cache || !obj) return;
+    slab = (kmem_slab_t*)KMEM_FRAME_BASE(obj);
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        PRINT_ASSERT(slab->magic == KMEM_SLAB_MAGIC && slab->cache == cache,
+            "Freeing %#x to the wrong cache (%s)\n", (uint32_t)obj, cache->name);
+        if (!slab->free_list) {
+            slab_list_remove(&cache->full, slab);
+            slab_list_push(&cache->partial, slab);
+        }
+        *(void**)obj = slab->free_list;
+        slab->free_list = obj;
+        slab->inuse--;
+        cache->total_frees++;
+        cache->active_objs--;
+
+        if (!slab->inuse) {
+            slab_list_remove(&cache->partial, slab);
+            if (cache->empty) {
+                slab->magic = 0;
+                cache->num_slabs--;
+                frame_free((uint32_t)slab);
+            } else {
+                slab_list_push(&cache->empty, slab);
+            }
+        }
+    }
+}
+
+// Gets rid of a cache nothing is allocated from anymore
+// Inputs: cache -- a cache from kmem_cache_create
+// Outputs: 0 on success, -1 if it still has objects out (it's left alone then)
+// Side effects: Gives back its empty slab and takes it out of slabinfo
+int32_t kmem_cache_destroy(kmem_cache_t* cache) {
+    kmem_cache_t** link;
+    int32_t ret = -1;
+    if (!cache || cache == &cache_cache) return -1;
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        if (!cache->active_objs) {
+            for (link = &all_caches; *link && *link != cache; link = &(*link)->next_cache);
+            if (*link) {
+                *link = cache->next_cache;
+                if (cache->empty) {
+                    cache->empty->magic = 0;
+                    frame_free((uint32_t)cache->empty);
+                }
+                ret = 0;
+            }
+        }
+    }
+    if (!ret) kmem_cache_free(&cache_cache, cache);
+    return ret;
+}
+
+// Finds the kmalloc size class for a size
+// Inputs: size -- requested size
+// Outputs: Index into kmalloc_caches, -1 if the size needs a large allocation
+static int32_t kmalloc_class(uint32_t size) {
+    int32_t i;
+    uint32_t class_size;
+    for (i = 0, class_size = KMALLOC_MIN_SIZE; i < KMALLOC_NUM_CLASSES; i++, class_size <<= 1) {
+        if (size <= class_size) return i;
+    }
+    return -1;
+}
+
+// General purpose kernel allocation
+// Inputs: size -- bytes wanted
+// Outputs: Pointer aligned to KMEM_OBJ_ALIGN, NULL on failure or for size 0
+void* kmalloc(uint32_t size) {
+    int32_t class_idx;
+    uint32_t num_frames;
+    kmem_large_hdr_t* hdr;
+    if (!size) return NULL;
+
+    class_idx = kmalloc_class(size);
+    if (class_idx >= 0) return kmem_cache_alloc(kmalloc_caches[class_idx]);
+
+    // Too big for a slab: whole frames, with a header in front
+    num_frames = CEILDIV(size + sizeof(kmem_large_hdr_t), FRAME_SIZE);
+    hdr = (kmem_large_hdr_t*)frame_alloc_contig(num_frames, 1);
+    if (!hdr) return NULL;
+    hdr->magic = KMEM_LARGE_MAGIC;
+    hdr->num_frames = num_frames;
+    hdr->size = size;
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        large_allocs++;
+        large_frames += num_frames;
+    }
+    return hdr + 1;
+}
+
+// kmalloc, but zeroed
+// Inputs: size -- bytes wanted
+// Outputs: Pointer to zeroed memory, NULL on failure
+void* kzalloc(uint32_t size) {
+    void* ptr = kmalloc(size);
+    if (ptr) memset(ptr, 0, size);
+    return ptr;
+}
+
+// Frees memory from kmalloc/kzalloc
+// Inputs: ptr -- pointer returned by kmalloc (NULL is ignored)
+// Outputs: None
+void kfree(void* ptr) {
+    uint32_t base;
+    if (!ptr) return;
+    base = KMEM_FRAME_BASE(ptr);
+
+    if (((kmem_slab_t*)base)->magic == KMEM_SLAB_MAGIC) {
+        kmem_cache_free(((kmem_slab_t*)base)->cache, ptr);
+        return;
+    }
+
+    // Large allocations always start right after the header at the base of a frame
+    kmem_large_hdr_t* hdr = (kmem_large_hdr_t*)base;
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        PRINT_ASSERT(hdr->magic == KMEM_LARGE_MAGIC && (uint32_t)ptr == (uint32_t)(hdr + 1),
+            "kfree of %#x, which kmalloc never returned\n", (uint32_t)ptr);
+        hdr->magic = 0;
+        large_allocs--;
+        large_frames -= hdr->num_frames;
+    }
+    frame_free_contig(base, hdr->num_frames);
+}
+
+// Writes the per-cache usage report (the "slabinfo" kernel file)
+// Inputs: out -- buffer to fill
+// Outputs: None
+static void kmem_show_slabinfo(kernfs_buf_t* out) {
+    kmem_cache_t* cache;
+    uint32_t flags, garbage;
+    kernfs_puts(out, "name              objsize active   peak  total slabs   allocs    frees fails\n");
+    // Caches can go away (see kmem_cache_destroy)
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        for (cache = all_caches; cache; cache = cache->next_cache) {
+            uint32_t pad;
+            kernfs_puts(out, cache->name);
+            for (pad = strlen((const int8_t*)cache->name); pad < 17; pad++) kernfs_putc(out, ' ');
+            kernfs_putu(out, cache->obj_size, 8);
+            kernfs_putu(out, cache->active_objs, 7);
+            kernfs_putu(out, cache->peak_objs, 7);
+            kernfs_putu(out, cache->num_slabs * cache->objs_per_slab, 7);
+            kernfs_putu(out, cache->num_slabs, 6);
+            kernfs_putu(out, cache->total_allocs, 9);
+            kernfs_putu(out, cache->total_frees, 9);
+            kernfs_putu(out, cache->failed_allocs, 6);
+            kernfs_putc(out, '\n');
+        }
+    }
+    kernfs_puts(out, "large allocations: ");
+    kernfs_putu(out, large_allocs, 0);
+    kernfs_puts(out, " (");
+    kernfs_putu(out, large_frames, 0);
+    kernfs_puts(out, " frames)\nframes free: ");
+    kernfs_putu(out, frame_num_free(), 0);
+    kernfs_puts(out, "/");
+    kernfs_putu(out, frame_num_total(), 0);
+    kernfs_putc(out, '\n');
+}
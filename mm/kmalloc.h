@@ -0,0 +1,70 @@
+#ifndef KMALLOC_H
+#define KMALLOC_H
+
+#include "../types.h"
+#include "../common.h"
+#include "frame.h"
+
+#define KMEM_CACHE_NAME_LEN     24
+#define KMEM_SLAB_MAGIC         0x51AB51AB
+#define KMEM_LARGE_MAGIC        0x1A46E000
+#define KMEM_OBJ_ALIGN          8
+// kmalloc serves sizes up to this from its caches, anything larger gets whole frames
+#define KMALLOC_MIN_SIZE        16
+#define KMALLOC_MAX_CACHED_SIZE 1024
+#define KMALLOC_NUM_CLASSES     7 // 16, 32, ..., 1024
+
+#ifndef ASM
+
+struct kmem_cache_t;
+
+// Lives at the base of every slab frame. Objects are carved out of the rest of the frame.
+typedef struct kmem_slab_t {
+    uint32_t magic;
+    struct kmem_cache_t* cache;
+    struct kmem_slab_t* prev;
+    struct kmem_slab_t* next;
+    void* free_list;        // Free objects link through their first word
+    uint32_t inuse;
+} kmem_slab_t;
+
+// Lives at the base of the first frame of a large kmalloc allocation
+typedef struct kmem_large_hdr_t {
+    uint32_t magic;
+    uint32_t num_frames;
+    uint32_t size;
+    uint32_t _pad;
+} kmem_large_hdr_t;
+STATIC_ASSERT(sizeof(kmem_large_hdr_t) % KMEM_OBJ_ALIGN == 0);
+
+typedef struct kmem_cache_t {
+    char name[KMEM_CACHE_NAME_LEN];
+    uint32_t obj_size;      // Rounded up to KMEM_OBJ_ALIGN
+    uint32_t objs_per_slab;
+    kmem_slab_t* partial;   // Slabs with both free and used objects
+    kmem_slab_t* full;      // Slabs with no free objects
+    kmem_slab_t* empty;     // At most one slab with no used objects, kept to avoid thrashing
+    // Instrumentation
+    uint32_t num_slabs;
+    uint32_t active_objs;
+    uint32_t peak_objs;
+    uint32_t total_allocs;
+    uint32_t total_frees;
+    uint32_t failed_allocs;
+    struct kmem_cache_t* next_cache;
+} kmem_cache_t;
+
+void kmem_init(void);
+
+kmem_cache_t* kmem_cache_create(const char* name, uint32_t obj_size);
+void* kmem_cache_alloc(kmem_cache_t* cache);
+void* kmem_cache_zalloc(kmem_cache_t* cache);
+void kmem_cache_free(kmem_cache_t* cache, void* obj);
+int32_t kmem_cache_destroy(kmem_cache_t* cache);
+
+void* kmalloc(uint32_t size);
+void* kzalloc(uint32_t size);
+void kfree(void* ptr);
+
+#endif /* ASM */
+#endif
@@ -0,0 +1,328 @@
+#include "ksm.h"
+#include "frame.h"
+#include "kmalloc.h"
+#include "vma.h"
+#include "../lib.h"
+#include "../paging.h"
+#include "../process/process.h"
+#include "../memfs/kernfs.h"
+
+/* file-scope variables */
+static int32_t ksm_enabled;
+static kmem_cache_t* ksm_stable_cache;
+static ksm_stable_t* stable_table[KSM_HASH_BUCKETS];
+static ksm_candidate_t unstable_table[KSM_HASH_BUCKETS];
+// Where the scanner left off
+static uint32_t scan_pid = 1;
+static uint32_t scan_addr = USER_WINDOW_BEGIN_ADDR;
+static uint32_t prune_bucket;
+// Instrumentation
+static uint32_t pages_scanned;
+static uint32_t full_scans;
+static uint32_t pages_merged;
+
+/* file-scope functions */
+static int32_t ksm_next_page(uint32_t* pid, uint32_t* addr, uint32_t* frame);
+static uint32_t ksm_hash_page(uint32_t frame);
+static int32_t ksm_pages_equal(uint32_t frame_a, uint32_t frame_b);
+static int32_t ksm_page_is_mergeable(const user_mm_t* mm, uint32_t addr, uint32_t frame);
+static void ksm_map_to_stable(uint32_t pid, page_table_entry_t* pte, uint32_t stable_frame);
+static void ksm_try_merge(uint32_t pid, uint32_t addr, uint32_t frame, uint32_t hash);
+static void ksm_prune(void);
+static void ksm_show(kernfs_buf_t* out);
+static int32_t ksm_store(const uint8_t* buf, int32_t nbytes);
+
+// Registers the ksm kernel file. Merging is off until "1" is written to it.
+// Inputs: None
+// Outputs: None
+void ksm_init() {
+    ksm_stable_cache = kmem_cache_create("ksm_stable", sizeof(ksm_stable_t));
+    kernfs_register("ksm", ksm_show, ksm_store);
+}
+
+// Turns the scanner on or off. Pages merged so far stay merged until written to.
+// Inputs: enabled -- nonzero to scan
+// Outputs: the previous setting
+int32_t ksm_set_enabled(int32_t enabled) {
+    int32_t old = ksm_enabled;
+    ksm_enabled = enabled ? 1 : 0;
+    return old;
+}
+
+// Scans a few user pages for merging. Call this wherever the CPU has nothing better to do.
+// Hashing runs with interrupts enabled; only the final check and remap don't.
+// Inputs: None
+// Outputs: None
+void ksm_idle() {
+    uint32_t i, pid, addr, frame;
+    if (!ksm_enabled || !ksm_stable_cache) return;
+    ksm_prune();
+    for (i = 0; i < KSM_PAGES_PER_IDLE; i++) {
+        if (!ksm_next_page(&pid, &addr, &frame)) return;
+        ksm_try_merge(pid, addr, frame, ksm_hash_page(frame));
+        pages_scanned++;
+    }
+}
+
+// Inputs: None
+// Outputs: Frames freed by merging that are still saved (mappings of merged frames minus the frames)
+uint32_t ksm_frames_saved() {
+    uint32_t i, saved = 0;
+    ksm_stable_t* node;
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        for (i = 0; i < KSM_HASH_BUCKETS; i++) {
+            for (node = stable_table[i]; node; node = node->next) {
+                // One reference is the table's, one mapping would have needed the frame anyway
+                if (frame_refcount(node->frame) > 2) saved += frame_refcount(node->frame) - 2;
+            }
+        }
+    }
+    return saved;
+}
+
+// Moves the scan cursor to the next page that could be merged
+// Inputs: pid, addr, frame -- filled with the page found
+// Outputs: 1 if a page was found, 0 if KSM_SCAN_STEP_LIMIT entries went by without one
+static int32_t ksm_next_page(uint32_t* pid, uint32_t* addr, uint32_t* frame) {
+    uint32_t steps;
+    int32_t found = 0;
+    user_mm_t* mm;
+    page_table_entry_t* pte;
+    uint32_t flags, garbage;
+    // Keeps the cursor to one scanner at a time
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        for (steps = 0; steps < KSM_SCAN_STEP_LIMIT && !found; steps++) {
+            if (scan_addr >= USER_WINDOW_END_ADDR) {
+                scan_addr = USER_WINDOW_BEGIN_ADDR;
+                if (++scan_pid > MAX_NUM_PROCESS) {
+                    scan_pid = 1;
+                    full_scans++;
+                }
+            }
+            // A thread's pages are its process's, which are scanned under the process's PID
+            mm = is_thread_pid(scan_pid) ? NULL : get_user_mm(scan_pid);
+            if (!mm || mm_is_active_elsewhere(mm)) {
+                // No such process, or it's running on another CPU whose TLB we can't flush: skip all of it
+                put_user_mm(mm);
+                scan_addr = USER_WINDOW_END_ADDR;
+                continue;
+            }
+            // Held so the process can't unmap or fault the page in meanwhile
+            spin_lock(&mm->lock);
+            pte = get_mm_pte(mm, scan_addr);
+            if (!pte) {
+                // Nothing touched in this 4MB, skip all of it
+                scan_addr = GET_ADDR_FROM_4MB_OFFSET_HIGH(GET_4MB_OFFSET_HIGH(scan_addr) + 1);
+            } else {
+                if (ksm_page_is_mergeable(mm, scan_addr, pte->base_addr << 12)) {
+                    *pid = scan_pid;
+                    *addr = scan_addr;
+                    *frame = pte->base_addr << 12;
+                    found = 1;
+                }
+                scan_addr += SIZEOF_4KBPAGE;
+            }
+            spin_unlock(&mm->lock);
+            put_user_mm(mm);
+        }
+    }
+    return found;
+}
+
+// Checks that a page is still a private page backed by a given frame, and either writable
+// or read-only program text (which doesn't need copy-on-write once merged)
+// Inputs: mm -- owner's address space, addr -- user address, frame -- frame it should be backed by
+// Outputs: 1 if it can be merged, 0 otherwise
+// Side effects: Must be called with the address space's lock held
+static int32_t ksm_page_is_mergeable(const user_mm_t* mm, uint32_t addr, uint32_t frame) {
+    page_table_entry_t* pte = get_mm_pte(mm, addr);
+    vm_area_t* area;
+    if (!pte || !pte->present || (pte->base_addr << 12) != frame) return 0;
+    if (!pte->read_write && pte->custom != PTE_CUSTOM_READONLY) return 0;
+    // Shared memory is meant to be written by everyone attached
+    area = mm_find_area(mm, addr);
+    if (area && area->shm) return 0;
+    return frame_refcount(frame) == 1;
+}
+
+// FNV-1a over the page's words
+// Inputs: frame -- physical (identity mapped) address of the page
+// Outputs: The hash
+static uint32_t ksm_hash_page(uint32_t frame) {
+    const uint32_t* words = (const uint32_t*)frame;
+    uint32_t i, hash = 2166136261U;
+    for (i = 0; i < SIZEOF_4KBPAGE / sizeof(uint32_t); i++) {
+        hash ^= words[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+// Inputs: frame_a, frame_b -- physical (identity mapped) addresses of two pages
+// Outputs: 1 if their contents are identical, 0 otherwise
+static int32_t ksm_pages_equal(uint32_t frame_a, uint32_t frame_b) {
+    const uint32_t* a = (const uint32_t*)frame_a;
+    const uint32_t* b = (const uint32_t*)frame_b;
+    uint32_t i;
+    for (i = 0; i < SIZEOF_4KBPAGE / sizeof(uint32_t); i++) {
+        if (a[i] != b[i]) return 0;
+    }
+    return 1;
+}
+
+// Points a page at a merged frame, read-only, and frees its old frame
+// Inputs: pid -- owner, pte -- its entry for the page, stable_frame -- the merged frame
+// Outputs: None
+// Side effects: Must be called with the owner's address space locked. Flushes TLB if the window is mapped.
+static void ksm_map_to_stable(uint32_t pid, page_table_entry_t* pte, uint32_t stable_frame) {
+    uint32_t old_frame = pte->base_addr << 12;
+    frame_ref(stable_frame);
+    pte->base_addr = GET_20_MSB(stable_frame);
+    pte->read_write = 0;
+    if (old_frame != stable_frame) frame_put(old_frame);
+    if (user_window_is_mapped(pid)) flush_tlb();
+    pages_merged++;
+}
+
+// Merges a page with a merged frame or an earlier page with the same contents,
+// or remembers it so a later page can be merged with it
+// Inputs: pid, addr, frame -- the page, hash -- hash of its contents
+// Outputs: None
+static void ksm_try_merge(uint32_t pid, uint32_t addr, uint32_t frame, uint32_t hash) {
+    uint32_t bucket = hash % KSM_HASH_BUCKETS;
+    ksm_stable_t* node;
+    ksm_stable_t* new_node = kmem_cache_alloc(ksm_stable_cache);
+    user_mm_t* mm = get_user_mm(pid);
+    user_mm_t* cand_mm;
+
+    uint32_t flags, garbage;
+    // Keeps the tables to one scanner at a time, the address spaces are locked on their own
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        page_table_entry_t* pte = NULL;
+        ksm_candidate_t* cand = &unstable_table[bucket];
+        int32_t merged = 0;
+        // Another CPU running the process would keep using the page out of its TLB
+        int32_t locked = mm && !mm_is_active_elsewhere(mm);
+        if (locked) {
+            spin_lock(&mm->lock);
+            // The page may have changed since ksm_next_page, but contents are compared again below
+            if (ksm_page_is_mergeable(mm, addr, frame)) pte = get_mm_pte(mm, addr);
+        }
+
+        for (node = stable_table[bucket]; pte && node && !merged; node = node->next) {
+            if (node->hash == hash && ksm_pages_equal(node->frame, frame)) {
+                ksm_map_to_stable(pid, pte, node->frame);
+                merged = 1;
+            }
+        }
+
+        if (pte && !merged && new_node && cand->pid && cand->hash == hash && cand->frame != frame) {
+            cand_mm = get_user_mm(cand->pid);
+            // Waiting for the earlier page's address space while holding this one could deadlock
+            // with whoever takes them the other way around, so a busy one is left for next time
+            if (cand_mm && !mm_is_active_elsewhere(cand_mm) && (cand_mm == mm || spin_trylock(&cand_mm->lock))) {
+                if (ksm_page_is_mergeable(cand_mm, cand->addr, cand->frame) && ksm_pages_equal(cand->frame, frame)) {
+                    // The earlier page's frame becomes the merged frame
+                    page_table_entry_t* cand_pte = get_mm_pte(cand_mm, cand->addr);
+                    cand_pte->read_write = 0;
+                    if (user_window_is_mapped(cand->pid)) flush_tlb();
+                    frame_ref(cand->frame);
+                    new_node->hash = hash;
+                    new_node->frame = cand->frame;
+                    new_node->next = stable_table[bucket];
+                    stable_table[bucket] = new_node;
+                    new_node = NULL;
+                    ksm_map_to_stable(pid, pte, cand->frame);
+                    cand->pid = 0;
+                    merged = 1;
+                }
+                if (cand_mm != mm) spin_unlock(&cand_mm->lock);
+            }
+            put_user_mm(cand_mm);
+        }
+
+        if (pte && !merged) {
+            cand->hash = hash;
+            cand->pid = pid;
+            cand->addr = addr;
+            cand->frame = frame;
+        }
+        if (locked) spin_unlock(&mm->lock);
+    }
+
+    put_user_mm(mm);
+    if (new_node) kmem_cache_free(ksm_stable_cache, new_node);
+}
+
+// Drops merged frames nobody maps anymore, one bucket per call
+// Inputs: None
+// Outputs: None
+static void ksm_prune() {
+    ksm_stable_t** link;
+    ksm_stable_t* node;
+    ksm_stable_t* dead = NULL;
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        link = &stable_table[prune_bucket];
+        while ((node = *link)) {
+            if (frame_refcount(node->frame) == 1) {
+                *link = node->next;
+                frame_put(node->frame);
+                node->next = dead;
+                dead = node;
+            } else {
+                link = &node->next;
+            }
+        }
+        prune_bucket = (prune_bucket + 1) % KSM_HASH_BUCKETS;
+    }
+    while ((node = dead)) {
+        dead = node->next;
+        kmem_cache_free(ksm_stable_cache, node);
+    }
+}
+
+// Fills the ksm kernel file
+// Inputs: out -- buffer to fill
+// Outputs: None
+static void ksm_show(kernfs_buf_t* out) {
+    uint32_t i, shared = 0, sharing = 0;
+    ksm_stable_t* node;
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        for (i = 0; i < KSM_HASH_BUCKETS; i++) {
+            for (node = stable_table[i]; node; node = node->next) {
+                if (frame_refcount(node->frame) < 2) continue;
+                shared++;
+                sharing += frame_refcount(node->frame) - 1;
+            }
+        }
+    }
+    kernfs_puts(out, "enabled:       ");
+    kernfs_putu(out, ksm_enabled, 0);
+    kernfs_puts(out, "\npages_shared:  ");
+    kernfs_putu(out, shared, 0);
+    kernfs_puts(out, "\npages_sharing: ");
+    kernfs_putu(out, sharing, 0);
+    kernfs_puts(out, "\nframes_saved:  ");
+    kernfs_putu(out, sharing - shared, 0);
+    kernfs_puts(out, "\npages_scanned: ");
+    kernfs_putu(out, pages_scanned, 0);
+    kernfs_puts(out, "\npages_merged:  ");
+    kernfs_putu(out, pages_merged, 0);
+    kernfs_puts(out, "\nfull_scans:    ");
+    kernfs_putu(out, full_scans, 0);
+    kernfs_puts(out, "\ncow_breaks:    ");
+    kernfs_putu(out, get_cow_break_count(), 0);
+    kernfs_putc(out, '\n');
+}
+
+// Handles writes to the ksm kernel file: "1" starts the scanner, "0" stops it
+// Inputs: buf -- data written, nbytes -- its length
+// Outputs: nbytes on success, -1 for anything else
+static int32_t ksm_store(const uint8_t* buf, int32_t nbytes) {
+    if (nbytes < 1 || (buf[0] != '0' && buf[0] != '1')) return -1;
+    ksm_set_enabled(buf[0] == '1');
+    return nbytes;
+}
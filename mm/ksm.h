@@ -0,0 +1,36 @@
+#ifndef KSM_H
+#define KSM_H
+
+#include "../types.h"
+#include "../common.h"
+
+// Same-page merging: identical private user pages, across or within processes, are
+// mapped read-only to a single frame and copied again on the first write (see break_cow).
+#define KSM_HASH_BUCKETS        256
+#define KSM_PAGES_PER_IDLE      8       // Pages hashed per ksm_idle call
+#define KSM_SCAN_STEP_LIMIT     4096    // Page table entries looked at per call while finding them
+
+#ifndef ASM
+
+// A frame holding merged pages. The table holds one reference of its own.
+typedef struct ksm_stable_t {
+    uint32_t hash;
+    uint32_t frame;
+    struct ksm_stable_t* next;
+} ksm_stable_t;
+
+// A page seen once, waiting for a twin. pid 0 marks an empty slot.
+typedef struct ksm_candidate_t {
+    uint32_t hash;
+    uint32_t pid;
+    uint32_t addr;
+    uint32_t frame;
+} ksm_candidate_t;
+
+void ksm_init(void);
+void ksm_idle(void);
+int32_t ksm_set_enabled(int32_t enabled);
+uint32_t ksm_frames_saved(void);
+
+#endif /* ASM */
+#endif
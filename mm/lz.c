@@ -0,0 +1,143 @@
+#include "lz.h"
+#include "../lib.h"
+
+#define LZ_NIBBLE_MAX   15
+#define LZ_LEN_BYTE_MAX 255
+
+/* file-scope functions */
+static uint32_t lz_hash(const uint8_t* p);
+static uint8_t* lz_put_length(uint8_t* op, const uint8_t* oend, uint32_t len);
+static uint8_t* lz_emit(uint8_t* op, const uint8_t* oend, const uint8_t* lit, uint32_t lit_len,
+                        uint32_t offset, uint32_t match_len);
+
+// Compresses a buffer
+// Inputs:
+//      src, src_len -- data to compress, at most LZ_MAX_INPUT bytes
+//      dst, dst_cap -- where to put the result
+//      table -- LZ_HASH_SIZE entries of scratch space, contents don't matter
+// Outputs: Compressed size, -1 if it doesn't fit in dst_cap bytes
+int32_t lz_compress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap, uint16_t* table) {
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    const uint8_t* end = src + src_len;
+    const uint8_t* cand;
+    const uint8_t* oend = dst + dst_cap;
+    uint8_t* op = dst;
+    uint32_t h, match_len;
+    if (src_len > LZ_MAX_INPUT) return -1;
+
+    // Stale entries are harmless, every candidate is compared before it's used
+    memset(table, 0, LZ_HASH_SIZE * sizeof(uint16_t));
+    while (src_len >= LZ_MIN_MATCH && ip <= end - LZ_MIN_MATCH) {
+        h = lz_hash(ip);
+        cand = src + table[h];
+        table[h] = (uint16_t)(ip - src);
+        if (cand >= ip || *(const uint32_t*)cand != *(const uint32_t*)ip) {
+            ip++;
+            continue;
+        }
+        // Matches may overlap what they produce, the decoder copies byte by byte
+        for (match_len = LZ_MIN_MATCH; ip + match_len < end && cand[match_len] == ip[match_len]; match_len++);
+        op = lz_emit(op, oend, anchor, ip - anchor, ip - cand, match_len);
+        if (!op) return -1;
+        ip += match_len;
+        anchor = ip;
+    }
+
+    op = lz_emit(op, oend, anchor, end - anchor, 0, 0);
+    if (!op) return -1;
+    return op - dst;
+}
+
+// Decompresses a buffer produced by lz_compress
+// Inputs: src, src_len -- compressed data, dst, dst_cap -- where to put the result
+// Outputs: Decompressed size, -1 if the data is corrupt or doesn't fit in dst_cap bytes
+int32_t lz_decompress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap) {
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + src_len;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dst_cap;
+    uint32_t token, lit_len, match_len, offset, byte;
+
+    while (ip < iend) {
+        token = *ip++;
+        lit_len = token >> 4;
+        if (lit_len == LZ_NIBBLE_MAX) {
+            do {
+                if (ip >= iend) return -1;
+                byte = *ip++;
+                lit_len += byte;
+            } while (byte == LZ_LEN_BYTE_MAX);
+        }
+        if (lit_len > (uint32_t)(iend - ip) || lit_len > (uint32_t)(oend - op)) return -1;
+        memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+        if (ip == iend) break;
+
+        if (iend - ip < 2) return -1;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        match_len = token & LZ_NIBBLE_MAX;
+        if (match_len == LZ_NIBBLE_MAX) {
+            do {
+                if (ip >= iend) return -1;
+                byte = *ip++;
+                match_len += byte;
+            } while (byte == LZ_LEN_BYTE_MAX);
+        }
+        match_len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (uint32_t)(op - dst) || match_len > (uint32_t)(oend - op)) return -1;
+        for (; match_len; match_len--, op++) *op = *(op - offset);
+    }
+    return op - dst;
+}
+
+// Inputs: p -- at least LZ_MIN_MATCH readable bytes
+// Outputs: Slot of the hash table for the bytes there
+static uint32_t lz_hash(const uint8_t* p) {
+    return (*(const uint32_t*)p * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// Writes the extra bytes of a length that didn't fit its nibble
+// Inputs: op -- output position, oend -- end of the output, len -- what's left of the length
+// Outputs: New output position, NULL if out of room
+static uint8_t* lz_put_length(uint8_t* op, const uint8_t* oend, uint32_t len) {
+    for (; len >= LZ_LEN_BYTE_MAX; len -= LZ_LEN_BYTE_MAX) {
+        if (op >= oend) return NULL;
+        *op++ = LZ_LEN_BYTE_MAX;
+    }
+    if (op >= oend) return NULL;
+    *op++ = len;
+    return op;
+}
+
+// Writes one sequence
+// Inputs:
+//      op, oend -- output position and end
+//      lit, lit_len -- literals preceding the match
+//      offset, match_len -- the match, match_len 0 for the last sequence
+// Outputs: New output position, NULL if out of room
+static uint8_t* lz_emit(uint8_t* op, const uint8_t* oend, const uint8_t* lit, uint32_t lit_len,
+                        uint32_t offset, uint32_t match_len) {
+    uint32_t lit_nibble = lit_len < LZ_NIBBLE_MAX ? lit_len : LZ_NIBBLE_MAX;
+    uint32_t match_nibble = 0;
+    if (match_len) {
+        match_len -= LZ_MIN_MATCH;
+        match_nibble = match_len < LZ_NIBBLE_MAX ? match_len : LZ_NIBBLE_MAX;
+    }
+
+    if (op >= oend) return NULL;
+    *op++ = (lit_nibble << 4) | match_nibble;
+    if (lit_nibble == LZ_NIBBLE_MAX && !(op = lz_put_length(op, oend, lit_len - LZ_NIBBLE_MAX))) return NULL;
+    if (lit_len > (uint32_t)(oend - op)) return NULL;
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+    if (offset == 0) return op;
+
+    if (oend - op < 2) return NULL;
+    *op++ = offset & 0xFF;
+    *op++ = offset >> 8;
+    if (match_nibble == LZ_NIBBLE_MAX && !(op = lz_put_length(op, oend, match_len - LZ_NIBBLE_MAX))) return NULL;
+    return op;
+}
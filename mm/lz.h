@@ -0,0 +1,21 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include "../types.h"
+
+// A small LZ77 codec in the LZ4 block format: each sequence is a token byte (literal count
+// in the high nibble, match length - LZ_MIN_MATCH in the low one, 15 meaning more length
+// bytes follow), the literals, then a 2 byte little-endian match offset. The last sequence
+// has literals only. Fast enough to compress a page in a page fault's worth of time.
+#define LZ_MIN_MATCH    4
+#define LZ_HASH_BITS    10
+#define LZ_HASH_SIZE    (1 << LZ_HASH_BITS)
+#define LZ_MAX_INPUT    0xFFFF      // Match offsets are 16 bits
+
+#ifndef ASM
+
+int32_t lz_compress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap, uint16_t* table);
+int32_t lz_decompress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap);
+
+#endif /* ASM */
+#endif
@@ -0,0 +1,173 @@
+#include "shm.h"
+#include "vma.h"
+#include "kmalloc.h"
+#include "zero_pool.h"
+#include "../lib.h"
+#include "../process/process.h"
+
+/* file-scope variables */
+static shm_segment_t* shm_segments;
+
+/* file-scope functions */
+static shm_segment_t* shm_find(const char* name);
+static int32_t shm_map_and_put(uint32_t pid, shm_segment_t* seg);
+
+// Creates a named segment and attaches it to the creating process
+// The segment lives as long as some process has it attached; its pages are allocated
+// and zeroed when first touched by any of them.
+// Inputs:
+//      pid -- creating process
+//      name -- name other processes attach it by, at most SHM_NAME_LEN characters
+//      size -- bytes, rounded up to whole pages, at most SHM_MAX_SIZE
+// Outputs: Address the segment was attached at, -1 on failure (bad arguments, name taken, out of memory)
+int32_t shm_create_segment(uint32_t pid, const char* name, uint32_t size) {
+    shm_segment_t* seg;
+    int32_t taken = 0;
+    if (!name || size == 0 || size > SHM_MAX_SIZE) return -1;
+    if (strlen((const int8_t*)name) == 0 || strlen((const int8_t*)name) > SHM_NAME_LEN) return -1;
+
+    seg = kzalloc(sizeof(shm_segment_t));
+    if (!seg) return -1;
+    strncpy((int8_t*)seg->name, (const int8_t*)name, SHM_NAME_LEN);
+    seg->name[SHM_NAME_LEN] = '\0';
+    seg->num_pages = PAGE_ALIGN_UP(size) / SIZEOF_4KBPAGE;
+    seg->frames = kzalloc(seg->num_pages * sizeof(uint32_t));
+    if (!seg->frames) {
+        kfree(seg);
+        return -1;
+    }
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        if (shm_find(seg->name)) {
+            taken = 1;
+        } else {
+            // This reference keeps the segment alive until it's attached
+            seg->refcount = 1;
+            seg->next = shm_segments;
+            shm_segments = seg;
+        }
+    }
+
+    if (taken) {
+        kfree(seg->frames);
+        kfree(seg);
+        return -1;
+    }
+    return shm_map_and_put(pid, seg);
+}
+
+// Attaches an existing segment to a process
+// Inputs: pid -- attaching process, name -- the segment's name
+// Outputs: Address the segment was attached at, -1 if there is no such segment or no room
+int32_t shm_attach_segment(uint32_t pid, const char* name) {
+    shm_segment_t* seg;
+    if (!name) return -1;
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        seg = shm_find(name);
+        if (seg) seg->refcount++;
+    }
+
+    if (!seg) return -1;
+    return shm_map_and_put(pid, seg);
+}
+
+// Detaches a segment from a process
+// Inputs: pid -- the process, addr -- address the segment was attached at
+// Outputs: 0 on success, -1 if no segment is attached there
+// Side effects: The segment is freed along with its frames if this was the last attachment
+int32_t shm_detach_segment(uint32_t pid, uint32_t addr) {
+    pcb_t* pcb = get_pcb(pid);
+    vm_area_t* area;
+    uint32_t length = 0;
+    if (!pcb || is_kernel_pid(pid)) return -1;
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        area = mm_find_area(pcb->mm, addr);
+        if (area && area->shm && area->begin == addr) length = area->end - area->begin;
+    }
+
+    if (!length) return -1;
+    return mm_munmap(pid, addr, length);
+}
+
+// Takes a reference to a segment
+// Inputs: seg -- the segment, which must already be referenced
+// Outputs: None
+void shm_ref(shm_segment_t* seg) {
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        PRINT_ASSERT(seg->refcount > 0, "Referencing dead segment %s\n", seg->name);
+        seg->refcount++;
+    }
+}
+
+// Drops a reference to a segment, freeing it when it was the last one
+// Pages still mapped somewhere keep their own frame references (see frame_ref), so only
+// the segment's references are dropped here.
+// Inputs: seg -- the segment
+// Outputs: None
+void shm_put(shm_segment_t* seg) {
+    shm_segment_t** link;
+    uint32_t i;
+    int32_t last = 0;
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        PRINT_ASSERT(seg->refcount > 0, "Segment %s released too often\n", seg->name);
+        if (--seg->refcount == 0) {
+            for (link = &shm_segments; *link != seg; link = &(*link)->next);
+            *link = seg->next;
+            last = 1;
+        }
+    }
+
+    if (!last) return;
+    for (i = 0; i < seg->num_pages; i++) {
+        if (seg->frames[i] != FRAME_NULL) frame_put(seg->frames[i]);
+    }
+    kfree(seg->frames);
+    kfree(seg);
+}
+
+// Gets the frame behind a page of a segment, for mapping it into a process
+// Inputs: seg -- the segment, page -- page number within the segment
+// Outputs: The frame with a new reference for the caller's mapping, FRAME_NULL if the page
+//      is past the end of the segment or we're out of memory
+// Side effects: Allocates and zeroes the frame on the first touch by any process
+uint32_t shm_get_frame(shm_segment_t* seg, uint32_t page) {
+    uint32_t frame = FRAME_NULL;
+    if (!seg || page >= seg->num_pages) return FRAME_NULL;
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        if (seg->frames[page] == FRAME_NULL) seg->frames[page] = frame_alloc_zeroed();
+        frame = seg->frames[page];
+        if (frame != FRAME_NULL) frame_ref(frame);
+    }
+    return frame;
+}
+
+// Looks up a segment by name
+// Inputs: name -- name to search for
+// Outputs: The segment, NULL if there is none
+// Side effects: Must be called with interrupts off
+static shm_segment_t* shm_find(const char* name) {
+    shm_segment_t* seg;
+    for (seg = shm_segments; seg; seg = seg->next) {
+        if (!strncmp((const int8_t*)seg->name, (const int8_t*)name, SHM_NAME_LEN + 1)) return seg;
+    }
+    return NULL;
+}
+
+// Maps a whole segment into a process's mmap range, then drops the caller's reference
+// Inputs: pid -- process to map into, seg -- segment holding a reference taken by the caller
+// Outputs: Address it was mapped at, -1 on failure
+static int32_t shm_map_and_put(uint32_t pid, shm_segment_t* seg) {
+    int32_t addr = mm_map_area(pid, 0, seg->num_pages * SIZEOF_4KBPAGE, VMA_SHM, seg);
+    shm_put(seg);
+    return addr;
+}
@@ -0,0 +1,32 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include "../types.h"
+#include "../common.h"
+#include "../memfs/memfs.h"
+
+#define SHM_NAME_LEN    MAX_FILENAME_LENGTH
+#define SHM_MAX_SIZE    (16 * ONE_MB)
+
+#ifndef ASM
+
+// A named shared memory segment. Every process attaching it maps the same frames,
+// each at whatever address was free in its own mmap range.
+typedef struct shm_segment_t {
+    char name[SHM_NAME_LEN + 1];
+    uint32_t num_pages;
+    uint32_t* frames;       // num_pages entries, FRAME_NULL until some process touches the page
+    uint32_t refcount;      // One per vm_area_t mapping it, plus short-lived ones during attach
+    struct shm_segment_t* next;
+} shm_segment_t;
+
+int32_t shm_create_segment(uint32_t pid, const char* name, uint32_t size);
+int32_t shm_attach_segment(uint32_t pid, const char* name);
+int32_t shm_detach_segment(uint32_t pid, uint32_t addr);
+
+void shm_ref(shm_segment_t* seg);
+void shm_put(shm_segment_t* seg);
+uint32_t shm_get_frame(shm_segment_t* seg, uint32_t page);
+
+#endif /* ASM */
+#endif
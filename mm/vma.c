@@ -0,0 +1,292 @@
+#include "vma.h"
+#include "kmalloc.h"
+#include "shm.h"
+#include "../lib.h"
+#include "../process/process.h"
+
+/* file-scope variables */
+static kmem_cache_t* user_mm_cache;
+static kmem_cache_t* vm_area_cache;
+
+/* file-scope functions */
+static user_mm_t* get_mm_of_pid(uint32_t pid);
+static uint32_t find_free_range(const user_mm_t* mm, uint32_t length);
+static int32_t range_is_free(const user_mm_t* mm, uint32_t begin, uint32_t end);
+
+// Creates an empty address space: no page tables, an empty heap and no mmap areas
+// Inputs: None
+// Outputs: The new address space, NULL if out of memory
+user_mm_t* mm_create() {
+    user_mm_t* mm;
+    if (!user_mm_cache) user_mm_cache = kmem_cache_create("user_mm", sizeof(user_mm_t));
+    if (!vm_area_cache) vm_area_cache = kmem_cache_create("vm_area", sizeof(vm_area_t));
+    if (!user_mm_cache || !vm_area_cache) return NULL;
+
+    // Zeroed, so no page tables and no huge pages either
+    mm = kmem_cache_zalloc(user_mm_cache);
+    if (!mm) return NULL;
+    mm->refcount = 1;
+    mm->brk = USER_HEAP_BEGIN_ADDR;
+    mm->stack_low = USER_STACK_END_ADDR;
+    mm->areas = NULL;
+    mm->active_cpu = MM_NO_CPU;
+    return mm;
+}
+
+// Frees an address space's areas and the structure itself
+// The page tables and the frames behind them belong to paging, see destroy_user_programpage
+// Inputs: mm -- address space to free, must not be mapped anymore nor referenced (see put_user_mm)
+// Outputs: None
+void mm_destroy(user_mm_t* mm) {
+    vm_area_t* area;
+    if (!mm) return;
+    while ((area = mm->areas)) {
+        mm->areas = area->next;
+        if (area->shm) shm_put(area->shm);
+        kmem_cache_free(vm_area_cache, area);
+    }
+    kmem_cache_free(user_mm_cache, mm);
+}
+
+// Checks whether a page fault at an address may be resolved by backing the page with a frame
+// Inputs: mm -- address space of the faulting process, addr -- faulting address
+// Outputs: 1 if the address is in the program page, the heap, an mmap area or the stack;
+//      0 otherwise (including the stack guard page)
+int32_t mm_addr_is_valid(const user_mm_t* mm, uint32_t addr) {
+    if (!mm) return 0;
+    if (addr >= BEGINNING_USERPAGE_VIRTUAL_ADDR && addr < BEGINNING_USERPAGE_VIRTUAL_ADDR + SIZEOF_PROGRAMPAGE) return 1;
+    // The whole region is reserved, but the stack only grows down into it a little at a time
+    // (the page fault handler lowers stack_low), so a wild pointer into it is still caught
+    if (addr >= USER_STACK_BEGIN_ADDR && addr < USER_STACK_END_ADDR) {
+        return addr + USER_STACK_GROWTH_GAP >= mm->stack_low;
+    }
+    // The page holding the last byte of the heap is usable in full
+    if (addr >= USER_HEAP_BEGIN_ADDR && addr < PAGE_ALIGN_UP(mm->brk)) return 1;
+    return mm_find_area(mm, addr) != NULL;
+}
+
+// Finds the area containing an address
+// Inputs: mm -- address space to search, addr -- the address
+// Outputs: The area, NULL if the address isn't in one (the program page and heap aren't areas)
+vm_area_t* mm_find_area(const user_mm_t* mm, uint32_t addr) {
+    vm_area_t* area;
+    if (!mm) return NULL;
+    for (area = mm->areas; area && area->begin <= addr; area = area->next) {
+        if (addr < area->end) return area;
+    }
+    return NULL;
+}
+
+// Adds up everything a process may touch without faulting for real
+// Inputs: mm -- the address space
+// Outputs: Bytes in the program page, the heap, every mmap area and the stack grown so far
+// Side effects: Must be called with interrupts off
+uint32_t mm_virtual_size(const user_mm_t* mm) {
+    const vm_area_t* area;
+    uint32_t size;
+    if (!mm) return 0;
+    size = SIZEOF_PROGRAMPAGE + PAGE_ALIGN_UP(mm->brk) - USER_HEAP_BEGIN_ADDR + USER_STACK_END_ADDR - mm->stack_low;
+    for (area = mm->areas; area; area = area->next) size += area->end - area->begin;
+    return size;
+}
+
+// Moves the end of a process's heap
+// Nothing is allocated up front; pages are backed when first touched.
+// Shrinking releases the pages that end up entirely past the new end.
+// Inputs: pid -- process whose heap to resize, increment -- bytes to grow (negative to shrink) by
+// Outputs: The old end of the heap, -1 if the heap would leave its range or a huge page in the
+//      part given back couldn't be split for lack of memory
+int32_t mm_sbrk(uint32_t pid, int32_t increment) {
+    user_mm_t* mm = get_mm_of_pid(pid);
+    uint32_t old_brk, new_brk;
+    int32_t retval = -1;
+    if (!mm) return -1;
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        old_brk = mm->brk;
+        new_brk = old_brk + (uint32_t)increment;
+        // Unsigned wraparound in either direction lands outside the heap range
+        if (increment >= 0 ? (new_brk >= old_brk && new_brk <= USER_HEAP_END_ADDR)
+                           : (new_brk < old_brk && new_brk >= USER_HEAP_BEGIN_ADDR)) {
+            mm->brk = new_brk;
+            retval = (int32_t)old_brk;
+        }
+    }
+
+    if (retval != -1 && new_brk < old_brk && unmap_user_range(pid, PAGE_ALIGN_UP(new_brk), PAGE_ALIGN_UP(old_brk)) == -1) {
+        // Everything is still mapped, so the heap keeps it
+        CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+            if (mm->brk == new_brk) mm->brk = old_brk;
+        }
+        retval = -1;
+    }
+    return retval;
+}
+
+// Reserves an anonymous, zero-filled area in a process's mmap range
+// Nothing is allocated up front; pages are backed when first touched.
+// Inputs:
+//      pid -- process to map into
+//      addr -- page aligned address the area has to start at, 0 to let the kernel pick
+//      length -- size of the area, rounded up to whole pages
+// Outputs: The start of the area, -1 on failure (bad arguments, no room, out of memory)
+int32_t mm_mmap(uint32_t pid, uint32_t addr, uint32_t length) {
+    return mm_map_area(pid, addr, length, VMA_ANON, NULL);
+}
+
+// Adds an area to a process's mmap range
+// Inputs:
+//      pid -- process to map into
+//      addr -- page aligned address the area has to start at, 0 to let the kernel pick
+//      length -- size of the area, rounded up to whole pages
+//      flags -- VMA_ANON or VMA_SHM
+//      shm -- segment backing a VMA_SHM area from its first page, which gets a reference for the area
+// Outputs: The start of the area, -1 on failure (bad arguments, no room, out of memory)
+int32_t mm_map_area(uint32_t pid, uint32_t addr, uint32_t length, uint32_t flags, shm_segment_t* shm) {
+    user_mm_t* mm = get_mm_of_pid(pid);
+    vm_area_t* new_area;
+    vm_area_t** link;
+    int32_t retval = -1;
+    if (!mm || length == 0 || length > USER_MMAP_END_ADDR - USER_MMAP_BEGIN_ADDR) return -1;
+    if (addr & (SIZEOF_4KBPAGE - 1)) return -1;
+    if ((flags & VMA_SHM) ? !shm : shm != NULL) return -1;
+    length = PAGE_ALIGN_UP(length);
+
+    new_area = kmem_cache_alloc(vm_area_cache);
+    if (!new_area) return -1;
+
+    uint32_t flags_save, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags_save, garbage) {
+        if (!addr) {
+            addr = find_free_range(mm, length);
+        } else if (addr < USER_MMAP_BEGIN_ADDR || addr > USER_MMAP_END_ADDR - length
+                || !range_is_free(mm, addr, addr + length)) {
+            addr = 0;
+        }
+        if (addr) {
+            new_area->begin = addr;
+            new_area->end = addr + length;
+            new_area->flags = flags;
+            new_area->shm = shm;
+            new_area->pgoff = 0;
+            if (shm) shm_ref(shm);
+            // Keep the list sorted
+            for (link = &mm->areas; *link && (*link)->begin < addr; link = &(*link)->next);
+            new_area->next = *link;
+            *link = new_area;
+            retval = (int32_t)addr;
+        }
+    }
+
+    if (retval == -1) kmem_cache_free(vm_area_cache, new_area);
+    return retval;
+}
+
+// Removes a range from a process's mmap areas and releases the pages behind it
+// Shared memory pages only lose this mapping's reference, the segment keeps its own.
+// Areas only partly inside the range are trimmed, or split if the range is in their middle.
+// Inputs:
+//      pid -- process to unmap from
+//      addr -- page aligned start of the range
+//      length -- size of the range, rounded up to whole pages
+// Outputs: 0 on success (including when nothing was mapped there), -1 on failure, in which case
+//      everything stays mapped
+int32_t mm_munmap(uint32_t pid, uint32_t addr, uint32_t length) {
+    user_mm_t* mm = get_mm_of_pid(pid);
+    vm_area_t* spare;
+    vm_area_t* area;
+    vm_area_t** link;
+    uint32_t end;
+    if (!mm || length == 0 || (addr & (SIZEOF_4KBPAGE - 1))) return -1;
+    if (addr < USER_MMAP_BEGIN_ADDR || addr >= USER_MMAP_END_ADDR) return -1;
+    if (length > USER_MMAP_END_ADDR - addr) return -1;
+    end = addr + PAGE_ALIGN_UP(length);
+
+    // Splitting an area needs a second descriptor, get it before touching anything
+    spare = kmem_cache_alloc(vm_area_cache);
+    if (!spare) return -1;
+    // Pages before areas: a huge page that can't be split for lack of memory leaves it all as it was
+    if (unmap_user_range(pid, addr, end) == -1) {
+        kmem_cache_free(vm_area_cache, spare);
+        return -1;
+    }
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        link = &mm->areas;
+        while ((area = *link) && area->begin < end) {
+            if (area->end <= addr) {
+                link = &area->next;
+            } else if (area->begin >= addr && area->end <= end) {
+                // Entirely inside the range
+                *link = area->next;
+                if (area->shm) shm_put(area->shm);
+                kmem_cache_free(vm_area_cache, area);
+            } else if (area->begin < addr && area->end > end) {
+                // The range is in the middle
+                spare->begin = end;
+                spare->end = area->end;
+                spare->flags = area->flags;
+                spare->shm = area->shm;
+                spare->pgoff = area->pgoff + (end - area->begin) / SIZEOF_4KBPAGE;
+                if (spare->shm) shm_ref(spare->shm);
+                spare->next = area->next;
+                area->end = addr;
+                area->next = spare;
+                spare = NULL;
+                break;
+            } else if (area->begin < addr) {
+                area->end = addr;
+                link = &area->next;
+            } else {
+                area->pgoff += (end - area->begin) / SIZEOF_4KBPAGE;
+                area->begin = end;
+                break;
+            }
+        }
+    }
+
+    if (spare) kmem_cache_free(vm_area_cache, spare);
+    // Drops whatever another thread touched in the meantime. Nothing is mapped there anymore
+    // to fault on, and there's no huge page left to split.
+    unmap_user_range(pid, addr, end);
+    return 0;
+}
+
+// Gets the address space of a user process
+// Inputs: pid -- the process
+// Outputs: Its address space, NULL for PID 0 or a process without one
+static user_mm_t* get_mm_of_pid(uint32_t pid) {
+    pcb_t* pcb = get_pcb(pid);
+    if (!pcb || is_kernel_pid(pid)) return NULL;
+    return pcb->mm;
+}
+
+// First-fit search of the mmap range
+// Inputs: mm -- address space to search, length -- page aligned size needed
+// Outputs: Start of a free range, 0 if there is none
+// Side effects: Must be called with interrupts off
+static uint32_t find_free_range(const user_mm_t* mm, uint32_t length) {
+    const vm_area_t* area;
+    uint32_t candidate = USER_MMAP_BEGIN_ADDR;
+    for (area = mm->areas; area; area = area->next) {
+        if (area->end <= candidate) continue;
+        if (area->begin >= candidate + length) break;
+        candidate = area->end;
+    }
+    if (candidate > USER_MMAP_END_ADDR - length) return 0;
+    return candidate;
+}
+
+// Checks that no area overlaps a range
+// Inputs: mm -- address space to check, begin/end -- the range
+// Outputs: 1 if nothing is mapped in [begin, end), 0 otherwise
+// Side effects: Must be called with interrupts off
+static int32_t range_is_free(const user_mm_t* mm, uint32_t begin, uint32_t end) {
+    const vm_area_t* area;
+    for (area = mm->areas; area && area->begin < end; area = area->next) {
+        if (area->end > begin) return 0;
+    }
+    return 1;
+}
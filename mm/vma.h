@@ -0,0 +1,70 @@
+#ifndef VMA_H
+#define VMA_H
+
+#include "../types.h"
+#include "../common.h"
+#include "../paging.h"
+#include "../sched/spinlock.h"
+
+#define PAGE_ALIGN_DOWN(addr)   ((uint32_t)(addr) & ~(SIZEOF_4KBPAGE - 1))
+#define PAGE_ALIGN_UP(addr)     PAGE_ALIGN_DOWN((uint32_t)(addr) + SIZEOF_4KBPAGE - 1)
+
+// vm_area_t flags
+#define VMA_ANON    0x1     // Zero-filled on first touch
+#define VMA_SHM     0x2     // Backed by the frames of a shared memory segment
+
+#ifndef ASM
+
+struct shm_segment_t;
+
+// A range of the user window handed out by mmap or shm_attach_segment
+typedef struct vm_area_t {
+    uint32_t begin;         // Page aligned
+    uint32_t end;           // Page aligned, exclusive
+    uint32_t flags;
+    struct shm_segment_t* shm;  // VMA_SHM only, the area holds a reference to it
+    uint32_t pgoff;             // VMA_SHM only, page of the segment mapped at begin
+    struct vm_area_t* next;
+} vm_area_t;
+
+// user_mm_t's active_cpu while none of its tasks is running
+#define MM_NO_CPU   0xFFFFFFFF
+
+// Everything a process can address in the user window
+typedef struct user_mm_t {
+    // Taken by paging while it changes the page tables and huge pages below, see create_new_user_programpage
+    spinlock_t lock;
+    // The process's reference plus one per get_user_mm, changed under paging's lock. The page
+    // tables and the structure go when the last one is put.
+    uint32_t refcount;
+    // NULL until something in that 4MB is touched, index 0 is the program page
+    page_table_entry_t* page_tables[USER_WINDOW_NUM_TABLES];
+    // Base of the 4MB page mapping that 4MB instead of a table, FRAME_NULL if there is none
+    // (see promote_huge_page)
+    uint32_t huge_pages[USER_WINDOW_NUM_TABLES];
+    uint32_t huge_promotions;
+    uint32_t unmap_seq;     // Bumped whenever pages leave the window (unmapped or compressed), see promote_huge_page
+    uint32_t huge_demotions;
+    uint32_t brk;           // End of the heap, USER_HEAP_BEGIN_ADDR while it's empty
+    uint32_t stack_low;     // Lowest stack page backed so far, USER_STACK_END_ADDR while none is
+    vm_area_t* areas;       // Sorted by address, never overlapping
+    // CPU running one of its tasks, MM_NO_CPU while none is. Only that CPU's TLB can have its
+    // pages cached, see activate_existing_user_programpage. Changed under paging's lock.
+    uint32_t active_cpu;
+    // Tasks waiting for it to leave that CPU (see sched_wait_for_mm), none of its tasks are picked meanwhile
+    uint32_t claimed;
+} user_mm_t;
+
+user_mm_t* mm_create(void);
+void mm_destroy(user_mm_t* mm);
+int32_t mm_addr_is_valid(const user_mm_t* mm, uint32_t addr);
+vm_area_t* mm_find_area(const user_mm_t* mm, uint32_t addr);
+uint32_t mm_virtual_size(const user_mm_t* mm);
+int32_t mm_map_area(uint32_t pid, uint32_t addr, uint32_t length, uint32_t flags, struct shm_segment_t* shm);
+
+int32_t mm_sbrk(uint32_t pid, int32_t increment);
+int32_t mm_mmap(uint32_t pid, uint32_t addr, uint32_t length);
+int32_t mm_munmap(uint32_t pid, uint32_t addr, uint32_t length);
+
+#endif /* ASM */
+#endif
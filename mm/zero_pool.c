@@ -0,0 +1,114 @@
+#include "zero_pool.h"
+#include "../lib.h"
+#include "../memfs/kernfs.h"
+
+/* file-scope variables */
+static uint32_t zero_pool[ZERO_POOL_MAX_FRAMES];
+static uint32_t zero_pool_count;
+// Instrumentation
+static uint32_t zero_pool_hits;
+static uint32_t zero_pool_misses;
+static uint32_t zero_pool_idle_zeroed;
+static uint32_t zero_pool_stolen;
+
+/* file-scope functions */
+static void zero_pool_show(kernfs_buf_t* out);
+
+// Registers the pool's report. The pool starts empty and fills up the first time the system idles.
+// Inputs: None
+// Outputs: None
+void zero_pool_init() {
+    kernfs_register("zeropool", zero_pool_show, NULL);
+}
+
+// Allocates a frame that reads as all zeroes
+// Inputs: None
+// Outputs: Physical address of the frame, FRAME_NULL if out of memory
+// Side effects: Zeroes the frame here if the pool is empty
+uint32_t frame_alloc_zeroed() {
+    uint32_t frame = FRAME_NULL;
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        if (zero_pool_count) {
+            frame = zero_pool[--zero_pool_count];
+            zero_pool_hits++;
+        } else {
+            zero_pool_misses++;
+        }
+    }
+    if (frame != FRAME_NULL) return frame;
+
+    frame = frame_alloc();
+    if (frame != FRAME_NULL) memset((void*)frame, 0, FRAME_SIZE);
+    return frame;
+}
+
+// Takes a frame out of the pool for an allocation that found no free frames
+// Inputs: None
+// Outputs: Physical address of the frame, FRAME_NULL if the pool is empty
+uint32_t zero_pool_steal() {
+    uint32_t frame = FRAME_NULL;
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        if (zero_pool_count) {
+            frame = zero_pool[--zero_pool_count];
+            zero_pool_stolen++;
+        }
+    }
+    return frame;
+}
+
+// Zeroes a few frames into the pool. Call this wherever the CPU has nothing better to do.
+// Interrupts stay enabled while zeroing, so it's safe to call from polling loops.
+// Inputs: None
+// Outputs: None
+// Side effects: Allocates up to ZERO_POOL_IDLE_BATCH frames
+void zero_pool_idle() {
+    uint32_t i, frame;
+    int32_t full;
+    for (i = 0; i < ZERO_POOL_IDLE_BATCH; i++) {
+        if (zero_pool_count >= ZERO_POOL_MAX_FRAMES || frame_num_free() <= ZERO_POOL_MIN_FREE) return;
+        frame = frame_alloc();
+        if (frame == FRAME_NULL) return;
+        memset((void*)frame, 0, FRAME_SIZE);
+
+        uint32_t flags, garbage;
+        CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+            // Something may have filled the pool while we were zeroing
+            full = zero_pool_count >= ZERO_POOL_MAX_FRAMES;
+            if (!full) {
+                zero_pool[zero_pool_count++] = frame;
+                zero_pool_idle_zeroed++;
+            }
+        }
+        if (full) {
+            frame_free(frame);
+            return;
+        }
+    }
+}
+
+// Inputs: None
+// Outputs: Number of zeroed frames ready in the pool
+uint32_t zero_pool_size() {
+    return zero_pool_count;
+}
+
+// Fills the zeropool kernel file
+// Inputs: out -- buffer to fill
+// Outputs: None
+static void zero_pool_show(kernfs_buf_t* out) {
+    kernfs_puts(out, "ready:   ");
+    kernfs_putu(out, zero_pool_count, 0);
+    kernfs_puts(out, "/");
+    kernfs_putu(out, ZERO_POOL_MAX_FRAMES, 0);
+    kernfs_puts(out, "\nhits:    ");
+    kernfs_putu(out, zero_pool_hits, 0);
+    kernfs_puts(out, "\nmisses:  ");
+    kernfs_putu(out, zero_pool_misses, 0);
+    kernfs_puts(out, "\nzeroed:  ");
+    kernfs_putu(out, zero_pool_idle_zeroed, 0);
+    kernfs_puts(out, "\nstolen:  ");
+    kernfs_putu(out, zero_pool_stolen, 0);
+    kernfs_putc(out, '\n');
+}
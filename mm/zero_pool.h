@@ -0,0 +1,24 @@
+#ifndef ZERO_POOL_H
+#define ZERO_POOL_H
+
+#include "../types.h"
+#include "../common.h"
+#include "frame.h"
+
+// Frames zeroed ahead of time while the CPU would otherwise spin or halt
+#define ZERO_POOL_MAX_FRAMES    256     // 1MB of ready pages
+// Leave at least this many frames to the allocator, so the pool never causes an out-of-memory
+#define ZERO_POOL_MIN_FREE      512
+// Frames zeroed per zero_pool_idle call, keeps each call short enough for a polling loop
+#define ZERO_POOL_IDLE_BATCH    4
+
+#ifndef ASM
+
+void zero_pool_init(void);
+uint32_t frame_alloc_zeroed(void);
+uint32_t zero_pool_steal(void);
+void zero_pool_idle(void);
+uint32_t zero_pool_size(void);
+
+#endif /* ASM */
+#endif
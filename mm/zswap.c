@@ -0,0 +1,348 @@
+#include "zswap.h"
+#include "lz.h"
+#include "vma.h"
+#include "../lib.h"
+#include "../paging.h"
+#include "../process/process.h"
+#include "../memfs/kernfs.h"
+
+// A slot holds the pool frame and which end of it the page is at
+#define ZSWAP_HANDLE_LAST       1
+#define ZSWAP_HANDLE_HDR(handle)    ((zswap_pool_hdr_t*)((handle) & ~(FRAME_SIZE - 1)))
+#define ZSWAP_LENGTH_CHUNKS(length) CEILDIV((uint32_t)(length), ZSWAP_CHUNK_SIZE)
+
+/* file-scope variables */
+// Slot 0 is never used so a swapped entry is never all zeroes
+static uint32_t zswap_slots[ZSWAP_MAX_SLOTS];
+// Pool frames with one half free, by how many chunks are free
+static zswap_pool_hdr_t* unpaired[ZSWAP_CHUNKS];
+static uint32_t free_slot_hint = 1;
+// Compression runs with interrupts off, so one set of scratch buffers is enough
+static uint8_t compress_buf[ZSWAP_MAX_STORED];
+static uint16_t lz_table[LZ_HASH_SIZE];
+// Set while compressing, allocations made on the way don't reclaim again (and clobber compress_buf)
+static int32_t reclaiming;
+// Where the reclaim scan left off
+static uint32_t scan_pid = 1;
+static uint32_t scan_addr = USER_WINDOW_BEGIN_ADDR;
+// Instrumentation
+static uint32_t stored_pages;
+static uint32_t stored_bytes;
+static uint32_t pool_frames;
+static uint32_t swap_outs;
+static uint32_t swap_ins;
+static uint32_t rejected;
+static uint32_t load_cycles_avg;
+static uint32_t load_cycles_max;
+
+/* file-scope functions */
+static int32_t zswap_page_is_candidate(const user_mm_t* mm, uint32_t addr, const page_table_entry_t* pte);
+static int32_t zswap_store(uint32_t pid, user_mm_t* mm, page_table_entry_t* pte);
+static uint32_t zswap_alloc_slot(void);
+static uint32_t zswap_pool_free_chunks(const zswap_pool_hdr_t* hdr);
+static void zswap_pool_link(zswap_pool_hdr_t* hdr);
+static void zswap_pool_unlink(zswap_pool_hdr_t* hdr);
+static uint8_t* zswap_handle_data(uint32_t handle, uint32_t* length);
+static void zswap_show(kernfs_buf_t* out);
+
+// Registers the zswap report
+// Inputs: None
+// Outputs: None
+void zswap_init() {
+    kernfs_register("zswap", zswap_show, NULL);
+}
+
+// Frees frames by compressing cold user pages. Pages with the accessed bit set get it
+// cleared and a second chance instead, so pages in use stay put.
+// Address spaces locked by someone else are passed over: the caller of frame_alloc may hold
+// one (a page fault holds its own), and waiting for it would never end.
+// Inputs: count -- number of frames wanted
+// Outputs: Number of frames freed
+uint32_t zswap_reclaim(uint32_t count) {
+    uint32_t steps, freed = 0;
+    user_mm_t* mm;
+    page_table_entry_t* pte;
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        if (!reclaiming) {
+            reclaiming = 1;
+            for (steps = 0; steps < ZSWAP_SCAN_LIMIT && freed < count; steps++) {
+                if (scan_addr >= USER_WINDOW_END_ADDR) {
+                    scan_addr = USER_WINDOW_BEGIN_ADDR;
+                    if (++scan_pid > MAX_NUM_PROCESS) scan_pid = 1;
+                }
+                // A thread's pages are its process's, which are scanned under the process's PID
+                mm = is_thread_pid(scan_pid) ? NULL : get_user_mm(scan_pid);
+                if (!mm || mm_is_active_elsewhere(mm) || !spin_trylock(&mm->lock)) {
+                    // No such process, it's busy or it's running on another CPU, skip all of it
+                    put_user_mm(mm);
+                    scan_addr = USER_WINDOW_END_ADDR;
+                    continue;
+                }
+                pte = get_mm_pte(mm, scan_addr);
+                if (!pte) {
+                    // Nothing touched in this 4MB, skip all of it
+                    scan_addr = GET_ADDR_FROM_4MB_OFFSET_HIGH(GET_4MB_OFFSET_HIGH(scan_addr) + 1);
+                } else {
+                    if (zswap_page_is_candidate(mm, scan_addr, pte)) {
+                        if (pte->accessed) {
+                            pte->accessed = 0;
+                        } else if (zswap_store(scan_pid, mm, pte) == 0) {
+                            freed++;
+                        }
+                    }
+                    scan_addr += SIZEOF_4KBPAGE;
+                }
+                spin_unlock(&mm->lock);
+                put_user_mm(mm);
+            }
+            reclaiming = 0;
+        }
+    }
+    return freed;
+}
+
+// Compresses one page right away, whether it's cold or not
+// Inputs: pid -- owner, addr -- user address of the page
+// Outputs: 0 on success, -1 if the page isn't a private resident page, doesn't compress
+//      well enough, or there's no room
+int32_t zswap_swap_out(uint32_t pid, uint32_t addr) {
+    int32_t retval = -1;
+    user_mm_t* mm = get_user_mm(pid);
+    if (!mm) return -1;
+
+    uint32_t flags, garbage;
+    SPIN_LOCK_IRQSAVE(&mm->lock, flags, garbage) {
+        page_table_entry_t* pte = get_mm_pte(mm, addr);
+        // Another CPU running the process would keep using the page out of its TLB
+        if (!reclaiming && pte && !mm_is_active_elsewhere(mm) && zswap_page_is_candidate(mm, addr, pte)) {
+            reclaiming = 1;
+            retval = zswap_store(pid, mm, pte);
+            reclaiming = 0;
+        }
+    }
+    put_user_mm(mm);
+    return retval;
+}
+
+// Brings a compressed page back, for the page fault handler
+// Inputs: slot -- slot from the swapped page table entry
+// Outputs: A frame holding the page, FRAME_NULL if out of memory (the page stays compressed)
+// Side effects: Frees the slot on success. Must be called with interrupts off.
+uint32_t zswap_load(uint32_t slot) {
+    uint32_t start = rdtsc_low();
+    uint32_t frame, cycles, length;
+    uint8_t* data;
+    if (slot == 0 || slot >= ZSWAP_MAX_SLOTS || !zswap_slots[slot]) return FRAME_NULL;
+
+    frame = frame_alloc();
+    if (frame == FRAME_NULL) return FRAME_NULL;
+    data = zswap_handle_data(zswap_slots[slot], &length);
+    if (lz_decompress(data, length, (uint8_t*)frame, FRAME_SIZE) != FRAME_SIZE) {
+        // Can't happen unless the heap got scribbled on, the process gets killed over it
+        frame_free(frame);
+        return FRAME_NULL;
+    }
+    zswap_free(slot);
+    swap_ins++;
+
+    cycles = rdtsc_low() - start;
+    // Moving average over roughly the last 8 loads
+    load_cycles_avg = load_cycles_avg - load_cycles_avg / 8 + cycles / 8;
+    if (cycles > load_cycles_max) load_cycles_max = cycles;
+    return frame;
+}
+
+// Drops a compressed page, for when its process unmaps it or exits
+// Inputs: slot -- slot from the swapped page table entry
+// Outputs: None
+// Side effects: Gives the pool frame back once both its halves are unused
+void zswap_free(uint32_t slot) {
+    uint32_t handle, length;
+    zswap_pool_hdr_t* hdr;
+    uint32_t flags, garbage;
+    if (slot == 0 || slot >= ZSWAP_MAX_SLOTS) return;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        handle = zswap_slots[slot];
+        zswap_slots[slot] = 0;
+        if (handle) {
+            hdr = ZSWAP_HANDLE_HDR(handle);
+            zswap_handle_data(handle, &length);
+            stored_pages--;
+            stored_bytes -= length;
+            if (slot < free_slot_hint) free_slot_hint = slot;
+
+            // A frame with one half in use is on a list, one with both isn't
+            if (hdr->first_length && hdr->last_length) {
+                if (handle & ZSWAP_HANDLE_LAST) hdr->last_length = 0;
+                else hdr->first_length = 0;
+                zswap_pool_link(hdr);
+            } else {
+                zswap_pool_unlink(hdr);
+                frame_free((uint32_t)hdr);
+                pool_frames--;
+            }
+        }
+    }
+}
+
+// Inputs: None
+// Outputs: Number of pages held compressed
+uint32_t zswap_num_stored() {
+    return stored_pages;
+}
+
+// Checks whether a page may be compressed: resident, writable, mapped only here, not shared memory
+// Inputs: mm -- owner's address space, addr -- the page, pte -- its entry
+// Outputs: 1 if it may, 0 otherwise
+// Side effects: Must be called with the address space's lock held
+static int32_t zswap_page_is_candidate(const user_mm_t* mm, uint32_t addr, const page_table_entry_t* pte) {
+    vm_area_t* area;
+    if (!pte->present || !pte->read_write || !pte->user_supervisor) return 0;
+    // Merged pages (see mm/ksm.c) and shared memory have more than one reference
+    if (frame_refcount(pte->base_addr << 12) != 1) return 0;
+    area = mm_find_area(mm, addr);
+    return !(area && area->shm);
+}
+
+// Compresses a page, points its entry at the slot holding it and frees its frame
+// A page goes next to one already in the pool if it fits, which saves its whole frame.
+// Otherwise it starts a pool frame of its own, which only pays off once another page joins it,
+// so it has to leave at least half the frame for that one.
+// Inputs: pid -- owner, mm -- its address space, pte -- entry of a page zswap_page_is_candidate accepted
+// Outputs: 0 on success, -1 if it doesn't compress well enough or there's no room
+// Side effects: Must be called with the address space's lock held and interrupts off.
+//      Flushes TLB if the window is mapped.
+static int32_t zswap_store(uint32_t pid, user_mm_t* mm, page_table_entry_t* pte) {
+    uint32_t frame = pte->base_addr << 12;
+    uint32_t slot, handle, chunks;
+    zswap_pool_hdr_t* hdr = NULL;
+    int32_t length = lz_compress((const uint8_t*)frame, FRAME_SIZE, compress_buf, ZSWAP_MAX_STORED, lz_table);
+    if (length < 0) {
+        rejected++;
+        return -1;
+    }
+    // Best fit among the frames with a half free
+    for (chunks = ZSWAP_LENGTH_CHUNKS(length); chunks < ZSWAP_CHUNKS && !hdr; chunks++) hdr = unpaired[chunks];
+    if (!hdr && length > ZSWAP_MAX_UNPAIRED) {
+        rejected++;
+        return -1;
+    }
+    slot = zswap_alloc_slot();
+    if (!slot) return -1;
+
+    if (hdr) {
+        zswap_pool_unlink(hdr);
+    } else {
+        hdr = (zswap_pool_hdr_t*)frame_alloc();
+        if (!hdr) return -1;
+        memset(hdr, 0, sizeof(zswap_pool_hdr_t));
+        pool_frames++;
+    }
+    if (!hdr->first_length) {
+        hdr->first_length = length;
+        handle = (uint32_t)hdr;
+    } else {
+        hdr->last_length = length;
+        handle = (uint32_t)hdr | ZSWAP_HANDLE_LAST;
+    }
+    if (!hdr->first_length || !hdr->last_length) zswap_pool_link(hdr);
+    memcpy(zswap_handle_data(handle, NULL), compress_buf, length);
+    zswap_slots[slot] = handle;
+    stored_pages++;
+    stored_bytes += length;
+    swap_outs++;
+
+    *(uint32_t*)pte = 0;
+    pte->custom = PTE_CUSTOM_SWAPPED;
+    pte->base_addr = slot;
+    // The dirty bit goes with the entry, and a huge page promotion copying meanwhile has to know
+    mm->unmap_seq++;
+    if (user_window_is_mapped(pid)) flush_tlb();
+    frame_put(frame);
+    get_thread_leader(pid)->mem_stats.resident_pages--;
+    return 0;
+}
+
+// Finds an unused slot
+// Inputs: None
+// Outputs: The slot, 0 if all are taken
+// Side effects: Must be called with interrupts off
+static uint32_t zswap_alloc_slot() {
+    uint32_t slot;
+    for (slot = free_slot_hint; slot < ZSWAP_MAX_SLOTS; slot++) {
+        if (!zswap_slots[slot]) {
+            free_slot_hint = slot + 1;
+            return slot;
+        }
+    }
+    return 0;
+}
+
+// Inputs: hdr -- a pool frame
+// Outputs: Chunks unused by either half
+static uint32_t zswap_pool_free_chunks(const zswap_pool_hdr_t* hdr) {
+    return ZSWAP_CHUNKS - ZSWAP_LENGTH_CHUNKS(hdr->first_length) - ZSWAP_LENGTH_CHUNKS(hdr->last_length);
+}
+
+// Puts a pool frame with one half free on the list for its free space
+// Inputs: hdr -- the pool frame, on no list
+// Outputs: None
+// Side effects: Must be called with interrupts off
+static void zswap_pool_link(zswap_pool_hdr_t* hdr) {
+    zswap_pool_hdr_t** head = &unpaired[zswap_pool_free_chunks(hdr)];
+    hdr->prev = NULL;
+    hdr->next = *head;
+    if (*head) (*head)->prev = hdr;
+    *head = hdr;
+}
+
+// Takes a pool frame off the list for its free space
+// Inputs: hdr -- the pool frame, which must have exactly one half in use
+// Outputs: None
+// Side effects: Must be called with interrupts off
+static void zswap_pool_unlink(zswap_pool_hdr_t* hdr) {
+    if (hdr->prev) hdr->prev->next = hdr->next;
+    else unpaired[zswap_pool_free_chunks(hdr)] = hdr->next;
+    if (hdr->next) hdr->next->prev = hdr->prev;
+    hdr->prev = hdr->next = NULL;
+}
+
+// Finds a stored page in its pool frame
+// Inputs: handle -- from a slot, length -- set to its compressed length unless NULL
+// Outputs: Where its compressed bytes start
+static uint8_t* zswap_handle_data(uint32_t handle, uint32_t* length) {
+    zswap_pool_hdr_t* hdr = ZSWAP_HANDLE_HDR(handle);
+    if (handle & ZSWAP_HANDLE_LAST) {
+        if (length) *length = hdr->last_length;
+        return (uint8_t*)hdr + FRAME_SIZE - ZSWAP_LENGTH_CHUNKS(hdr->last_length) * ZSWAP_CHUNK_SIZE;
+    }
+    if (length) *length = hdr->first_length;
+    return (uint8_t*)hdr + ZSWAP_CHUNK_SIZE;
+}
+
+// Fills the zswap kernel file
+// Inputs: out -- buffer to fill
+// Outputs: None
+static void zswap_show(kernfs_buf_t* out) {
+    kernfs_puts(out, "stored_pages:    ");
+    kernfs_putu(out, stored_pages, 0);
+    kernfs_puts(out, "\nstored_bytes:    ");
+    kernfs_putu(out, stored_bytes, 0);
+    kernfs_puts(out, "\npool_frames:     ");
+    kernfs_putu(out, pool_frames, 0);
+    // Memory the pool takes as a percentage of what the pages took, lower is better
+    kernfs_puts(out, "\nratio_percent:   ");
+    kernfs_putu(out, stored_pages ? pool_frames * 100 / stored_pages : 0, 0);
+    kernfs_puts(out, "\nswap_outs:       ");
+    kernfs_putu(out, swap_outs, 0);
+    kernfs_puts(out, "\nswap_ins:        ");
+    kernfs_putu(out, swap_ins, 0);
+    kernfs_puts(out, "\nrejected:        ");
+    kernfs_putu(out, rejected, 0);
+    kernfs_puts(out, "\nload_cycles_avg: ");
+    kernfs_putu(out, load_cycles_avg, 0);
+    kernfs_puts(out, "\nload_cycles_max: ");
+    kernfs_putu(out, load_cycles_max, 0);
+    kernfs_putc(out, '\n');
+}
@@ -0,0 +1,43 @@
+#ifndef ZSWAP_H
+#define ZSWAP_H
+
+#include "../types.h"
+#include "../common.h"
+#include "frame.h"
+
+// Compressed in-memory swap. When frames run out, cold private user pages are compressed
+// into a pool of frames and their own frames freed; touching them again decompresses them.
+// Pool frames hold two compressed pages each, one from each end (like Linux's zbud), so a
+// page only frees memory once it shares its pool frame with another.
+#define ZSWAP_MAX_SLOTS         8192                    // 32MB worth of user pages
+#define ZSWAP_CHUNK_SIZE        64                      // Pool frames are handed out in chunks
+#define ZSWAP_CHUNKS            (FRAME_SIZE / ZSWAP_CHUNK_SIZE - 1)     // The first chunk holds the header
+// Largest compressed page that still leaves a chunk for the other half of the pool frame
+#define ZSWAP_MAX_STORED        ((ZSWAP_CHUNKS - 1) * ZSWAP_CHUNK_SIZE)
+// Largest one worth starting a pool frame with: it has to leave room for one that compresses as badly,
+// or storing it frees nothing
+#define ZSWAP_MAX_UNPAIRED      (ZSWAP_CHUNKS / 2 * ZSWAP_CHUNK_SIZE)
+#define ZSWAP_RECLAIM_BATCH     16                      // Pages compressed per shortage
+#define ZSWAP_SCAN_LIMIT        16384                   // Page table entries looked at per shortage
+
+#ifndef ASM
+
+// Lives in the first chunk of every pool frame. The first page is stored right after it,
+// the last one at the very end of the frame.
+typedef struct zswap_pool_hdr_t {
+    uint16_t first_length;          // 0 if unused
+    uint16_t last_length;
+    struct zswap_pool_hdr_t* prev;  // On the list of frames with one half free, see zswap.c
+    struct zswap_pool_hdr_t* next;
+} zswap_pool_hdr_t;
+STATIC_ASSERT(sizeof(zswap_pool_hdr_t) <= ZSWAP_CHUNK_SIZE);
+
+void zswap_init(void);
+uint32_t zswap_reclaim(uint32_t count);
+int32_t zswap_swap_out(uint32_t pid, uint32_t addr);
+uint32_t zswap_load(uint32_t slot);
+void zswap_free(uint32_t slot);
+uint32_t zswap_num_stored(void);
+
+#endif /* ASM */
+#endif
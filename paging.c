@@ -3,8 +3,41 @@
 #include "lib.h"
 #include "device-drivers/terminal.h"
 #include "common.h"
+#include "mm/frame.h"
+#include "mm/vma.h"
+#include "mm/shm.h"
+#include "mm/zero_pool.h"
+#include "mm/zswap.h"
+#include "memfs/kernfs.h"
+#include "sched/spinlock.h"
+#include "sched/sched.h"
+#include "sched/smp.h"
 
-proc_paging_state_t curr_proc_paging_state;
+// A CPU's page directories, the paging state it has loaded and the address space its user window
+// was last pointed at. The boot processor's directories are the ones in x86_desc.S, the other
+// CPUs get copies (see paging_init_cpu), so each one can map a different process.
+typedef struct paging_cpu_t {
+    page_directory_entry_t* kernel_pd;
+    page_directory_entry_t* user_pd;
+    page_table_entry_t* user_vmem;      // The user directory's first 4MB, where vidmap goes
+    proc_paging_state_t state;
+    user_mm_t* window_mm;               // NULL while it runs no process, see set_window_mm
+} paging_cpu_t;
+
+static paging_cpu_t paging_cpus[SMP_MAX_CPUS];
+// Protects every CPU's page directories, video memory page tables and paging state, and the
+// address spaces' active_cpu. A process's own page tables have the lock in its user_mm_t, which
+// is always taken first.
+static spinlock_t paging_lock;
+static lock_stats_t paging_lock_stats;
+static lock_stats_t mm_lock_stats;
+static int32_t pat_enabled;
+static uint32_t cow_breaks;
+// Where paging_huge_idle left off
+static uint32_t huge_scan_pid = 1;
+static uint32_t huge_scan_idx;
+// Promotions that found a full table but no free 4MB of contiguous memory
+static uint32_t huge_no_memory;
 
 void enable_paging_c(uint32_t addr);
 pde_4mb_page_t get_configured_pde4mb_for_kernel_code();
@@ -13,6 +46,14 @@ int32_t initialize_user_page_directory();
 int32_t initialize_kern_vidmem();
 
 static int32_t is_valid_vmem_physical_begin_addr(uint32_t addr);
+static int32_t break_cow(page_table_entry_t* pte);
+static pde_4mb_page_t get_configured_pde4mb_for_user(uint32_t phys_addr);
+static void set_window_pde(const user_mm_t* mm, uint32_t table_idx);
+static void set_window_mm(user_mm_t* mm);
+static paging_cpu_t* paging_this_cpu();
+static int32_t demote_huge_page(int32_t pid, user_mm_t* mm, uint32_t table_idx);
+static int32_t is_promotable(const user_mm_t* mm, uint32_t table_idx);
+static void huge_show(kernfs_buf_t* out);
 
 const uint32_t vmem_begin_addrs[NUM_VMEM_PAGE] = {(const uint32_t) KERN_VMEM_PHYSICAL_BEGIN_ADDR,
                                                   (const uint32_t) BACKGROUND_VMEM_PHYSICAL_BEGIN_ADDR_T1,
@@ -27,6 +68,10 @@ const uint32_t vmem_begin_addrs[NUM_VMEM_PAGE] = {(const uint32_t) KERN_VMEM_PHY
 //      Also all side effects of enable_paging_c apply.    
 void paging_init() {
     uint32_t i;
+    lock_stats_init(&paging_lock_stats, "paging");
+    lock_stats_init(&mm_lock_stats, "mm");
+    spin_lock_init(&paging_lock, &paging_lock_stats);
+    paging_memtype_init();
     for (i = 0; i < NUM_PAGE_ENTRIES; i++) {
         // By default, no page/entry should be present.
         kernel_vmem_page_table[i].present = 0;
@@ -41,11 +86,88 @@ void paging_init() {
     
     initialize_kern_vidmem();
     initialize_user_page_directory(user_page_descriptor_table);
+    paging_cpus[0].kernel_pd = kernel_page_descriptor_table;
+    paging_cpus[0].user_pd = user_page_descriptor_table;
+    paging_cpus[0].user_vmem = user_vmem_page_table;
+    paging_cpus[0].window_mm = NULL;
     enable_paging_c((uint32_t)(kernel_page_descriptor_table));
 
-    curr_proc_paging_state.user_vidmem_active = 0;
-    curr_proc_paging_state.current_mapped_pid = 0;
-    curr_proc_paging_state.active_pde = (page_directory_entry_t*)kernel_page_descriptor_table;
+    paging_cpus[0].state.user_vidmem_active = 0;
+    paging_cpus[0].state.current_mapped_pid = 0;
+    paging_cpus[0].state.active_pde = (page_directory_entry_t*)kernel_page_descriptor_table;
+}
+
+// Gives an application processor page directories of its own, copies of the boot processor's
+// with nothing in the user window and no video memory mapped for the user
+// Inputs: cpu -- the application processor's number
+// Outputs: 0 success, -1 if out of memory
+// Side effects: Takes three frames. Identity maps made after this go to every CPU's directories
+//      (see map_kernel_identity_4mb).
+int32_t paging_init_cpu(uint32_t cpu) {
+    const uint32_t VIRTUAL_OFFSET_TO_MEM = GET_10_MSB(USER_WINDOW_BEGIN_ADDR);
+    uint32_t i;
+    uint32_t kernel_pd, user_pd, user_vmem;
+    paging_cpu_t* ap;
+    if (!cpu || cpu >= SMP_MAX_CPUS) return -1;
+    kernel_pd = frame_alloc();
+    user_pd = frame_alloc();
+    user_vmem = frame_alloc();
+    if (kernel_pd == FRAME_NULL || user_pd == FRAME_NULL || user_vmem == FRAME_NULL) {
+        if (kernel_pd != FRAME_NULL) frame_free(kernel_pd);
+        if (user_pd != FRAME_NULL) frame_free(user_pd);
+        if (user_vmem != FRAME_NULL) frame_free(user_vmem);
+        return -1;
+    }
+
+    ap = &paging_cpus[cpu];
+    uint32_t flags, garbage;
+    SPIN_LOCK_IRQSAVE(&paging_lock, flags, garbage) {
+        ap->kernel_pd = (page_directory_entry_t*)kernel_pd;
+        ap->user_pd = (page_directory_entry_t*)user_pd;
+        ap->user_vmem = (page_table_entry_t*)user_vmem;
+        memcpy(ap->kernel_pd, paging_cpus[0].kernel_pd, SIZEOF_4KBPAGE);
+        memcpy(ap->user_pd, paging_cpus[0].user_pd, SIZEOF_4KBPAGE);
+        memcpy(ap->user_vmem, paging_cpus[0].user_vmem, SIZEOF_4KBPAGE);
+        for (i = 0; i < USER_WINDOW_NUM_TABLES; i++) {
+            ap->kernel_pd[VIRTUAL_OFFSET_TO_MEM + i].entry_to_4kb_table.present_4kbtab = 0;
+            ap->user_pd[VIRTUAL_OFFSET_TO_MEM + i].entry_to_4kb_table.present_4kbtab = 0;
+        }
+        ap->user_pd[GET_4KB_OFFSET_HIGH(BEGINNING_USERVID_VIRTUAL_ADDR)].entry_to_4kb_table
+            = get_configured_pde4kb_for_vmem(1, ap->user_vmem);
+        ap->user_vmem[GET_4KB_OFFSET_MIDDLE(BEGINNING_USERVID_VIRTUAL_ADDR)].present = 0;
+        ap->window_mm = NULL;
+        ap->state.user_vidmem_active = 0;
+        ap->state.current_mapped_pid = 0;
+        ap->state.active_pde = ap->kernel_pd;
+    }
+    return 0;
+}
+
+// Turns on paging for an application processor, with the directories paging_init_cpu gave it
+// Inputs: None
+// Outputs: None
+// Side effects: Programs this CPU's PAT, all side effects of enable_paging_c apply
+void paging_start_cpu() {
+    paging_memtype_init();
+    enable_paging_c((uint32_t)paging_this_cpu()->kernel_pd);
+}
+
+// Inputs: None
+// Outputs: This CPU's kernel page directory, which maps the running process's user window too
+page_directory_entry_t* get_kernel_page_directory() {
+    return paging_this_cpu()->kernel_pd;
+}
+
+// Inputs: None
+// Outputs: This CPU's user page directory
+page_directory_entry_t* get_user_page_directory() {
+    return paging_this_cpu()->user_pd;
+}
+
+// Inputs: None
+// Outputs: This CPU's paging bookkeeping
+static paging_cpu_t* paging_this_cpu() {
+    return &paging_cpus[smp_cpu_id()];
 }
 
 // Helper function which sets control register flags in order to configure paging.
@@ -58,9 +180,21 @@ void enable_paging_c(uint32_t addr) {
     cr0_register_fmt introduce_cr0;
     cr4_register_fmt introduce_cr4;
 
+    cr0_register_fmt keep_cr0;
+
     introduce_cr0.bits = 0;
     introduce_cr0.pe = 1;
     introduce_cr0.pg = 1;
+    // Make read-only user pages read-only for the kernel too, or kernel writes
+    // through user pointers would land in copy-on-write pages shared with others
+    introduce_cr0.wp = 1;
+
+    // The CPU comes out of reset with caching disabled (CD and NW set), and
+    // nothing guarantees the bootloader cleared them. Clear both so the memory
+    // types chosen in the page tables actually take effect.
+    keep_cr0.bits = ~0;
+    keep_cr0.cd = 0;
+    keep_cr0.nw = 0;
 
     introduce_cr4.bits = 0;
     introduce_cr4.pse = 1;
@@ -71,14 +205,16 @@ void enable_paging_c(uint32_t addr) {
         "orl $0x10, %%eax;"
         "movl %%eax, %%cr4;"
 
-        // Set paging bit (and protection bit) to enable paging
+        // Set paging bit (and protection bit) to enable paging, and turn on caching
         "movl %%cr0, %%eax;" 
         "orl %[cr0setflgs], %%eax;" 
+        "andl %[cr0keepflgs], %%eax;"
         "movl %%eax, %%cr0;" 
         
         :
         :   [cr4setflgs] "m" (introduce_cr4.bits),
-            [cr0setflgs] "m" (introduce_cr0.bits)
+            [cr0setflgs] "m" (introduce_cr0.bits),
+            [cr0keepflgs] "m" (keep_cr0.bits)
         : "eax"
     );
 }
@@ -105,14 +241,13 @@ pde_4mb_page_t get_configured_pde4mb_for_kernel_code() {
     the_page.present_4mb = 1; // Is present
     the_page.read_write_4mb = 1; // Want to read/write
     the_page.user_supervisor_4mb = 0; // Kernels's page, so supervisor mode
-    the_page.writethrough_4mb = 0; // Always want writeback
-    the_page.cache_disabled_4mb = 1; // Cache because this is actual memory
     the_page.dirty_4mb = 0; // Not dirty (yet)
     the_page.page_size_set_to_one_4mb = 1;
     the_page.global_4mb = 1; // Many users one kernel
     the_page.page_table_attr_4mb = 0; // We're told to set this to zero.
     the_page.reserved_set_to_zero_4mb = 0;
     the_page.base_addr_4mb = GET_10_MSB(KERN_BEGIN_ADDR);
+    set_pde4mb_memtype(&the_page, get_memtype_for_physical(KERN_BEGIN_ADDR)); // Actual memory, so cache it
     return the_page;
 }
 
@@ -147,12 +282,11 @@ int32_t initialize_user_vidmem() {
     user_vmem_page_table[pt_entry_idx].present = 0;
     user_vmem_page_table[pt_entry_idx].read_write = 1;
     user_vmem_page_table[pt_entry_idx].user_supervisor = 1; // User may access this page.
-    user_vmem_page_table[pt_entry_idx].writethrough = 0;
-    user_vmem_page_table[pt_entry_idx].cache_disabled = 0;
     user_vmem_page_table[pt_entry_idx].dirty = 0;
-    user_vmem_page_table[pt_entry_idx].page_table_attr = 0;
     user_vmem_page_table[pt_entry_idx].global = 0; 
     user_vmem_page_table[pt_entry_idx].base_addr = GET_20_MSB(VIDMEM_KERN_BEGIN_ADDR); // Mapping to the kernel's video memory
+    // Every page this entry can be pointed at (see set_user_vmem_base_addr) is a VGA text buffer
+    set_pte_memtype(&user_vmem_page_table[pt_entry_idx], get_memtype_for_physical(VIDMEM_KERN_BEGIN_ADDR));
     return 0;
 }
 
@@ -168,12 +302,10 @@ int32_t initialize_kern_vidmem() {
         kernel_vmem_page_table[pte_idx].present = 1;
         kernel_vmem_page_table[pte_idx].read_write = 1;
         kernel_vmem_page_table[pte_idx].user_supervisor = 0; // Kernel's video memory only
-        kernel_vmem_page_table[pte_idx].writethrough = 0;
-        kernel_vmem_page_table[pte_idx].cache_disabled = 0;
         kernel_vmem_page_table[pte_idx].dirty = 0;
-        kernel_vmem_page_table[pte_idx].page_table_attr = 0;
         kernel_vmem_page_table[pte_idx].global = 0; 
         kernel_vmem_page_table[pte_idx].base_addr = GET_20_MSB(vmem_begin_addrs[i]);
+        set_pte_memtype(&kernel_vmem_page_table[pte_idx], get_memtype_for_physical(vmem_begin_addrs[i]));
     }
     return 0;
 }
@@ -185,10 +317,11 @@ int32_t initialize_kern_vidmem() {
 int32_t activate_user_vidmem() {
     uint32_t flags, garbage;
     uint32_t pt_entry_idx = GET_4KB_OFFSET_MIDDLE(BEGINNING_USERVID_VIRTUAL_ADDR);
-    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
-        user_vmem_page_table[pt_entry_idx].present = 1;
+    SPIN_LOCK_IRQSAVE(&paging_lock, flags, garbage) {
+        paging_cpu_t* cpu = paging_this_cpu();
+        cpu->user_vmem[pt_entry_idx].present = 1;
         flush_tlb();
-        curr_proc_paging_state.user_vidmem_active = 1;
+        cpu->state.user_vidmem_active = 1;
     }
     return 0;
 }
@@ -200,127 +333,724 @@ int32_t activate_user_vidmem() {
 int32_t deactivate_user_vidmem() {
     uint32_t flags, garbage;
     int32_t pt_entry_idx = GET_4KB_OFFSET_MIDDLE(BEGINNING_USERVID_VIRTUAL_ADDR);
-    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
-        user_vmem_page_table[pt_entry_idx].present = 0;
+    SPIN_LOCK_IRQSAVE(&paging_lock, flags, garbage) {
+        paging_cpu_t* cpu = paging_this_cpu();
+        cpu->user_vmem[pt_entry_idx].present = 0;
         flush_tlb();
-        curr_proc_paging_state.user_vidmem_active = 0;
+        cpu->state.user_vidmem_active = 0;
     }
     return 0;
 }
 
-// Creates all necessary pages for process memory for a new process
+// Creates the address space for a new process's user window
+// The window itself starts out empty; page tables and pages are allocated when first touched
+// (see handle_user_page_fault), so a process only pays for the memory it actually uses.
 // Inputs: The PID of the new process
 // Outputs: 0 success, -1 failure
-// Side effects: Updates kernel_page_descriptor_table and user_page_descriptor_table and marks the appropriate pages as present
+// Side effects: Allocates the address space and records it in the PCB. Its page tables get a lock
+//      of their own, so faults and unmaps in different processes don't wait for each other.
 int32_t create_new_user_programpage(int32_t pid) {
-    // Introduce two new pages:
-    //      Page for user directory for user program page
-    //      Page for kernel to access that user program page
-    pde_4mb_page_t u_user_page;
-    pde_4mb_page_t k_user_page;
-
-    // Boring configuration according to descriptors.pdf, see paging_init for some explanation on these flags
-    u_user_page.present_4mb = 1;
-    u_user_page.read_write_4mb = 1;
-    u_user_page.user_supervisor_4mb = 1; // For user and for kernel
-    u_user_page.writethrough_4mb = 0;
-    u_user_page.cache_disabled_4mb = 1;
-    u_user_page.accessed_4mb = 0;
-    u_user_page.dirty_4mb = 0;
-    u_user_page.page_size_set_to_one_4mb = 1;
-    u_user_page.global_4mb = 0;
-    u_user_page.custom_4mb = 0;
-    u_user_page.page_table_attr_4mb = 0;
-    u_user_page.reserved_set_to_zero_4mb = 0;
-    
-    k_user_page.present_4mb = 1;
-    k_user_page.read_write_4mb = 1;
-    k_user_page.user_supervisor_4mb = 0; // For kernel only
-    k_user_page.writethrough_4mb = 0;
-    k_user_page.cache_disabled_4mb = 1;
-    k_user_page.accessed_4mb = 0;
-    k_user_page.dirty_4mb = 0;
-    k_user_page.page_size_set_to_one_4mb = 1;
-    k_user_page.global_4mb = 0;
-    k_user_page.custom_4mb = 0;
-    k_user_page.page_table_attr_4mb = 0;
-    k_user_page.reserved_set_to_zero_4mb = 0;
-
-    const uint32_t VIRTUAL_OFFSET_TO_MEM = GET_10_MSB(BEGINNING_USERPAGE_VIRTUAL_ADDR);
-    const uint32_t PHYSICAL_OFFSET_TO_MEM = 
-        GET_10_MSB(BEGINNING_USERPAGE_PHYSICAL_ADDR + (pid - 1) * SIZEOF_PROGRAMPAGE);
+    pcb_t* pcb = get_pcb(pid);
+    if (!pcb || is_kernel_pid(pid)) return -1;
+
+    user_mm_t* mm = mm_create();
+    if (!mm) return -1;
+    spin_lock_init(&mm->lock, &mm_lock_stats);
 
     uint32_t flags, garbage;
-    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
-        // If the kernel page was already present, our bookkeeping was bad - need to fail fast
+    SPIN_LOCK_IRQSAVE(&paging_lock, flags, garbage) {
+        // If the address space was already there, our bookkeeping was bad - need to fail fast
         // Better to fail fast than to brownout and not figure out what the heck was going on
-        // TODO: Set up a new entry in the kernel for a kernel panic
-        PRINT_ASSERT(
-            kernel_page_descriptor_table[PHYSICAL_OFFSET_TO_MEM].entry_to_4mb_page.present_4mb == 0
-            , "Creating already present page for PID=%d!\n", pid
-        );
-
-        // Mapping virtual to physical
-        u_user_page.base_addr_4mb = PHYSICAL_OFFSET_TO_MEM;
-
-        // Map the virtual offset to the 
-        // WARNING: If there are page fault bugs, check this
-        user_page_descriptor_table[VIRTUAL_OFFSET_TO_MEM].entry_to_4mb_page = u_user_page;
-        
-        // One-to-one mapping
-        k_user_page.base_addr_4mb = PHYSICAL_OFFSET_TO_MEM;
-        kernel_page_descriptor_table[PHYSICAL_OFFSET_TO_MEM].entry_to_4mb_page = k_user_page;
+        PRINT_ASSERT(pcb->mm == NULL, "Creating already present page for PID=%d!\n", pid);
+        pcb->mm = mm;
     }
     return 0;
 }
 
 // Function to activate an existiung user program page
-// Sets up the user page descriptor table to point to the existing physical memory
+// Points the user window of this CPU's page directories at the process's page tables and huge pages. The
+// kernel directory maps it too, so the kernel can use user pointers directly (see copy_from_user).
+// An address space is only ever in use on one CPU, so changes to its page tables only have to be
+// flushed from the TLB of the CPU making them: if another CPU is running one of the process's
+// threads, this waits for it to switch away first (see sched_wait_for_mm).
 // Inputs: The PID to activate paging for
-// Outputs: 0 success, -1 failure
-// Side effects: Modifies user_page_descriptor_table, flushes TLB
+// Outputs: 0 success, -1 failure (including the process exiting while we waited)
+// Side effects: Modifies this CPU's page directories, flushes TLB. May let other CPUs into the kernel
+//      while it waits, so it mustn't run on a kernel stack that's been freed (see process_free).
 int32_t activate_existing_user_programpage(int32_t pid) {
     if (is_kernel_pid(pid)) return 0; // PID 0 means we don't have to configure any program page -- just ignore.
-    const uint32_t VIRTUAL_OFFSET_TO_MEM = GET_10_MSB(BEGINNING_USERPAGE_VIRTUAL_ADDR);
-    const uint32_t PHYSICAL_OFFSET_TO_MEM = 
-        GET_10_MSB(BEGINNING_USERPAGE_PHYSICAL_ADDR + (pid - 1) * SIZEOF_PROGRAMPAGE);
+    uint32_t i;
+    int32_t retval = -1;
+    pcb_t* pcb;
     
-    // If it doesn't exist for the kernel, it doesn't exist for us
-    if (!kernel_page_descriptor_table[PHYSICAL_OFFSET_TO_MEM].entry_to_4mb_page.present_4mb) {
-            return -1;
-    }
+    // If it doesn't exist for the process, it doesn't exist for us. Held on to while we wait.
+    user_mm_t* mm = get_user_mm(pid);
+    if (!mm) return -1;
 
     uint32_t flags, garbage;
     CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
-        user_page_descriptor_table[VIRTUAL_OFFSET_TO_MEM].entry_to_4mb_page.base_addr_4mb = PHYSICAL_OFFSET_TO_MEM;
-        user_page_descriptor_table[VIRTUAL_OFFSET_TO_MEM].entry_to_4mb_page.present_4mb = 1;
-        curr_proc_paging_state.current_mapped_pid = pid;
-        flush_tlb();
+        sched_wait_for_mm(mm);
+        spin_lock(&paging_lock);
+        pcb = get_pcb(pid);
+        if (pcb && pcb->mm == mm) {
+            set_window_mm(mm);
+            for (i = 0; i < USER_WINDOW_NUM_TABLES; i++) set_window_pde(mm, i);
+            paging_this_cpu()->state.current_mapped_pid = pid;
+            flush_tlb();
+            retval = 0;
+        }
+        spin_unlock(&paging_lock);
     }
-    return 0;
+    put_user_mm(mm);
+    return retval;
+}
+
+// Checks whether an address space may be in another CPU's TLB, in which case its page tables
+// can't be changed from here (see activate_existing_user_programpage)
+// Inputs: mm -- the address space
+// Outputs: 1 if another CPU is running one of its tasks, 0 otherwise
+// Side effects: The answer only holds while this CPU stays in the kernel (see kernel_lock_enter)
+int32_t mm_is_active_elsewhere(const user_mm_t* mm) {
+    return mm->active_cpu != MM_NO_CPU && mm->active_cpu != smp_cpu_id();
+}
+
+// Records which address space this CPU's user window is for, see user_mm_t's active_cpu
+// Inputs: mm -- the address space, NULL if the CPU runs no process now
+// Outputs: None
+// Side effects: Must be called with paging_lock held. The one it was for before becomes free to
+//      run elsewhere. Doesn't touch the page directories.
+static void set_window_mm(user_mm_t* mm) {
+    paging_cpu_t* cpu = paging_this_cpu();
+    uint32_t id = smp_cpu_id();
+    if (cpu->window_mm && cpu->window_mm != mm && cpu->window_mm->active_cpu == id) {
+        cpu->window_mm->active_cpu = MM_NO_CPU;
+    }
+    cpu->window_mm = mm;
+    if (mm) mm->active_cpu = id;
 }
 
 // Function to destroy an existing user program page
-// Marks the process page for the kernel as not present
+// Frees every page the process touched, then its page tables and the address space itself once
+// nobody else holds it (see get_user_mm)
 // Inputs: The PID to delete paging for
-// Outputs: 0 success, -1 failure, busy loop on inconsistency
-// Side effects: Modifies kernel_page_descriptor_table, flushes TLB
+// Outputs: 0 success, -1 failure
+// Side effects: Unmaps the user window if it belonged to this process, flushes TLB
 int32_t destroy_user_programpage(int32_t pid) {
-    const uint32_t PHYSICAL_OFFSET_TO_MEM = 
-        GET_10_MSB(BEGINNING_USERPAGE_PHYSICAL_ADDR + (pid - 1) * SIZEOF_PROGRAMPAGE);
+    const uint32_t VIRTUAL_OFFSET_TO_MEM = GET_10_MSB(USER_WINDOW_BEGIN_ADDR);
+    uint32_t i;
+    user_mm_t* mm;
+    pcb_t* pcb = get_pcb(pid);
+    if (!pcb) return -1;
+    if (!pcb->mm) {
+        printf("Deconfigure inconsistency!\n");
+        while(1) { int y = 0; (void)y; }
+    }
     
     uint32_t flags, garbage;
-    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
-        if (!kernel_page_descriptor_table[PHYSICAL_OFFSET_TO_MEM].entry_to_4mb_page.present_4mb) {
-            printf("Deconfigure inconsistency!\n");
-            while(1) { int y = 0; (void)y; }
+    SPIN_LOCK_IRQSAVE(&paging_lock, flags, garbage) {
+        if (user_window_is_mapped(pid)) {
+            paging_cpu_t* cpu = paging_this_cpu();
+            for (i = 0; i < USER_WINDOW_NUM_TABLES; i++) {
+                cpu->user_pd[VIRTUAL_OFFSET_TO_MEM + i].entry_to_4kb_table.present_4kbtab = 0;
+                cpu->kernel_pd[VIRTUAL_OFFSET_TO_MEM + i].entry_to_4kb_table.present_4kbtab = 0;
+            }
+            set_window_mm(NULL);
+            cpu->state.current_mapped_pid = 0;
+            flush_tlb();
         }
-        kernel_page_descriptor_table[PHYSICAL_OFFSET_TO_MEM].entry_to_4mb_page.present_4mb = 0;
     }
+    // Takes the address space's lock itself
+    unmap_user_range(pid, USER_WINDOW_BEGIN_ADDR, USER_WINDOW_END_ADDR);
+    SPIN_LOCK_IRQSAVE(&paging_lock, flags, garbage) {
+        mm = pcb->mm;
+        pcb->mm = NULL;
+    }
+    // Nobody can look it up anymore, whoever still has it (see get_user_mm) frees it
+    put_user_mm(mm);
     
     return 0;
 }
 
+// Gets a process's address space and keeps it from being freed, for walking it with interrupts
+// on while the process might exit
+// Inputs: pid -- a user process or thread
+// Outputs: Its address space, NULL if it has none. Hand it to put_user_mm when done.
+// Side effects: The page tables stay allocated, but an exiting process still unmaps everything
+//      in them; take the address space's lock to look at them.
+user_mm_t* get_user_mm(int32_t pid) {
+    user_mm_t* mm = NULL;
+    pcb_t* pcb;
+    if (is_kernel_pid(pid)) return NULL;
+
+    uint32_t flags, garbage;
+    // destroy_user_programpage clears pcb->mm under the same lock
+    SPIN_LOCK_IRQSAVE(&paging_lock, flags, garbage) {
+        pcb = get_pcb(pid);
+        if (pcb && pcb->mm) {
+            mm = pcb->mm;
+            mm->refcount++;
+        }
+    }
+    return mm;
+}
+
+// Lets go of an address space from get_user_mm or a process that's done with it
+// Inputs: mm -- the address space
+// Outputs: None
+// Side effects: The last one frees its page tables and the address space itself
+void put_user_mm(user_mm_t* mm) {
+    uint32_t i, last;
+    if (!mm) return;
+
+    uint32_t flags, garbage;
+    SPIN_LOCK_IRQSAVE(&paging_lock, flags, garbage) {
+        last = --mm->refcount == 0;
+        // No CPU may take it for one it's still running, see set_window_mm
+        for (i = 0; last && i < SMP_MAX_CPUS; i++) {
+            if (paging_cpus[i].window_mm == mm) paging_cpus[i].window_mm = NULL;
+        }
+    }
+    if (!last) return;
+    for (i = 0; i < USER_WINDOW_NUM_TABLES; i++) {
+        if (mm->page_tables[i]) frame_free((uint32_t)mm->page_tables[i]);
+    }
+    mm_destroy(mm);
+}
+
+// Releases the pages backing part of a process's user window
+// The range stays valid or invalid as before; touching it again gets fresh zeroed pages
+// if it's still part of the program page, heap or an mmap area.
+// Inputs: pid -- owner of the window, begin/end -- page aligned range [begin, end) to release
+// Outputs: number of pages released, -1 on failure (nothing is released then)
+// Side effects: Drops the mapping's reference to each frame (freeing it unless it's shared memory)
+//      or frees the page's compressed copy, flushes TLB if the window is mapped.
+//      Huge pages only partly in the range are split back into 4KB pages first, which fails
+//      if there's no memory for their page tables.
+int32_t unmap_user_range(int32_t pid, uint32_t begin, uint32_t end) {
+    pcb_t* pcb = get_pcb(pid);
+    int32_t released = 0;
+    uint32_t i, addr, table_idx, region;
+    if (!pcb || !pcb->mm) return -1;
+    if (begin < USER_WINDOW_BEGIN_ADDR || end > USER_WINDOW_END_ADDR || begin > end) return -1;
+
+    uint32_t flags, garbage;
+    SPIN_LOCK_IRQSAVE(&pcb->mm->lock, flags, garbage) {
+        // Only the huge pages at either end can be partly in the range. Split them before
+        // anything is released, so running out of memory leaves the whole range mapped.
+        uint32_t ends[2] = {begin, end - 1};
+        for (i = 0; i < 2 && begin < end && released != -1; i++) {
+            table_idx = GET_10_MSB(ends[i] - USER_WINDOW_BEGIN_ADDR);
+            region = USER_WINDOW_BEGIN_ADDR + table_idx * SIZEOF_PROGRAMPAGE;
+            if (pcb->mm->huge_pages[table_idx] != FRAME_NULL && (region < begin || region + SIZEOF_PROGRAMPAGE > end)) {
+                if (demote_huge_page(pid, pcb->mm, table_idx)) released = -1;
+            }
+        }
+        if (released != -1) pcb->mm->unmap_seq++;
+        for (addr = begin; addr < end && released != -1; addr += SIZEOF_4KBPAGE) {
+            table_idx = GET_10_MSB(addr - USER_WINDOW_BEGIN_ADDR);
+            region = USER_WINDOW_BEGIN_ADDR + table_idx * SIZEOF_PROGRAMPAGE;
+            // Whole huge pages are all that's left after the splitting above
+            if (pcb->mm->huge_pages[table_idx] != FRAME_NULL) {
+                frame_free_contig(pcb->mm->huge_pages[table_idx], SIZEOF_PROGRAMPAGE / SIZEOF_4KBPAGE);
+                pcb->mm->huge_pages[table_idx] = FRAME_NULL;
+                if (user_window_is_mapped(pid)) {
+                    spin_lock(&paging_lock);
+                    set_window_pde(pcb->mm, table_idx);
+                    spin_unlock(&paging_lock);
+                }
+                released += SIZEOF_PROGRAMPAGE / SIZEOF_4KBPAGE;
+                addr = region + SIZEOF_PROGRAMPAGE - SIZEOF_4KBPAGE;
+                continue;
+            }
+            page_table_entry_t* table = pcb->mm->page_tables[table_idx];
+            if (!table) {
+                // Nothing was ever touched in this 4MB, skip to the next one
+                addr = (addr | (SIZEOF_PROGRAMPAGE - 1)) + 1 - SIZEOF_4KBPAGE;
+                continue;
+            }
+            page_table_entry_t* pte = &table[GET_4KB_OFFSET_MIDDLE(addr)];
+            if (pte->present) {
+                frame_put(pte->base_addr << 12);
+                *(uint32_t*)pte = 0;
+                released++;
+            } else if (pte->custom == PTE_CUSTOM_SWAPPED) {
+                zswap_free(pte->base_addr);
+                *(uint32_t*)pte = 0;
+            }
+        }
+        if (released > 0) {
+            if (user_window_is_mapped(pid)) flush_tlb();
+            get_thread_leader(pid)->mem_stats.resident_pages -= released;
+        }
+    }
+    return released;
+}
+
+// Makes the resident pages of part of a process's user window read-only for good
+// Writes to them fault for real instead of being treated as copy-on-write, and the pages
+// can still be merged with identical ones (see mm/ksm.c).
+// Inputs: pid -- owner of the window, begin/end -- page aligned range [begin, end) to protect
+// Outputs: number of pages protected, -1 on failure
+// Side effects: Flushes TLB if the window is mapped
+int32_t protect_user_range(int32_t pid, uint32_t begin, uint32_t end) {
+    pcb_t* pcb = get_pcb(pid);
+    int32_t protected_pages = 0;
+    uint32_t addr;
+    if (!pcb || !pcb->mm || is_kernel_pid(pid)) return -1;
+    if (begin < USER_WINDOW_BEGIN_ADDR || end > USER_WINDOW_END_ADDR || begin > end) return -1;
+
+    uint32_t flags, garbage;
+    SPIN_LOCK_IRQSAVE(&pcb->mm->lock, flags, garbage) {
+        for (addr = begin; addr < end; addr += SIZEOF_4KBPAGE) {
+            // Huge pages are always writable, so they have to be split first; leave them be
+            page_table_entry_t* pte = get_user_pte(pid, addr);
+            if (!pte || !pte->present) continue;
+            pte->read_write = 0;
+            pte->custom = PTE_CUSTOM_READONLY;
+            protected_pages++;
+        }
+        if (protected_pages && user_window_is_mapped(pid)) flush_tlb();
+    }
+    return protected_pages;
+}
+
+// Backs a page of the mapped user window on first touch
+// Called from the page fault handler for faults from both user and kernel mode (the kernel
+// reaches user memory through copy_from_user and friends, which recover if this fails).
+// Only addresses the process was given (see mm_addr_is_valid) are backed.
+// Inputs: fault_addr -- the faulting linear address (CR2), errcode -- error code pushed by the CPU
+// Outputs: 0 if the fault was resolved and the access can be retried, -1 if it's a real fault
+// Side effects: May allocate a page table for the surrounding 4MB, allocates and zeroes a frame
+//      (or takes the shared memory segment's) and maps it into the user window.
+//      Writes to copy-on-write pages get a private copy of the page, and pages that were
+//      compressed away are decompressed into a new frame. Counts the fault in the process's
+//      mem_stats: major if the page came back from compressed swap, minor otherwise.
+int32_t handle_user_page_fault(uint32_t fault_addr, uint32_t errcode) {
+    const uint32_t VIRTUAL_OFFSET_TO_MEM = GET_10_MSB(USER_WINDOW_BEGIN_ADDR);
+    int32_t retval = -1;
+    if (fault_addr < USER_WINDOW_BEGIN_ADDR || fault_addr >= USER_WINDOW_END_ADDR) return -1;
+    // Whatever task this interrupts puts the window back the way it was before we run again
+    uint32_t pid = paging_this_cpu()->state.current_mapped_pid;
+    pcb_t* pcb = is_kernel_pid(pid) ? NULL : get_pcb(pid);
+    if (!pcb || !pcb->mm) return -1;
+
+    uint32_t flags, garbage;
+    SPIN_LOCK_IRQSAVE(&pcb->mm->lock, flags, garbage) {
+        uint32_t table_idx = GET_10_MSB(fault_addr) - VIRTUAL_OFFSET_TO_MEM;
+        page_table_entry_t* table = NULL;
+        uint32_t frame = FRAME_NULL;
+        int32_t from_swap = 0;
+        // Huge pages are fully populated and writable, so any fault in one is real
+        if (pcb->mm->huge_pages[table_idx] == FRAME_NULL && mm_addr_is_valid(pcb->mm, fault_addr)) {
+            table = pcb->mm->page_tables[table_idx];
+            // New tables start out with every entry not present
+            if (!table && (table = (page_table_entry_t*)frame_alloc_zeroed()) != NULL) {
+                pcb->mm->page_tables[table_idx] = table;
+                spin_lock(&paging_lock);
+                set_window_pde(pcb->mm, table_idx);
+                spin_unlock(&paging_lock);
+            }
+        }
+        page_table_entry_t* pte = table ? &table[GET_4KB_OFFSET_MIDDLE(fault_addr)] : NULL;
+        // A write to a present read-only page is copy-on-write (see mm/ksm.c) unless the page
+        // is read-only for good, any other protection fault is real
+        if (pte && pte->present && (errcode & PF_ERR_WRITE) && !pte->read_write && pte->custom != PTE_CUSTOM_READONLY) {
+            retval = break_cow(pte);
+            if (!retval) get_thread_leader(pid)->mem_stats.minor_faults++;
+        } else if (pte && !pte->present && pte->custom == PTE_CUSTOM_SWAPPED) {
+            frame = zswap_load(pte->base_addr);
+            from_swap = 1;
+        } else if (pte && !pte->present) {
+            vm_area_t* area = mm_find_area(pcb->mm, fault_addr);
+            if (area && area->shm) {
+                frame = shm_get_frame(area->shm, area->pgoff + (PAGE_ALIGN_DOWN(fault_addr) - area->begin) / SIZEOF_4KBPAGE);
+            } else {
+                frame = frame_alloc_zeroed();
+            }
+        }
+        if (pte && !pte->present && frame != FRAME_NULL) {
+            pte->read_write = 1;
+            pte->user_supervisor = 1;
+            pte->accessed = 0;
+            pte->dirty = 0;
+            pte->global = 0;
+            pte->custom = 0;
+            pte->base_addr = GET_20_MSB(frame);
+            set_pte_memtype(pte, get_memtype_for_physical(frame));
+            pte->present = 1;
+            // Not-present entries are never cached, so there's nothing to invalidate
+            retval = 0;
+            proc_mem_stats_t* stats = &get_thread_leader(pid)->mem_stats;
+            stats->resident_pages++;
+            if (from_swap) {
+                stats->major_faults++;
+            } else {
+                stats->minor_faults++;
+            }
+            if (fault_addr >= USER_STACK_BEGIN_ADDR && PAGE_ALIGN_DOWN(fault_addr) < pcb->mm->stack_low) {
+                pcb->mm->stack_low = PAGE_ALIGN_DOWN(fault_addr);
+            }
+        }
+    }
+    return retval;
+}
+
+// Gives a copy-on-write page to the process that wrote to it
+// Inputs: pte -- entry of the mapped user window that was written through
+// Outputs: 0 on success, -1 if out of memory
+// Side effects: Copies the page unless nobody else has a reference to the frame anymore,
+//      makes the entry writable and flushes TLB. Must be called with the address space's lock held.
+static int32_t break_cow(page_table_entry_t* pte) {
+    uint32_t old_frame = pte->base_addr << 12;
+    if (frame_refcount(old_frame) > 1) {
+        uint32_t new_frame = frame_alloc();
+        if (new_frame == FRAME_NULL) return -1;
+        memcpy((void*)new_frame, (const void*)old_frame, SIZEOF_4KBPAGE);
+        pte->base_addr = GET_20_MSB(new_frame);
+        frame_put(old_frame);
+    }
+    pte->read_write = 1;
+    cow_breaks++;
+    // The read-only entry may be cached
+    flush_tlb();
+    return 0;
+}
+
+// Checks whether a process's address space is the one in this CPU's user window right now
+// Threads share their process's address space, so this compares that rather than PIDs.
+// Inputs: pid -- a user process or thread
+// Outputs: 1 if its user window is mapped, 0 otherwise
+int32_t user_window_is_mapped(int32_t pid) {
+    pcb_t* mapped = get_pcb(paging_this_cpu()->state.current_mapped_pid);
+    pcb_t* pcb = get_pcb(pid);
+    return mapped && pcb && pcb->mm && mapped->mm == pcb->mm;
+}
+
+// Finds the page table entry mapping a user address in a process's window
+// Inputs: pid -- owner of the window, addr -- address in the user window
+// Outputs: The entry (which may be not present), NULL if no page table covers the address yet
+page_table_entry_t* get_user_pte(int32_t pid, uint32_t addr) {
+    pcb_t* pcb = get_pcb(pid);
+    if (!pcb || is_kernel_pid(pid)) return NULL;
+    return get_mm_pte(pcb->mm, addr);
+}
+
+// get_user_pte for an address space held with get_user_mm, whose process may be gone
+// Inputs: mm -- the address space (NULL finds nothing), addr -- address in the user window
+// Outputs: The entry (which may be not present), NULL if no page table covers the address yet
+// Side effects: The entry is only stable while the address space's lock is held
+page_table_entry_t* get_mm_pte(const user_mm_t* mm, uint32_t addr) {
+    page_table_entry_t* table;
+    if (!mm || addr < USER_WINDOW_BEGIN_ADDR || addr >= USER_WINDOW_END_ADDR) return NULL;
+    table = mm->page_tables[GET_10_MSB(addr - USER_WINDOW_BEGIN_ADDR)];
+    if (!table) return NULL;
+    return &table[GET_4KB_OFFSET_MIDDLE(addr)];
+}
+
+// Inputs: None
+// Outputs: Number of copy-on-write faults resolved so far
+uint32_t get_cow_break_count() {
+    return cow_breaks;
+}
+
+// Collapses a fully populated 4MB of a process's window into a single 4MB page
+// Only done when every page is present, writable and private (not merged or shared memory),
+// so nothing but the process's own page table points at the old frames. The copy runs with
+// interrupts on, so the process may write to the region meantime: the dirty bits are cleared
+// first and pages written to get copied again when the page directory entry is switched over.
+// Inputs: pid -- owner of the window, table_idx -- which 4MB of the window
+// Outputs: 0 on success, -1 if the region doesn't qualify (or stopped qualifying while it was
+//      copied) or there's no free, aligned 4MB
+// Side effects: Copies the region, frees its frames and page table, flushes TLB if the window is mapped.
+//      A process running on another CPU is left alone.
+int32_t promote_huge_page(int32_t pid, uint32_t table_idx) {
+    const uint32_t NUM_PAGES = SIZEOF_PROGRAMPAGE / SIZEOF_4KBPAGE;
+    user_mm_t* mm;
+    page_table_entry_t* table = NULL;
+    int32_t retval = -1;
+    uint32_t i, frame, unmap_seq = 0, huge = FRAME_NULL;
+    if (table_idx >= USER_WINDOW_NUM_TABLES || !(mm = get_user_mm(pid))) return -1;
+
+    uint32_t flags, garbage;
+    SPIN_LOCK_IRQSAVE(&mm->lock, flags, garbage) {
+        // Sparse regions keep their table, and another CPU's TLB would keep writing past the dirty bits
+        if (!mm_is_active_elsewhere(mm) && is_promotable(mm, table_idx)) {
+            table = mm->page_tables[table_idx];
+            for (i = 0; i < NUM_PAGES; i++) table[i].dirty = 0;
+            // Cached entries would let writes through without setting the bit again
+            if (user_window_is_mapped(pid)) flush_tlb();
+            unmap_seq = mm->unmap_seq;
+        }
+    }
+    if (table) {
+        huge = frame_try_alloc_contig(NUM_PAGES, NUM_PAGES);
+        if (huge == FRAME_NULL) huge_no_memory++;
+    }
+
+    // A page at a time, each held on to while it's copied in case it gets unmapped meanwhile
+    for (i = 0; huge != FRAME_NULL && i < NUM_PAGES; i++) {
+        frame = FRAME_NULL;
+        SPIN_LOCK_IRQSAVE(&mm->lock, flags, garbage) {
+            if (mm->page_tables[table_idx] == table && mm->unmap_seq == unmap_seq && table[i].present) {
+                frame = table[i].base_addr << 12;
+                frame_ref(frame);
+            }
+        }
+        if (frame == FRAME_NULL) break;
+        memcpy((void*)(huge + i * SIZEOF_4KBPAGE), (const void*)frame, SIZEOF_4KBPAGE);
+        frame_put(frame);
+    }
+
+    if (huge != FRAME_NULL && i == NUM_PAGES) {
+        SPIN_LOCK_IRQSAVE(&mm->lock, flags, garbage) {
+            // Nothing was unmapped (and maybe touched again as a fresh page) or compressed away
+            // meanwhile, and every page is still private
+            if (mm->page_tables[table_idx] == table && mm->unmap_seq == unmap_seq && !mm_is_active_elsewhere(mm)
+                && is_promotable(mm, table_idx)) {
+                for (i = 0; i < NUM_PAGES; i++) {
+                    frame = table[i].base_addr << 12;
+                    if (table[i].dirty) memcpy((void*)(huge + i * SIZEOF_4KBPAGE), (const void*)frame, SIZEOF_4KBPAGE);
+                    frame_put(frame);
+                }
+                frame_free((uint32_t)table);
+                mm->page_tables[table_idx] = NULL;
+                mm->huge_pages[table_idx] = huge;
+                mm->huge_promotions++;
+                if (user_window_is_mapped(pid)) {
+                    spin_lock(&paging_lock);
+                    set_window_pde(mm, table_idx);
+                    flush_tlb();
+                    spin_unlock(&paging_lock);
+                }
+                retval = 0;
+            }
+        }
+    }
+    if (retval && huge != FRAME_NULL) frame_free_contig(huge, NUM_PAGES);
+    put_user_mm(mm);
+    return retval;
+}
+
+// Registers the hugepages report
+// Inputs: None
+// Outputs: None
+void paging_huge_init() {
+    kernfs_register("hugepages", huge_show, NULL);
+}
+
+// Looks at a few page tables for one that can become a huge page. Call this wherever the
+// CPU has nothing better to do.
+// Inputs: None
+// Outputs: None
+// Side effects: Promotes at most one region, which copies 4MB
+void paging_huge_idle() {
+    uint32_t i;
+    for (i = 0; i < HUGE_SCAN_TABLES_PER_IDLE; i++) {
+        if (++huge_scan_idx >= USER_WINDOW_NUM_TABLES) {
+            huge_scan_idx = 0;
+            if (++huge_scan_pid > MAX_NUM_PROCESS) huge_scan_pid = 1;
+        }
+        if (!get_pcb(huge_scan_pid) || is_thread_pid(huge_scan_pid)) {
+            // Nobody there (or a thread, whose window is its process's), move on to the next PID
+            huge_scan_idx = USER_WINDOW_NUM_TABLES;
+            continue;
+        }
+        if (!promote_huge_page(huge_scan_pid, huge_scan_idx)) return;
+    }
+}
+
+// Gets a page directory entry mapping a 4MB page into the user window
+// Inputs: phys_addr -- 4MB aligned physical address of the page
+// Outputs: The entry
+static pde_4mb_page_t get_configured_pde4mb_for_user(uint32_t phys_addr) {
+    pde_4mb_page_t the_page;
+    the_page.present_4mb = 1;
+    the_page.read_write_4mb = 1;
+    the_page.user_supervisor_4mb = 1;
+    the_page.accessed_4mb = 0;
+    the_page.dirty_4mb = 0;
+    the_page.page_size_set_to_one_4mb = 1;
+    the_page.global_4mb = 0; // Differs between processes
+    the_page.custom_4mb = 0;
+    the_page.reserved_set_to_zero_4mb = 0;
+    the_page.base_addr_4mb = GET_10_MSB(phys_addr);
+    set_pde4mb_memtype(&the_page, get_memtype_for_physical(phys_addr));
+    return the_page;
+}
+
+// Points one 4MB of the user window in both of this CPU's page directories at what the process has
+// there: a huge page, a page table, or nothing
+// Inputs: mm -- address space of the mapped process, table_idx -- which 4MB of the window
+// Outputs: None
+// Side effects: Must be called with paging_lock held. Doesn't flush TLB.
+static void set_window_pde(const user_mm_t* mm, uint32_t table_idx) {
+    const uint32_t VIRTUAL_OFFSET_TO_MEM = GET_10_MSB(USER_WINDOW_BEGIN_ADDR);
+    page_directory_entry_t window;
+    if (mm->huge_pages[table_idx] != FRAME_NULL) {
+        window.entry_to_4mb_page = get_configured_pde4mb_for_user(mm->huge_pages[table_idx]);
+    } else {
+        window.entry_to_4kb_table = get_configured_pde4kb_for_vmem(1, mm->page_tables[table_idx]);
+        window.entry_to_4kb_table.present_4kbtab = mm->page_tables[table_idx] != NULL;
+    }
+    paging_this_cpu()->user_pd[VIRTUAL_OFFSET_TO_MEM + table_idx] = window;
+    paging_this_cpu()->kernel_pd[VIRTUAL_OFFSET_TO_MEM + table_idx] = window;
+}
+
+// Splits a huge page back into 4KB pages, for when only part of it gets unmapped
+// The frames stay where they are, each one can be freed on its own.
+// Inputs: pid -- owner of the window, mm -- its address space, table_idx -- which 4MB of the window
+// Outputs: 0 on success, -1 if out of memory for the page table
+// Side effects: Must be called with the address space's lock held. Flushes TLB if the window is mapped.
+static int32_t demote_huge_page(int32_t pid, user_mm_t* mm, uint32_t table_idx) {
+    uint32_t i, frame;
+    page_table_entry_t* table = (page_table_entry_t*)frame_alloc_zeroed();
+    if (!table) return -1;
+    for (i = 0; i < SIZEOF_PROGRAMPAGE / SIZEOF_4KBPAGE; i++) {
+        frame = mm->huge_pages[table_idx] + i * SIZEOF_4KBPAGE;
+        table[i].read_write = 1;
+        table[i].user_supervisor = 1;
+        table[i].base_addr = GET_20_MSB(frame);
+        set_pte_memtype(&table[i], get_memtype_for_physical(frame));
+        table[i].present = 1;
+    }
+    mm->page_tables[table_idx] = table;
+    mm->huge_pages[table_idx] = FRAME_NULL;
+    mm->huge_demotions++;
+    if (user_window_is_mapped(pid)) {
+        spin_lock(&paging_lock);
+        set_window_pde(mm, table_idx);
+        flush_tlb();
+        spin_unlock(&paging_lock);
+    }
+    return 0;
+}
+
+// Checks whether 4MB of a window can become a huge page: it has a table, and every page in
+// it is present, writable and mapped nowhere else
+// Inputs: mm -- the address space, table_idx -- which 4MB of its window
+// Outputs: 1 if it can, 0 otherwise
+// Side effects: Must be called with the address space's lock held
+static int32_t is_promotable(const user_mm_t* mm, uint32_t table_idx) {
+    uint32_t i;
+    page_table_entry_t* table = mm->page_tables[table_idx];
+    if (!table || mm->huge_pages[table_idx] != FRAME_NULL) return 0;
+    for (i = 0; i < SIZEOF_PROGRAMPAGE / SIZEOF_4KBPAGE; i++) {
+        if (!table[i].present || !table[i].read_write || frame_refcount(table[i].base_addr << 12) != 1) return 0;
+    }
+    return 1;
+}
+
+// Fills the hugepages kernel file: per process, how its user window is mapped and how
+// many TLB entries it would take to cover all of it
+// Inputs: out -- buffer to fill
+// Outputs: None
+static void huge_show(kernfs_buf_t* out) {
+    uint32_t pid, i, j, small, huge, tables;
+    user_mm_t* mm;
+    kernfs_puts(out, "pid 4k_pages 4m_pages tables tlb_entries reach_kb promoted demoted\n");
+    for (pid = 1; pid <= MAX_NUM_PROCESS; pid++) {
+        uint32_t flags, garbage;
+        if (is_thread_pid(pid) || !(mm = get_user_mm(pid))) continue;
+        SPIN_LOCK_IRQSAVE(&mm->lock, flags, garbage) {
+            small = huge = tables = 0;
+            for (i = 0; i < USER_WINDOW_NUM_TABLES; i++) {
+                if (mm->huge_pages[i] != FRAME_NULL) huge++;
+                if (!mm->page_tables[i]) continue;
+                tables++;
+                for (j = 0; j < SIZEOF_PROGRAMPAGE / SIZEOF_4KBPAGE; j++) small += mm->page_tables[i][j].present;
+            }
+            kernfs_putu(out, pid, 3);
+            kernfs_putu(out, small, 9);
+            kernfs_putu(out, huge, 9);
+            kernfs_putu(out, tables, 7);
+            kernfs_putu(out, small + huge, 12);
+            kernfs_putu(out, small * (SIZEOF_4KBPAGE / ONE_KB) + huge * (SIZEOF_PROGRAMPAGE / ONE_KB), 9);
+            kernfs_putu(out, mm->huge_promotions, 9);
+            kernfs_putu(out, mm->huge_demotions, 8);
+            kernfs_putc(out, '\n');
+        }
+        put_user_mm(mm);
+    }
+    kernfs_puts(out, "promotions without free 4MB: ");
+    kernfs_putu(out, huge_no_memory, 0);
+    kernfs_putc(out, '\n');
+}
+
+// Reads the faulting address of the last page fault
+// Inputs: None
+// Outputs: CR2
+uint32_t get_page_fault_addr() {
+    uint32_t pf_addr;
+    asm volatile (
+        "movl %%cr2, %[addr]"
+        : [addr] "=r" (pf_addr)
+    );
+    return pf_addr;
+}
+
+// Identity maps a 4KB page of the first 4MB for the kernel, for the odd piece of low memory it has
+// to write itself (see smp_init)
+// Inputs: phys_addr -- 4KB aligned physical address below 4MB
+// Outputs: 0 success, -1 failure
+// Side effects: Modifies kernel_vmem_page_table, which every CPU's kernel directory shares. Only
+//      this CPU's TLB is flushed, so it's for booting, before the other CPUs come up.
+int32_t map_kernel_identity_low_page(uint32_t phys_addr) {
+    uint32_t pte_idx = GET_4KB_OFFSET_MIDDLE(phys_addr);
+    if (phys_addr & (SIZEOF_4KBPAGE - 1) || GET_4KB_OFFSET_HIGH(phys_addr)) return -1;
+
+    uint32_t flags, garbage;
+    SPIN_LOCK_IRQSAVE(&paging_lock, flags, garbage) {
+        kernel_vmem_page_table[pte_idx].present = 1;
+        kernel_vmem_page_table[pte_idx].read_write = 1;
+        kernel_vmem_page_table[pte_idx].user_supervisor = 0;
+        kernel_vmem_page_table[pte_idx].dirty = 0;
+        kernel_vmem_page_table[pte_idx].global = 0;
+        kernel_vmem_page_table[pte_idx].base_addr = GET_20_MSB(phys_addr);
+        set_pte_memtype(&kernel_vmem_page_table[pte_idx], get_memtype_for_physical(phys_addr));
+        flush_tlb();
+    }
+    return 0;
+}
+
+// Identity maps a 4MB region for the kernel in every CPU's page directories.
+// Used for memory the kernel manages itself (see mm/frame.c), so it's reachable whichever CR3 is loaded.
+// Inputs: phys_addr -- 4MB aligned physical address
+// Outputs: 0 success, -1 failure
+// Side effects: Modifies the page directories, flushes this CPU's TLB. The other CPUs' TLBs aren't,
+//      so like map_kernel_identity_low_page it's for booting.
+int32_t map_kernel_identity_4mb(uint32_t phys_addr) {
+    pde_4mb_page_t the_page;
+    const uint32_t OFFSET_TO_MEM = GET_10_MSB(phys_addr);
+
+    if (phys_addr & (SIZEOF_PROGRAMPAGE - 1)) return -1;
+    // The user window is the only part of the user directory that changes per process, don't shadow it
+    if (phys_addr >= USER_WINDOW_BEGIN_ADDR && phys_addr < USER_WINDOW_END_ADDR) return -1;
+
+    the_page.present_4mb = 1;
+    the_page.read_write_4mb = 1;
+    the_page.user_supervisor_4mb = 0; // Kernel only
+    the_page.accessed_4mb = 0;
+    the_page.dirty_4mb = 0;
+    the_page.page_size_set_to_one_4mb = 1;
+    the_page.global_4mb = 0;
+    the_page.custom_4mb = 0;
+    the_page.reserved_set_to_zero_4mb = 0;
+    the_page.base_addr_4mb = OFFSET_TO_MEM;
+    set_pde4mb_memtype(&the_page, get_memtype_for_physical(phys_addr));
+
+    uint32_t flags, garbage;
+    SPIN_LOCK_IRQSAVE(&paging_lock, flags, garbage) {
+        uint32_t cpu;
+        for (cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+            if (!paging_cpus[cpu].kernel_pd) continue;
+            paging_cpus[cpu].kernel_pd[OFFSET_TO_MEM].entry_to_4mb_page = the_page;
+            paging_cpus[cpu].user_pd[OFFSET_TO_MEM].entry_to_4mb_page = the_page;
+        }
+        flush_tlb();
+    }
+    return 0;
+}
+
 // Function to initialize the user_page_descriptor_table to proper values
 // Inputs: None
 // Outputs: 0 success, -1 failure
@@ -374,7 +1104,7 @@ int32_t set_new_cr3(uint32_t new_pd_addr) {
             : "eax", "ecx"
         );
         flush_tlb();
-        curr_proc_paging_state.active_pde = (page_directory_entry_t*)new_pd_addr;
+        paging_this_cpu()->state.active_pde = (page_directory_entry_t*)new_pd_addr;
     }
     return 0;
 }
@@ -423,15 +1153,22 @@ uint32_t get_default_bgvmem_begin_addr(int32_t tid) {
     return vmem_begin_addrs[tid + 1];
 }
 
-// Function that sets user virtual video memory mapping.
+// Function that sets user virtual video memory mapping, on this CPU.
 // Inputs: addr -- physical begin address of a video memory page.
 // Outputs: 0 upon success, -1 upon failure.
+// Side effects: Flushes TLB if the mapping changed
 int32_t set_user_vmem_base_addr(uint32_t addr) {
     if (!is_valid_vmem_physical_begin_addr(addr)) {return -1;}
 
     uint32_t pt_idx = GET_4KB_OFFSET_MIDDLE(BEGINNING_USERVID_VIRTUAL_ADDR);
-    user_vmem_page_table[pt_idx].base_addr = GET_20_MSB(addr);
-    flush_tlb();
+    uint32_t flags, garbage;
+    SPIN_LOCK_IRQSAVE(&paging_lock, flags, garbage) {
+        page_table_entry_t* pte = &paging_this_cpu()->user_vmem[pt_idx];
+        if (pte->base_addr != GET_20_MSB(addr)) {
+            pte->base_addr = GET_20_MSB(addr);
+            flush_tlb();
+        }
+    }
     return 0;
 }
 
@@ -455,11 +1192,17 @@ static int32_t is_valid_vmem_physical_begin_addr(uint32_t addr) {
 }
 
 // Function that loads a given process paging state to the CPU and page tables; necessary for the scheduler
+// The state may have been saved on another CPU, whose directories it then names: it gets this CPU's
+// directory of the same kind.
 // Inputs: 
 //      state: state of the paging state to restore
 // Outputs: None
-// Side effects: Activates or deactivates the user video memory, modifies the necessary CR3, and maps the program page if necessary
+// Side effects: Activates or deactivates the user video memory, modifies the necessary CR3, and maps the program page if necessary.
+//      Without a program page, whichever process this CPU ran before may run elsewhere.
 void load_paging_state_to_universe(proc_paging_state_t state) {
+    uint32_t cpu;
+    int32_t is_user_pd = 0;
+    uint32_t flags, garbage;
     if (state.user_vidmem_active) {
         activate_user_vidmem();
     } else {
@@ -468,17 +1211,28 @@ void load_paging_state_to_universe(proc_paging_state_t state) {
     
     if (state.current_mapped_pid) {
         activate_existing_user_programpage(state.current_mapped_pid);
+    } else {
+        SPIN_LOCK_IRQSAVE(&paging_lock, flags, garbage) {
+            set_window_mm(NULL);
+            paging_this_cpu()->state.current_mapped_pid = 0;
+        }
     }
 
+    for (cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (paging_cpus[cpu].user_pd && state.active_pde == paging_cpus[cpu].user_pd) is_user_pd = 1;
+    }
+    state.active_pde = is_user_pd ? get_user_page_directory() : get_kernel_page_directory();
     set_new_cr3((uint32_t)state.active_pde);
-    curr_proc_paging_state = state;
+    SPIN_LOCK_IRQSAVE(&paging_lock, flags, garbage) {
+        paging_this_cpu()->state = state;
+    }
 }
 
 // Function that returns the current paging state that the computer is taking upon
 // Inputs: None
-// Outputs: The paginig state as a struct
+// Outputs: This CPU's paging state as a struct
 proc_paging_state_t current_universe_paging_state() {
-    return curr_proc_paging_state;
+    return paging_this_cpu()->state;
 }
 
 // Gets an initial paging state of a universe for a fresh new PID
@@ -489,6 +1243,103 @@ proc_paging_state_t init_root_proc_paging_state(uint32_t pid) {
     proc_paging_state_t new_state;
     new_state.user_vidmem_active = 0;
     new_state.current_mapped_pid = pid;
-    new_state.active_pde = (page_directory_entry_t*)user_page_descriptor_table;
+    new_state.active_pde = get_user_page_directory();
     return new_state;
 }
+
+// Detects the PAT and, if present, programs it so that the PWT-only entry selects
+// write-combining. Must run before any mapping is configured.
+// Inputs: None
+// Outputs: None
+// Side effects: Writes the IA32_PAT MSR and flushes the caches when the PAT exists.
+//      Without the PAT (or CPUID/MSRs), pat_enabled stays 0 and write-combining
+//      requests fall back to uncacheable in set_pde4mb_memtype/set_pte_memtype.
+void paging_memtype_init() {
+    uint32_t eax, ebx, ecx, edx;
+    pat_enabled = 0;
+    if (!cpu_has_cpuid()) return;
+    cpuid(CPUID_FEATURE_LEAF, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_EDX_MSR) || !(edx & CPUID_EDX_PAT)) return;
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        // Nothing may be cached with a stale type across the PAT change
+        asm volatile ("wbinvd" : : : "memory");
+        wrmsr(IA32_PAT_MSR, PAT_VALUE_LOW, PAT_VALUE_HIGH);
+        asm volatile ("wbinvd" : : : "memory");
+    }
+    pat_enabled = 1;
+}
+
+// Returns whether write-combining through the PAT is available
+// Inputs: None
+// Outputs: 1 if the PAT was programmed, 0 if we are on the fallback types
+int32_t paging_has_pat() {
+    return pat_enabled;
+}
+
+// The memory-type policy: decides how a physical address should be cached
+// Inputs: phys_addr -- any physical address
+// Outputs: MEMTYPE_WC for the VGA window, MEMTYPE_UC for ROM/MMIO holes, MEMTYPE_WB for RAM
+memtype_t get_memtype_for_physical(uint32_t phys_addr) {
+    if (phys_addr >= VGA_WINDOW_BEGIN_ADDR && phys_addr < VGA_WINDOW_END_ADDR) return MEMTYPE_WC;
+    if (phys_addr >= VGA_WINDOW_END_ADDR && phys_addr < LEGACY_ROM_END_ADDR) return MEMTYPE_UC;
+    if (phys_addr >= HIGH_MMIO_BEGIN_ADDR) return MEMTYPE_UC;
+    return MEMTYPE_WB;
+}
+
+// Helper that encodes a memory type as (PAT, PCD, PWT) bits for the current CPU
+// Inputs: type -- requested memory type, pat/pcd/pwt -- bits to fill
+// Outputs: None
+static void encode_memtype(memtype_t type, uint32_t* pat, uint32_t* pcd, uint32_t* pwt) {
+    *pat = 0; // We never use the upper four PAT entries
+    switch (type) {
+    case MEMTYPE_WC:
+        if (pat_enabled) {
+            // PAT entry 1 was reprogrammed to WC
+            *pcd = 0;
+            *pwt = 1;
+            return;
+        }
+        // No PAT: PWT alone would be write-through, which can read stale
+        // framebuffer data. Uncacheable is the safe fallback.
+        *pcd = 1;
+        *pwt = 1;
+        return;
+    case MEMTYPE_UC:
+        *pcd = 1;
+        *pwt = 1;
+        return;
+    case MEMTYPE_WB:
+    default:
+        *pcd = 0;
+        *pwt = 0;
+        return;
+    }
+}
+
+// Sets the caching bits of a PDE pointing to a 4MB page
+// Inputs: pde -- entry to modify, type -- memory type to apply
+// Outputs: None
+// Side effects: Modifies *pde (the caller flushes the TLB if the entry is live)
+void set_pde4mb_memtype(pde_4mb_page_t* pde, memtype_t type) {
+    uint32_t pat, pcd, pwt;
+    if (!pde) return;
+    encode_memtype(type, &pat, &pcd, &pwt);
+    pde->page_table_attr_4mb = pat;
+    pde->cache_disabled_4mb = pcd;
+    pde->writethrough_4mb = pwt;
+}
+
+// Sets the caching bits of a PTE pointing to a 4KB page
+// Inputs: pte -- entry to modify, type -- memory type to apply
+// Outputs: None
+// Side effects: Modifies *pte (the caller flushes the TLB if the entry is live)
+void set_pte_memtype(page_table_entry_t* pte, memtype_t type) {
+    uint32_t pat, pcd, pwt;
+    if (!pte) return;
+    encode_memtype(type, &pat, &pcd, &pwt);
+    pte->page_table_attr = pat;
+    pte->cache_disabled = pcd;
+    pte->writethrough = pwt;
+}
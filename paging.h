@@ -25,6 +25,46 @@
 #define GET_ADDR_FROM_4MB_OFFSET_HIGH(offset) (((offset) & 0x3FF) << 22)
 #define GET_4MB_OFFSET_LOW(addr)  ( (addr) & 0x003FFFFF )
 
+// CPUID leaf 1 EDX feature bits we care about for memory typing
+#define CPUID_FEATURE_LEAF      1
+#define CPUID_EDX_MSR           (1 << 5)
+#define CPUID_EDX_PAT           (1 << 16)
+
+// The PAT MSR holds eight memory types, one byte per entry.
+// A mapping selects entry (PAT << 2 | PCD << 1 | PWT).
+#define IA32_PAT_MSR            0x277
+#define PAT_TYPE_UC             0x00
+#define PAT_TYPE_WC             0x01
+#define PAT_TYPE_WT             0x04
+#define PAT_TYPE_WB             0x06
+#define PAT_TYPE_UC_MINUS       0x07
+// Entry 1 (PWT only) is reprogrammed from WT to WC, everything else keeps its power-on type.
+#define PAT_ENTRY(idx, type)    ((type) << (8 * ((idx) % 4)))
+#define PAT_VALUE_LOW   (PAT_ENTRY(0, PAT_TYPE_WB) | PAT_ENTRY(1, PAT_TYPE_WC) \
+                        | PAT_ENTRY(2, PAT_TYPE_UC_MINUS) | PAT_ENTRY(3, PAT_TYPE_UC))
+#define PAT_VALUE_HIGH  (PAT_ENTRY(4, PAT_TYPE_WB) | PAT_ENTRY(5, PAT_TYPE_WT) \
+                        | PAT_ENTRY(6, PAT_TYPE_UC_MINUS) | PAT_ENTRY(7, PAT_TYPE_UC))
+
+// Physical ranges with a non-RAM memory type
+#define VGA_WINDOW_BEGIN_ADDR   0xA0000
+#define VGA_WINDOW_END_ADDR     0xC0000
+#define LEGACY_ROM_END_ADDR     0x100000
+#define HIGH_MMIO_BEGIN_ADDR    0xFEC00000
+
+// Page fault error code bits
+#define PF_ERR_PRESENT          0x1     // Protection violation rather than a not-present page
+#define PF_ERR_WRITE            0x2
+#define PF_ERR_USER             0x4
+
+// Software bits of a user page table entry. A not-present entry marked swapped holds
+// a compressed swap slot in base_addr instead of a frame (see mm/zswap.c). A present entry
+// marked read-only maps program text, so writing to it is a real fault rather than copy-on-write.
+#define PTE_CUSTOM_SWAPPED      0x1
+#define PTE_CUSTOM_READONLY     0x2
+
+// Tables looked at per paging_huge_idle call when searching for one to promote
+#define HUGE_SCAN_TABLES_PER_IDLE   4
+
 #ifndef ASM
 
 // Union to represent the CR0 register format without using masks.
@@ -136,6 +176,14 @@ typedef union page_directory_entry_t {
         pde_unknown_page_t entry_to_unknown_page;
 } page_directory_entry_t;
 
+// Memory types handed out to mappings. Which PWT/PCD bits encode each one
+// depends on whether the PAT could be programmed, see paging_memtype_init.
+typedef enum memtype_t {
+    MEMTYPE_WB = 0,     // Write-back, for normal RAM
+    MEMTYPE_WC,         // Write-combining, for framebuffers (the VGA text buffers)
+    MEMTYPE_UC          // Uncacheable, for memory-mapped IO
+} memtype_t;
+
 typedef struct page_table_entry_t {
     uint32_t present : 1;
     uint32_t read_write : 1;
@@ -152,8 +200,6 @@ typedef struct page_table_entry_t {
 
 #define TARGET_PROGRAM_LOCATION_VIRTUAL 0x08048000
 
-// Where the userpage starts, from a physical (true) perspective
-#define BEGINNING_USERPAGE_PHYSICAL_ADDR (8 * ONE_MB)
 // Where the userpage starts, from a virtual (user's) perspective
 #define BEGINNING_USERPAGE_VIRTUAL_ADDR (128 * ONE_MB)
 #define BEGINNING_USERVID_VIRTUAL_ADDR 0xC0000
@@ -171,6 +217,28 @@ typedef struct page_table_entry_t {
 #define SIZEOF_PROGRAMPAGE (4 * ONE_MB)
 #define SIZEOF_4KBPAGE (4 * ONE_KB)
 
+// The user window is everything a process can address besides video memory. Each 4MB of it
+// gets its own page table the first time something in it is touched, see handle_user_page_fault.
+//      128MB - 132MB   program image
+//      132MB - 256MB   heap, grown with sbrk
+//      256MB - 376MB   anonymous mmap areas, minus the stack guard page at the very top
+//      376MB - 384MB   stack, backed page by page as it grows down
+#define USER_WINDOW_NUM_TABLES  64
+#define USER_WINDOW_BEGIN_ADDR  BEGINNING_USERPAGE_VIRTUAL_ADDR
+#define USER_WINDOW_END_ADDR    (USER_WINDOW_BEGIN_ADDR + USER_WINDOW_NUM_TABLES * SIZEOF_PROGRAMPAGE)
+#define USER_HEAP_BEGIN_ADDR    (BEGINNING_USERPAGE_VIRTUAL_ADDR + SIZEOF_PROGRAMPAGE)
+#define USER_HEAP_END_ADDR      (256 * ONE_MB)
+#define USER_STACK_MAX_SIZE     (8 * ONE_MB)
+#define USER_STACK_END_ADDR     USER_WINDOW_END_ADDR
+#define USER_STACK_BEGIN_ADDR   (USER_STACK_END_ADDR - USER_STACK_MAX_SIZE)
+// How far below the lowest stack page backed so far a fault may land and still grow the stack,
+// enough for a large frame of locals. Anything further down is a stray pointer.
+#define USER_STACK_GROWTH_GAP   (64 * ONE_KB)
+// Never mapped, so overflowing the stack faults instead of running into an mmap area
+#define USER_STACK_GUARD_ADDR   (USER_STACK_BEGIN_ADDR - SIZEOF_4KBPAGE)
+#define USER_MMAP_BEGIN_ADDR    USER_HEAP_END_ADDR
+#define USER_MMAP_END_ADDR      USER_STACK_GUARD_ADDR
+
 // Don't let our custom vidmap address map to the null page
 STATIC_ASSERT(!(
     BEGINNING_USERVID_VIRTUAL_ADDR >= 0 && 
@@ -203,22 +271,48 @@ extern page_directory_entry_t user_page_descriptor_table[NUM_PAGE_ENTRIES];
 extern page_table_entry_t kernel_vmem_page_table[NUM_PAGE_ENTRIES];             // 4kb
 extern page_table_entry_t user_vmem_page_table[NUM_PAGE_ENTRIES];               // 4kb
 
-#define PAGING_MAX_PID 7
 typedef struct proc_paging_state_t {
     uint8_t user_vidmem_active;
     uint32_t current_mapped_pid;
     page_directory_entry_t* active_pde;
 } proc_paging_state_t;
 
-extern proc_paging_state_t active_paging_state;
 void paging_init(void);
-
+int32_t paging_init_cpu(uint32_t cpu);
+void paging_start_cpu(void);
+page_directory_entry_t* get_kernel_page_directory(void);
+page_directory_entry_t* get_user_page_directory(void);
+
+void paging_memtype_init(void);
+int32_t paging_has_pat(void);
+memtype_t get_memtype_for_physical(uint32_t phys_addr);
+void set_pde4mb_memtype(pde_4mb_page_t* pde, memtype_t type);
+void set_pte_memtype(page_table_entry_t* pte, memtype_t type);
+
+int32_t map_kernel_identity_4mb(uint32_t phys_addr);
+int32_t map_kernel_identity_low_page(uint32_t phys_addr);
 int32_t set_new_cr3(uint32_t new_pd_addr);
 void flush_tlb();
 
+struct user_mm_t;
+
 int32_t destroy_user_programpage(int32_t nth_process);
 int32_t create_new_user_programpage(int32_t nth_process);
+struct user_mm_t* get_user_mm(int32_t pid);
+void put_user_mm(struct user_mm_t* mm);
+int32_t mm_is_active_elsewhere(const struct user_mm_t* mm);
+int32_t handle_user_page_fault(uint32_t fault_addr, uint32_t errcode);
+page_table_entry_t* get_user_pte(int32_t pid, uint32_t addr);
+page_table_entry_t* get_mm_pte(const struct user_mm_t* mm, uint32_t addr);
+int32_t user_window_is_mapped(int32_t pid);
+uint32_t get_cow_break_count(void);
+uint32_t get_page_fault_addr(void);
 int32_t activate_existing_user_programpage(int32_t pid);
+int32_t unmap_user_range(int32_t pid, uint32_t begin, uint32_t end);
+int32_t protect_user_range(int32_t pid, uint32_t begin, uint32_t end);
+int32_t promote_huge_page(int32_t pid, uint32_t table_idx);
+void paging_huge_init(void);
+void paging_huge_idle(void);
 
 int32_t is_unsafe_page_walk(void* addr);
 
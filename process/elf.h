@@ -0,0 +1,56 @@
+#ifndef ELF_H
+#define ELF_H
+
+#include "../types.h"
+
+// The parts of the 32-bit ELF format the program loader uses (see load_executable_into_memory)
+
+#define ELF_IDENT_SIZE      16
+#define ELF_IDENT_CLASS     4
+#define ELF_IDENT_DATA      5
+#define ELF_CLASS_32        1
+#define ELF_DATA_LSB        1
+#define ELF_TYPE_EXEC       2
+#define ELF_MACHINE_386     3
+
+// Program header types and flags
+#define ELF_PT_LOAD         1
+#define ELF_PF_X            0x1
+#define ELF_PF_W            0x2
+#define ELF_PF_R            0x4
+
+// Program headers looked at, more than any of our programs has
+#define ELF_MAX_PHDRS       16
+
+#ifndef ASM
+
+typedef struct elf32_ehdr_t {
+    uint8_t  e_ident[ELF_IDENT_SIZE];
+    uint16_t e_type;
+    uint16_t e_machine;
+    uint32_t e_version;
+    uint32_t e_entry;
+    uint32_t e_phoff;
+    uint32_t e_shoff;
+    uint32_t e_flags;
+    uint16_t e_ehsize;
+    uint16_t e_phentsize;
+    uint16_t e_phnum;
+    uint16_t e_shentsize;
+    uint16_t e_shnum;
+    uint16_t e_shstrndx;
+} __attribute__((packed)) elf32_ehdr_t;
+
+typedef struct elf32_phdr_t {
+    uint32_t p_type;
+    uint32_t p_offset;      // Where the segment's bytes start in the file
+    uint32_t p_vaddr;       // Where they go in memory
+    uint32_t p_paddr;
+    uint32_t p_filesz;      // Bytes in the file
+    uint32_t p_memsz;       // Bytes in memory, the ones past p_filesz are zero (.bss)
+    uint32_t p_flags;
+    uint32_t p_align;
+} __attribute__((packed)) elf32_phdr_t;
+
+#endif /* ASM */
+#endif
@@ -1,10 +1,13 @@
 #include "file.h"
 #include "process.h"
+#include "uaccess.h"
+#include "../mm/kmalloc.h"
 #include "../lib.h"
 #include "../device-drivers/rtc.h"
 #include "../device-drivers/terminal.h"
 #include "../memfs/memfs.h"
 #include "../memfs/fs_interface.h"
+#include "../memfs/kernfs.h"
 
 // Description: Filler function to put into file_operations_t for an unsupported operation (close)
 // Inputs/Outputs: None
@@ -50,10 +53,10 @@ int32_t generic_open(const uint8_t* filename) {
     
     pcb_t* curr_pcb = get_current_pcb();
     if (!curr_pcb) {return -1;}
-    uint8_t* k_filename = (uint8_t*) translate_user_to_kernel(filename, curr_pcb->pid);
-    if (!k_filename) return -1;
-
-    if (strlen((const char*) k_filename) == 0) {return -1;}
+    // One more than the longest name, so names that are too long don't match a truncated one
+    char k_filename[MAX_FILENAME_LENGTH + 2];
+    int32_t length = strncpy_from_user(k_filename, (const char*) filename, sizeof(k_filename));
+    if (length <= 0 || length > MAX_FILENAME_LENGTH) {return -1;}
 
     int32_t new_fd = get_allocatable_fd(curr_pcb);
     if (new_fd == FAIL_FD) {return -1;}
@@ -62,8 +65,17 @@ int32_t generic_open(const uint8_t* filename) {
 
     // open operation for file or directory
     fs_boot_blk_dentry_t temp_dentry;
-    if (read_dentry_by_name((const char*) k_filename, &temp_dentry) == -1) {return -1;}
-    else {
+    int32_t kernfs_id;
+    if (read_dentry_by_name((const char*) k_filename, &temp_dentry) == -1) {
+        // not in the filesystem image, it may be a kernel file
+        kernfs_id = kernfs_lookup((const char*) k_filename);
+        if (kernfs_id == -1) {return -1;}
+        new_fdt->operations = &kernfs_file_ops;
+        new_fdt->context.filetype = FILETYPE_KERN;
+        new_fdt->context.inode = kernfs_id;
+        new_fdt->context.offset = 0;
+        new_fdt->present = 1;
+    } else {
         // asssign different fops based on file type
         if (temp_dentry.filetype == FILETYPE_DIR) {
             new_fdt->operations = &file_system_directory_ops;
@@ -99,7 +111,8 @@ int32_t generic_close(int32_t fd) {
     pcb_t* curr_pcb = get_current_pcb();
     if (!curr_pcb) {return -1;}
 
-    if (curr_pcb->fd_array[fd].present == 0 ||                  // the fdt is not present
+    if (curr_pcb->fd_array == NULL ||                           // the process has no fd array (the root pcb)
+        curr_pcb->fd_array[fd].present == 0 ||                  // the fdt is not present
         curr_pcb->fd_array[fd].operations == NULL ||            // the fdt's operation struct doesn't exist
         curr_pcb->fd_array[fd].operations->close == NULL ||     // the fdt's close operation doesn't exist
         (*curr_pcb->fd_array[fd].operations->close)() == -1     // the close operation failed
@@ -118,21 +131,41 @@ int32_t generic_close(int32_t fd) {
  *         nbytes -- number of bytes to be read.
  *     RETURN VALUE: number of bytes read.
  */
-int32_t generic_read(int32_t fd, uint8_t* k_buf, int32_t nbytes) {
+int32_t generic_read(int32_t fd, uint8_t* buf, int32_t nbytes) {
     // sanity checks
-    if (fd < 0 || fd >= MAX_NUM_FD) {return -1;}
+    if (fd < 0 || fd >= MAX_NUM_FD || nbytes < 0) {return -1;}
+    if (!user_access_ok(buf, nbytes)) {return -1;}
 
     pcb_t* curr_pcb = get_current_pcb();
     if (!curr_pcb) {return -1;}
-    uint8_t* buf = (uint8_t*)translate_user_to_kernel(k_buf, curr_pcb->pid);
-    if (!buf) return -1;
 
-    if (curr_pcb->fd_array[fd].present == 0 ||                  // the fdt is not present
+    if (curr_pcb->fd_array == NULL ||                           // the process has no fd array (the root pcb)
+        curr_pcb->fd_array[fd].present == 0 ||                  // the fdt is not present
         curr_pcb->fd_array[fd].operations == NULL ||            // the fdt's operation struct doesn't exist
         curr_pcb->fd_array[fd].operations->read == NULL         // the fdt's read operation doesn't exist
         ) {return -1;}
 
-    return (*curr_pcb->fd_array[fd].operations->read)(&(curr_pcb->fd_array[fd].context), buf, nbytes);
+    file_descriptor_t* fdt = &(curr_pcb->fd_array[fd]);
+    // Files can be read piece by piece, devices and directories give one answer per read
+    int32_t whole = (fdt->context.filetype == FILETYPE_FILE || fdt->context.filetype == FILETYPE_KERN);
+    uint8_t* chunk = kmalloc(FILE_IO_CHUNK_SIZE);
+    int32_t done = 0, want, got;
+    if (!chunk) {return -1;}
+    do {
+        want = (nbytes - done < FILE_IO_CHUNK_SIZE) ? nbytes - done : FILE_IO_CHUNK_SIZE;
+        got = (*fdt->operations->read)(&(fdt->context), chunk, want);
+        if (got <= 0) {
+            if (done == 0) done = got;
+            break;
+        }
+        if (copy_to_user(buf + done, chunk, got)) {
+            done = -1;
+            break;
+        }
+        done += got;
+    } while (whole && got == want && done < nbytes);
+    kfree(chunk);
+    return done;
 }
 
 /*
@@ -143,21 +176,39 @@ int32_t generic_read(int32_t fd, uint8_t* k_buf, int32_t nbytes) {
  *         nbytes -- number of bytes to be written.
  *     RETURN VALUE: number of bytes written.
  */
-int32_t generic_write(int32_t fd, const uint8_t* k_buf, int32_t nbytes) {
+int32_t generic_write(int32_t fd, const uint8_t* buf, int32_t nbytes) {
     // sanity checks
-    if (fd < 0 || fd >= MAX_NUM_FD) {return -1;}
+    if (fd < 0 || fd >= MAX_NUM_FD || nbytes < 0) {return -1;}
+    if (!user_access_ok(buf, nbytes)) {return -1;}
 
     pcb_t* curr_pcb = get_current_pcb();
     if (!curr_pcb) {return -1;}
-    const uint8_t* buf = (const uint8_t*)translate_user_to_kernel(k_buf, curr_pcb->pid);
-    if (!buf) return -1;
 
-    if (curr_pcb->fd_array[fd].present == 0 ||                  // the fdt is not present
+    if (curr_pcb->fd_array == NULL ||                           // the process has no fd array (the root pcb)
+        curr_pcb->fd_array[fd].present == 0 ||                  // the fdt is not present
         curr_pcb->fd_array[fd].operations == NULL ||            // the fdt's operation struct doesn't exist
         curr_pcb->fd_array[fd].operations->write == NULL        // the fdt's write operation doesn't exist
         ) {return -1;}
 
-    return (*curr_pcb->fd_array[fd].operations->write)(&(curr_pcb->fd_array[fd].context), buf, nbytes);
+    file_descriptor_t* fdt = &(curr_pcb->fd_array[fd]);
+    uint8_t* chunk = kmalloc(FILE_IO_CHUNK_SIZE);
+    int32_t done = 0, want, put;
+    if (!chunk) {return -1;}
+    do {
+        want = (nbytes - done < FILE_IO_CHUNK_SIZE) ? nbytes - done : FILE_IO_CHUNK_SIZE;
+        if (copy_from_user(chunk, buf + done, want)) {
+            done = -1;
+            break;
+        }
+        put = (*fdt->operations->write)(&(fdt->context), chunk, want);
+        if (put <= 0) {
+            if (done == 0) done = put;
+            break;
+        }
+        done += put;
+    } while (put == want && done < nbytes);
+    kfree(chunk);
+    return done;
 }
 
 /*
@@ -170,6 +221,7 @@ int32_t generic_write(int32_t fd, const uint8_t* k_buf, int32_t nbytes) {
 static int32_t get_allocatable_fd(pcb_t* pcb) {
     int32_t ret_fd = FAIL_FD;
     int32_t i;
+    if (!pcb->fd_array) {return FAIL_FD;}
     for (i = 2; i < MAX_NUM_FD; i++) {
         if (pcb->fd_array[i].present) {continue;}
         ret_fd = i;
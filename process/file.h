@@ -7,7 +7,10 @@
 #define FILETYPE_DEV    0
 #define FILETYPE_DIR    1
 #define FILETYPE_FILE   2
+#define FILETYPE_KERN   3
 #define FILETYPE_UNKOWN 0xFFFFFFFF
+// Bytes moved between user memory and a file operation at a time
+#define FILE_IO_CHUNK_SIZE 1024
 #define STDIN_FD 0
 #define STDOUT_FD 1
 
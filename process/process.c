@@ -6,29 +6,58 @@
 #include "process.h"
 #include "../common.h"
 #include "../sched/sched.h"
+#include "../mm/kmalloc.h"
+#include "../mm/vma.h"
+#include "elf.h"
+#include "../memfs/kernfs.h"
+#include "../sched/spinlock.h"
+#include "../sched/smp.h"
+#include "../sched/kernel_lock.h"
+#include "../mm/frame.h"
+#include "uaccess.h"
 
 /* file-scope variables */
 static uint32_t current_pid;
 static int process_counter;
+static kmem_cache_t* fd_array_cache;
+static kmem_cache_t* pcb_cache;
 pcb_t root_pcb;
+// The application processors' idle tasks, see process_allocate_idle. Like the root pcb, which is
+// the boot processor's, they're all PID 0: get_pcb(0) is the one of the CPU asking.
+static pcb_t ap_idle_pcbs[SMP_MAX_CPUS];
+// PID -> PCB, NULL for unused PIDs. pid_map[0] is the root pcb.
+static pcb_t* pid_map[MAX_NUM_PROCESS + 1];
+// Stack of unused PIDs, so allocating and freeing a PID is O(1)
+static uint32_t free_pids[MAX_NUM_PROCESS];
+static uint32_t num_free_pids;
+// Freed PCBs whose kernel stacks may still be in use, see process_free
+static pcb_t* zombie_list;
+// Protects process_counter, free_pids, zombie_list and writes to pid_map. Reading pid_map
+// (see get_pcb) needs no lock, a PCB stays around as a zombie for a while after it's taken out.
+static ticket_lock_t pid_lock;
+static lock_stats_t pid_lock_stats;
 
 /* file-scope functions */
 static uint32_t get_allocatable_pid();
+static void reap_zombies();
+static int32_t zombie_stack_in_use(const pcb_t* zombie);
+static void memstat_show(kernfs_buf_t* out);
+static int32_t load_segment(executability_result_t exec_info, const elf32_phdr_t* ph, uint8_t* buf);
+static int32_t page_is_in_writable_segment(const elf32_phdr_t* phdrs, uint32_t count, uint32_t page);
 
 // Translates a userspace address to an address for the kernel to use
+// The user window is mapped at the same address in the kernel's page directory
+// (see activate_existing_user_programpage), so this is a range check rather than arithmetic.
 // Inputs:
 //      user_addr: Address to translate
-//      nth_process: PID of the process
+//      nth_process: PID of the process, which must be the one whose user window is mapped
 // Outputs: Address translated to kernelspace, NULL if the address is out-of-bounds by the user
 void* translate_user_to_kernel(const void* user_addr, uint32_t pid) {
     uint32_t value = (uint32_t)user_addr;
-    if (value >= BEGINNING_USERPAGE_VIRTUAL_ADDR && 
-                value < BEGINNING_USERPAGE_VIRTUAL_ADDR + SIZEOF_PROGRAMPAGE) {
-        uint32_t kern_value = value
-                - BEGINNING_USERPAGE_VIRTUAL_ADDR
-                + BEGINNING_USERPAGE_PHYSICAL_ADDR
-                + (pid - 1) * SIZEOF_PROGRAMPAGE;
-        return (void*)kern_value;
+    pcb_t* pcb = get_pcb(pid);
+    if (!pcb || !user_window_is_mapped(pid)) return 0;
+    if (mm_addr_is_valid(pcb->mm, value)) {
+        return (void*)value;
     } else {
         return 0;
     }
@@ -37,20 +66,11 @@ void* translate_user_to_kernel(const void* user_addr, uint32_t pid) {
 // Translates a kernel address to an address for a user with PID nth_process
 // Inputs:
 //      kern_addr: Address to translate
-//      nth_process: PID of the process
+//      nth_process: PID of the process, which must be the one whose program window is mapped
 // Outputs: Address translated to userspace, NULL if the address is out-of-bounds by the user
 void* translate_kernel_to_user(const void* kern_addr, uint32_t pid) {
-    uint32_t value = (uint32_t)kern_addr;
-    const uint32_t USER_PROGMEM_PHYS_START = BEGINNING_USERPAGE_PHYSICAL_ADDR + (pid - 1) * SIZEOF_PROGRAMPAGE;
-    if (value >= USER_PROGMEM_PHYS_START && value < USER_PROGMEM_PHYS_START + SIZEOF_PROGRAMPAGE) {
-        uint32_t user_value = value
-            - (pid - 1) * SIZEOF_PROGRAMPAGE
-            - BEGINNING_USERPAGE_PHYSICAL_ADDR
-            + BEGINNING_USERPAGE_VIRTUAL_ADDR;
-        return (void*)user_value;
-    } else {
-        return 0;
-    }
+    // Both views of the user window are the same
+    return translate_user_to_kernel(kern_addr, pid);
 }
 
 // Sets the only necessary parameters for the TSS
@@ -58,54 +78,123 @@ void* translate_kernel_to_user(const void* kern_addr, uint32_t pid) {
 // Outputs: None
 // Side effects: Loads the TSS with the new_ss0 and new_esp0 for privileged context switch
 void update_tss_for_new_stack(uint16_t new_ss0, uint32_t new_esp0) {
-    tss.ss0 = new_ss0;
-    tss.esp0 = new_esp0;
+    tss_t* cpu_tss = smp_tss();
+    cpu_tss->ss0 = new_ss0;
+    cpu_tss->esp0 = new_esp0;
 }
 
-// Returns the address for the kernel stack area for the process,
-// which includes the address of the PCB
+// Returns the address for the kernel stack area for the process
 // Inputs: PID
-// Outputs: Address of the process control area if the PID is valid, 0 else
+// Outputs: Address of the process's kernel stack if the PID is valid, 0 else (including PID 0)
 // Side effects, none
 proc_area_t* get_process_area_address(uint32_t pid) {
-    // With (pid) - 0;
-    //      PID=1's stack ends at 8MB
-    // With (pid) - 1:
-    //      PID=1's stack ends at 8MB - 8KB
-    return (proc_area_t*)(BEGINNING_USERPAGE_PHYSICAL_ADDR) - (pid) - 1; // Add some padding 
-}
-
-proc_page_t* get_process_page_address(uint32_t pid) {
-    return (proc_page_t*)(BEGINNING_USERPAGE_PHYSICAL_ADDR) + pid - 1;
+    pcb_t* pcb = get_pcb(pid);
+    if (!pcb) return NULL;
+    return pcb->kstack;
 }
 // Loads the executable into memory for a specific process
+// Only the PT_LOAD segments are read, each to the address it asks for. Their .bss is left to
+// be zero-filled on first touch, and pages of segments that aren't writable become read-only
+// unless a writable segment shares them.
 // Inputs:
 //      exec_info: Information about the executable
-//      nth_process: PID of the process
+//      nth_process: PID of the process, which must be the one whose user window is mapped
 // Outputs:
-//      -1 if there was an error in loading to memory
+//      -1 if there was an error in loading to memory (including running out of memory for its pages)
 //      0 otherwise
 // Side effects:
 //      Loads the executable described by the exec_info struct into the proper memory location
 int32_t load_executable_into_memory(executability_result_t exec_info, uint32_t pid) {
-    uint8_t* prog_image_target_addr = (uint8_t*)(
-        translate_user_to_kernel((void*)TARGET_PROGRAM_LOCATION_VIRTUAL, pid)
-    );
+    elf32_phdr_t phdrs[ELF_MAX_PHDRS];
+    uint32_t i, page, run, begin, end, copied = 0;
+    uint32_t entry = get_user_eip(exec_info);
+    int32_t entry_ok = 0;
+    uint8_t* buf;
+    pcb_t* pcb = get_pcb(pid);
 
-    if (!prog_image_target_addr) return -1;
-    
-    if (!exec_info.is_executable) return -1;
+    if (!exec_info.is_executable || exec_info.phdr_count > ELF_MAX_PHDRS) return -1;
+    if (!pcb || !pcb->mm || !user_window_is_mapped(pid)) return -1;
+    if (exec_info.phdr_count * sizeof(elf32_phdr_t) !=
+        read_data(exec_info.exec_inode, exec_info.phdr_offset, (uint8_t*)phdrs, exec_info.phdr_count * sizeof(elf32_phdr_t))) {
+            printf("Unable to read program headers!\n");
+            return -1;
+        }
 
-    if (exec_info.exec_file_length !=
-        read_data(exec_info.exec_inode, 0, prog_image_target_addr, exec_info.exec_file_length)) {
+    // Check every segment before anything is copied
+    for (i = 0; i < exec_info.phdr_count; i++) {
+        elf32_phdr_t* ph = &phdrs[i];
+        if (ph->p_type != ELF_PT_LOAD) continue;
+        if (ph->p_filesz > ph->p_memsz || ph->p_offset > exec_info.exec_file_length
+            || ph->p_filesz > exec_info.exec_file_length - ph->p_offset) return -1;
+        // Everything has to fit in the program page, the heap starts right after it
+        if (ph->p_vaddr < BEGINNING_USERPAGE_VIRTUAL_ADDR || ph->p_memsz > SIZEOF_PROGRAMPAGE
+            || ph->p_vaddr - BEGINNING_USERPAGE_VIRTUAL_ADDR > SIZEOF_PROGRAMPAGE - ph->p_memsz) return -1;
+        if ((ph->p_flags & ELF_PF_X) && entry >= ph->p_vaddr && entry - ph->p_vaddr < ph->p_memsz) entry_ok = 1;
+    }
+    if (!entry_ok) {
+        printf("Entry point isn't in an executable segment!\n");
+        return -1;
+    }
+
+    // The file is read into a kernel buffer and copied out from there, so a page that can't be
+    // backed fails the load instead of faulting in the kernel
+    buf = (uint8_t*)frame_alloc();
+    if (!buf) return -1;
+    for (i = 0; i < exec_info.phdr_count; i++) {
+        elf32_phdr_t* ph = &phdrs[i];
+        if (ph->p_type != ELF_PT_LOAD || ph->p_filesz == 0) continue;
+        if (load_segment(exec_info, ph, buf)) {
             printf("Unable to copy to memory!\n");
+            frame_free((uint32_t)buf);
             return -1;
         }
+        copied += (PAGE_ALIGN_UP(ph->p_vaddr + ph->p_filesz) - PAGE_ALIGN_DOWN(ph->p_vaddr)) / SIZEOF_4KBPAGE;
+    }
+    frame_free((uint32_t)buf);
+
+    // Protect the pages of read-only segments, in runs between the pages a writable segment shares
+    for (i = 0; i < exec_info.phdr_count; i++) {
+        if (phdrs[i].p_type != ELF_PT_LOAD || (phdrs[i].p_flags & ELF_PF_W) || phdrs[i].p_filesz == 0) continue;
+        begin = PAGE_ALIGN_DOWN(phdrs[i].p_vaddr);
+        end = PAGE_ALIGN_UP(phdrs[i].p_vaddr + phdrs[i].p_filesz);
+        for (run = page = begin; page <= end; page += SIZEOF_4KBPAGE) {
+            if (page < end && !page_is_in_writable_segment(phdrs, exec_info.phdr_count, page)) continue;
+            if (run < page) protect_user_range(pid, run, page);
+            run = page + SIZEOF_4KBPAGE;
+        }
+    }
 
-    // Sanity Check
-    if (*(uint32_t*)(exec_info.start_eip) != *(uint32_t*)(prog_image_target_addr + EXEC_START_EIP_OFFSET)) {
-        printf("Sanity check failed, extracted EIP and copied program image are not equal! \n");
-        return -1;
+    pcb->mem_stats.exec_pages_copied = copied;
+    return 0;
+}
+
+// Copies a segment's bytes from the file to where it goes, and zeroes the rest of its last page
+// Inputs: exec_info -- the executable, ph -- a PT_LOAD segment checked by load_executable_into_memory,
+//      buf -- a kernel buffer of FRAME_SIZE bytes
+// Outputs: 0 on success, -1 if the file couldn't be read or a page couldn't be backed
+static int32_t load_segment(executability_result_t exec_info, const elf32_phdr_t* ph, uint8_t* buf) {
+    uint32_t done, chunk, end;
+    for (done = 0; done < ph->p_filesz; done += chunk) {
+        chunk = ph->p_filesz - done < FRAME_SIZE ? ph->p_filesz - done : FRAME_SIZE;
+        if (read_data(exec_info.exec_inode, ph->p_offset + done, buf, chunk) != chunk) return -1;
+        if (copy_to_user((void*)(ph->p_vaddr + done), buf, chunk)) return -1;
+    }
+    // The pages after this one are fresh, but this one may hold another segment's bytes
+    end = PAGE_ALIGN_UP(ph->p_vaddr + ph->p_filesz);
+    if (end > ph->p_vaddr + ph->p_memsz) end = ph->p_vaddr + ph->p_memsz;
+    memset(buf, 0, end - (ph->p_vaddr + ph->p_filesz));
+    return copy_to_user((void*)(ph->p_vaddr + ph->p_filesz), buf, end - (ph->p_vaddr + ph->p_filesz));
+}
+
+// Checks whether a writable segment has any of its bytes in a page
+// Inputs: phdrs -- the program headers, count -- how many, page -- page aligned user address
+// Outputs: 1 if one does, 0 otherwise
+static int32_t page_is_in_writable_segment(const elf32_phdr_t* phdrs, uint32_t count, uint32_t page) {
+    uint32_t i;
+    for (i = 0; i < count; i++) {
+        const elf32_phdr_t* ph = &phdrs[i];
+        if (ph->p_type != ELF_PT_LOAD || !(ph->p_flags & ELF_PF_W) || ph->p_memsz == 0) continue;
+        if (PAGE_ALIGN_DOWN(ph->p_vaddr) <= page && PAGE_ALIGN_UP(ph->p_vaddr + ph->p_memsz) > page) return 1;
     }
     return 0;
 }
@@ -118,22 +207,32 @@ int32_t load_executable_into_memory(executability_result_t exec_info, uint32_t p
  *     RETURN VALUE: none
  */
 void process_init() {
-    int i;
+    uint32_t i;
 
     // initialize file scope variables
     current_pid = 0; // Make true PIDs start at 1
     process_counter = 0;
-
-    // set all user pcbs as inactivated
-    for (i = 1; i <= MAX_NUM_PROCESS; i++) {
-        pcb_t* curr_pcb = get_pcb(i);
-        curr_pcb->pid = (uint32_t) i;
-        curr_pcb->present = 0;
-    }
+    zombie_list = NULL;
+    lock_stats_init(&pid_lock_stats, "pid");
+    ticket_lock_init(&pid_lock, &pid_lock_stats);
+    if (!fd_array_cache) fd_array_cache = kmem_cache_create("fd_array", MAX_NUM_FD * sizeof(file_descriptor_t));
+    if (!pcb_cache) pcb_cache = kmem_cache_create("pcb", sizeof(pcb_t));
+    kernfs_register("memstat", memstat_show, NULL);
+
+    // no user pcbs exist yet; hand out low PIDs first so the root shells get 1..NUM_SIMULTANEOUS_PROCS
+    for (i = 1; i <= MAX_NUM_PROCESS; i++) pid_map[i] = NULL;
+    for (i = 0; i < MAX_NUM_PROCESS; i++) free_pids[i] = MAX_NUM_PROCESS - i;
+    num_free_pids = MAX_NUM_PROCESS;
 
     // Initialize the root PCB
     root_pcb.pid = 0;
     root_pcb.present = 1;
+    root_pcb.fd_array = NULL;
+    root_pcb.kstack = NULL;
+    root_pcb.mm = NULL;
+    root_pcb.tgid = 0;
+    memset(&root_pcb.mem_stats, 0, sizeof(root_pcb.mem_stats));
+    pid_map[0] = &root_pcb;
 }
 
 /*
@@ -144,29 +243,124 @@ void process_init() {
  */
 pcb_t* process_allocate(uint32_t parent) {
     // sanity checks
-    if (process_counter > MAX_NUM_PROCESS) {return NULL;}
+    if (process_counter >= MAX_NUM_PROCESS) {return NULL;}
 
-    // allocate a new pcb
-    uint32_t new_pid = get_allocatable_pid();
-    if (new_pid > MAX_NUM_PROCESS) {return NULL;}
+    reap_zombies();
 
-    pcb_t* new_pcb;
-    new_pcb = get_pcb(new_pid);
-    if (!new_pcb) {return NULL;}
+    // allocate the pcb, its kernel stack and its fd array
+    pcb_t* new_pcb = kmem_cache_zalloc(pcb_cache);
+    proc_area_t* new_kstack = (proc_area_t*)frame_alloc_contig(PROC_AREA_SIZE / FRAME_SIZE, PROC_AREA_SIZE / FRAME_SIZE);
+    file_descriptor_t* new_fd_array = kmem_cache_alloc(fd_array_cache);
+    uint32_t new_pid = FAIL_PID;
 
-    // initialize the new pcb
     uint32_t flags, garbage;
-    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
-        initialize_fd_array(new_pcb->fd_array);
-        new_pcb->present = 1;
-        new_pcb->parent_pid = parent;
-        new_pcb->flag_activated_vidmap = 0;
+    TICKET_LOCK_IRQSAVE(&pid_lock, flags, garbage) {
+        if (new_pcb && new_kstack && new_fd_array) new_pid = get_allocatable_pid();
+    }
+
+    if (new_pid == FAIL_PID) {
+        // out of memory or PIDs, undo whatever did get allocated
+        kmem_cache_free(pcb_cache, new_pcb);
+        if (new_kstack) frame_free_contig((uint32_t)new_kstack, PROC_AREA_SIZE / FRAME_SIZE);
+        kmem_cache_free(fd_array_cache, new_fd_array);
+        return NULL;
+    }
+
+    // initialize the new pcb; nobody can find it before it's in pid_map
+    new_kstack->magic = KSTACK_MAGIC;
+    new_kstack->owner = new_pcb;
+    new_pcb->kstack = new_kstack;
+    new_pcb->pid = new_pid;
+    new_pcb->fd_array = new_fd_array;
+    initialize_fd_array(new_pcb->fd_array);
+    new_pcb->present = 1;
+    new_pcb->parent_pid = parent;
+    new_pcb->flag_activated_vidmap = 0;
+    new_pcb->mm = NULL;
+    new_pcb->tgid = new_pid;
+    new_pcb->cpu = smp_cpu_id();
+    TICKET_LOCK_IRQSAVE(&pid_lock, flags, garbage) {
+        pid_map[new_pid] = new_pcb;
+        process_counter++;
+    }
+    return new_pcb;
+}
+
+/*
+ * process_allocate_thread
+ *     DESCRIPTION: Allocate a pcb and kernel stack for a new thread of a process. The thread
+ *                  shares the leader's address space and fd array; it joins the group (and
+ *                  the run queue) once thread_start links it in.
+ *     INPUTS: leader -- thread group leader
+ *     RETURN VALUE: pointer to the new pcb upon success, NULL upon failure.
+ */
+pcb_t* process_allocate_thread(pcb_t* leader) {
+    if (!leader || !leader->mm || process_counter >= MAX_NUM_PROCESS) {return NULL;}
+
+    reap_zombies();
+
+    pcb_t* new_pcb = kmem_cache_zalloc(pcb_cache);
+    proc_area_t* new_kstack = (proc_area_t*)frame_alloc_contig(PROC_AREA_SIZE / FRAME_SIZE, PROC_AREA_SIZE / FRAME_SIZE);
+    uint32_t new_pid = FAIL_PID;
+
+    uint32_t flags, garbage;
+    TICKET_LOCK_IRQSAVE(&pid_lock, flags, garbage) {
+        if (new_pcb && new_kstack) new_pid = get_allocatable_pid();
+    }
+
+    if (new_pid == FAIL_PID) {
+        kmem_cache_free(pcb_cache, new_pcb);
+        if (new_kstack) frame_free_contig((uint32_t)new_kstack, PROC_AREA_SIZE / FRAME_SIZE);
+        return NULL;
+    }
+
+    new_kstack->magic = KSTACK_MAGIC;
+    new_kstack->owner = new_pcb;
+    new_pcb->kstack = new_kstack;
+    new_pcb->pid = new_pid;
+    new_pcb->fd_array = leader->fd_array;
+    new_pcb->present = 1;
+    // Resolves to the same terminal as the leader, see get_canonical_pid
+    new_pcb->parent_pid = leader->pid;
+    new_pcb->mm = leader->mm;
+    new_pcb->tgid = leader->pid;
+    // Only one CPU at a time runs a process's threads anyway (see sched_wait_for_mm)
+    new_pcb->cpu = leader->cpu;
+    new_pcb->start_exec_info = leader->start_exec_info;
+    memcpy(new_pcb->argument, leader->argument, sizeof(new_pcb->argument));
+    TICKET_LOCK_IRQSAVE(&pid_lock, flags, garbage) {
+        pid_map[new_pid] = new_pcb;
         process_counter++;
     }
-    
     return new_pcb;
 }
 
+/*
+ * process_allocate_idle
+ *     DESCRIPTION: Set up an application processor's idle task, the one it runs whenever it
+ *                  has nothing else (see sched_idle). It gets a kernel stack like any task,
+ *                  which the CPU starts out on.
+ *     INPUTS: cpu -- the application processor's number
+ *     RETURN VALUE: top of its kernel stack upon success, 0 upon failure.
+ */
+uint32_t process_allocate_idle(uint32_t cpu) {
+    if (!cpu || cpu >= SMP_MAX_CPUS) {return 0;}
+
+    proc_area_t* new_kstack = (proc_area_t*)frame_alloc_contig(PROC_AREA_SIZE / FRAME_SIZE, PROC_AREA_SIZE / FRAME_SIZE);
+    if (!new_kstack) {return 0;}
+
+    pcb_t* idle_pcb = &ap_idle_pcbs[cpu];
+    memset(idle_pcb, 0, sizeof(*idle_pcb));
+    new_kstack->magic = KSTACK_MAGIC;
+    new_kstack->owner = idle_pcb;
+    idle_pcb->kstack = new_kstack;
+    idle_pcb->pid = 0;
+    idle_pcb->present = 1;
+    idle_pcb->tgid = 0;
+    idle_pcb->cpu = cpu;
+    return (uint32_t)&(new_kstack->lowest_stack_elem);
+}
+
 /*
  * process_free
  *     DESCRIPTION: Close/clear the pcb indexed by the input pid.
@@ -183,17 +377,98 @@ int process_free(uint32_t pid) {
 
     uint32_t parent = curr_pcb->parent_pid;
     // free the pcb of the current process
+    // The caller is usually still running on this process's kernel stack, so the pcb and
+    // stack only go on the zombie list here; reap_zombies frees them on a later allocation
+    // once this CPU is done with them.
     uint32_t flags, garbage;
     CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        // Gone tasks don't get another turn, nor wait for anything. The run and wait queues
+        // are still only safe with interrupts off.
+        sched_remove(pid);
+        wait_queue_remove(curr_pcb);
+        timer_cancel(&curr_pcb->timeout);
+        curr_pcb->blocked = 0;
         curr_pcb->present = 0;
         curr_pcb->flag_activated_vidmap = 0;
-        close_pid_fds(pid);
+        // A thread's fd array and address space are the leader's
+        if (curr_pcb->tgid == pid) {
+            close_pid_fds(pid);
+            kmem_cache_free(fd_array_cache, curr_pcb->fd_array);
+        } else {
+            curr_pcb->mm = NULL;
+        }
+        curr_pcb->fd_array = NULL;
+    }
+    TICKET_LOCK_IRQSAVE(&pid_lock, flags, garbage) {
+        pid_map[pid] = NULL;
+        free_pids[num_free_pids++] = pid;
+        curr_pcb->next_zombie = zombie_list;
+        zombie_list = curr_pcb;
+        curr_pcb->freed_on_cpu = smp_cpu_id();
+        curr_pcb->freed_at_entry = kernel_lock_entries[curr_pcb->freed_on_cpu];
         process_counter--;
     }
 
     return parent;
 }
 
+/*
+ * reap_zombies
+ *     DESCRIPTION: Free the pcbs and kernel stacks of processes that went through
+ *                  process_free and whose stacks are no longer in use (see
+ *                  zombie_stack_in_use). The others stay on the zombie list.
+ *     INPUTS: none
+ *     RETURN VALUE: none
+ */
+static void reap_zombies() {
+    pcb_t* zombies;
+    pcb_t* in_use = NULL;
+    pcb_t* in_use_tail = NULL;
+    uint32_t flags, garbage;
+    TICKET_LOCK_IRQSAVE(&pid_lock, flags, garbage) {
+        zombies = zombie_list;
+        zombie_list = NULL;
+    }
+    while (zombies) {
+        pcb_t* next = zombies->next_zombie;
+        if (zombie_stack_in_use(zombies)) {
+            zombies->next_zombie = in_use;
+            in_use = zombies;
+            if (!in_use_tail) in_use_tail = zombies;
+        } else {
+            zombies->kstack->magic = 0;
+            zombies->kstack->owner = NULL;
+            frame_free_contig((uint32_t)zombies->kstack, PROC_AREA_SIZE / FRAME_SIZE);
+            kmem_cache_free(pcb_cache, zombies);
+        }
+        zombies = next;
+    }
+    if (in_use) {
+        TICKET_LOCK_IRQSAVE(&pid_lock, flags, garbage) {
+            in_use_tail->next_zombie = zombie_list;
+            zombie_list = in_use;
+        }
+    }
+}
+
+/*
+ * zombie_stack_in_use
+ *     DESCRIPTION: Check whether a zombie's kernel stack may still be in use. Halting and
+ *                  killing a process both finish by leaving its kernel stack with interrupts
+ *                  off, but on the way to user mode that's after the kernel lock is let go.
+ *                  Once the CPU that freed it came back into the kernel, it's done with the
+ *                  stack; before that, only that CPU itself can tell by where it runs.
+ *     INPUTS: zombie -- a pcb on the zombie list
+ *     RETURN VALUE: 1 if the stack may still be in use, 0 if not.
+ */
+static int32_t zombie_stack_in_use(const pcb_t* zombie) {
+    uint32_t esp;
+    if (kernel_lock_entries[zombie->freed_on_cpu] != zombie->freed_at_entry) {return 0;}
+    if (zombie->freed_on_cpu != smp_cpu_id()) {return 1;}
+    asm volatile ("movl %%esp, %0" : "=r"(esp));
+    return (esp & ~(PROC_AREA_SIZE - 1)) == (uint32_t)zombie->kstack;
+}
+
 /*
  * get_current_pcb
  *     DESCRIPTION: Get the pointer to the current running process's pcb.
@@ -218,33 +493,24 @@ uint32_t get_current_pid() {
 
 /*
  * get_allocatable_pid
- *     DESCRIPTION: Iterate through all reserved memory blocks for pcb, return an
- *                  index (pid) to an available block if any.
+ *     DESCRIPTION: Pop an unused pid off the free pid stack. Call with pid_lock held.
  *     INPUTS: none
  *     RETURN VALUE: valid pid upon success, FAIL_PID upon failure.
  */
 static uint32_t get_allocatable_pid() {
-    uint32_t ret_pid = FAIL_PID;
-    uint32_t i;
-    for (i = 0; i <= MAX_NUM_PROCESS; i++) {
-        pcb_t* curr_pcb = get_pcb(i);
-        if (!curr_pcb) {return FAIL_PID;}       // null check failed
-        if (curr_pcb->present) {continue;}      // current pcb occupied
-        ret_pid = i;
-        break;
-    }
-    return ret_pid;
+    if (!num_free_pids) {return FAIL_PID;}
+    return free_pids[--num_free_pids];
 }
 
 // Returns the address for the pcb for the process,
 // Inputs: PID
-// Outputs: Address of the process control block if the PID is valid, 0 else
+// Outputs: Address of the process control block if the PID is in use, 0 else
 // Side effects, none
 
 pcb_t* get_pcb(uint32_t pid) {
     if (pid > MAX_NUM_PROCESS) {return NULL;}
-    // The top of the process area holds the PCB, so we can just pointer cast this
-    else if (pid) return (pcb_t*) (get_process_area_address(pid));
+    else if (pid) return pid_map[pid];
+    else if (smp_cpu_id()) return &ap_idle_pcbs[smp_cpu_id()];
     else return &root_pcb; // PID = 0 means we are at the root PCB
 }
 
@@ -324,7 +590,10 @@ int32_t initialize_kstack_context(
 // Outputs: Address to the stack position
 // Notes: While other people use math directly in the form of macros, we use structs. Null checks are unnecessary, because we're not accessing memory.
 uint32_t get_initial_esp0_of_process(uint32_t pid) {
-    return (uint32_t)&(get_process_area_address(pid)->lowest_stack_elem);
+    proc_area_t* kstack = get_process_area_address(pid);
+    // PID 0 lives on the boot stack, right below the end of the kernel page
+    if (!kstack) return KERNEL_END_ADDR - sizeof(uint32_t);
+    return (uint32_t)&(kstack->lowest_stack_elem);
 }
 
 // Get the initial ESP of a new user process
@@ -333,9 +602,9 @@ uint32_t get_initial_esp0_of_process(uint32_t pid) {
 // Outputs: ESP address of the process
 // Notes: See the get_initial_esp0_of_process
 uint32_t get_initial_esp_of_process(uint32_t pid) {
-    return (uint32_t)(
-        translate_kernel_to_user(&(get_process_page_address(pid)->lowest_user_stack_elem), pid)
-    );
+    (void)pid; // Every process has the same layout in its own user window
+    // Leave the topmost word alone, like the old stack at the top of the program page did
+    return USER_STACK_END_ADDR - 2 * sizeof(uint32_t);
 }
 
 // Function to return whether the PID represents the kernel
@@ -355,12 +624,31 @@ int is_root_pid(uint32_t pid) {
 }
 
 
+// Function to return whether the PID is a thread rather than a process (or its main thread)
+// Inputs: PID
+// Outputs: Truthy value if the PID belongs to a thread created by thread_start
+int is_thread_pid(uint32_t pid) {
+    pcb_t* pcb = get_pcb(pid);
+    return pcb && pcb->tgid != pid;
+}
+
+// Finds the process a thread belongs to, which is where per-process state like mem_stats is kept
+// Inputs: PID of a process or one of its threads
+// Outputs: The thread group leader's PCB, NULL if there's no such PID
+pcb_t* get_thread_leader(uint32_t pid) {
+    pcb_t* pcb = get_pcb(pid);
+    if (!pcb) return NULL;
+    return get_pcb(pcb->tgid);
+}
+
 // Inputs: A number that is like an ESP address
-// Outputs: PID mathematically derived from the ESP address
+// Outputs: PID of the owner of the kernel stack containing the address, 0 if it's not a process kernel stack
 uint32_t derive_pid_from_esplike(uint32_t num) {
-    const uint32_t nth_bit_set = 13; // Calculated with the hex value representation of 8KB
-    uint32_t offset_start = (KERN_BEGIN_ADDR + SIZEOF_PROGRAMPAGE - 1) >> nth_bit_set;
-    return offset_start - (num >> nth_bit_set);
+    proc_area_t* area = (proc_area_t*)(num & ~(PROC_AREA_SIZE - 1));
+    // Kernel stacks only ever come from the frame pool; anything else is the boot stack (PID 0)
+    if ((uint32_t)area < frame_pool_begin() || (uint32_t)area >= frame_pool_end()) return 0;
+    if (area->magic != KSTACK_MAGIC || !area->owner) return 0;
+    return area->owner->pid;
 }
 
 // Linux does something like this, we can do something like this too!
@@ -382,7 +670,7 @@ uint32_t derive_pid_from_esp() {
 // Inputs: None
 // Outputs: PID as the tss tell sus
 int32_t derive_pid_from_tss() {
-    return derive_pid_from_esplike(tss.esp0);
+    return derive_pid_from_esplike(smp_tss()->esp0);
 }
 
 // Identify the ultimate parent of a given PID
@@ -407,6 +695,7 @@ void close_pid_fds(uint32_t pid) {
     pcb_t* curr_pcb = get_pcb(pid);
     PRINT_ASSERT(curr_pcb != NULL, "Cannot close the FDs of PID %d!\n", pid);
     int i;
+    if (!curr_pcb->fd_array) return;
     // Ignore STDOUT and STDIN
     for (i = STDOUT_FD + 1; i < MAX_NUM_FD; i++) {
         if (curr_pcb->fd_array[i].present) {
@@ -414,3 +703,30 @@ void close_pid_fds(uint32_t pid) {
         }
     }
 }
+
+// Prints one line per user process: resident and virtual size, faults, and pages loaded by exec
+// Inputs: out -- buffer to print into
+// Outputs: None
+static void memstat_show(kernfs_buf_t* out) {
+    uint32_t pid;
+    pcb_t* pcb;
+    user_mm_t* mm;
+    kernfs_puts(out, "pid   rss_kb vsize_kb   minflt   majflt exec_pages\n");
+    for (pid = 1; pid <= MAX_NUM_PROCESS; pid++) {
+        uint32_t flags, garbage;
+        if (is_thread_pid(pid) || !(mm = get_user_mm(pid))) continue;
+        SPIN_LOCK_IRQSAVE(&mm->lock, flags, garbage) {
+            pcb = get_pcb(pid);
+            if (pcb) {
+                kernfs_putu(out, pid, 3);
+                kernfs_putu(out, pcb->mem_stats.resident_pages * (SIZEOF_4KBPAGE / ONE_KB), 9);
+                kernfs_putu(out, mm_virtual_size(mm) / ONE_KB, 9);
+                kernfs_putu(out, pcb->mem_stats.minor_faults, 9);
+                kernfs_putu(out, pcb->mem_stats.major_faults, 9);
+                kernfs_putu(out, pcb->mem_stats.exec_pages_copied, 11);
+                kernfs_putc(out, '\n');
+            }
+        }
+        put_user_mm(mm);
+    }
+}
@@ -8,13 +8,19 @@
 #include "../paging.h"
 #include "file.h"
 #include "../device-drivers/keyboard.h"
+#include "../sched/wait.h"
+#include "../sched/timer.h"
+#include "../sched/acct.h"
 
 #define FAIL_PID        ((uint32_t)-1)
-#define MAX_NUM_PROCESS 6
+// PIDs run from 1 to MAX_NUM_PROCESS. PCBs and kernel stacks are allocated on demand,
+// so this only sizes the PID map.
+#define MAX_NUM_PROCESS 256
 
 #define KERNEL_START_ADDR   0x400000
 #define KERNEL_END_ADDR     0x800000
 #define PROC_AREA_SIZE (8 * ONE_KB)
+#define KSTACK_MAGIC    0x57ACC0DE
 
 typedef struct universal_state_t {
     regs_hwcontext_t gp_regs;
@@ -23,37 +29,76 @@ typedef struct universal_state_t {
     uint32_t esp0;
 } universal_state_t;
 
+struct proc_area_t;
+struct user_mm_t;
+
+// Memory use of a process, kept up to date by paging and reported in the memstat kernel file
+typedef struct proc_mem_stats_t {
+    uint32_t resident_pages;    // User window pages backed by a frame right now
+    uint32_t minor_faults;      // Resolved without restoring any data: first touch, copy-on-write
+    uint32_t major_faults;      // Resolved by bringing a page back from compressed swap
+    uint32_t exec_pages_copied; // Pages of program image written by the loader
+} proc_mem_stats_t;
+
 typedef struct pcb_t {
     universal_state_t universal_state;
     parse_command_result_t create_command_info;
     executability_result_t start_exec_info;
     hwcontext_t pre_sysexec_state;
     from_kernel_context_t pre_sysexec_kstack;
-    file_descriptor_t fd_array[MAX_NUM_FD];
+    file_descriptor_t* fd_array;    // MAX_NUM_FD entries from fd_array_cache, NULL for the root pcb
     uint32_t pid;
     uint32_t parent_pid;
     uint32_t present;
     char argument[KEYBOARD_BUF_SIZE+1];
     uint32_t flag_activated_vidmap;
+    struct proc_area_t* kstack;             // NULL for the root pcb, which runs on the boot stack
+    struct user_mm_t* mm;   // The user window, see create_new_user_programpage. NULL for the root pcb
+    proc_mem_stats_t mem_stats;     // Kept in the thread group leader's PCB only
+    struct pcb_t* next_zombie;
+    // CPU that freed it and how often that CPU had entered the kernel then, see reap_zombies
+    uint32_t freed_on_cpu;
+    uint32_t freed_at_entry;
+    // Threads (see thread_start) are PCBs sharing the leader's mm and fd_array
+    uint32_t tgid;                  // PID of the thread group leader, the PID itself for a process
+    struct pcb_t* next_thread;      // The leader links every other thread of the group through this
+    uint32_t futex_addr;            // User address the thread sleeps on, 0 while it isn't waiting
+    wait_queue_t futex_waiters;     // Leader only
+    // The scheduler's run queues (see sched_enqueue), which never hold the running task
+    uint32_t cpu;                   // CPU whose run queue it goes on, see sched_steal
+    uint32_t on_run_queue;
+    struct pcb_t* run_prev;
+    struct pcb_t* run_next;
+    uint32_t sched_level;           // Priority level, 0 first. Only changes while off the run queue
+    uint32_t ticks_left;            // Jiffies of the quantum, 0 to get a new one when next scheduled
+    uint32_t quantum;               // Jiffies at level 0, 0 for SCHED_BASE_QUANTUM
+    uint32_t ran_since;             // Jiffy the running task was last charged up to, see charge_running
+    // Set while sleeping on a wait queue (see sleep_on), which keeps the task off the run queue
+    uint32_t blocked;
+    wait_queue_t* waiting_on;
+    struct pcb_t* wait_next;
+    ktimer_t timeout;               // Ends a sleep_on_timeout
+    task_acct_t acct;
 } pcb_t;
 
 extern pcb_t root_pcb;
 
+// Layout of the user's program page, starting at BEGINNING_USERPAGE_VIRTUAL_ADDR
+// The stack has its own region at the top of the user window (see USER_STACK_BEGIN_ADDR)
 // Never allocate this on the stack
 typedef struct pcb_page {
-    uint8_t data[4 * ONE_MB - 2*sizeof(uint32_t)];
-    uint32_t lowest_user_stack_elem;
-    uint32_t _pad_to_avoid_pagefault; // I think the user will be fine with four bytes less
+    uint8_t data[4 * ONE_MB];
 } __attribute__((packed)) proc_page_t;
 STATIC_ASSERT(sizeof(proc_page_t) == 4*ONE_MB);
 
-#define PROC_AREA_SIZE (8 * ONE_KB)
 #define NO_PARENT_PID 0
-// Struct defined for easier pointer arithmetic
+// A kernel stack. These are PROC_AREA_SIZE aligned, so masking any ESP on the stack
+// finds the header and, through it, the PCB of the process running on it.
 // Don't allocate on the stack, just use it for pointer arithmetic
 typedef struct proc_area_t {
-    pcb_t pcb;
-    uint8_t kstack_values[PROC_AREA_SIZE - sizeof(pcb_t) - sizeof(uint32_t)];
+    uint32_t magic;     // KSTACK_MAGIC while the stack belongs to a process
+    pcb_t* owner;
+    uint8_t kstack_values[PROC_AREA_SIZE - 3 * sizeof(uint32_t)];
     uint32_t lowest_stack_elem;
 } __attribute__((packed)) proc_area_t;
 STATIC_ASSERT(sizeof(proc_area_t) == PROC_AREA_SIZE);
@@ -68,6 +113,8 @@ void* translate_kernel_to_user(const void* kern_addr, uint32_t nth_process);
 
 extern void process_init();
 extern pcb_t* process_allocate(uint32_t parent);
+pcb_t* process_allocate_thread(pcb_t* leader);
+uint32_t process_allocate_idle(uint32_t cpu);
 extern int process_free(uint32_t pid);
 void close_pid_fds(uint32_t pid);
 
@@ -75,6 +122,7 @@ extern uint32_t get_current_pid();
 uint32_t get_canonical_pid(uint32_t pid);
 extern pcb_t* get_current_pcb();
 extern pcb_t* get_pcb(uint32_t pid);
+pcb_t* get_thread_leader(uint32_t pid);
 
 int32_t save_context_in_pcb(
     pcb_t* this_pcb, 
@@ -91,7 +139,9 @@ int32_t initialize_kstack_context(
 
 int is_kernel_pid(uint32_t pid);
 int is_root_pid(uint32_t pid);
+int is_thread_pid(uint32_t pid);
 
+uint32_t derive_pid_from_esplike(uint32_t num);
 uint32_t derive_pid_from_esp();
 int32_t derive_pid_from_tss();
 
@@ -0,0 +1,148 @@
+#include "thread.h"
+#include "uaccess.h"
+#include "../lib.h"
+#include "../paging.h"
+#include "../mm/vma.h"
+#include "../sched/sched.h"
+
+// Starts a new thread in the calling process
+// The thread shares the caller's address space and open files but has its own kernel stack
+// and registers, and gets the CPU through the run queue like any process. It starts at
+// entry as if called with arg, on a stack the caller set up (mmap it, say), and ends with halt.
+// Inputs:
+//      entry -- user address to start at
+//      stack_top -- user address just past the thread's stack
+//      arg -- the entry function's only argument
+// Outputs: PID of the new thread, -1 on failure
+int32_t thread_start(uint32_t entry, uint32_t stack_top, uint32_t arg) {
+    pcb_t* leader = get_thread_leader(get_current_pid());
+    pcb_t* thread;
+    // No return address: returning from entry faults, which ends the thread just like halt
+    uint32_t frame[2] = {0, arg};
+    uint32_t esp = (stack_top & ~(sizeof(uint32_t) - 1)) - sizeof(frame);
+    if (!leader || is_kernel_pid(leader->pid) || !leader->mm) return -1;
+    if (!mm_addr_is_valid(leader->mm, entry) || copy_to_user((void*)esp, frame, sizeof(frame))) return -1;
+
+    thread = process_allocate_thread(leader);
+    if (!thread) return -1;
+
+    // Same first state as a freshly loaded program, see prep_shell_task
+    eflags_register_fmt_t inherited_flags = get_eflags();
+    inherited_flags.int_f = 1;
+    thread->universal_state.esp0 = get_initial_esp0_of_process(thread->pid);
+    thread->universal_state.paging_state = init_root_proc_paging_state(thread->pid);
+    thread->universal_state.paging_state.user_vidmem_active = current_universe_paging_state().user_vidmem_active;
+    thread->universal_state.gp_regs.eax
+        = thread->universal_state.gp_regs.ebx
+        = thread->universal_state.gp_regs.ecx
+        = thread->universal_state.gp_regs.edx
+        = thread->universal_state.gp_regs.edi
+        = thread->universal_state.gp_regs.esi
+        = thread->universal_state.gp_regs.ebp = 0;
+    thread->universal_state.gp_regs.ds = USER_DS;
+    thread->universal_state.gp_regs._pad_ds = 0;
+    thread->universal_state.gp_regs.es = 0;
+    thread->universal_state.gp_regs._pad_es = 0;
+    thread->universal_state.iret_regs.esp = esp;
+    thread->universal_state.iret_regs.ret_eip = entry;
+    thread->universal_state.iret_regs.eflags = inherited_flags;
+    thread->universal_state.iret_regs.cs = USER_CS;
+    thread->universal_state.iret_regs._pad_cs = 0;
+    thread->universal_state.iret_regs.ss = USER_DS;
+    thread->flag_activated_vidmap = leader->flag_activated_vidmap;
+
+    // From here on the scheduler may pick it
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        thread->next_thread = leader->next_thread;
+        leader->next_thread = thread;
+        sched_enqueue(thread->pid);
+    }
+    return thread->pid;
+}
+
+// Ends the calling thread; its process and the other threads carry on
+// Inputs: None
+// Outputs: None, doesn't return
+// Side effects: Frees the thread and hands the CPU to the next task on the run queue
+void thread_exit() {
+    pcb_t* self = get_current_pcb();
+    pcb_t* leader;
+    pcb_t** link;
+    PRINT_ASSERT(self && is_thread_pid(self->pid), "thread_exit outside of a thread!\n");
+    leader = get_pcb(self->tgid);
+
+    // We're leaving this kernel stack for good, nothing may come back to it
+    cli();
+    for (link = &leader->next_thread; *link != self; link = &(*link)->next_thread);
+    *link = self->next_thread;
+    process_free(self->pid);
+    sched_exit_current();
+}
+
+// Ends every thread of a process but the leader, which is about to exit or restart
+// Inputs: leader -- the process, which must be the one running
+// Outputs: None
+// Side effects: The threads' PCBs and kernel stacks go on the zombie list (see process_free)
+void thread_kill_others(pcb_t* leader) {
+    pcb_t* thread;
+    if (!leader || is_thread_pid(leader->pid)) return;
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        // process_free takes them off the futex queue, the leader can't be on it as it's running
+        while ((thread = leader->next_thread)) {
+            leader->next_thread = thread->next_thread;
+            process_free(thread->pid);
+        }
+    }
+}
+
+// Waits for futex_wake on an address, if the word there still holds the expected value
+// Checking the word and going to sleep happen with interrupts off, so no wake in between is lost.
+// Futexes are private to a process: the address is looked up in the caller's address space.
+// Inputs: uaddr -- 4-byte aligned user address of the futex word, val -- value it should hold
+// Outputs: 0 once woken, -1 if the word held something else or the address is bad
+// Side effects: The thread sleeps on its process's futex queue, off the run queue
+int32_t futex_wait(uint32_t uaddr, uint32_t val) {
+    pcb_t* self = get_current_pcb();
+    pcb_t* leader = get_thread_leader(get_current_pid());
+    uint32_t current;
+    int32_t retval = -1;
+    if (!self || !leader || is_kernel_pid(leader->pid)) return -1;
+    if (!uaddr || (uaddr & (sizeof(uint32_t) - 1))) return -1;
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        if (!copy_from_user(&current, (const void*)uaddr, sizeof(current)) && current == val) {
+            self->futex_addr = uaddr;
+            while (self->futex_addr) sleep_on(&leader->futex_waiters);
+            retval = 0;
+        }
+    }
+    return retval;
+}
+
+// Wakes threads of the caller's process waiting on an address, oldest first
+// Inputs: uaddr -- user address of the futex word, count -- most threads to wake
+// Outputs: Number of threads woken, -1 on failure
+int32_t futex_wake(uint32_t uaddr, uint32_t count) {
+    pcb_t* leader = get_thread_leader(get_current_pid());
+    pcb_t* waiter;
+    pcb_t* next;
+    int32_t woken = 0;
+    if (!leader || is_kernel_pid(leader->pid) || !uaddr) return -1;
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        for (waiter = leader->futex_waiters.head; waiter && (uint32_t)woken < count; waiter = next) {
+            next = waiter->wait_next;
+            if (waiter->futex_addr == uaddr) {
+                waiter->futex_addr = 0;
+                wake_up_task(waiter);
+                woken++;
+            }
+        }
+    }
+    return woken;
+}
@@ -0,0 +1,21 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+#include "../types.h"
+#include "process.h"
+
+// Operations of the futex system call, passed in ECX
+#define FUTEX_WAIT  0
+#define FUTEX_WAKE  1
+
+#ifndef ASM
+
+int32_t thread_start(uint32_t entry, uint32_t stack_top, uint32_t arg);
+void thread_exit(void);
+void thread_kill_others(pcb_t* leader);
+
+int32_t futex_wait(uint32_t uaddr, uint32_t val);
+int32_t futex_wake(uint32_t uaddr, uint32_t count);
+
+#endif /* ASM */
+#endif
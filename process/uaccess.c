@@ -0,0 +1,65 @@
+#include "uaccess.h"
+#include "../paging.h"
+
+// Both ends are provided by the linker, the entries come from EX_TABLE_ENTRY
+extern const ex_table_entry_t __start_ex_table[];
+extern const ex_table_entry_t __stop_ex_table[];
+
+// In uaccess_asm.S
+uint32_t __copy_user(void* dst, const void* src, uint32_t n);
+int32_t __strncpy_from_user(char* dst, const char* src, uint32_t n);
+
+// Checks that a whole range lies in the user window
+// Whether it's actually mapped is up to the page fault handler when the range is touched,
+// for the process whose window is mapped (during a syscall, the caller).
+// Inputs: user_addr -- start of the range, n -- its length
+// Outputs: 1 if it does, 0 if any of it is outside (or it wraps around)
+int32_t user_access_ok(const void* user_addr, uint32_t n) {
+    uint32_t addr = (uint32_t)user_addr;
+    return addr >= USER_WINDOW_BEGIN_ADDR && addr <= USER_WINDOW_END_ADDR && n <= USER_WINDOW_END_ADDR - addr;
+}
+
+// Copies a buffer from user memory
+// Inputs: dst -- kernel buffer, user_src -- user buffer, n -- bytes to copy
+// Outputs: 0 on success, -1 if the range is outside the window or part of it isn't mapped
+// Side effects: Pages are backed or brought back on the way as usual. On failure
+//      dst may have been partly written.
+int32_t copy_from_user(void* dst, const void* user_src, uint32_t n) {
+    if (!user_access_ok(user_src, n)) return -1;
+    return __copy_user(dst, user_src, n) ? -1 : 0;
+}
+
+// Copies a buffer to user memory
+// Inputs: user_dst -- user buffer, src -- kernel buffer, n -- bytes to copy
+// Outputs: 0 on success, -1 if the range is outside the window or part of it isn't mapped
+// Side effects: On failure user_dst may have been partly written
+int32_t copy_to_user(void* user_dst, const void* src, uint32_t n) {
+    if (!user_access_ok(user_dst, n)) return -1;
+    return __copy_user(user_dst, src, n) ? -1 : 0;
+}
+
+// Copies a NUL-terminated string from user memory
+// Inputs: dst -- kernel buffer, user_src -- the string, n -- size of dst
+// Outputs: Length of the string, n if it didn't end within n bytes (dst then isn't terminated),
+//      -1 if it starts outside the window or runs into an unmapped page
+int32_t strncpy_from_user(char* dst, const char* user_src, uint32_t n) {
+    uint32_t addr = (uint32_t)user_src;
+    if (addr < USER_WINDOW_BEGIN_ADDR || addr >= USER_WINDOW_END_ADDR) return -1;
+    // The string may be shorter than n, only a string running off the window is an error
+    if (n > USER_WINDOW_END_ADDR - addr) {
+        int32_t len = __strncpy_from_user(dst, user_src, USER_WINDOW_END_ADDR - addr);
+        return len == (int32_t)(USER_WINDOW_END_ADDR - addr) ? -1 : len;
+    }
+    return __strncpy_from_user(dst, user_src, n);
+}
+
+// Looks for the fixup of a faulting kernel instruction
+// Inputs: eip -- address of the instruction that faulted
+// Outputs: Where to continue, 0 if the instruction isn't allowed to fault
+uint32_t search_exception_table(uint32_t eip) {
+    const ex_table_entry_t* entry;
+    for (entry = __start_ex_table; entry < __stop_ex_table; entry++) {
+        if (entry->insn == eip) return entry->fixup;
+    }
+    return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef UACCESS_H
+#define UACCESS_H
+
+#ifndef ASM
+#include "../types.h"
+#endif
+
+// Records that a fault at insn (a kernel instruction touching user memory) should continue
+// at fixup instead of killing anything. See search_exception_table.
+#define EX_TABLE_ENTRY(insn, fixup) \
+    .pushsection ex_table, "a"; \
+    .long insn, fixup; \
+    .popsection
+
+#ifndef ASM
+
+typedef struct ex_table_entry_t {
+    uint32_t insn;
+    uint32_t fixup;
+} ex_table_entry_t;
+
+int32_t user_access_ok(const void* user_addr, uint32_t n);
+int32_t copy_from_user(void* dst, const void* user_src, uint32_t n);
+int32_t copy_to_user(void* user_dst, const void* src, uint32_t n);
+int32_t strncpy_from_user(char* dst, const char* user_src, uint32_t n);
+uint32_t search_exception_table(uint32_t eip);
+
+#endif /* ASM */
+#endif
@@ -0,0 +1,139 @@
+#include "acct.h"
+#include "../lib.h"
+#include "../common.h"
+#include "../process/process.h"
+#include "../memfs/kernfs.h"
+#include "clock.h"
+
+static void top_show(kernfs_buf_t* out);
+static uint32_t cycles_to_ms(uint64_t cycles);
+
+// Registers the top kernel file
+// Inputs: None
+// Outputs: None
+void acct_init() {
+    kernfs_register("top", top_show, NULL);
+}
+
+// Charges a running task for the time since it was last charged
+// Inputs: pcb -- the task, now -- TSC, in_kernel -- whether it spent that time in the kernel
+// Outputs: None
+// Side effects: Must be called with interrupts off. A task that wasn't counting (see acct_stop)
+//      only starts counting from now.
+void acct_charge(pcb_t* pcb, uint64_t now, int32_t in_kernel) {
+    if (!pcb) return;
+    if (pcb->acct.stamp) {
+        if (in_kernel) pcb->acct.sys_cycles += now - pcb->acct.stamp;
+        else pcb->acct.user_cycles += now - pcb->acct.stamp;
+    }
+    if (!pcb->acct.started) pcb->acct.started = now;
+    pcb->acct.stamp = now;
+}
+
+// Stops counting a task's time, now that something else runs in its place
+// Inputs: pcb -- the task
+// Outputs: None
+void acct_stop(pcb_t* pcb) {
+    if (pcb) pcb->acct.stamp = 0;
+}
+
+// Starts counting a task's time, now that the scheduler picked it
+// Inputs: pcb -- the task, now -- TSC
+// Outputs: None
+// Side effects: Must be called with interrupts off
+void acct_dispatch(pcb_t* pcb, uint64_t now) {
+    if (!pcb) return;
+    if (pcb->acct.ready_since) pcb->acct.wait_cycles += now - pcb->acct.ready_since;
+    pcb->acct.ready_since = 0;
+    if (!pcb->acct.started) pcb->acct.started = now;
+    pcb->acct.stamp = now;
+}
+
+// Notes that a task went on the run queue
+// Inputs: pcb -- the task, now -- TSC
+// Outputs: None
+void acct_ready(pcb_t* pcb, uint64_t now) {
+    if (pcb) pcb->acct.ready_since = now;
+}
+
+// Charges the caller's time in user mode, called by syscall_prologue
+// Inputs: None
+// Outputs: None
+void acct_syscall_enter() {
+    pcb_t* pcb = get_current_pcb();
+    if (!pcb || is_kernel_pid(pcb->pid)) return;
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        acct_charge(pcb, rdtsc(), 0);
+    }
+}
+
+// Charges the caller's time in the kernel, called by syscall_epilogue
+// Inputs: None
+// Outputs: None
+void acct_syscall_exit() {
+    pcb_t* pcb = get_current_pcb();
+    if (!pcb || is_kernel_pid(pcb->pid)) return;
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        acct_charge(pcb, rdtsc(), 1);
+    }
+}
+
+// Works out a share of some time, as a percentage
+// Inputs: part, whole -- TSC cycles
+// Outputs: The percentage, at most 100
+static uint32_t percent_of(uint64_t part, uint64_t whole) {
+    // Shifted down to 32 bits, there's no 64-bit division
+    uint32_t part_units = (uint32_t)(part >> 16);
+    uint32_t whole_hundredths = (uint32_t)(whole >> 16) / 100;
+    if (!whole_hundredths) return 0;
+    part_units /= whole_hundredths;
+    return part_units > 100 ? 100 : part_units;
+}
+
+// Turns TSC cycles into milliseconds for top
+// Inputs: cycles -- TSC cycles
+// Outputs: Milliseconds, 0 if the TSC isn't calibrated (see clock_init)
+static uint32_t cycles_to_ms(uint64_t cycles) {
+    uint32_t khz = clock_tsc_khz();
+    return khz ? (uint32_t)div_u64_rem(cycles, khz, NULL) : 0;
+}
+
+// Prints one line per task: state, priority level, where its time went (in milliseconds, see
+// cycles_to_ms, so 0 without a calibrated TSC), the share of its lifetime it had the CPU, and how
+// often it gave the CPU up or had it taken away
+// States: R running, Q on the run queue, S asleep, W waiting for a child
+// Inputs: out -- buffer to print into
+// Outputs: None
+static void top_show(kernfs_buf_t* out) {
+    uint32_t pid;
+    pcb_t* pcb;
+    uint32_t current = get_current_pid();
+    kernfs_puts(out, "pid tgid st lvl  user_ms   sys_ms  wait_ms cpu%    vcsw   ivcsw\n");
+    for (pid = 1; pid <= MAX_NUM_PROCESS; pid++) {
+        uint32_t flags, garbage;
+        CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+            pcb = get_pcb(pid);
+            if (pcb) {
+                uint64_t now = rdtsc();
+                char state = 'W';
+                if (pid == current) state = 'R';
+                else if (pcb->on_run_queue) state = 'Q';
+                else if (pcb->blocked) state = 'S';
+                kernfs_putu(out, pid, 3);
+                kernfs_putu(out, pcb->tgid, 5);
+                kernfs_puts(out, "  ");
+                kernfs_putc(out, state);
+                kernfs_putu(out, pcb->sched_level, 4);
+                kernfs_putu(out, cycles_to_ms(pcb->acct.user_cycles), 9);
+                kernfs_putu(out, cycles_to_ms(pcb->acct.sys_cycles), 9);
+                kernfs_putu(out, cycles_to_ms(pcb->acct.wait_cycles), 9);
+                kernfs_putu(out, pcb->acct.started ? percent_of(pcb->acct.user_cycles + pcb->acct.sys_cycles, now - pcb->acct.started) : 0, 5);
+                kernfs_putu(out, pcb->acct.voluntary_switches, 8);
+                kernfs_putu(out, pcb->acct.involuntary_switches, 8);
+                kernfs_putc(out, '\n');
+            }
+        }
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef ACCT_H
+#define ACCT_H
+
+#include "../types.h"
+
+#ifndef ASM
+
+struct pcb_t;
+
+// Where a task's time went, in TSC cycles, kept up to date by the scheduler and the syscall
+// entry and exit paths, and reported in the top kernel file
+typedef struct task_acct_t {
+    uint64_t user_cycles;
+    uint64_t sys_cycles;
+    uint64_t wait_cycles;       // Ready to run, but on the run queue
+    uint64_t started;           // When it first ran, 0 before that
+    uint64_t stamp;             // Counted up to here while it runs, 0 while it doesn't
+    uint64_t ready_since;       // When it went on the run queue, 0 while it isn't on it
+    uint32_t voluntary_switches;    // Blocked or yielded
+    uint32_t involuntary_switches;  // Preempted
+} task_acct_t;
+
+void acct_init();
+void acct_charge(struct pcb_t* pcb, uint64_t now, int32_t in_kernel);
+void acct_stop(struct pcb_t* pcb);
+void acct_dispatch(struct pcb_t* pcb, uint64_t now);
+void acct_ready(struct pcb_t* pcb, uint64_t now);
+void acct_syscall_enter();
+void acct_syscall_exit();
+
+#endif /* ASM */
+#endif
@@ -0,0 +1,117 @@
+#include "clock.h"
+#include "tick.h"
+#include "../lib.h"
+#include "../common.h"
+#include "../device-drivers/pit.h"
+#include "../device-drivers/rtc.h"
+#include "../memfs/kernfs.h"
+
+// TSC cycles per millisecond, 0 without a TSC to go by, in which case the clock counts jiffies
+static uint32_t tsc_khz;
+static uint32_t clock_mult;
+// Where the monotonic clock starts
+static uint64_t boot_tsc;
+// The CMOS clock as clock_init read it, and the monotonic clock at that point
+static uint32_t boot_epoch;
+static uint64_t boot_epoch_ns;
+
+static uint64_t cycles_to_ns(uint64_t cycles);
+static void clock_show(kernfs_buf_t* out);
+
+// Times the TSC against PIT channel 2 and reads the wall clock off the CMOS
+// Inputs: None
+// Outputs: None
+// Side effects: Busy-waits CLOCK_CALIBRATE_US with interrupts off. Without a TSC (or with one too
+//      slow to scale, see CLOCK_MIN_TSC_KHZ) the clock only moves a jiffy at a time.
+void clock_init() {
+    uint32_t eax, ebx, ecx, edx;
+    uint32_t count = CLOCK_CALIBRATE_US * (FREQ / 1000) / 1000;
+    uint64_t start, cycles;
+    uint32_t khz;
+
+    tsc_khz = 0;
+    if (cpu_has_cpuid()) {
+        cpuid(1, &eax, &ebx, &ecx, &edx);
+        if (edx & CPUID_FEATURE_TSC) {
+            uint32_t flags, garbage;
+            CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+                start = rdtsc();
+                pit_wait(count);
+                cycles = rdtsc() - start;
+            }
+            // The wait took count / FREQ seconds exactly, rather than the microseconds asked for
+            khz = (uint32_t)div_u64_rem(cycles * FREQ, count * 1000, NULL);
+            if (khz >= CLOCK_MIN_TSC_KHZ) {
+                clock_mult = (uint32_t)div_u64_rem((uint64_t)NSEC_PER_MSEC << CLOCK_SHIFT, khz, NULL);
+                boot_tsc = start;
+                tsc_khz = khz;
+            }
+        }
+    }
+
+    boot_epoch = rtc_read_epoch();
+    boot_epoch_ns = clock_ns();
+    kernfs_register("clock", clock_show, NULL);
+}
+
+// Reads the monotonic clock
+// Inputs: None
+// Outputs: Nanoseconds since clock_init
+uint64_t clock_ns() {
+    if (!tsc_khz) return (uint64_t)tick_now() * (NSEC_PER_SEC / TICK_HZ);
+    return cycles_to_ns(rdtsc() - boot_tsc);
+}
+
+// Inputs: None
+// Outputs: TSC cycles per millisecond, 0 if the TSC isn't calibrated
+uint32_t clock_tsc_khz() {
+    return tsc_khz;
+}
+
+// Reads a clock into seconds and nanoseconds
+// Inputs: clock_id -- CLOCK_MONOTONIC or CLOCK_REALTIME, ts -- filled in
+// Outputs: 0 on success, -1 for an unknown clock
+int32_t clock_gettime(uint32_t clock_id, timespec_t* ts) {
+    uint64_t ns = clock_ns();
+    uint32_t sec, nsec;
+    if (!ts) return -1;
+    if (clock_id == CLOCK_MONOTONIC) {
+        sec = (uint32_t)div_u64_rem(ns, NSEC_PER_SEC, &nsec);
+    } else if (clock_id == CLOCK_REALTIME) {
+        sec = boot_epoch + (uint32_t)div_u64_rem(ns - boot_epoch_ns, NSEC_PER_SEC, &nsec);
+    } else {
+        return -1;
+    }
+    ts->sec = sec;
+    ts->nsec = nsec;
+    return 0;
+}
+
+// Scales TSC cycles to nanoseconds without a 64-bit multiplication that could overflow
+// Inputs: cycles -- TSC cycles
+// Outputs: Nanoseconds
+static uint64_t cycles_to_ns(uint64_t cycles) {
+    uint32_t lo = (uint32_t)cycles, hi = (uint32_t)(cycles >> 32);
+    uint64_t ns = ((uint64_t)lo * clock_mult) >> CLOCK_SHIFT;
+    return ns + (((uint64_t)hi * clock_mult) << (32 - CLOCK_SHIFT));
+}
+
+// Prints the TSC rate and both clocks
+// Inputs: out -- buffer to print into
+// Outputs: None
+static void clock_show(kernfs_buf_t* out) {
+    timespec_t mono, real;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &real);
+    kernfs_puts(out, "tsc_khz:   ");
+    kernfs_putu(out, tsc_khz, 0);
+    kernfs_puts(out, "\nmonotonic: ");
+    kernfs_putu(out, mono.sec, 0);
+    kernfs_puts(out, " s ");
+    kernfs_putu(out, mono.nsec, 0);
+    kernfs_puts(out, " ns\nrealtime:  ");
+    kernfs_putu(out, real.sec, 0);
+    kernfs_puts(out, " s ");
+    kernfs_putu(out, real.nsec, 0);
+    kernfs_puts(out, " ns\n");
+}
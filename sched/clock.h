@@ -0,0 +1,33 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include "../types.h"
+
+#define NSEC_PER_SEC            1000000000
+#define NSEC_PER_MSEC           1000000
+// How long the TSC is timed against PIT channel 2 at boot, in microseconds
+#define CLOCK_CALIBRATE_US      10000
+// Cycles are turned into nanoseconds as (cycles * clock_mult) >> CLOCK_SHIFT
+#define CLOCK_SHIFT             24
+// Below this the multiplier wouldn't fit in 32 bits, see clock_init
+#define CLOCK_MIN_TSC_KHZ       4000
+#define CPUID_FEATURE_TSC       0x10            //CPUID leaf 1, EDX
+
+// Clocks for gettime
+#define CLOCK_MONOTONIC         0       // Since boot, never goes back
+#define CLOCK_REALTIME          1       // Since 1970, seeded from the CMOS clock at boot
+
+#ifndef ASM
+
+typedef struct timespec_t {
+    uint32_t sec;
+    uint32_t nsec;
+} timespec_t;
+
+void clock_init();
+uint64_t clock_ns();
+uint32_t clock_tsc_khz();
+int32_t clock_gettime(uint32_t clock_id, timespec_t* ts);
+
+#endif /* ASM */
+#endif
@@ -0,0 +1,65 @@
+#include "kernel_lock.h"
+#include "spinlock.h"
+#include "smp.h"
+#include "../lib.h"
+#include "../common.h"
+#include "../process/process.h"
+#include "../device-drivers/terminal.h"
+
+// One CPU at a time runs kernel code, whatever it is doing there. Everything that was kept
+// consistent with CRITICAL_SECTION_FLAGSAVE on one CPU stays consistent this way: a CPU only
+// runs kernel code with the lock, and the lock only changes hands on the way to user mode or
+// to the halt in sched_idle. The statistics are set up statically since the boot processor
+// takes the lock before lock_stats_init can run.
+static lock_stats_t kernel_lock_stats;
+static ticket_lock_t kernel_lock = {0, 0, 0, &kernel_lock_stats};
+volatile uint32_t kernel_lock_owner = KERNEL_LOCK_NO_OWNER;
+volatile uint32_t kernel_lock_entries[SMP_MAX_CPUS];
+
+// Names the kernel lock's statistics in lockstat
+// Inputs: None
+// Outputs: None
+void kernel_lock_init() {
+    lock_stats_init(&kernel_lock_stats, "kernel");
+}
+
+// Takes the kernel lock for this CPU, first thing on the way into the kernel
+// Interrupts and exceptions taken in the kernel find the lock theirs already.
+// Inputs: None
+// Outputs: None
+// Side effects: Spins with interrupts off while another CPU is in the kernel. Whatever ran in the
+//      kernel meanwhile may have left another terminal active, so the running task's one is made
+//      active again (see set_active_terminal).
+void kernel_lock_enter() {
+    uint32_t cpu = smp_cpu_id();
+    pcb_t* curr;
+    int32_t tid;
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        if (kernel_lock_owner != cpu) {
+            ticket_lock(&kernel_lock);
+            kernel_lock_owner = cpu;
+            kernel_lock_entries[cpu]++;
+            curr = get_current_pcb();
+            if (curr && !is_kernel_pid(curr->pid)) {
+                tid = (int32_t)get_canonical_pid(curr->pid) - 1;
+                if (tid != active_tid) {
+                    spin_lock(&terminal_lock);
+                    set_active_terminal(tid);
+                    spin_unlock(&terminal_lock);
+                }
+            }
+        }
+    }
+}
+
+// Lets go of the kernel lock, for this CPU's way back to user mode or into the idle halt
+// Inputs: None
+// Outputs: None
+// Side effects: Must be called with interrupts off, on the kernel stack of the task that runs
+//      next on this CPU (see exit_sched_to_u): another CPU may pick up any other task right away
+void kernel_lock_leave() {
+    if (kernel_lock_owner != smp_cpu_id()) return;
+    kernel_lock_owner = KERNEL_LOCK_NO_OWNER;
+    ticket_unlock(&kernel_lock);
+}
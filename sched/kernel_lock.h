@@ -0,0 +1,31 @@
+#ifndef KERNEL_LOCK_H
+#define KERNEL_LOCK_H
+
+#include "../types.h"
+#include "../x86_desc.h"
+
+// kernel_lock_owner while no CPU is in the kernel
+#define KERNEL_LOCK_NO_OWNER    0xFFFFFFFF
+
+// For the interrupt and system call linkage, on the way out: lets go of the kernel lock if the
+// context on the stack, whose CS is cs_offset bytes up from ESP, goes back to user mode.
+// Interrupts have to be off. Clobbers EAX, ECX and EDX.
+#define KERNEL_LOCK_LEAVE_TO_USER(cs_offset) \
+    cmpw $USER_CS, cs_offset(%esp); \
+    jne 1f; \
+    call kernel_lock_leave; \
+1:
+
+#ifndef ASM
+
+// CPU in the kernel right now, KERNEL_LOCK_NO_OWNER if none is
+extern volatile uint32_t kernel_lock_owner;
+// Times each CPU took the kernel lock, see process_free
+extern volatile uint32_t kernel_lock_entries[SMP_MAX_CPUS];
+
+void kernel_lock_init();
+void kernel_lock_enter();
+void kernel_lock_leave();
+
+#endif /* ASM */
+#endif
@@ -2,20 +2,48 @@
 #define SCHED_H
 
 #include "../x86_desc.h"
+#include "tick.h"
 
 #define NUM_SIMULTANEOUS_PROCS 3
+// Each CPU's idle task, which on the boot processor is the boot context (see sched_idle)
+#define SCHED_IDLE_PID 0
+
+// Priority levels, 0 runs first. A task starts at the top and sinks a level every time it uses up
+// its quantum, which doubles from level to level.
+#define SCHED_NUM_LEVELS    3
+#define SCHED_BASE_QUANTUM  2       // Jiffies at level 0, unless the task picked its own (see sched_set_quantum)
+#define SCHED_MAX_QUANTUM   TICK_HZ // Longest a task may pick
+// Jiffies between moving every task back to the top level, a second
+#define SCHED_BOOST_PERIOD  TICK_HZ
 
 #ifndef ASM
 
+struct user_mm_t;
+
 void exit_sched_to_k();
 void exit_sched_to_u();
 
 // C helpers called by the ASM functions
 void exit_sched_to_k_helper(exit_sched_to_k_context_t* fill_context);
 void exit_sched_to_u_helper(exit_sched_to_u_context_t* fill_context);
+uint32_t exit_sched_stack();
+int32_t handle_lapic_interrupt(sched_hwcontext_t* proc_context);
 
 void schedule_failed(int retval);
 int sched_init();
+int sched_enqueue(uint32_t pid);
+int sched_wake(uint32_t pid);
+int sched_need_resched();
+int sched_remove(uint32_t pid);
+uint32_t sched_num_ready();
+uint32_t sched_steal(uint32_t to_cpu);
+int32_t sched_runnable_on(uint32_t cpu);
+void sched_wait_for_mm(struct user_mm_t* mm);
+uint32_t sched_next_event(uint32_t pid, uint32_t now);
+int32_t sched_set_quantum(uint32_t pid, uint32_t quantum);
+void sched_yield();
+void sched_idle();
+void sched_exit_current();
 
 #endif
 #endif
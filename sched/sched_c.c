@@ -1,13 +1,52 @@
 #include "../lib.h"
 #include "sched.h"
+#include "../idt.h"
 #include "../process/process.h"
 #include "../paging.h"
 #include "../device-drivers/pit.h"
+#include "../device-drivers/apic.h"
 #include "../device-drivers/terminal.h"
+#include "../memfs/kernfs.h"
+#include "../mm/idle.h"
+#include "../mm/vma.h"
+#include "timer.h"
+#include "smp.h"
+#include "kernel_lock.h"
 
-static int pids_for_states[NUM_SIMULTANEOUS_PROCS];
-static int pfs_ptr;
-static int ignore_prior_state_for_init_flag;
+// Tasks ready to run on each CPU, one queue per priority level with the oldest first. The running
+// task isn't on them: it goes to the back of its level's queue when preempted. A parent waiting in
+// execute isn't either, its child runs in its place.
+typedef struct run_queue_t {
+    pcb_t* head[SCHED_NUM_LEVELS];
+    pcb_t* tail[SCHED_NUM_LEVELS];
+    uint32_t num_ready;
+} run_queue_t;
+static run_queue_t run_queues[SMP_MAX_CPUS];
+// What the scheduler keeps track of for each CPU
+typedef struct sched_cpu_t {
+    // Task the exit_sched_to_* helpers resume, picked by switch_to_next_scheduled
+    uint32_t next_scheduled_pid;
+    // Task the scheduler last gave the CPU to, SCHED_IDLE_PID while it's idle. A parent that
+    // executes a child or a child that halts hands the CPU over without the scheduler, so this
+    // is only good for telling apart busy and idle CPUs, and for what to preempt.
+    uint32_t running_pid;
+    // Set while leaving a task that no longer exists, which therefore doesn't go back on the queue
+    int current_task_gone_flag;
+    // Set when a task woke up that should run before the one running now, see sched_wake
+    int need_resched_flag;
+    // Jiffy the idle task last got the CPU at
+    uint32_t idle_since;
+    // Whether the local APIC timer is armed, for the application processors (see program_next_tick)
+    int32_t ticking;
+} sched_cpu_t;
+static sched_cpu_t sched_cpus[SMP_MAX_CPUS];
+static uint32_t last_boost;
+// Instrumentation, see sched_show
+static uint32_t sched_idle_jiffies;
+static uint32_t sched_idle_halts;
+static uint32_t sched_switches;
+static uint32_t sched_demotions;
+static uint32_t sched_boosts;
 
 int prep_shell_task(uint32_t pid);
 uint32_t* get_prekint_esp(uint32_t* post_int_esp);
@@ -16,43 +55,483 @@ int load_resuming_state_kernel(exit_sched_to_k_context_t* destination, uint32_t
 int store_universal_state_in_pcb(sched_hwcontext_t* proc_context);
 void exit_sched_to_u();
 void exit_sched_to_k();
+static void switch_to_next_scheduled(int yielding);
+static pcb_t* run_queue_pop();
+static pcb_t* run_queue_first(uint32_t queue_cpu, uint32_t cpu);
+static int32_t task_can_run_on(const pcb_t* pcb, uint32_t cpu);
+static int32_t higher_level_ready(uint32_t level);
+static uint32_t lowest_level_of(const pcb_t* pcb);
+static int32_t is_foreground(uint32_t pid);
+static void boost_all_levels();
+static void charge_running(pcb_t* pcb, uint32_t now);
+static void sched_tick(pcb_t* curr, uint32_t now);
+static void program_next_tick(pcb_t* next_pcb, uint32_t now);
+static void arm_tick(uint32_t n);
+static int32_t tick_is_armed();
+static void kick_for(uint32_t cpu);
+static void run_queue_push(pcb_t* pcb);
+static void run_queue_link(run_queue_t* rq, pcb_t* pcb);
+static void run_queue_unlink(pcb_t* pcb);
+static void sched_show(kernfs_buf_t* out);
 
-// Initializes all necessary scheduler values (note: does NOT touch the PIT)
+// Initializes all necessary scheduler values
 // Inputs: None
 // Outputs: None
-// Side effects: Allocates PIDs, initializes the pids_for_states array, preps the PIDs as if they were all preempted on initial execution
+// Side effects: Allocates PIDs for the root shells, preps them as if they were all preempted on initial
+//      execution and queues them up, the first one to run first. They start running once the boot
+//      context turns into the idle task, see sched_idle. The PIT stays quiet until then.
 int sched_init() {
     int i;
+    memset(run_queues, 0, sizeof(run_queues));
+    memset(sched_cpus, 0, sizeof(sched_cpus));
+    tick_init();
+    last_boost = tick_now();
+    for (i = 0; i < SMP_MAX_CPUS; i++) sched_cpus[i].idle_since = last_boost;
+    kernfs_register("schedstat", sched_show, NULL);
+    acct_init();
     for (i = 0; i < NUM_SIMULTANEOUS_PROCS; i++) {
         pcb_t* root_pcb = process_allocate(NO_PARENT_PID);
         if (!root_pcb) return -1;
         uint32_t root_pid = root_pcb->pid;
-        pids_for_states[i] = root_pid;
         if (prep_shell_task(root_pid)) return -1;
+        sched_enqueue(root_pid);
     }
-    // For the first sched hit, we do not load any initial state
-    ignore_prior_state_for_init_flag = 1;
-    // Start at 0th entry in pids_for_states
-    // (This marks the 2nd procstream as in use, leaving the 0th to be launched.)
-    pfs_ptr = NUM_SIMULTANEOUS_PROCS - 1;
     return 0;
 }
 
-// Marks the current PID for future reloading and gets the next scheduled PID
-// Inputs: PID to store
-// Outputs: PID that will be resumed
-// Side effects: Updates the "current" scheduled PID that has to be resumed later, marks the next PID as scheduled
-int set_current_and_get_next_scheduled_pid(uint32_t pid) {
-    pids_for_states[pfs_ptr] = pid;
-    pfs_ptr = (pfs_ptr + 1) % NUM_SIMULTANEOUS_PROCS;
-    return pids_for_states[pfs_ptr];
+// One round of the idle task, which is what the boot context becomes once it's done booting, and
+// what the application processors run from the start (see smp_ap_main)
+// The scheduler runs it whenever no other task is ready; it never goes on a run queue.
+// Inputs: None
+// Outputs: None
+// Side effects: Does background memory work on the boot processor, then either hands the CPU to a
+//      task that became ready, here or on another CPU, or halts until the next interrupt. Other
+//      CPUs get the kernel lock meanwhile.
+void sched_idle() {
+    uint32_t cpu = smp_cpu_id();
+    if (sched_runnable_on(cpu)) sched_yield();
+    // The other CPUs would only wait for the kernel lock meanwhile
+    if (!cpu) mm_idle();
+    cli();
+    if (sched_runnable_on(cpu)) {
+        sched_yield();
+    } else {
+        sched_idle_halts++;
+        kernel_lock_leave();
+        // sti only takes effect after hlt, so a wakeup can't slip in between. Its interrupt
+        // handler takes the kernel lock back and keeps it on the way back here.
+        asm volatile ("sti; hlt" ::: "memory");
+        kernel_lock_enter();
+    }
+    sti();
+}
+
+// Checks whether a CPU has anything to run, on its own run queue or stolen from another's
+// Inputs: cpu -- the CPU
+// Outputs: 1 if some ready task can run there, 0 otherwise
+int32_t sched_runnable_on(uint32_t cpu) {
+    uint32_t queue_cpu;
+    int32_t retval = 0;
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        for (queue_cpu = 0; queue_cpu < SMP_MAX_CPUS && !retval; queue_cpu++) {
+            if (run_queue_first(queue_cpu, cpu)) retval = 1;
+        }
+    }
+    return retval;
+}
+
+// Makes a task ready to run on the CPU it last ran on, after every task at its priority level
+// that already is
+// Inputs: pid -- task to queue, which must not be running or queued already
+// Outputs: 0 on success, -1 if there's no such task or it's queued already
+// Side effects: The task gets the CPU once the ones ahead of it had their turn. If the running task
+//      had the CPU to itself, its quantum starts counting down (see program_next_tick). Another
+//      CPU is kicked to have a look (see kick_for).
+int sched_enqueue(uint32_t pid) {
+    pcb_t* pcb = get_pcb(pid);
+    pcb_t* curr = get_current_pcb();
+    uint32_t cpu = smp_cpu_id();
+    int retval = -1;
+    if (!pcb || is_kernel_pid(pid)) return -1;
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        if (!pcb->on_run_queue) {
+            run_queue_push(pcb);
+            // The idle task makes way on its own
+            if (pcb->cpu == cpu && curr && !is_kernel_pid(curr->pid) && !tick_is_armed()) {
+                charge_running(curr, tick_now());
+                arm_tick(curr->ticks_left);
+            }
+            kick_for(pcb->cpu);
+            retval = 0;
+        }
+    }
+    return retval;
+}
+
+// Gets other CPUs to notice a task that was just queued on a CPU's run queue
+// That CPU has to if it's halted in its idle task or runs a task without ticks. If it's busy,
+// an idle CPU gets to steal the task instead of waiting for it to be done.
+// Inputs: cpu -- the CPU whose queue got the task
+// Outputs: None
+// Side effects: Must be called with interrupts off
+static void kick_for(uint32_t cpu) {
+    uint32_t other, this_cpu = smp_cpu_id();
+    sched_cpu_t* target = &sched_cpus[cpu];
+    int32_t target_idle = is_kernel_pid(target->running_pid);
+    if (cpu != this_cpu && (target_idle || (cpu ? !target->ticking : !tick_armed()))) smp_kick(cpu);
+    if (target_idle) return;
+    for (other = 0; other < SMP_MAX_CPUS; other++) {
+        if (other == cpu || other == this_cpu || !smp_cpu_is_up(other)) continue;
+        if (is_kernel_pid(sched_cpus[other].running_pid) && !smp_kick(other)) break;
+    }
+}
+
+// Puts a task at the back of its priority level's queue, on the CPU it last ran on
+// Inputs: pcb -- the task, which must not be queued already
+// Outputs: None
+// Side effects: Must be called with interrupts off
+static void run_queue_push(pcb_t* pcb) {
+    acct_ready(pcb, rdtsc());
+    pcb->on_run_queue = 1;
+    run_queue_link(&run_queues[pcb->cpu], pcb);
+}
+
+// Links a task in at the back of its priority level's queue on one CPU
+// Inputs: rq -- the CPU's run queue, pcb -- the task, which must not be linked in anywhere
+// Outputs: None
+// Side effects: Must be called with interrupts off
+static void run_queue_link(run_queue_t* rq, pcb_t* pcb) {
+    uint32_t level = pcb->sched_level;
+    pcb->run_next = NULL;
+    pcb->run_prev = rq->tail[level];
+    if (rq->tail[level]) rq->tail[level]->run_next = pcb;
+    else rq->head[level] = pcb;
+    rq->tail[level] = pcb;
+    rq->num_ready++;
+}
+
+// Unlinks a task from the queue it's on, leaving on_run_queue alone
+// Inputs: pcb -- the task, which must be linked in
+// Outputs: None
+// Side effects: Must be called with interrupts off
+static void run_queue_unlink(pcb_t* pcb) {
+    run_queue_t* rq = &run_queues[pcb->cpu];
+    uint32_t level = pcb->sched_level;
+    if (pcb->run_prev) pcb->run_prev->run_next = pcb->run_next;
+    else rq->head[level] = pcb->run_next;
+    if (pcb->run_next) pcb->run_next->run_prev = pcb->run_prev;
+    else rq->tail[level] = pcb->run_prev;
+    pcb->run_prev = pcb->run_next = NULL;
+    rq->num_ready--;
+}
+
+// Takes a task off the run queue, wherever it is on it
+// Inputs: pid -- task to remove
+// Outputs: 0 on success, -1 if the task isn't queued
+// Side effects: The task won't run until queued again
+int sched_remove(uint32_t pid) {
+    pcb_t* pcb = get_pcb(pid);
+    int retval = -1;
+    if (!pcb) return -1;
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        if (pcb->on_run_queue) {
+            run_queue_unlink(pcb);
+            pcb->on_run_queue = 0;
+            retval = 0;
+        }
+    }
+    return retval;
+}
+
+// Counts the tasks waiting for their turn
+// Inputs: None
+// Outputs: Number of tasks on every CPU's run queue, which doesn't include the running ones
+uint32_t sched_num_ready() {
+    uint32_t cpu, total = 0;
+    for (cpu = 0; cpu < SMP_MAX_CPUS; cpu++) total += run_queues[cpu].num_ready;
+    return total;
+}
+
+// Moves a ready task from the busiest other CPU over to one that ran out of work
+// It takes the task due to run there next among those that can run on to_cpu (see
+// task_can_run_on).
+// Inputs: to_cpu -- the CPU to move it to
+// Outputs: PID of the task moved, FAIL_PID if no other CPU has one to spare
+// Side effects: The task runs on to_cpu from now on, until stolen back
+uint32_t sched_steal(uint32_t to_cpu) {
+    uint32_t cpu, busiest = 0;
+    pcb_t* pcb;
+    pcb_t* steal = NULL;
+    uint32_t retval = FAIL_PID;
+    if (to_cpu >= SMP_MAX_CPUS) return FAIL_PID;
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        for (cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+            if (cpu == to_cpu || run_queues[cpu].num_ready <= busiest) continue;
+            pcb = run_queue_first(cpu, to_cpu);
+            if (pcb) {
+                steal = pcb;
+                busiest = run_queues[cpu].num_ready;
+            }
+        }
+        if (steal) {
+            // It keeps waiting, so its wait time carries on counting
+            run_queue_unlink(steal);
+            steal->cpu = to_cpu;
+            run_queue_link(&run_queues[to_cpu], steal);
+            retval = steal->pid;
+        }
+    }
+    return retval;
+}
+
+// Checks whether a task may run on a CPU
+// A process's tasks only run on one CPU at a time, the one its address space is mapped on (see
+// activate_existing_user_programpage), and none at all while a CPU waits to take it over (see
+// sched_wait_for_mm).
+// Inputs: pcb -- the task, cpu -- the CPU
+// Outputs: 1 if it may, 0 if not
+// Side effects: Must be called with interrupts off
+static int32_t task_can_run_on(const pcb_t* pcb, uint32_t cpu) {
+    pcb_t* mapped = get_pcb(pcb->universal_state.paging_state.current_mapped_pid);
+    user_mm_t* mm = mapped ? mapped->mm : NULL;
+    if (!mm) return 1;
+    if (mm->claimed) return 0;
+    return mm->active_cpu == MM_NO_CPU || mm->active_cpu == cpu;
+}
+
+// Waits until no other CPU runs the tasks of an address space, so this one can map it
+// The CPU running them is kicked, and until it's done none of them gets picked anywhere (see
+// task_can_run_on), so the wait ends by the time that CPU switches tasks.
+// Inputs: mm -- the address space
+// Outputs: None
+// Side effects: Must be called in the kernel with interrupts off. Lets other CPUs into the kernel
+//      while it waits, and the running task may be preempted meanwhile.
+void sched_wait_for_mm(user_mm_t* mm) {
+    if (!mm || !mm_is_active_elsewhere(mm)) return;
+    mm->claimed++;
+    smp_kick(mm->active_cpu);
+    while (mm_is_active_elsewhere(mm)) {
+        kernel_lock_leave();
+        asm volatile ("sti; pause; cli" ::: "memory");
+        kernel_lock_enter();
+    }
+    mm->claimed--;
+}
+
+// Works out when a task needs the PIT to interrupt it
+// The next timer has to run on time either way (see timer_next_event). Other than that, with nothing
+// else ready a task can run for as long as it likes, and the idle task only ever stops for interrupts.
+// Otherwise the task's quantum ends or the next boost is due, whichever is first.
+// Inputs: pid -- task about to run, now -- the time in jiffies
+// Outputs: Jiffies from now, 0 if it doesn't need ticks at all
+// Side effects: Must be called with interrupts off
+uint32_t sched_next_event(uint32_t pid, uint32_t now) {
+    pcb_t* pcb = get_pcb(pid);
+    uint32_t until, since_boost;
+    uint32_t timer_until = timer_next_event(now);
+    if (!pcb || is_kernel_pid(pid) || !run_queues[smp_cpu_id()].num_ready) return timer_until;
+
+    until = pcb->ticks_left ? pcb->ticks_left : 1;
+    since_boost = now - last_boost;
+    if (since_boost >= SCHED_BOOST_PERIOD) return 1;
+    if (SCHED_BOOST_PERIOD - since_boost < until) until = SCHED_BOOST_PERIOD - since_boost;
+    if (timer_until && timer_until < until) until = timer_until;
+    return until;
+}
+
+// Arms this CPU's tick for whatever the next task needs next, or stops ticks if it doesn't need any
+// Inputs: next_pcb -- task about to run, now -- the time in jiffies
+// Outputs: None
+// Side effects: Must be called with interrupts off
+static void program_next_tick(pcb_t* next_pcb, uint32_t now) {
+    uint32_t until = sched_next_event(next_pcb->pid, now);
+    // An idle CPU looks again every jiffy for tasks it can steal, which it may not be able to
+    // yet because their process runs on another CPU
+    if (!until && is_kernel_pid(next_pcb->pid) && sched_num_ready()) until = 1;
+    if (until) arm_tick(until);
+    else if (smp_cpu_id()) {
+        lapic_timer_stop();
+        sched_cpus[smp_cpu_id()].ticking = 0;
+    } else {
+        tick_stop();
+    }
+}
+
+// Arms this CPU's tick: the PIT on the boot processor, which also keeps the time and runs the
+// timers, the local APIC timer on the others
+// Inputs: n -- jiffies from now
+// Outputs: None
+// Side effects: Must be called with interrupts off
+static void arm_tick(uint32_t n) {
+    uint32_t cpu = smp_cpu_id();
+    if (cpu) {
+        lapic_timer_arm(n);
+        sched_cpus[cpu].ticking = 1;
+    } else {
+        tick_arm(n);
+    }
+}
+
+// Inputs: None
+// Outputs: Whether this CPU's tick is armed, see arm_tick
+static int32_t tick_is_armed() {
+    uint32_t cpu = smp_cpu_id();
+    return cpu ? sched_cpus[cpu].ticking : tick_armed();
+}
+
+// Charges the running task for the time it had the CPU since it was last charged
+// Inputs: pcb -- the task, now -- the time in jiffies
+// Outputs: None
+// Side effects: Must be called with interrupts off
+static void charge_running(pcb_t* pcb, uint32_t now) {
+    uint32_t used = now - pcb->ran_since;
+    pcb->ran_since = now;
+    pcb->ticks_left = used < pcb->ticks_left ? pcb->ticks_left - used : 0;
+}
+
+// Takes the oldest task of the highest priority level that has any, on this CPU
+// With nothing here that can run, it steals one from another CPU first (see sched_steal).
+// Inputs: None
+// Outputs: The task, NULL if there's nothing to run
+// Side effects: Must be called with interrupts off
+static pcb_t* run_queue_pop() {
+    uint32_t cpu = smp_cpu_id();
+    pcb_t* pcb = run_queue_first(cpu, cpu);
+    if (!pcb) pcb = get_pcb(sched_steal(cpu));
+    if (pcb) sched_remove(pcb->pid);
+    return pcb;
+}
+
+// Finds the task a CPU's run queue has up next for a CPU, skipping those that can't run there
+// Inputs: queue_cpu -- the CPU whose queue to look at, cpu -- the CPU to run it on
+// Outputs: The task, NULL if there's none
+// Side effects: Must be called with interrupts off
+static pcb_t* run_queue_first(uint32_t queue_cpu, uint32_t cpu) {
+    uint32_t level;
+    pcb_t* pcb;
+    for (level = 0; level < SCHED_NUM_LEVELS; level++) {
+        for (pcb = run_queues[queue_cpu].head[level]; pcb; pcb = pcb->run_next) {
+            if (task_can_run_on(pcb, cpu)) return pcb;
+        }
+    }
+    return NULL;
+}
+
+// Checks for ready tasks on this CPU that take precedence over a priority level
+// Inputs: level -- the level
+// Outputs: 1 if a task of a higher level (a lower number) is ready to run here, 0 otherwise
+// Side effects: Must be called with interrupts off
+static int32_t higher_level_ready(uint32_t level) {
+    uint32_t i, cpu = smp_cpu_id();
+    pcb_t* pcb;
+    for (i = 0; i < level && i < SCHED_NUM_LEVELS; i++) {
+        for (pcb = run_queues[cpu].head[i]; pcb; pcb = pcb->run_next) {
+            if (task_can_run_on(pcb, cpu)) return 1;
+        }
+    }
+    return 0;
+}
+
+// Finds how far down a task may be demoted
+// Inputs: pcb -- the task
+// Outputs: The last level, or the one above it for the displayed terminal's tasks so they always
+//      run ahead of background work that used up its quanta
+static uint32_t lowest_level_of(const pcb_t* pcb) {
+    if (is_foreground(pcb->pid)) return SCHED_NUM_LEVELS - 2;
+    return SCHED_NUM_LEVELS - 1;
+}
+
+// Checks whether a task belongs to the terminal on screen
+// Inputs: pid -- the task
+// Outputs: 1 if it runs in the displayed terminal, 0 otherwise
+static int32_t is_foreground(uint32_t pid) {
+    return (int32_t)get_canonical_pid(pid) - 1 == displayed_tid;
+}
+
+// Moves every ready task (and the running ones) back to the top level, on every CPU
+// Tasks that use up their quanta sink to the last level; this keeps them from starving there
+// forever behind interactive ones, and lets tasks that stopped hogging the CPU climb back.
+// Inputs: None
+// Outputs: None
+// Side effects: Must be called with interrupts off
+static void boost_all_levels() {
+    uint32_t cpu, level;
+    pcb_t* pcb;
+    pcb_t* curr = get_current_pcb();
+    for (cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        run_queue_t* rq = &run_queues[cpu];
+        for (level = 1; level < SCHED_NUM_LEVELS; level++) {
+            for (pcb = rq->head[level]; pcb; pcb = pcb->run_next) pcb->sched_level = 0;
+            if (!rq->head[level]) continue;
+            // Splice the whole level onto the back of level 0, oldest first
+            rq->head[level]->run_prev = rq->tail[0];
+            if (rq->tail[0]) rq->tail[0]->run_next = rq->head[level];
+            else rq->head[0] = rq->head[level];
+            rq->tail[0] = rq->tail[level];
+            rq->head[level] = rq->tail[level] = NULL;
+        }
+        pcb = get_pcb(sched_cpus[cpu].running_pid);
+        if (pcb && !is_kernel_pid(pcb->pid) && !pcb->on_run_queue) pcb->sched_level = 0;
+    }
+    if (curr && !is_kernel_pid(curr->pid)) curr->sched_level = 0;
+    sched_boosts++;
+}
+
+// Makes a task that was asleep ready to run again, ahead of the ones that kept the CPU busy
+// Waking up moves it a priority level up, and to the top if it belongs to the displayed terminal
+// so whoever is typing there gets answered first. Either way it starts with a fresh quantum.
+// Inputs: pid -- task that woke up, which must not be running or queued already
+// Outputs: 0 on success, -1 if there's no such task or it's queued already
+// Side effects: If it should run before the task running on its CPU, the next interrupt to finish
+//      there switches to it
+int sched_wake(uint32_t pid) {
+    pcb_t* pcb = get_pcb(pid);
+    pcb_t* curr;
+    int retval = -1;
+    if (!pcb || is_kernel_pid(pid)) return -1;
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        if (!pcb->on_run_queue) {
+            if (is_foreground(pid)) pcb->sched_level = 0;
+            else if (pcb->sched_level) pcb->sched_level--;
+            pcb->ticks_left = 0;
+            retval = sched_enqueue(pid);
+            curr = pcb->cpu == smp_cpu_id() ? get_current_pcb() : get_pcb(sched_cpus[pcb->cpu].running_pid);
+            if (!curr || is_kernel_pid(curr->pid) || pcb->sched_level < curr->sched_level) {
+                sched_cpus[pcb->cpu].need_resched_flag = 1;
+            }
+        }
+    }
+    return retval;
+}
+
+// Sets how long a task's quantum is, so batch work can run for longer stretches and latency
+// sensitive work can make way sooner. It still doubles from priority level to level.
+// Inputs: pid -- the task, quantum -- jiffies at level 0, up to SCHED_MAX_QUANTUM. 0 for the default.
+// Outputs: 0 on success, -1 if there's no such task or the quantum is too long
+// Side effects: Takes effect from the task's next quantum
+int32_t sched_set_quantum(uint32_t pid, uint32_t quantum) {
+    pcb_t* pcb = get_pcb(pid);
+    if (!pcb || is_kernel_pid(pid) || quantum > SCHED_MAX_QUANTUM) return -1;
+    pcb->quantum = quantum;
+    return 0;
 }
 
-// Look ahead at the next scheduled PID without updating any state
+// Checks whether the running task should make way for one that just woke up
+// Interrupt handlers check this once they're done (see common_interrupt_handler) and sched_yield if so.
 // Inputs: None
-// Outputs: The next scheduled PID
-int peek_next_scheduled_pid() {
-    return pids_for_states[(pfs_ptr + 1) % NUM_SIMULTANEOUS_PROCS];
+// Outputs: 1 if a task of a higher priority level than the running one is ready here, 0 otherwise
+int sched_need_resched() {
+    uint32_t cpu = smp_cpu_id();
+    return sched_cpus[cpu].need_resched_flag && run_queues[cpu].num_ready;
 }
 
 // Injects a kernel IRET context into the PCB for a PID that will be returned to in kernel mode
@@ -77,16 +556,6 @@ int inject_kiret_into_kstack(uint32_t target_pid) {
     return 0;
 }
 
-// Gets the PID to load state from -- aka, the next scheduled PID
-// Why is it called loadfrom? All values in pids_for_states are consciously set by us; they will not
-// change under our noses, so they will always have valid info.
-// Inputs: none
-// Outputs: the loadfrom PID
-// Side effects: Really?
-int get_loadfrom_pid() {
-    return pids_for_states[pfs_ptr];
-}
-
 // Gets the PID to store state to -- aka, the preempted PID
 // Why is it called storeto? Because the PID may change if we end up halting or executing, so this
 // would be where we would store our current state instead of what we last recorded.
@@ -95,7 +564,6 @@ int get_loadfrom_pid() {
 // Outputs: the storeto PID
 // Side effects: Returns the PID from which state must be stored into
 int get_storeto_pid() {
-    if (ignore_prior_state_for_init_flag) return NUM_SIMULTANEOUS_PROCS;
     return derive_pid_from_esp();
 }
 
@@ -113,10 +581,9 @@ void schedule_failed(int retval) {
 // Outputs: None
 // Side effects: Updates fill_context such that on return of this function and returning to ASM linkage, the return to the process's kernel mode works
 void exit_sched_to_k_helper(exit_sched_to_k_context_t* fill_context) {
-    uint32_t preempted_pid = get_storeto_pid();
-    uint32_t next_pid = set_current_and_get_next_scheduled_pid(preempted_pid);
-    load_resuming_state_kernel(fill_context, next_pid);
-    ignore_prior_state_for_init_flag = 0;
+    sched_cpu_t* self = &sched_cpus[smp_cpu_id()];
+    load_resuming_state_kernel(fill_context, self->next_scheduled_pid);
+    self->current_task_gone_flag = 0;
 }
 
 // Called from an ASM function, do complex loading in C for return to the process in user mode
@@ -124,26 +591,170 @@ void exit_sched_to_k_helper(exit_sched_to_k_context_t* fill_context) {
 // Outputs: None
 // Side effects: Updates fill_context such that on return of this function and returning to ASM linkage, the return to the process's user mode works
 void exit_sched_to_u_helper(exit_sched_to_u_context_t* fill_context) {
-    uint32_t preempted_pid = get_storeto_pid();
-    uint32_t next_pid = set_current_and_get_next_scheduled_pid(preempted_pid);
-    load_resuming_state_user(fill_context, next_pid);
-    ignore_prior_state_for_init_flag = 0;
+    sched_cpu_t* self = &sched_cpus[smp_cpu_id()];
+    load_resuming_state_user(fill_context, self->next_scheduled_pid);
+    self->current_task_gone_flag = 0;
+}
+
+// Finds where exit_sched_to_u builds the context to return to user mode with: the top of the next
+// task's kernel stack, which holds nothing while the task is in user mode. The stack we're on may
+// be the task we just left, which another CPU can pick up as soon as we let go of the kernel lock.
+// Inputs: None
+// Outputs: ESP to switch to
+uint32_t exit_sched_stack() {
+    return get_pcb(sched_cpus[smp_cpu_id()].next_scheduled_pid)->universal_state.esp0;
 }
 
 // Handles the PIT interrupt, called through the PIT asm linkage
+// The PIT only interrupts when a one-shot armed by program_next_tick runs out, so this runs the
+// timers due since and charges the running task for all the jiffies since it was last charged.
 // Inputs: The hardware context as was initialized by the IDT function
 // Outputs: 0 on success
 // Side effects: Completes a scheduling cycle
 int32_t handle_pit_interrupt(sched_hwcontext_t* proc_context) {
-    if (!ignore_prior_state_for_init_flag) {
-        store_universal_state_in_pcb(proc_context);
-    }
+    pcb_t* curr = get_pcb(get_storeto_pid());
+    uint32_t now;
+    tick_expired();
+    now = tick_now();
+    timer_run(now);
+    sched_tick(curr, now);
+    store_universal_state_in_pcb(proc_context);
     send_eoi(PIT_IRQ);
-    uint32_t next_pid = peek_next_scheduled_pid();
+    switch_to_next_scheduled(0);
+    return 0;
+}
 
-    set_active_terminal(get_canonical_pid(next_pid) - 1);
+// Handles the local APIC timer and reschedule IPIs of the application processors, called through
+// their asm linkage. The timer is armed like the PIT (see arm_tick), but only the PIT keeps the
+// time and runs the timers. A reschedule IPI (see smp_kick) just gets the CPU to pick again.
+// Inputs: The hardware context as was initialized by the IDT function
+// Outputs: 0 on success
+// Side effects: Completes a scheduling cycle
+int32_t handle_lapic_interrupt(sched_hwcontext_t* proc_context) {
+    sched_tick(get_pcb(get_storeto_pid()), tick_now());
+    store_universal_state_in_pcb(proc_context);
+    lapic_eoi();
+    switch_to_next_scheduled(0);
+    return 0;
+}
+
+// Charges the interrupted task for its time, and boosts every task when it's time to
+// Inputs: curr -- the interrupted task, now -- the time in jiffies
+// Outputs: None
+// Side effects: Must be called with interrupts off
+static void sched_tick(pcb_t* curr, uint32_t now) {
+    if (curr && !is_kernel_pid(curr->pid)) {
+        charge_running(curr, now);
+        // Used up its whole quantum, so it's busy computing: other tasks go first from now on
+        if (!curr->ticks_left && curr->sched_level < lowest_level_of(curr)) {
+            curr->sched_level++;
+            sched_demotions++;
+        }
+    }
+    if (now - last_boost >= SCHED_BOOST_PERIOD) {
+        last_boost = now;
+        boost_all_levels();
+    }
+}
+
+// Handles the scheduler's software interrupt (see sched_yield), like a PIT interrupt but without the EOI
+// Inputs: The hardware context as was initialized by the IDT function
+// Outputs: Doesn't return to the caller, the task resumes past its int instruction once scheduled
+// Side effects: Completes a scheduling cycle
+int32_t handle_sched_interrupt(sched_hwcontext_t* proc_context) {
+    store_universal_state_in_pcb(proc_context);
+    switch_to_next_scheduled(1);
+    return 0;
+}
+
+// Gives up the CPU to the next ready task, whatever its priority level
+// The running task goes to the back of its level's queue, unless it's blocked (see sleep_on).
+// Inputs: None
+// Outputs: None
+// Side effects: Returns once the task is scheduled again, with the interrupt flag as it was
+void sched_yield() {
+    asm volatile ("int %0" :: "i"(IDT_SCHED) : "memory", "cc");
+}
+
+// Leaves the running task for good, without saving any of its state
+// Inputs: None
+// Outputs: None, doesn't return
+// Side effects: Switches to the task at the front of the run queue. Whatever freed the running task
+//      must not have let anything reuse its kernel stack, which we leave with interrupts off.
+void sched_exit_current() {
+    cli();
+    sched_cpus[smp_cpu_id()].current_task_gone_flag = 1;
+    switch_to_next_scheduled(1);
+}
+
+// Resumes the next task to run, in whatever mode it was stopped in
+// The running task keeps the CPU while it has some of its quantum left and no higher priority level
+// has work, unless it's yielding. Otherwise it goes to the back of its level's queue (unless it's gone
+// or blocked) and the oldest task of the highest level with any runs. If nothing else is ready the
+// running task just keeps going, and if it can't either the idle task runs. A running task whose
+// process another CPU waits for (see sched_wait_for_mm) makes way like a yielding one. Then this
+// CPU's tick is armed for whatever the next task needs, if anything (see sched_next_event).
+// Inputs: yielding -- whether the running task gives up the rest of its quantum
+// Outputs: None, doesn't return
+// Side effects: The state of the running task must be saved already (or not needed anymore)
+static void switch_to_next_scheduled(int yielding) {
+    uint32_t cpu = smp_cpu_id();
+    sched_cpu_t* self = &sched_cpus[cpu];
+    pcb_t* prev_pcb = self->current_task_gone_flag ? NULL : get_pcb(get_storeto_pid());
+    pcb_t* next_pcb = NULL;
+    // The idle task never queues up, it only runs when nothing else can
+    int prev_runnable = prev_pcb && !prev_pcb->blocked && !is_kernel_pid(prev_pcb->pid);
+    int prev_may_stay = prev_runnable && task_can_run_on(prev_pcb, cpu);
+    int prev_idle = prev_pcb && is_kernel_pid(prev_pcb->pid);
+    // Giving up the CPU by blocking or yielding is voluntary, unless it's to make way for a task
+    // that just woke up (see sched_need_resched)
+    int voluntary = prev_pcb && (prev_pcb->blocked || (yielding && !self->need_resched_flag));
+    uint32_t now = tick_now();
+    uint64_t now_tsc = rdtsc();
+
+    self->need_resched_flag = 0;
+    if (prev_pcb && !prev_idle) {
+        charge_running(prev_pcb, now);
+        acct_charge(prev_pcb, now_tsc, prev_pcb->universal_state.iret_regs.cs == KERNEL_CS);
+    }
+    if (prev_may_stay && !yielding && prev_pcb->ticks_left && !higher_level_ready(prev_pcb->sched_level)) {
+        next_pcb = prev_pcb;
+    } else {
+        next_pcb = run_queue_pop();
+        if (prev_runnable) {
+            if (next_pcb || !prev_may_stay) {
+                prev_pcb->cpu = cpu;
+                run_queue_push(prev_pcb);
+            } else {
+                next_pcb = prev_pcb;
+            }
+        }
+    }
+    if (!next_pcb) next_pcb = get_pcb(SCHED_IDLE_PID);
+    if (!is_kernel_pid(next_pcb->pid) && !next_pcb->ticks_left) {
+        next_pcb->ticks_left = (next_pcb->quantum ? next_pcb->quantum : SCHED_BASE_QUANTUM) << next_pcb->sched_level;
+    }
+    if (next_pcb != prev_pcb) {
+        sched_switches++;
+        if (prev_pcb && !prev_idle) {
+            acct_stop(prev_pcb);
+            if (voluntary) prev_pcb->acct.voluntary_switches++;
+            else prev_pcb->acct.involuntary_switches++;
+        }
+        if (!is_kernel_pid(next_pcb->pid)) acct_dispatch(next_pcb, now_tsc);
+        next_pcb->ran_since = now;
+        if (prev_idle) sched_idle_jiffies += now - self->idle_since;
+        if (is_kernel_pid(next_pcb->pid)) self->idle_since = now;
+    }
+    self->next_scheduled_pid = self->running_pid = next_pcb->pid;
+    program_next_tick(next_pcb, now);
+
+    if (!is_kernel_pid(next_pcb->pid)) {
+        spin_lock(&terminal_lock);
+        set_active_terminal(get_canonical_pid(next_pcb->pid) - 1);
+        spin_unlock(&terminal_lock);
+    }
 
-    pcb_t* next_pcb = get_pcb(next_pid);
     if (next_pcb->universal_state.iret_regs.cs == KERNEL_CS) {
         exit_sched_to_k();
     } else if (next_pcb->universal_state.iret_regs.cs == USER_CS) {
@@ -151,7 +762,6 @@ int32_t handle_pit_interrupt(sched_hwcontext_t* proc_context) {
     } else {
         PRINT_ASSERT(0, "Bad saved CS value!!\n");
     }
-    return 0;
 }
 
 // Prepares the PCB and memroy for the PID to initialize at a program, very helpful for testing scheduling without the terminals
@@ -236,7 +846,7 @@ int store_universal_state_in_pcb(sched_hwcontext_t* proc_context) {
     store_pcb->universal_state.iret_regs._pad_cs = 0;
     store_pcb->universal_state.iret_regs.eflags = proc_context->iret_context.eflags;
 
-    store_pcb->universal_state.esp0 = tss.esp0;
+    store_pcb->universal_state.esp0 = smp_tss()->esp0;
     store_pcb->universal_state.paging_state = current_universe_paging_state();
 
     if (proc_context->iret_context.cs == USER_CS) {
@@ -269,9 +879,18 @@ int load_resuming_state_user(exit_sched_to_u_context_t* destination, uint32_t re
     if (!source_pcb) return -1;
     destination->regs_context = source_pcb->universal_state.gp_regs;
     destination->iret_context = source_pcb->universal_state.iret_regs;
-    tss.ss0 = KERNEL_DS;
-    tss.esp0 = source_pcb->universal_state.esp0;
-    load_paging_state_to_universe(source_pcb->universal_state.paging_state);
+    update_tss_for_new_stack(KERNEL_DS, source_pcb->universal_state.esp0);
+    if (is_kernel_pid(resume_pid)) {
+        // The idle task only touches kernel memory. It lets go of the user window, so another
+        // CPU can map that process (see sched_wait_for_mm).
+        proc_paging_state_t idle_paging_state = current_universe_paging_state();
+        idle_paging_state.active_pde = get_kernel_page_directory();
+        idle_paging_state.current_mapped_pid = 0;
+        idle_paging_state.user_vidmem_active = 0;
+        load_paging_state_to_universe(idle_paging_state);
+    } else {
+        load_paging_state_to_universe(source_pcb->universal_state.paging_state);
+    }
     return 0;
 }
 
@@ -290,8 +909,49 @@ int load_resuming_state_kernel(exit_sched_to_k_context_t* destination, uint32_t
     // so it will not be reinitialized here.
     destination->next_esp = (uint32_t*)source_pcb->universal_state.iret_regs.esp;
 
-    tss.ss0 = KERNEL_DS;
-    tss.esp0 = source_pcb->universal_state.esp0;
-    load_paging_state_to_universe(source_pcb->universal_state.paging_state);
+    update_tss_for_new_stack(KERNEL_DS, source_pcb->universal_state.esp0);
+    if (is_kernel_pid(resume_pid)) {
+        // The idle task only touches kernel memory. It lets go of the user window, so another
+        // CPU can map that process (see sched_wait_for_mm).
+        proc_paging_state_t idle_paging_state = current_universe_paging_state();
+        idle_paging_state.active_pde = get_kernel_page_directory();
+        idle_paging_state.current_mapped_pid = 0;
+        idle_paging_state.user_vidmem_active = 0;
+        load_paging_state_to_universe(idle_paging_state);
+    } else {
+        load_paging_state_to_universe(source_pcb->universal_state.paging_state);
+    }
     return 0;
 }
+
+// Prints how busy the CPUs have been, counted in jiffies
+// ticks is how many times the PIT actually interrupted, which is far less than a tick per jiffy.
+// idle adds up every CPU's, so busy is out of uptime on each of them.
+// Inputs: out -- buffer to print into
+// Outputs: None
+static void sched_show(kernfs_buf_t* out) {
+    uint32_t uptime = tick_now();
+    uint32_t idle = sched_idle_jiffies;
+    uint32_t capacity = uptime * smp_num_cpus;
+    kernfs_puts(out, "uptime:   ");
+    kernfs_putu(out, uptime, 0);
+    kernfs_puts(out, "\nidle:     ");
+    kernfs_putu(out, idle, 0);
+    kernfs_puts(out, "\nbusy:     ");
+    kernfs_putu(out, capacity > idle ? (capacity - idle) * 100 / capacity : 0, 0);
+    kernfs_puts(out, "%\nticks:    ");
+    kernfs_putu(out, tick_num_interrupts(), 0);
+    kernfs_puts(out, "\ncpus:     ");
+    kernfs_putu(out, smp_num_cpus, 0);
+    kernfs_puts(out, "\nready:    ");
+    kernfs_putu(out, sched_num_ready(), 0);
+    kernfs_puts(out, "\nswitches: ");
+    kernfs_putu(out, sched_switches, 0);
+    kernfs_puts(out, "\nhalts:    ");
+    kernfs_putu(out, sched_idle_halts, 0);
+    kernfs_puts(out, "\ndemoted:  ");
+    kernfs_putu(out, sched_demotions, 0);
+    kernfs_puts(out, "\nboosts:   ");
+    kernfs_putu(out, sched_boosts, 0);
+    kernfs_putc(out, '\n');
+}
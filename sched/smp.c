@@ -0,0 +1,134 @@
+#include "smp.h"
+#include "../lib.h"
+#include "../paging.h"
+#include "../idt.h"
+#include "../process/process.h"
+#include "../device-drivers/apic.h"
+#include "../device-drivers/pit.h"
+#include "kernel_lock.h"
+#include "sched.h"
+#include "tick.h"
+
+volatile uint32_t smp_num_cpus = 1;
+volatile uint32_t smp_ap_next_id = 1;
+uint32_t smp_ap_stacks[SMP_MAX_CPUS];
+// Local APIC IDs by CPU number, for sending them IPIs
+uint32_t smp_apic_ids[SMP_MAX_CPUS];
+// Whether each application processor runs tasks, see smp_ap_main
+static volatile int32_t smp_cpu_up[SMP_MAX_CPUS];
+// TSSs of the application processors, by CPU number. The boot processor has the one in x86_desc.S.
+static tss_t ap_tss[SMP_MAX_CPUS];
+
+// Starts the application processors
+// Every other CPU gets INIT and two startup IPIs pointing at the trampoline, which brings it to
+// smp_ap_main on the stack of its idle task. There's no table of CPUs to go through: whoever
+// shows up gets a number, up to SMP_MAX_CPUS.
+// Inputs: None
+// Outputs: None
+// Side effects: Sets up an idle task and page directories per possible CPU (see
+//      process_allocate_idle and paging_init_cpu), and the trampoline page. Busy-waits some 100ms.
+//      Without a local APIC the kernel simply stays on one CPU.
+void smp_init() {
+    uint32_t i;
+    if (lapic_init()) return;
+    smp_apic_ids[0] = lapic_id();
+
+    for (i = 1; i < SMP_MAX_CPUS; i++) {
+        // A CPU without a stack parks in the trampoline
+        if (paging_init_cpu(i)) break;
+        smp_ap_stacks[i] = process_allocate_idle(i);
+        if (!smp_ap_stacks[i]) break;
+    }
+    if (map_kernel_identity_low_page(SMP_TRAMPOLINE_ADDR)) return;
+    memcpy((void*)SMP_TRAMPOLINE_ADDR, smp_trampoline_start, smp_trampoline_end - smp_trampoline_start);
+    memcpy((void*)(SMP_TRAMPOLINE_ADDR + (smp_trampoline_gdtr - smp_trampoline_start)), gdt_desc_ptr, sizeof(gdt_desc_ptr));
+
+    lapic_ipi_all_but_self(LAPIC_ICR_INIT | LAPIC_ICR_ASSERT);
+    pit_udelay(SMP_INIT_DELAY);
+    for (i = 0; i < 2; i++) {
+        lapic_ipi_all_but_self(LAPIC_ICR_STARTUP | LAPIC_ICR_ASSERT | SMP_STARTUP_VECTOR);
+        pit_udelay(SMP_SIPI_DELAY);
+    }
+    pit_udelay(SMP_CHECKIN_DELAY);
+}
+
+// Finds out which CPU this is
+// Every CPU loads a TSS of its own, so the task register already says which one it is without
+// going out to the local APIC.
+// Inputs: None
+// Outputs: Its CPU number, 0 for the boot processor (and for everything before smp_init)
+uint32_t smp_cpu_id() {
+    uint16_t tr;
+    asm volatile ("str %0" : "=r"(tr));
+    if (tr < AP_TSS_BASE) return 0;
+    return (tr - AP_TSS_BASE) / sizeof(seg_desc_t) + 1;
+}
+
+// Finds the TSS of the CPU this runs on, whose esp0 is where its next trap into the kernel lands
+// Inputs: None
+// Outputs: The TSS
+tss_t* smp_tss() {
+    uint32_t cpu = smp_cpu_id();
+    return cpu ? &ap_tss[cpu] : &tss;
+}
+
+// Gets a CPU to look at its run queue, see sched_enqueue
+// The boot processor gets its PIT tick moved up, the others a reschedule IPI.
+// Inputs: cpu -- the CPU
+// Outputs: 0 on success, -1 if that CPU doesn't run tasks
+int32_t smp_kick(uint32_t cpu) {
+    if (!cpu) {
+        tick_arm(1);
+        return 0;
+    }
+    if (cpu >= SMP_MAX_CPUS || !smp_cpu_up[cpu]) return -1;
+    lapic_ipi(smp_apic_ids[cpu], IDT_RESCHED);
+    return 0;
+}
+
+// Inputs: cpu -- a CPU number
+// Outputs: Whether it runs tasks
+int32_t smp_cpu_is_up(uint32_t cpu) {
+    if (!cpu) return 1;
+    return cpu < SMP_MAX_CPUS && smp_cpu_up[cpu];
+}
+
+// Where an application processor goes from the trampoline, still without paging
+// It sets up its own TSS, paging and local APIC, then becomes an idle task like the boot
+// processor's, taking tasks off its run queue or stealing them from the others (see sched_idle).
+// Inputs: cpu -- the number it got
+// Outputs: None, doesn't return
+// Side effects: Takes the kernel lock like any other way into the kernel. Without a working local
+//      APIC timer it couldn't preempt its tasks, so it halts with interrupts off for good instead.
+void smp_ap_main(uint32_t cpu) {
+    seg_desc_t the_tss_desc;
+    the_tss_desc.granularity   = 0x0;
+    the_tss_desc.opsize        = 0x0;
+    the_tss_desc.reserved      = 0x0;
+    the_tss_desc.avail         = 0x0;
+    the_tss_desc.present       = 0x1;
+    the_tss_desc.dpl           = 0x0;
+    the_tss_desc.sys           = 0x0;
+    the_tss_desc.type          = 0x9;
+    SET_TSS_PARAMS(the_tss_desc, &ap_tss[cpu], tss_size);
+    ap_tss_desc_ptr[cpu - 1] = the_tss_desc;
+
+    ap_tss[cpu].ldt_segment_selector = KERNEL_LDT;
+    ap_tss[cpu].ss0 = KERNEL_DS;
+    ap_tss[cpu].esp0 = smp_ap_stacks[cpu];
+    ltr(AP_TSS_SEL(cpu));
+    lidt(idt_desc_ptr);
+    paging_start_cpu();
+
+    lapic_enable();
+    smp_apic_ids[cpu] = lapic_id();
+    kernel_lock_enter();
+    if (lapic_timer_init()) {
+        kernel_lock_leave();
+        while (1) asm volatile ("cli; hlt");
+    }
+    asm volatile ("lock incl %0" : "+m"(smp_num_cpus) :: "memory");
+    smp_cpu_up[cpu] = 1;
+
+    while (1) sched_idle();
+}
@@ -0,0 +1,35 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include "../x86_desc.h"
+
+// Physical page the application processors start in (real mode), see smp_trampoline.S
+#define SMP_TRAMPOLINE_ADDR     0x8000
+#define SMP_STARTUP_VECTOR      (SMP_TRAMPOLINE_ADDR >> 12)
+// Waits of the INIT-SIPI-SIPI sequence, and how long to give the APs to check in, in microseconds
+#define SMP_INIT_DELAY          10000
+#define SMP_SIPI_DELAY          200
+#define SMP_CHECKIN_DELAY       100000
+
+#ifndef ASM
+
+extern volatile uint32_t smp_num_cpus;
+// Read by the trampoline: the next CPU number to hand out, and the top of each CPU's idle task
+// stack (see process_allocate_idle)
+extern volatile uint32_t smp_ap_next_id;
+extern uint32_t smp_ap_stacks[SMP_MAX_CPUS];
+extern uint32_t smp_apic_ids[SMP_MAX_CPUS];
+
+extern uint8_t smp_trampoline_start[];
+extern uint8_t smp_trampoline_gdtr[];
+extern uint8_t smp_trampoline_end[];
+
+void smp_init();
+uint32_t smp_cpu_id();
+tss_t* smp_tss();
+int32_t smp_kick(uint32_t cpu);
+int32_t smp_cpu_is_up(uint32_t cpu);
+void smp_ap_main(uint32_t cpu);
+
+#endif /* ASM */
+#endif
@@ -0,0 +1,221 @@
+#include "spinlock.h"
+#include "../lib.h"
+#include "../memfs/kernfs.h"
+
+// Every lock_stats_t that was named, newest first, for the lockstat kernel file
+static lock_stats_t* stats_list;
+static spinlock_t stats_list_lock;
+
+static void lock_note_acquired(lock_stats_t* stats, uint32_t* held_since, uint32_t spins);
+static void lock_note_released(lock_stats_t* stats, uint32_t held_since);
+static void lockstat_show(kernfs_buf_t* out);
+
+// Tells the CPU it's in a spin loop, which saves power and lets a hyperthread sibling run
+static inline void cpu_relax(void) {
+    asm volatile ("pause" ::: "memory");
+}
+
+// Registers the lockstat kernel file
+// Inputs: None
+// Outputs: None
+void lock_init() {
+    kernfs_register("lockstat", lockstat_show, NULL);
+}
+
+// Starts keeping statistics under a name, for spin_lock_init and ticket_lock_init to point locks at
+// Inputs: stats -- the statistics, which must outlive every lock using them, name -- shown in lockstat
+// Outputs: None
+// Side effects: Zeroes the counts. Statistics set up again (say by process_init) keep their place.
+void lock_stats_init(lock_stats_t* stats, const char* name) {
+    lock_stats_t* listed;
+    lock_stats_t* next;
+    if (!stats) return;
+    uint32_t flags, garbage;
+    SPIN_LOCK_IRQSAVE(&stats_list_lock, flags, garbage) {
+        for (listed = stats_list; listed && listed != stats; listed = listed->next);
+        next = listed ? stats->next : stats_list;
+        memset(stats, 0, sizeof(*stats));
+        stats->name = name;
+        stats->next = next;
+        if (!listed) stats_list = stats;
+    }
+}
+
+// Initializes a lock as unlocked
+// Inputs: lock -- the lock, stats -- where to count its use (see lock_stats_init), NULL to not count
+// Outputs: None
+void spin_lock_init(spinlock_t* lock, lock_stats_t* stats) {
+    if (!lock) return;
+    lock->locked = 0;
+    lock->held_since = 0;
+    lock->stats = stats;
+}
+
+// Takes a lock, spinning until whoever has it lets go
+// Interrupts stay as they are, so only use this for locks interrupt handlers never take, or
+// with interrupts off already. Otherwise use spin_lock_irqsave.
+// Inputs: lock -- the lock, which this CPU must not hold already
+// Outputs: None
+void spin_lock(spinlock_t* lock) {
+    uint32_t spins = 0;
+    uint32_t taken;
+    while (1) {
+        taken = 1;
+        asm volatile ("xchgl %0, %1" : "+r"(taken), "+m"(lock->locked) :: "memory");
+        if (!taken) break;
+        // Only read while it's taken, so the cache line isn't bounced around by the xchg
+        while (lock->locked) {
+            cpu_relax();
+            spins++;
+        }
+        if (!spins) spins = 1;
+    }
+    lock_note_acquired(lock->stats, &lock->held_since, spins);
+}
+
+// Takes a lock if nobody has it
+// Inputs: lock -- the lock
+// Outputs: 1 if it was taken, 0 if somebody else has it
+int32_t spin_trylock(spinlock_t* lock) {
+    uint32_t taken = 1;
+    if (lock->locked) return 0;
+    asm volatile ("xchgl %0, %1" : "+r"(taken), "+m"(lock->locked) :: "memory");
+    if (taken) return 0;
+    lock_note_acquired(lock->stats, &lock->held_since, 0);
+    return 1;
+}
+
+// Lets go of a lock
+// Inputs: lock -- the lock, which this CPU must hold
+// Outputs: None
+void spin_unlock(spinlock_t* lock) {
+    lock_note_released(lock->stats, lock->held_since);
+    // Stores aren't reordered with earlier loads or stores on x86, the compiler only needs telling
+    asm volatile ("" ::: "memory");
+    lock->locked = 0;
+}
+
+// Turns interrupts off on this CPU, then takes a lock
+// For locks that interrupt handlers take too: one can't interrupt the holder on this CPU and spin forever.
+// Inputs: lock -- the lock
+// Outputs: The flags to hand to spin_unlock_irqrestore
+uint32_t spin_lock_irqsave(spinlock_t* lock) {
+    uint32_t flags;
+    cli_and_save(flags);
+    spin_lock(lock);
+    return flags;
+}
+
+// Lets go of a lock taken with spin_lock_irqsave and puts interrupts back the way they were
+// Inputs: lock -- the lock, flags -- what spin_lock_irqsave returned
+// Outputs: None
+void spin_unlock_irqrestore(spinlock_t* lock, uint32_t flags) {
+    spin_unlock(lock);
+    restore_flags(flags);
+}
+
+// Initializes a ticket lock as unlocked
+// Inputs: lock -- the lock, stats -- where to count its use (see lock_stats_init), NULL to not count
+// Outputs: None
+void ticket_lock_init(ticket_lock_t* lock, lock_stats_t* stats) {
+    if (!lock) return;
+    lock->next = lock->owner = 0;
+    lock->held_since = 0;
+    lock->stats = stats;
+}
+
+// Takes a ticket lock, after everyone that asked for it first
+// Same rules about interrupts as spin_lock.
+// Inputs: lock -- the lock, which this CPU must not hold already
+// Outputs: None
+void ticket_lock(ticket_lock_t* lock) {
+    uint32_t spins = 0;
+    uint32_t ticket = 1;
+    asm volatile ("lock xaddl %0, %1" : "+r"(ticket), "+m"(lock->next) :: "memory");
+    while (lock->owner != ticket) {
+        cpu_relax();
+        spins++;
+    }
+    lock_note_acquired(lock->stats, &lock->held_since, spins);
+}
+
+// Lets go of a ticket lock, to whoever drew the next ticket
+// Inputs: lock -- the lock, which this CPU must hold
+// Outputs: None
+void ticket_unlock(ticket_lock_t* lock) {
+    lock_note_released(lock->stats, lock->held_since);
+    asm volatile ("" ::: "memory");
+    // Only the holder writes owner, so this needs no lock prefix
+    lock->owner = lock->owner + 1;
+}
+
+// Turns interrupts off on this CPU, then takes a ticket lock, see spin_lock_irqsave
+// Inputs: lock -- the lock
+// Outputs: The flags to hand to ticket_unlock_irqrestore
+uint32_t ticket_lock_irqsave(ticket_lock_t* lock) {
+    uint32_t flags;
+    cli_and_save(flags);
+    ticket_lock(lock);
+    return flags;
+}
+
+// Lets go of a ticket lock taken with ticket_lock_irqsave and puts interrupts back the way they were
+// Inputs: lock -- the lock, flags -- what ticket_lock_irqsave returned
+// Outputs: None
+void ticket_unlock_irqrestore(ticket_lock_t* lock, uint32_t flags) {
+    ticket_unlock(lock);
+    restore_flags(flags);
+}
+
+// Counts an acquisition and starts timing the hold
+// Inputs: stats -- the lock's statistics, NULL if it keeps none, held_since -- the lock's timestamp,
+//      spins -- rounds it waited, 0 if it got the lock right away
+// Outputs: None
+static void lock_note_acquired(lock_stats_t* stats, uint32_t* held_since, uint32_t spins) {
+    if (!stats) return;
+    stats->acquired++;
+    if (spins) {
+        stats->contended++;
+        stats->spins += spins;
+    }
+    *held_since = rdtsc_low();
+}
+
+// Adds the hold that's ending to the lock's statistics
+// Inputs: stats -- the lock's statistics, NULL if it keeps none, held_since -- when it was taken
+// Outputs: None
+static void lock_note_released(lock_stats_t* stats, uint32_t held_since) {
+    uint32_t held;
+    if (!stats) return;
+    // The low word wraps every second or so, which no hold should come anywhere near
+    held = rdtsc_low() - held_since;
+    stats->hold_total += held;
+    if (held > stats->hold_max) stats->hold_max = held;
+}
+
+// Prints one line per named family of locks: how often they were taken and waited for, and
+// how long they were held on average and at most, in TSC cycles
+// Inputs: out -- buffer to print into
+// Outputs: None
+static void lockstat_show(kernfs_buf_t* out) {
+    lock_stats_t* stats;
+    uint32_t i;
+    kernfs_puts(out, "name        acquired contended     spins  hold_avg  hold_max\n");
+    for (stats = stats_list; stats; stats = stats->next) {
+        // Shifted down to 32 bits, there's no 64-bit division
+        uint64_t total = stats->hold_total;
+        uint32_t count = stats->acquired;
+        while (total >> 32) {
+            total >>= 1;
+            count >>= 1;
+        }
+        kernfs_puts(out, stats->name);
+        for (i = strlen((const int8_t*)stats->name); i < LOCK_NAME_WIDTH; i++) kernfs_putc(out, ' ');
+        kernfs_putu(out, stats->acquired, 10);
+        kernfs_putu(out, stats->contended, 10);
+        kernfs_putu(out, stats->spins, 10);
+        kernfs_putu(out, count ? (uint32_t)total / count : 0, 10);
+        kernfs_putu(out, stats->hold_max, 10);
+        kernfs_putc(out, '\n');
+    }
+}
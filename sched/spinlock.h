@@ -0,0 +1,76 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "../types.h"
+
+// Width of the name column of the lockstat kernel file
+#define LOCK_NAME_WIDTH 10
+
+#ifndef ASM
+
+// How often a lock was taken, how often it had to be waited for and how long it was held,
+// shared by every lock pointing at it (see spin_lock_init). Hold times are in TSC cycles.
+// Updated by whoever holds the lock, so a family of locks sharing one only gets approximate counts.
+typedef struct lock_stats_t {
+    const char* name;
+    uint32_t acquired;
+    uint32_t contended;     // Acquisitions that found it taken
+    uint32_t spins;         // Rounds spent waiting, over every contended acquisition
+    uint32_t hold_max;
+    uint64_t hold_total;
+    struct lock_stats_t* next;
+} lock_stats_t;
+
+// Test-and-set lock, the cheapest kind but with no order among CPUs waiting for it
+// All zeroes is unlocked and keeps no statistics, so zeroed memory needs no spin_lock_init.
+typedef struct spinlock_t {
+    volatile uint32_t locked;
+    uint32_t held_since;    // Low TSC word when it was taken, only kept with statistics
+    lock_stats_t* stats;    // NULL to keep none
+} spinlock_t;
+
+// Lock that CPUs get in the order they asked for it, for locks busy enough that one could starve
+// All zeroes is unlocked and keeps no statistics, like a spinlock_t.
+typedef struct ticket_lock_t {
+    volatile uint32_t next;     // Ticket the next caller draws
+    volatile uint32_t owner;    // Ticket that holds the lock
+    uint32_t held_since;
+    lock_stats_t* stats;
+} ticket_lock_t;
+
+// Usage, the locking counterpart of CRITICAL_SECTION_FLAGSAVE:
+// uint32_t flags, garbage;
+// SPIN_LOCK_IRQSAVE(&lock, flags, garbage) {
+//      Code touching what the lock protects...
+// }
+// Do NOT return or sleep in the block: the lock and the interrupt flag have to be given back.
+#define SPIN_LOCK_IRQSAVE(lock, flags, __mark) \
+    for (__mark = ((flags) = spin_lock_irqsave(lock), 0); \
+         __mark == 0; \
+        __mark = (spin_unlock_irqrestore(lock, flags), 1) \
+    )
+
+#define TICKET_LOCK_IRQSAVE(lock, flags, __mark) \
+    for (__mark = ((flags) = ticket_lock_irqsave(lock), 0); \
+         __mark == 0; \
+        __mark = (ticket_unlock_irqrestore(lock, flags), 1) \
+    )
+
+void lock_init();
+void lock_stats_init(lock_stats_t* stats, const char* name);
+
+void spin_lock_init(spinlock_t* lock, lock_stats_t* stats);
+void spin_lock(spinlock_t* lock);
+int32_t spin_trylock(spinlock_t* lock);
+void spin_unlock(spinlock_t* lock);
+uint32_t spin_lock_irqsave(spinlock_t* lock);
+void spin_unlock_irqrestore(spinlock_t* lock, uint32_t flags);
+
+void ticket_lock_init(ticket_lock_t* lock, lock_stats_t* stats);
+void ticket_lock(ticket_lock_t* lock);
+void ticket_unlock(ticket_lock_t* lock);
+uint32_t ticket_lock_irqsave(ticket_lock_t* lock);
+void ticket_unlock_irqrestore(ticket_lock_t* lock, uint32_t flags);
+
+#endif /* ASM */
+#endif
@@ -0,0 +1,185 @@
+#include "tick.h"
+#include "../lib.h"
+#include "../common.h"
+#include "../device-drivers/pit.h"
+#include "../device-drivers/rtc.h"
+#include "clock.h"
+
+// PIT cycles in a jiffy, and the most jiffies its 16-bit counter can wait for in one go
+#define TICK_PIT_COUNTS     (FREQ / TICK_HZ)
+#define TICK_MAX_ONESHOT    (PIT_MAX_COUNT / TICK_PIT_COUNTS)
+// A one-shot closer than this (about 1ms) to running out isn't reprogrammed, see tick_arm
+#define TICK_ARM_MARGIN     (TICK_PIT_COUNTS / 10)
+
+volatile uint32_t jiffies;
+// Jiffies that will have passed once the one-shot the PIT is counting down runs out, 0 if it isn't
+// counting. It was started with armed_counts cycles, the rest of the first jiffy being residual_counts
+// (nonzero only when it replaced one that was cut short).
+static uint32_t armed_jiffies;
+static uint32_t armed_counts;
+static uint32_t residual_counts;
+// Set while ticks are suppressed. Jiffies catch up from how far the TSC got since stopped_tsc, or
+// without a calibrated TSC (see clock_init) from the RTC, held interrupting since stopped_rtc for
+// the purpose. What didn't make a whole jiffy carries over to the next stop in stop_leftover_*.
+static int32_t tick_stopped;
+static int32_t stopped_by_tsc;
+static uint64_t stopped_tsc;
+static uint32_t stop_leftover_cycles;
+static uint32_t stopped_rtc;
+static uint32_t stop_leftover_rtc;
+static uint32_t tick_interrupts;
+
+static void stop_clock_start();
+static uint32_t jiffies_since_stop(uint32_t* partial);
+
+// Starts the clock with ticks suppressed, nothing needs one before the first task runs
+// Inputs: None
+// Outputs: None
+// Side effects: The PIT must be initialized already (see pit_init)
+void tick_init() {
+    jiffies = 0;
+    armed_jiffies = 0;
+    tick_interrupts = 0;
+    stop_leftover_cycles = 0;
+    stop_leftover_rtc = 0;
+    tick_stopped = 1;
+    stop_clock_start();
+}
+
+// Accounts for the one-shot that just ran out, called first thing by the PIT interrupt
+// Inputs: None
+// Outputs: Jiffies it covered
+// Side effects: Nothing is armed afterwards; the scheduler arms the next one or stops ticks
+uint32_t tick_expired() {
+    uint32_t elapsed = armed_jiffies;
+    jiffies += elapsed;
+    armed_jiffies = 0;
+    residual_counts = 0;
+    tick_interrupts++;
+    return elapsed;
+}
+
+// Makes sure the PIT interrupts within some jiffies from now
+// A one-shot that's counting already is cut short if it would run out later than that. One that's
+// about to run out is left alone, since its interrupt could end up pending behind the new count,
+// which would then be taken for that one.
+// Inputs: n -- jiffies, cut to what the PIT can count (about 50ms). At least 1.
+// Outputs: None
+// Side effects: Restarts ticks if they were stopped
+void tick_arm(uint32_t n) {
+    if (!n) n = 1;
+    if (n > TICK_MAX_ONESHOT) n = TICK_MAX_ONESHOT;
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        int32_t program = 1;
+        if (armed_jiffies) {
+            uint32_t left = pit_read_count();
+            uint32_t elapsed = residual_counts + armed_counts - left;
+            if (left > armed_counts || left < TICK_ARM_MARGIN || armed_jiffies - elapsed / TICK_PIT_COUNTS <= n) {
+                program = 0;
+            } else {
+                // Count what it got through, and line the new one up with the jiffies that follow
+                jiffies += elapsed / TICK_PIT_COUNTS;
+                residual_counts = elapsed % TICK_PIT_COUNTS;
+            }
+        } else if (tick_stopped) {
+            uint32_t partial;
+            jiffies += jiffies_since_stop(&partial);
+            if (stopped_by_tsc) {
+                stop_leftover_cycles = partial;
+            } else {
+                stop_leftover_rtc = partial;
+                rtc_release();
+            }
+            tick_stopped = 0;
+        }
+        if (program) {
+            armed_jiffies = n;
+            armed_counts = n * TICK_PIT_COUNTS - residual_counts;
+            pit_oneshot(armed_counts);
+        }
+    }
+}
+
+// Suppresses ticks until the next tick_arm
+// Inputs: None
+// Outputs: None
+// Side effects: If a one-shot is counting it still interrupts once, and its handler stops ticks then
+void tick_stop() {
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        if (!armed_jiffies && !tick_stopped) {
+            tick_stopped = 1;
+            stop_clock_start();
+        }
+    }
+}
+
+// Checks whether the PIT is going to interrupt
+// Inputs: None
+// Outputs: 1 while a one-shot is counting down, 0 otherwise
+int32_t tick_armed() {
+    return armed_jiffies != 0;
+}
+
+// Reads the time, down to the jiffy
+// jiffies itself only moves when the PIT interrupts or ticks restart; this also counts what the
+// one-shot in progress (or the TSC, while ticks are stopped) got through so far.
+// Inputs: None
+// Outputs: Jiffies since boot
+uint32_t tick_now() {
+    uint32_t now;
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        now = jiffies;
+        if (tick_stopped) {
+            now += jiffies_since_stop(NULL);
+        } else if (armed_jiffies) {
+            uint32_t left = pit_read_count();
+            // Past the end it wraps around, and its interrupt is about to count the whole of it
+            now += left <= armed_counts ? (residual_counts + armed_counts - left) / TICK_PIT_COUNTS : armed_jiffies;
+        }
+    }
+    return now;
+}
+
+// Converts milliseconds to jiffies
+// Inputs: ms -- milliseconds
+// Outputs: Jiffies, rounded up
+uint32_t tick_ms_to_jiffies(uint32_t ms) {
+    return ms / 1000 * TICK_HZ + (ms % 1000 * TICK_HZ + 999) / 1000;
+}
+
+uint32_t tick_num_interrupts() {
+    return tick_interrupts;
+}
+
+// Notes where the clock kept across stopped ticks starts from
+// Inputs: None
+// Outputs: None
+// Side effects: Must be called with interrupts off. Without a TSC the RTC is held until ticks restart.
+static void stop_clock_start() {
+    stopped_by_tsc = clock_tsc_khz() != 0;
+    if (stopped_by_tsc) {
+        stopped_tsc = rdtsc();
+    } else {
+        rtc_hold();
+        stopped_rtc = virt_rtc_clock;
+    }
+}
+
+// Converts the time since ticks stopped into jiffies
+// Inputs: partial -- if not NULL, gets what's left over short of a jiffy, for stop_leftover_*
+// Outputs: Whole jiffies that passed
+// Side effects: Must be called with interrupts off
+static uint32_t jiffies_since_stop(uint32_t* partial) {
+    if (stopped_by_tsc) {
+        uint64_t cycles = rdtsc() - stopped_tsc + stop_leftover_cycles;
+        return (uint32_t)div_u64_rem(cycles, clock_tsc_khz() * (1000 / TICK_HZ), partial);
+    }
+    uint32_t rtc_ticks = virt_rtc_clock - stopped_rtc + stop_leftover_rtc;
+    uint32_t rest = rtc_ticks % MAX_PHYSICAL_FREQ;
+    if (partial) *partial = (rest * TICK_HZ - rest * TICK_HZ / MAX_PHYSICAL_FREQ * MAX_PHYSICAL_FREQ) / TICK_HZ;
+    return rtc_ticks / MAX_PHYSICAL_FREQ * TICK_HZ + rest * TICK_HZ / MAX_PHYSICAL_FREQ;
+}
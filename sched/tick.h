@@ -0,0 +1,25 @@
+#ifndef TICK_H
+#define TICK_H
+
+#include "../types.h"
+
+// Jiffies per second. The scheduler counts time in jiffies, but the PIT only interrupts when
+// something is due (see tick_arm), not every jiffy.
+#define TICK_HZ     100
+
+#ifndef ASM
+
+// Jiffies since boot, brought up to date by tick_expired and tick_arm (see tick_now)
+extern volatile uint32_t jiffies;
+
+void tick_init();
+uint32_t tick_expired();
+void tick_arm(uint32_t n);
+void tick_stop();
+int32_t tick_armed();
+uint32_t tick_now();
+uint32_t tick_ms_to_jiffies(uint32_t ms);
+uint32_t tick_num_interrupts();
+
+#endif /* ASM */
+#endif
@@ -0,0 +1,190 @@
+#include "timer.h"
+#include "tick.h"
+#include "wait.h"
+#include "../lib.h"
+#include "../common.h"
+
+// Pending timers, by when they're due. Level 0 has a slot per jiffy; a slot of a higher level
+// holds timers due within the same 64^level jiffies, which move down a level (see cascade) once
+// the level below comes around to them. That keeps adding, cancelling and running a timer O(1).
+static ktimer_t* wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+// Next jiffy timer_run goes through, every one before has been
+static uint32_t wheel_jiffies;
+static uint32_t num_pending;
+
+static void wheel_insert(ktimer_t* timer);
+static void wheel_unlink(ktimer_t* timer);
+static void cascade(uint32_t level);
+
+// Prepares a timer, which isn't pending until timer_add
+// Inputs: timer -- the timer, fn -- what to call once it's due, data -- passed to fn
+// Outputs: None
+void timer_setup(ktimer_t* timer, void (*fn)(uint32_t data), uint32_t data) {
+    if (!timer) return;
+    timer->fn = fn;
+    timer->data = data;
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+// Makes a timer call its function at some jiffy
+// Inputs: timer -- a timer set up by timer_setup, expires -- jiffy it's due at (see tick_now).
+//      Past ones are run on the next PIT interrupt.
+// Outputs: 0 on success, -1 on a bad timer
+// Side effects: Moves the timer if it was pending already, and makes sure the PIT interrupts by then
+int32_t timer_add(ktimer_t* timer, uint32_t expires) {
+    if (!timer || !timer->fn) return -1;
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        uint32_t now = tick_now();
+        if (timer->pprev) wheel_unlink(timer);
+        // With nothing pending the wheel may lag far behind, it can skip straight to now
+        if (!num_pending) wheel_jiffies = now;
+        timer->expires = expires;
+        wheel_insert(timer);
+        tick_arm((int32_t)(expires - now) > 0 ? expires - now : 1);
+    }
+    return 0;
+}
+
+// Stops a timer from running
+// Inputs: timer -- the timer
+// Outputs: 1 if it was pending, 0 otherwise
+int32_t timer_cancel(ktimer_t* timer) {
+    int32_t was_pending = 0;
+    if (!timer) return 0;
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        if (timer->pprev) {
+            wheel_unlink(timer);
+            was_pending = 1;
+        }
+    }
+    return was_pending;
+}
+
+int32_t timer_pending(const ktimer_t* timer) {
+    return timer && timer->pprev != NULL;
+}
+
+uint32_t timer_num_pending() {
+    return num_pending;
+}
+
+// Runs every timer due up to a jiffy, called from the PIT interrupt
+// Inputs: now -- the jiffy
+// Outputs: None
+// Side effects: Must be called with interrupts off. Goes through every jiffy since the last call,
+//      unless nothing is pending.
+void timer_run(uint32_t now) {
+    while ((int32_t)(now - wheel_jiffies) >= 0) {
+        uint32_t index = wheel_jiffies & TIMER_WHEEL_MASK;
+        if (!num_pending) {
+            wheel_jiffies = now + 1;
+            break;
+        }
+        if (!index) cascade(1);
+        // Timers added by the ones running here, due already, land in this slot too
+        while (wheel[0][index]) {
+            ktimer_t* timer = wheel[0][index];
+            wheel_unlink(timer);
+            timer->fn(timer->data);
+        }
+        wheel_jiffies++;
+    }
+}
+
+// Works out when the PIT has to interrupt for timers
+// Only level 0 is searched, up to where it wraps around: timers of higher levels aren't due before
+// they come down to it, and it's soon enough to look again then.
+// Inputs: now -- the time in jiffies
+// Outputs: Jiffies from now, 0 if no timer is pending
+// Side effects: Must be called with interrupts off
+uint32_t timer_next_event(uint32_t now) {
+    uint32_t jiffy = wheel_jiffies;
+    if (!num_pending) return 0;
+    do {
+        if (wheel[0][jiffy & TIMER_WHEEL_MASK]) break;
+        jiffy++;
+    } while (jiffy & TIMER_WHEEL_MASK);
+    return (int32_t)(jiffy - now) > 0 ? jiffy - now : 1;
+}
+
+// Puts the running task to sleep for a while
+// Inputs: ms -- milliseconds to sleep, at least
+// Outputs: None
+// Side effects: Blocks the task (see sleep_on_timeout), other tasks run meanwhile
+void msleep(uint32_t ms) {
+    // Nobody wakes this up, only the timeout
+    wait_queue_t nobody;
+    // The jiffy in progress only partly counts
+    uint32_t left = tick_ms_to_jiffies(ms) + 1;
+    wait_queue_init(&nobody);
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        while (left) left = sleep_on_timeout(&nobody, left);
+    }
+}
+
+// Puts a timer in the slot for when it's due
+// Inputs: timer -- the timer, which must not be pending
+// Outputs: None
+// Side effects: Must be called with interrupts off
+static void wheel_insert(ktimer_t* timer) {
+    uint32_t delta = timer->expires - wheel_jiffies;
+    uint32_t level = 0;
+    ktimer_t** slot;
+
+    // Due already: into the slot timer_run goes through next
+    if ((int32_t)delta < 0) {
+        timer->expires = wheel_jiffies;
+        delta = 0;
+    }
+    // Farther than the wheel reaches: as far as it does
+    if (delta >> (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS)) {
+        delta = (1 << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS)) - 1;
+        timer->expires = wheel_jiffies + delta;
+    }
+    while (delta >> ((level + 1) * TIMER_WHEEL_BITS)) level++;
+
+    slot = &wheel[level][(timer->expires >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK];
+    timer->next = *slot;
+    if (*slot) (*slot)->pprev = &timer->next;
+    timer->pprev = slot;
+    *slot = timer;
+    num_pending++;
+}
+
+// Takes a pending timer out of its slot
+// Inputs: timer -- the timer
+// Outputs: None
+// Side effects: Must be called with interrupts off
+static void wheel_unlink(ktimer_t* timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+    num_pending--;
+}
+
+// Moves the timers of a level's current slot down to the levels below, now that they're close
+// Called whenever the level below wraps around, and in turn does the same for the level above if
+// this one wraps around too.
+// Inputs: level -- the level, at least 1
+// Outputs: None
+// Side effects: Must be called with interrupts off
+static void cascade(uint32_t level) {
+    uint32_t index;
+    if (level >= TIMER_WHEEL_LEVELS) return;
+    index = (wheel_jiffies >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK;
+    // The slot above empties into this one's next turn, so go through it first
+    if (!index) cascade(level + 1);
+    while (wheel[level][index]) {
+        ktimer_t* timer = wheel[level][index];
+        wheel_unlink(timer);
+        wheel_insert(timer);
+    }
+}
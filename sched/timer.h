@@ -0,0 +1,34 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "../types.h"
+
+// The timer wheel: TIMER_WHEEL_LEVELS levels of TIMER_WHEEL_SIZE slots each. A slot of level n
+// covers 64^n jiffies, so the wheel reaches 2^24 jiffies (about 46 hours) ahead.
+#define TIMER_WHEEL_BITS    6
+#define TIMER_WHEEL_SIZE    (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK    (TIMER_WHEEL_SIZE - 1)
+#define TIMER_WHEEL_LEVELS  4
+
+#ifndef ASM
+
+// A function to call at some jiffy, see timer_add. Embed it in whatever it times out.
+typedef struct ktimer_t {
+    uint32_t expires;               // Jiffy it's due at
+    void (*fn)(uint32_t data);      // Called from the PIT interrupt, with interrupts off
+    uint32_t data;
+    struct ktimer_t* next;          // In its wheel slot
+    struct ktimer_t** pprev;        // Link pointing at it, NULL while it isn't pending
+} ktimer_t;
+
+void timer_setup(ktimer_t* timer, void (*fn)(uint32_t data), uint32_t data);
+int32_t timer_add(ktimer_t* timer, uint32_t expires);
+int32_t timer_cancel(ktimer_t* timer);
+int32_t timer_pending(const ktimer_t* timer);
+void timer_run(uint32_t now);
+uint32_t timer_next_event(uint32_t now);
+uint32_t timer_num_pending();
+void msleep(uint32_t ms);
+
+#endif /* ASM */
+#endif
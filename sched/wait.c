@@ -0,0 +1,123 @@
+#include "wait.h"
+#include "sched.h"
+#include "timer.h"
+#include "../lib.h"
+#include "../process/process.h"
+
+static void wake_timed_out(uint32_t data);
+
+// Empties a wait queue
+// Inputs: wq -- the queue
+// Outputs: None
+void wait_queue_init(wait_queue_t* wq) {
+    if (!wq) return;
+    wq->head = wq->tail = NULL;
+}
+
+// Blocks the running task on a wait queue until wake_up picks it
+// The task is off the run queue while it sleeps, and the CPU goes to the next ready task (or idles).
+// Callers check their condition with interrupts off and loop, so no wakeup is lost in between:
+//      CRITICAL_SECTION_FLAGSAVE(flags, garbage) { while (!condition) sleep_on(wq); }
+// Inputs: wq -- queue to sleep on
+// Outputs: None
+// Side effects: Interrupts are on while the task sleeps, and off again when this returns
+void sleep_on(wait_queue_t* wq) {
+    pcb_t* self = get_current_pcb();
+    if (!wq || !self || is_kernel_pid(self->pid)) return;
+
+    cli();
+    self->wait_next = NULL;
+    self->waiting_on = wq;
+    self->blocked = 1;
+    if (wq->tail) wq->tail->wait_next = self;
+    else wq->head = self;
+    wq->tail = self;
+
+    // Comes back once woken up and scheduled again
+    while (self->blocked) sched_yield();
+}
+
+// Like sleep_on, but gives up waiting after a while, for callers that want a timeout
+//      CRITICAL_SECTION_FLAGSAVE(flags, garbage) { while (!condition && left) left = sleep_on_timeout(wq, left); }
+// Inputs: wq -- queue to sleep on, timeout -- most jiffies to wait
+// Outputs: Jiffies left of the timeout once woken, 0 if it ran out
+// Side effects: Same as sleep_on. The task's timeout timer is pending while it sleeps.
+uint32_t sleep_on_timeout(wait_queue_t* wq, uint32_t timeout) {
+    pcb_t* self = get_current_pcb();
+    uint32_t deadline, now;
+    if (!wq || !self || is_kernel_pid(self->pid) || !timeout) return 0;
+
+    cli();
+    deadline = tick_now() + timeout;
+    timer_setup(&self->timeout, wake_timed_out, (uint32_t)self);
+    timer_add(&self->timeout, deadline);
+    sleep_on(wq);
+    timer_cancel(&self->timeout);
+    now = tick_now();
+    return (int32_t)(deadline - now) > 0 ? deadline - now : 0;
+}
+
+// Wakes a task whose sleep_on_timeout ran out
+// Inputs: data -- its PCB
+// Outputs: None
+static void wake_timed_out(uint32_t data) {
+    wake_up_task((pcb_t*)data);
+}
+
+// Wakes the tasks that have been waiting on a queue the longest
+// Inputs: wq -- the queue, count -- most tasks to wake, WAKE_ALL for every one
+// Outputs: Number of tasks woken
+// Side effects: Woken tasks are queued up again. Fine to call from interrupt handlers.
+uint32_t wake_up(wait_queue_t* wq, uint32_t count) {
+    uint32_t woken = 0;
+    if (!wq) return 0;
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        while (wq->head && woken < count) {
+            wake_up_task(wq->head);
+            woken++;
+        }
+    }
+    return woken;
+}
+
+// Wakes one particular task, wherever it is on its wait queue
+// Inputs: pcb -- the task
+// Outputs: 0 on success, -1 if it wasn't sleeping
+// Side effects: The task is queued up again (see sched_wake), unless it's the running task
+//      (which hasn't gotten around to switching away yet) and just carries on
+int32_t wake_up_task(pcb_t* pcb) {
+    int32_t retval = -1;
+    if (!pcb) return -1;
+
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        if (pcb->blocked) {
+            wait_queue_remove(pcb);
+            pcb->blocked = 0;
+            if (pcb->pid != get_current_pid()) sched_wake(pcb->pid);
+            retval = 0;
+        }
+    }
+    return retval;
+}
+
+// Takes a task off whatever wait queue it's on, without waking it
+// Inputs: pcb -- the task
+// Outputs: None
+// Side effects: Must be called with interrupts off
+void wait_queue_remove(pcb_t* pcb) {
+    wait_queue_t* wq;
+    pcb_t** link;
+    pcb_t* prev = NULL;
+    if (!pcb || !(wq = pcb->waiting_on)) return;
+
+    for (link = &wq->head; *link && *link != pcb; link = &(*link)->wait_next) prev = *link;
+    if (*link) {
+        *link = pcb->wait_next;
+        if (wq->tail == pcb) wq->tail = prev;
+    }
+    pcb->wait_next = NULL;
+    pcb->waiting_on = NULL;
+}
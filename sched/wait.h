@@ -0,0 +1,27 @@
+#ifndef WAIT_H
+#define WAIT_H
+
+#include "../types.h"
+
+// Wakes every waiter, see wake_up
+#define WAKE_ALL    0xFFFFFFFF
+
+#ifndef ASM
+
+struct pcb_t;
+
+// Tasks sleeping until some event, linked through their PCBs (see sleep_on)
+typedef struct wait_queue_t {
+    struct pcb_t* head;     // Oldest waiter first
+    struct pcb_t* tail;
+} wait_queue_t;
+
+void wait_queue_init(wait_queue_t* wq);
+void sleep_on(wait_queue_t* wq);
+uint32_t sleep_on_timeout(wait_queue_t* wq, uint32_t timeout);
+uint32_t wake_up(wait_queue_t* wq, uint32_t count);
+int32_t wake_up_task(struct pcb_t* pcb);
+void wait_queue_remove(struct pcb_t* pcb);
+
+#endif /* ASM */
+#endif
@@ -1,4 +1,5 @@
 #include "parser.h"
+#include "../process/elf.h"
 
 // Determines struct equality between two parse_command_result_ts
 // Inputs: 
@@ -163,22 +164,27 @@ executability_result_t determine_executability(const char* filename) {
     }
     if (fdentry.filetype != FS_TYPE_FILE) return res;
     
-    // Try to read the magic bytes, fail if there isn't enough data in the file or if the magic
+    // Try to read the ELF header, fail if there isn't enough data in the file or if the magic
     // doesn't exist.
-    uint8_t magic_buffer[EXEC_MAGIC_NUMBYTES];
-    if (read_data(fdentry.inode_idx, 0, magic_buffer, EXEC_MAGIC_NUMBYTES) != EXEC_MAGIC_NUMBYTES)
+    elf32_ehdr_t ehdr;
+    if (read_data(fdentry.inode_idx, 0, (uint8_t*)&ehdr, sizeof(ehdr)) != sizeof(ehdr))
         return res;
     
-    if (!(  magic_buffer[0] == EXEC_MAGIC_BYTE_1_OF_4
-        &&  magic_buffer[1] == EXEC_MAGIC_BYTE_2_OF_4
-        &&  magic_buffer[2] == EXEC_MAGIC_BYTE_3_OF_4
-        &&  magic_buffer[3] == EXEC_MAGIC_BYTE_4_OF_4 )) return res;
-    
-    // Try to read the data up to where EIP is, if we can't even read EIP
-    // (because the file is just not long enough), it can't possibly be executable.
-    if (read_data(fdentry.inode_idx, EXEC_START_EIP_OFFSET, res.start_eip, sizeof(uint32_t)) != sizeof(uint32_t))
+    if (!(  ehdr.e_ident[0] == EXEC_MAGIC_BYTE_1_OF_4
+        &&  ehdr.e_ident[1] == EXEC_MAGIC_BYTE_2_OF_4
+        &&  ehdr.e_ident[2] == EXEC_MAGIC_BYTE_3_OF_4
+        &&  ehdr.e_ident[3] == EXEC_MAGIC_BYTE_4_OF_4 )) return res;
+
+    // Only statically linked 32-bit x86 programs can be loaded, and only by their program headers
+    if (ehdr.e_ident[ELF_IDENT_CLASS] != ELF_CLASS_32 || ehdr.e_ident[ELF_IDENT_DATA] != ELF_DATA_LSB
+        || ehdr.e_type != ELF_TYPE_EXEC || ehdr.e_machine != ELF_MACHINE_386) return res;
+    if (ehdr.e_phentsize != sizeof(elf32_phdr_t) || ehdr.e_phnum == 0 || ehdr.e_phnum > ELF_MAX_PHDRS)
         return res;
 
+    memcpy(res.start_eip, &ehdr.e_entry, sizeof(uint32_t));
+    res.phdr_offset = ehdr.e_phoff;
+    res.phdr_count = ehdr.e_phnum;
+
     // Note, there used to be code to reverse EIP, but that would be necessary if the file was
     // big endian...if we're directly mapping this into user memory, and it was *actually* big
     // endian, then we would have to reverse the bytes for every single opcode we had
@@ -4,7 +4,6 @@
 #include "../types.h"
 #include "../memfs/memfs.h"
 
-#define EXEC_START_EIP_OFFSET 24
 #define EXEC_MAGIC_NUMBYTES 4
 #define EXEC_MAGIC_BYTE_1_OF_4 0x7f
 #define EXEC_MAGIC_BYTE_2_OF_4 0x45
@@ -43,6 +42,9 @@ typedef struct executability_result_t {
     uint8_t start_eip[4];
     uint32_t exec_inode;
     uint32_t exec_file_length;
+    // Where the ELF program headers are, see load_executable_into_memory
+    uint32_t phdr_offset;
+    uint32_t phdr_count;
 } executability_result_t;
 
 executability_result_t determine_executability(const char* filename);
@@ -4,6 +4,7 @@
 #include "../paging.h"
 #include "parser.h"
 #include "../process/process.h"
+#include "../process/uaccess.h"
 #include "../memfs/memfs.h"
 #include "../device-drivers/keyboard.h"
 #include "../lib.h"
@@ -35,13 +36,16 @@ execute_result_t sys_execute_helper(
     if (!caller_context || !kstack_context) return rollback_info;
     
     // Set up kernel-style paging so we can access whatever memory we want
-    set_new_cr3((uint32_t)kernel_page_descriptor_table);
+    set_new_cr3((uint32_t)get_kernel_page_directory());
 
     // Obtain the PCB PID values of the current PID (parent) and the next PID (child)
     pcb_t* this_pcb = get_current_pcb();
     if (!this_pcb) return rollback_info;
     uint32_t this_pid = this_pcb->pid;
     rollback_info.origin_proc_id = this_pid;
+    // The rest of a process keeps running while it waits for the child, and may exit before
+    // the child does, so only the leader (whose exit waits for the child) may execute
+    if (is_thread_pid(this_pid)) return rollback_info;
 
     pcb_t* next_pcb = process_allocate(this_pid);
     if (!next_pcb) return rollback_info;
@@ -49,12 +53,11 @@ execute_result_t sys_execute_helper(
     rollback_info.flag_allocated_proc = 1;
     rollback_info.allocated_proc_id = next_pid;
 
-    // Translate the command pointer from user to kernel, which does range checking (returns NULL if out of range so it passes all other checks)
-    // NULL is the universal sign of invalidity - Confuscius 
-    const char* input_cmd = (const char*)(
-        translate_user_to_kernel((void*)(caller_context->ebx), this_pid)
-    );
-    
+    // Copy the command out of the caller's memory; it has to fit what the keyboard can produce
+    char input_cmd[KEYBOARD_BUF_SIZE+1];
+    int32_t cmd_length = strncpy_from_user(input_cmd, (const char*)caller_context->ebx, KEYBOARD_BUF_SIZE+1);
+    if (cmd_length == -1 || cmd_length > KEYBOARD_BUF_SIZE) return rollback_info;
+
     // Parse the input command and the arguments using our parse_res struct
     parse_command_result_t parse_res = parse_command((const char*)input_cmd);
     if (parse_res.cmd_end_idx_excl == parse_res.cmd_start_idx_incl) return rollback_info;
@@ -101,9 +104,8 @@ execute_result_t sys_execute_helper(
     ) == -1) return rollback_info;
 
     // Set our TSS
-    tss.esp0 = get_initial_esp0_of_process(next_pid);
+    update_tss_for_new_stack(KERNEL_DS, get_initial_esp0_of_process(next_pid));
     rollback_info.flag_updated_esp0 = 1;
-    tss.ss0 = KERNEL_DS;
 
 
     // Mark as success and return
@@ -2,6 +2,8 @@
 #include "../paging.h"
 #include "../x86_desc.h"
 #include "../process/process.h"
+#include "../process/thread.h"
+#include "../lib.h"
 
 int32_t fake_syshalt_for_roots(
     hwcontext_t* caller_context, 
@@ -21,10 +23,12 @@ int32_t sys_halt_helper(
     from_kernel_context_t* kstack_context
 ) {
     
-    set_new_cr3((uint32_t)kernel_page_descriptor_table);
+    set_new_cr3((uint32_t)get_kernel_page_directory());
     uint32_t status_code = (caller_context->ebx) & 0xFF; // Pass lower byte
     pcb_t* this_pcb = get_current_pcb();
     if (!this_pcb) return -1;
+    // Halting a thread only ends the thread
+    if (is_thread_pid(this_pcb->pid)) thread_exit();
     // Get the parent
     pcb_t* next_pcb = get_pcb(this_pcb->parent_pid);
     if (!next_pcb) return -1;
@@ -65,30 +69,38 @@ int32_t sys_halt_helper(
     kstack_context->iret_context.esp = 0xFEEDBEEF;
     kstack_context->iret_context.ss = 0xCAFE;
 
+    // Restore the parent's window first. If another CPU runs the parent's threads, this waits for
+    // it with the kernel lock let go (see sched_wait_for_mm), so nothing of ours is freed yet.
+    activate_existing_user_programpage(next_pid);
+
     // Assumption: every time we privilege switch from a process to its 
     // OWN kernel stack, that kernel stack is empty
     // Consequence: every time we finish the original software-induced interrupt and switch from
     // a process's kernel stack to that same process's original stack, the kernel stack is once again empty
     // (note): restoring the original in the K-to-K IRET switch is not a privilege switch
     // If this assumption is wrong, then the esp0 value below is wrong
-    tss.esp0 = get_initial_esp0_of_process(next_pid);
-    tss.ss0 = KERNEL_DS;
+    update_tss_for_new_stack(KERNEL_DS, get_initial_esp0_of_process(next_pid));
     
     // Deactivate user memory
     if (next_pcb->flag_activated_vidmap) deactivate_user_vidmem();
 
-    // Deallocate the PCB
-    process_free(this_pid);
+    // From here until the IRET into the parent's kernel context we must not be preempted:
+    // we are still running on this_pid's kernel stack, which process_free hands to the reaper.
+    // The IRET restores the parent's flags.
+    cli();
 
-    // Offline the main memory
+    // Its threads go first, they use the memory and files freed below
+    thread_kill_others(this_pcb);
+
+    // Offline the main memory (needs the PCB)
     destroy_user_programpage(this_pid);
 
-    // Resetore the parent's PID
-    activate_existing_user_programpage(next_pid);
+    // Deallocate the PCB
+    process_free(this_pid);
     
     // If we are not returning to the root PID (kernel launch context), we should reenable the user paging system
     if (next_pid != 0) {
-        set_new_cr3((uint32_t)user_page_descriptor_table);
+        set_new_cr3((uint32_t)get_user_page_directory());
     }
 
     return 0; 
@@ -110,10 +122,11 @@ int32_t fake_syshalt_for_roots(
     uint32_t flags, garbage;
     CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
         printf("Pid %d terminated.\n", pid);
+        thread_kill_others(get_pcb(pid));
         close_pid_fds(pid);
     }
     
-    // Do not modify the user_page_descriptor_table
+    // Do not modify the user page directory
     pcb_t* this_pcb = get_pcb(pid);
     uint32_t reset_eip = get_user_eip(this_pcb->start_exec_info);
     uint32_t reset_esp = get_initial_esp_of_process(pid);
@@ -139,7 +152,7 @@ int32_t fake_syshalt_for_roots(
     kstack_context->ds = USER_DS;
     kstack_context->_pad_ds = 0;
 
-    set_new_cr3((uint32_t)user_page_descriptor_table);
+    set_new_cr3((uint32_t)get_user_page_directory());
 
     // CLI for potentially problematic interrupts by the scheduler, this will be resolved in time with the IRET restarting EFLAGS
     cli();
@@ -5,7 +5,15 @@
 #include "../memfs/memfs.h"
 #include "../process/file.h"
 #include "../process/process.h"
+#include "../process/uaccess.h"
+#include "../process/thread.h"
+#include "../sched/timer.h"
+#include "../sched/sched.h"
+#include "../sched/clock.h"
+#include "../sched/acct.h"
 #include "../paging.h"
+#include "../mm/vma.h"
+#include "../mm/shm.h"
 #include "../types.h"
 #include "../lib.h"
 #include "sys_execute.h"
@@ -24,16 +32,20 @@ int32_t sys_execute_c(hwcontext_t* caller_context, from_kernel_context_t* kstack
     if (retval == -1) {
         // Rollback in reverse order of initialization, for safety guarantees
         if (rollback_info.flag_updated_esp0) {
-            tss.esp0 = get_initial_esp0_of_process(rollback_info.origin_proc_id);
+            update_tss_for_new_stack(KERNEL_DS, get_initial_esp0_of_process(rollback_info.origin_proc_id));
         }
         if (rollback_info.flag_configured_paging) {
             destroy_user_programpage(rollback_info.allocated_proc_id);
+            // The child's window was mapped while loading it, give the parent back its own
+            activate_existing_user_programpage(rollback_info.origin_proc_id);
         }
         if (rollback_info.flag_allocated_proc) {
             process_free(rollback_info.allocated_proc_id);
         }
     }
     if (syscall_epilogue()) return -1;
+    // The child runs in the parent's place from here, the parent's time doesn't go on meanwhile
+    if (retval == 0) acct_stop(get_pcb(rollback_info.origin_proc_id));
     return retval;
 }
 
@@ -129,20 +141,16 @@ int32_t sys_getargs(hwcontext_t* hw_context) {
     int32_t retval = 0;
     // get current process control block
     pcb_t* curr_pcb = get_current_pcb();
-    uint8_t* k_buf = (uint8_t*) hw_context->ebx;
-    uint8_t* buf = (uint8_t*)translate_user_to_kernel(k_buf, curr_pcb->pid);
+    uint8_t* buf = (uint8_t*) hw_context->ebx;
     int32_t nbytes = (int32_t) hw_context->ecx;
+    int32_t length = strlen((char*)curr_pcb->argument);
 
-    // check whether buf is a NULL pointer
-    if (buf == NULL) retval = -1;
-    else {
-        // return -1 whether argument of the program exists and the length does not exceed nbytes
-        if (strlen((char*)curr_pcb->argument) > nbytes || strlen((char*)curr_pcb->argument) == 0)
-            retval = -1;
-        else {
-            // copy program's argument to buf
-            strncpy((char*)buf, curr_pcb->argument, nbytes);
-        }
+    // return -1 whether argument of the program exists and the length does not exceed nbytes
+    if (nbytes < 0 || length > nbytes || length == 0) {
+        retval = -1;
+    } else {
+        // copy program's argument to buf, with its NUL if there's room
+        retval = copy_to_user(buf, curr_pcb->argument, (length < nbytes) ? length + 1 : length);
     }
     if (syscall_epilogue()) return -1;
     else return retval;
@@ -195,14 +203,200 @@ int32_t sys_sigreturn(hwcontext_t* hw_context) {
     return -1;
 }
 
+// Moves the end of the caller's heap
+// Inputs:
+//      hw_context: hardware context, EBX holds the (signed) number of bytes to grow the heap by
+// Output: the old end of the heap, -1 on failure
+// Side effects: Pages the heap shrinks past are released
+int32_t sys_sbrk(hwcontext_t* hw_context) {
+    if (syscall_prologue()) return -1;
+    int32_t increment = (int32_t) hw_context->ebx;
+    int32_t retval = mm_sbrk(get_current_pid(), increment);
+    if (syscall_epilogue()) return -1;
+    return retval;
+}
+
+// Maps an anonymous, zero-filled area into the caller's user window
+// Inputs:
+//      hw_context: hardware context, EBX holds the requested address (0 for any), ECX the length
+// Output: start of the area, -1 on failure
+// Side effects: Only reserves the range, pages are backed when touched
+int32_t sys_mmap(hwcontext_t* hw_context) {
+    if (syscall_prologue()) return -1;
+    uint32_t addr = hw_context->ebx;
+    uint32_t length = hw_context->ecx;
+    int32_t retval = mm_mmap(get_current_pid(), addr, length);
+    if (syscall_epilogue()) return -1;
+    return retval;
+}
+
+// Unmaps part of the caller's mmap areas
+// Inputs:
+//      hw_context: hardware context, EBX holds the start of the range, ECX its length
+// Output: 0 on success, -1 on failure
+// Side effects: Releases the pages behind the range
+int32_t sys_munmap(hwcontext_t* hw_context) {
+    if (syscall_prologue()) return -1;
+    uint32_t addr = hw_context->ebx;
+    uint32_t length = hw_context->ecx;
+    int32_t retval = mm_munmap(get_current_pid(), addr, length);
+    if (syscall_epilogue()) return -1;
+    return retval;
+}
+
+// Copies a segment name out of the caller's memory
+// Inputs: user_name -- user pointer to the name, kname -- buffer of SHM_NAME_LEN + 1 bytes
+// Outputs: 0 on success, -1 if the pointer is bad or the name is too long
+static int32_t copy_shm_name(const uint8_t* user_name, char* kname) {
+    int32_t length = strncpy_from_user(kname, (const char*)user_name, SHM_NAME_LEN + 1);
+    return (length == -1 || length > SHM_NAME_LEN) ? -1 : 0;
+}
+
+// Creates a named shared memory segment and attaches it to the caller
+// Inputs:
+//      hw_context: hardware context, EBX holds the name, ECX the size in bytes
+// Output: address the segment was attached at, -1 on failure
+// Side effects: Fails if a segment with that name already exists
+int32_t sys_shm_create(hwcontext_t* hw_context) {
+    if (syscall_prologue()) return -1;
+    char name[SHM_NAME_LEN + 1];
+    uint32_t size = hw_context->ecx;
+    int32_t retval = -1;
+    if (!copy_shm_name((const uint8_t*)hw_context->ebx, name)) {
+        retval = shm_create_segment(get_current_pid(), name, size);
+    }
+    if (syscall_epilogue()) return -1;
+    return retval;
+}
+
+// Attaches an existing shared memory segment to the caller
+// Inputs:
+//      hw_context: hardware context, EBX holds the name
+// Output: address the segment was attached at, -1 on failure
+// Side effects: None besides the mapping; pages are shared with every other attachment
+int32_t sys_shm_attach(hwcontext_t* hw_context) {
+    if (syscall_prologue()) return -1;
+    char name[SHM_NAME_LEN + 1];
+    int32_t retval = -1;
+    if (!copy_shm_name((const uint8_t*)hw_context->ebx, name)) {
+        retval = shm_attach_segment(get_current_pid(), name);
+    }
+    if (syscall_epilogue()) return -1;
+    return retval;
+}
+
+// Detaches a shared memory segment from the caller
+// Inputs:
+//      hw_context: hardware context, EBX holds the address it was attached at
+// Output: 0 on success, -1 on failure
+// Side effects: The last detach frees the segment
+int32_t sys_shm_detach(hwcontext_t* hw_context) {
+    if (syscall_prologue()) return -1;
+    int32_t retval = shm_detach_segment(get_current_pid(), hw_context->ebx);
+    if (syscall_epilogue()) return -1;
+    return retval;
+}
+
+// Starts a new thread in the caller's process
+// Inputs:
+//      hw_context: hardware context, EBX holds the entry point, ECX the top of the thread's
+//      stack and EDX the argument passed to the entry point
+// Output: PID of the new thread, -1 on failure
+// Side effects: The thread ends when it calls halt, or when the process exits
+int32_t sys_thread_create(hwcontext_t* hw_context) {
+    if (syscall_prologue()) return -1;
+    int32_t retval = thread_start(hw_context->ebx, hw_context->ecx, hw_context->edx);
+    if (syscall_epilogue()) return -1;
+    return retval;
+}
+
+// Waits on or wakes a futex, a word in the caller's memory its threads synchronize on
+// Inputs:
+//      hw_context: hardware context, EBX holds the address of the word, ECX the operation
+//      (FUTEX_WAIT or FUTEX_WAKE), EDX the value the word should hold for FUTEX_WAIT or
+//      the most threads to wake for FUTEX_WAKE
+// Output: FUTEX_WAIT: 0 once woken, -1 if the word changed already. FUTEX_WAKE: threads woken.
+//      -1 on bad arguments.
+// Side effects: FUTEX_WAIT blocks the calling thread
+int32_t sys_futex(hwcontext_t* hw_context) {
+    if (syscall_prologue()) return -1;
+    int32_t retval = -1;
+    if (hw_context->ecx == FUTEX_WAIT) {
+        retval = futex_wait(hw_context->ebx, hw_context->edx);
+    } else if (hw_context->ecx == FUTEX_WAKE) {
+        retval = futex_wake(hw_context->ebx, hw_context->edx);
+    }
+    if (syscall_epilogue()) return -1;
+    return retval;
+}
+
+// Puts the caller to sleep for a while, other tasks run meanwhile
+// Inputs:
+//      hw_context: hardware context, EBX holds the milliseconds to sleep
+// Output: 0 once the time is up
+// Side effects: Sleeps at least that long, give or take a jiffy (see TICK_HZ)
+int32_t sys_sleep(hwcontext_t* hw_context) {
+    if (syscall_prologue()) return -1;
+    msleep(hw_context->ebx);
+    if (syscall_epilogue()) return -1;
+    return 0;
+}
+
+// Gives up the rest of the caller's quantum to the next ready task
+// Inputs:
+//      hw_context: hardware context, unused
+// Output: 0 once the caller is scheduled again, right away if nothing else is ready
+// Side effects: The caller goes to the back of its priority level's queue
+int32_t sys_yield(hwcontext_t* hw_context) {
+    if (syscall_prologue()) return -1;
+    sched_yield();
+    if (syscall_epilogue()) return -1;
+    return 0;
+}
+
+// Sets how long the caller runs before the next task of its priority level gets a turn
+// Inputs:
+//      hw_context: hardware context, EBX holds the quantum in milliseconds, 0 for the default
+// Output: 0 on success, -1 if it's longer than SCHED_MAX_QUANTUM
+// Side effects: Only the calling thread's quantum changes, from its next one on
+int32_t sys_set_quantum(hwcontext_t* hw_context) {
+    if (syscall_prologue()) return -1;
+    int32_t retval = -1;
+    // Tiny quanta still get a whole jiffy
+    if (hw_context->ebx <= SCHED_MAX_QUANTUM * (1000 / TICK_HZ)) {
+        retval = sched_set_quantum(get_current_pid(), tick_ms_to_jiffies(hw_context->ebx));
+    }
+    if (syscall_epilogue()) return -1;
+    return retval;
+}
+
+// Reads a clock with nanosecond resolution
+// Inputs:
+//      hw_context: hardware context, EBX holds the clock (CLOCK_MONOTONIC or CLOCK_REALTIME),
+//          ECX the user's timespec_t to fill
+// Output: 0 on success, -1 for an unknown clock or a bad pointer
+// Side effects: None
+int32_t sys_gettime(hwcontext_t* hw_context) {
+    if (syscall_prologue()) return -1;
+    timespec_t ts;
+    int32_t retval = clock_gettime(hw_context->ebx, &ts);
+    if (!retval && copy_to_user((void*)hw_context->ecx, &ts, sizeof(ts))) retval = -1;
+    if (syscall_epilogue()) return -1;
+    return retval;
+}
+
 // Performs all necessary operations for beginning the syscall (setting up kernel-side mapping)
+// The time up to here counts as the caller's user time (see acct_charge)
 int32_t syscall_prologue() {
-    set_new_cr3((uint32_t)kernel_page_descriptor_table);
+    set_new_cr3((uint32_t)get_kernel_page_directory());
+    acct_syscall_enter();
     return 0;
 }
 
 // Performs all necessary operations for ending the syscall (setting up user-side mapping)
+// The time since syscall_prologue counts as the caller's system time
 int32_t syscall_epilogue() {
-    set_new_cr3((uint32_t)user_page_descriptor_table);
+    acct_syscall_exit();
+    set_new_cr3((uint32_t)get_user_page_directory());
     return 0;
 }
@@ -11,6 +11,18 @@ int32_t sys_getargs(hwcontext_t* context);
 int32_t sys_vidmap(hwcontext_t* context);
 int32_t sys_set_handler(hwcontext_t* context);
 int32_t sys_sigreturn(hwcontext_t* context);
+int32_t sys_sbrk(hwcontext_t* context);
+int32_t sys_mmap(hwcontext_t* context);
+int32_t sys_munmap(hwcontext_t* context);
+int32_t sys_shm_create(hwcontext_t* context);
+int32_t sys_shm_attach(hwcontext_t* context);
+int32_t sys_shm_detach(hwcontext_t* context);
+int32_t sys_thread_create(hwcontext_t* context);
+int32_t sys_futex(hwcontext_t* context);
+int32_t sys_sleep(hwcontext_t* context);
+int32_t sys_yield(hwcontext_t* context);
+int32_t sys_set_quantum(hwcontext_t* context);
+int32_t sys_gettime(hwcontext_t* context);
 int32_t syscall_prologue();
 int32_t syscall_epilogue();
 
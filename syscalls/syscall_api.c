@@ -57,3 +57,75 @@ int32_t sigreturn(void) {
     DO_SYSCALL_ZERO_ARGS(SYSCALL_NUM_SIGRETURN, retval);
     return retval;
 }
+
+void* sbrk(int32_t increment) {
+    int32_t retval;
+    DO_SYSCALL_ONE_ARG(SYSCALL_NUM_SBRK, retval, increment);
+    return (void*)retval;
+}
+
+void* mmap(void* addr, uint32_t length) {
+    int32_t retval;
+    DO_SYSCALL_TWO_ARGS(SYSCALL_NUM_MMAP, retval, addr, length);
+    return (void*)retval;
+}
+
+int32_t munmap(void* addr, uint32_t length) {
+    int32_t retval;
+    DO_SYSCALL_TWO_ARGS(SYSCALL_NUM_MUNMAP, retval, addr, length);
+    return retval;
+}
+
+void* shm_create(const uint8_t* name, uint32_t size) {
+    int32_t retval;
+    DO_SYSCALL_TWO_ARGS(SYSCALL_NUM_SHM_CREATE, retval, name, size);
+    return (void*)retval;
+}
+
+void* shm_attach(const uint8_t* name) {
+    int32_t retval;
+    DO_SYSCALL_ONE_ARG(SYSCALL_NUM_SHM_ATTACH, retval, name);
+    return (void*)retval;
+}
+
+int32_t shm_detach(void* addr) {
+    int32_t retval;
+    DO_SYSCALL_ONE_ARG(SYSCALL_NUM_SHM_DETACH, retval, addr);
+    return retval;
+}
+
+int32_t thread_create(void (*entry)(void*), void* stack_top, void* arg) {
+    int32_t retval;
+    DO_SYSCALL_THREE_ARGS(SYSCALL_NUM_THREAD_CREATE, retval, entry, stack_top, arg);
+    return retval;
+}
+
+int32_t futex(uint32_t* uaddr, int32_t op, uint32_t val) {
+    int32_t retval;
+    DO_SYSCALL_THREE_ARGS(SYSCALL_NUM_FUTEX, retval, uaddr, op, val);
+    return retval;
+}
+
+int32_t sleep(uint32_t ms) {
+    int32_t retval;
+    DO_SYSCALL_ONE_ARG(SYSCALL_NUM_SLEEP, retval, ms);
+    return retval;
+}
+
+int32_t yield(void) {
+    int32_t retval;
+    DO_SYSCALL_ZERO_ARGS(SYSCALL_NUM_YIELD, retval);
+    return retval;
+}
+
+int32_t set_quantum(uint32_t ms) {
+    int32_t retval;
+    DO_SYSCALL_ONE_ARG(SYSCALL_NUM_SET_QUANTUM, retval, ms);
+    return retval;
+}
+
+int32_t gettime(uint32_t clock_id, timespec_t* ts) {
+    int32_t retval;
+    DO_SYSCALL_TWO_ARGS(SYSCALL_NUM_GETTIME, retval, clock_id, ts);
+    return retval;
+}
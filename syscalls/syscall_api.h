@@ -1,6 +1,7 @@
 #ifndef SYSCALL_API_H
 #define SYSCALL_API_H
 #include "../types.h"
+#include "../sched/clock.h"
 
 int32_t halt(uint8_t status);
 int32_t execute(const uint8_t* command);
@@ -12,6 +13,18 @@ int32_t getargs(uint8_t* buf, int32_t nbytes);
 int32_t vidmap(uint8_t** screen_start);
 int32_t set_handler(int32_t signum, void* handler_address);
 int32_t sigreturn(void);
+void* sbrk(int32_t increment);
+void* mmap(void* addr, uint32_t length);
+int32_t munmap(void* addr, uint32_t length);
+void* shm_create(const uint8_t* name, uint32_t size);
+void* shm_attach(const uint8_t* name);
+int32_t shm_detach(void* addr);
+int32_t thread_create(void (*entry)(void*), void* stack_top, void* arg);
+int32_t futex(uint32_t* uaddr, int32_t op, uint32_t val);
+int32_t sleep(uint32_t ms);
+int32_t yield(void);
+int32_t set_quantum(uint32_t ms);
+int32_t gettime(uint32_t clock_id, timespec_t* ts);
 
 #define SYSCALL_NUM_HALT 1
 #define SYSCALL_NUM_EXECUTE 2
@@ -23,6 +36,18 @@ int32_t sigreturn(void);
 #define SYSCALL_NUM_VIDMAP 8
 #define SYSCALL_NUM_SET_HANDLER 9
 #define SYSCALL_NUM_SIGRETURN 10
+#define SYSCALL_NUM_SBRK 11
+#define SYSCALL_NUM_MMAP 12
+#define SYSCALL_NUM_MUNMAP 13
+#define SYSCALL_NUM_SHM_CREATE 14
+#define SYSCALL_NUM_SHM_ATTACH 15
+#define SYSCALL_NUM_SHM_DETACH 16
+#define SYSCALL_NUM_THREAD_CREATE 17
+#define SYSCALL_NUM_FUTEX 18
+#define SYSCALL_NUM_SLEEP 19
+#define SYSCALL_NUM_YIELD 20
+#define SYSCALL_NUM_SET_QUANTUM 21
+#define SYSCALL_NUM_GETTIME 22
 
 // Comments on macros:
 // Mark all ASM as volatile, because there's no knowing what memory a syscall might change
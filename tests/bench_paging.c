@@ -0,0 +1,98 @@
+#include "tests.h"
+#include "../paging.h"
+#include "../memfs/memfs.h"
+
+// Benchmarks for the paging memory-type policy. Each workload is timed once with
+// the type chosen by get_memtype_for_physical and once with the page forced to
+// uncacheable, which is what every mapping used to be.
+
+#define BENCH_BUF_SIZE      (16 * ONE_KB)
+#define BENCH_COPY_FILE     "fish"
+#define BENCH_COMPUTE_ITERS 64
+#define BENCH_FILL_ITERS    16
+#define BENCH_KERN_PDE_IDX  (KERN_BEGIN_ADDR / SIZEOF_PROGRAMPAGE)
+#define BENCH_BGVMEM_PTE_IDX (BACKGROUND_VMEM_PHYSICAL_BEGIN_ADDR_T1 / SIZEOF_4KBPAGE)
+
+static uint8_t bench_buf[BENCH_BUF_SIZE];
+
+// Applies a memtype to the kernel's 4MB page (code, data and the memfs module all live there)
+static void bench_set_kernel_memtype(memtype_t type) {
+    set_pde4mb_memtype(&kernel_page_descriptor_table[BENCH_KERN_PDE_IDX].entry_to_4mb_page, type);
+    asm volatile ("wbinvd" : : : "memory");
+    flush_tlb();
+}
+
+// Applies a memtype to the first background video memory page
+static void bench_set_bgvmem_memtype(memtype_t type) {
+    set_pte_memtype(&kernel_vmem_page_table[BENCH_BGVMEM_PTE_IDX], type);
+    asm volatile ("wbinvd" : : : "memory");
+    flush_tlb();
+}
+
+// Copies a whole file out of memfs into bench_buf, repeatedly
+static uint32_t bench_memfs_copy() {
+    fs_boot_blk_dentry_t dentry;
+    uint32_t i, start;
+    if (read_dentry_by_name(BENCH_COPY_FILE, &dentry) == -1) return 0;
+    start = rdtsc_low();
+    for (i = 0; i < BENCH_FILL_ITERS; i++) {
+        read_data(dentry.inode_idx, 0, bench_buf, BENCH_BUF_SIZE);
+    }
+    return rdtsc_low() - start;
+}
+
+// A checksum loop over bench_buf, standing in for a user program's compute loop
+static uint32_t bench_compute_loop() {
+    uint32_t i, j, start;
+    volatile uint32_t sum = 0;
+    start = rdtsc_low();
+    for (i = 0; i < BENCH_COMPUTE_ITERS; i++) {
+        for (j = 0; j < BENCH_BUF_SIZE; j++) {
+            sum = (sum << 1) ^ bench_buf[j];
+        }
+    }
+    return rdtsc_low() - start;
+}
+
+// Repaints a full text screen in the (offscreen) background video memory page
+static uint32_t bench_screen_fill() {
+    uint32_t i, start;
+    start = rdtsc_low();
+    for (i = 0; i < BENCH_FILL_ITERS; i++) {
+        memset_word((void*)BACKGROUND_VMEM_PHYSICAL_BEGIN_ADDR_T1, (ATTRIB << 8) | ('a' + i), NUM_ROWS * NUM_COLS);
+    }
+    return rdtsc_low() - start;
+}
+
+// Helper that prints one row of results
+static void bench_report(const char* name, uint32_t uc_cycles, uint32_t policy_cycles) {
+    printf("[BENCH %s] uncached = %u cycles, policy = %u cycles", name, uc_cycles, policy_cycles);
+    if (policy_cycles) printf(", %ux faster", uc_cycles / policy_cycles);
+    printf("\n");
+}
+
+void launch_bench_paging() {
+    uint32_t uc_copy, uc_compute, uc_fill;
+    uint32_t copy, compute, fill;
+    uint32_t flags, garbage;
+
+    printf("[BENCH paging] PAT %s\n", paging_has_pat() ? "available, VGA is write-combining" : "unavailable, VGA falls back to uncacheable");
+
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        bench_set_kernel_memtype(MEMTYPE_UC);
+        bench_set_bgvmem_memtype(MEMTYPE_UC);
+        uc_copy = bench_memfs_copy();
+        uc_compute = bench_compute_loop();
+        uc_fill = bench_screen_fill();
+
+        bench_set_kernel_memtype(get_memtype_for_physical(KERN_BEGIN_ADDR));
+        bench_set_bgvmem_memtype(get_memtype_for_physical(BACKGROUND_VMEM_PHYSICAL_BEGIN_ADDR_T1));
+        copy = bench_memfs_copy();
+        compute = bench_compute_loop();
+        fill = bench_screen_fill();
+    }
+
+    bench_report("memfs copy", uc_copy, copy);
+    bench_report("compute loop", uc_compute, compute);
+    bench_report("screen fill", uc_fill, fill);
+}
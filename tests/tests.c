@@ -12,6 +12,12 @@ void launch_tests(){
 	// launch_tests_cp2();
 	// launch_tests_cp4();
 	// launch_tests_cp5();
+	launch_tests_mm();
+	launch_tests_sched();
+
+    #ifdef BENCH_TESTING
+    launch_bench_paging();
+    #endif
 	
     #ifndef PRINT_TESTING
     printf("/!\\ Print testing was disabled.\n");
@@ -11,6 +11,9 @@ void launch_tests_cp2();
 void launch_tests_cp3();
 void launch_tests_cp4();
 void launch_tests_cp5();
+void launch_tests_mm();
+void launch_tests_sched();
+void launch_bench_paging();
 
 // ------------------CONFIGURATION
 #define IS_TESTING // Controls whether tests are run
@@ -19,6 +22,7 @@ void launch_tests_cp5();
 // #define RTC_TESTING //macro to only print things when RTC functionality is being tested.
 // #define SYSCALL_RET_TESTING // DO NOT USE
 // #define SYS_EXECUTE_TEST // DO NOT USE
+// #define BENCH_TESTING // Controls whether the (slow) benchmarks are run
 // -------------------------------
 #define TEST_SPIN() while (1){}
 #define TEST_VALUE_xECEB 0xECEB
@@ -0,0 +1,459 @@
+#include "tests.h"
+#include "../mm/frame.h"
+#include "../mm/kmalloc.h"
+#include "../memfs/kernfs.h"
+#include "../process/process.h"
+#include "../mm/vma.h"
+#include "../mm/shm.h"
+#include "../mm/zero_pool.h"
+#include "../mm/ksm.h"
+#include "../mm/zswap.h"
+#include "../process/uaccess.h"
+#include "../process/thread.h"
+#include "../sched/sched.h"
+
+#define TEST_MM_NUM_OBJS 600 // Enough to need several slabs of kmalloc-32
+#define TEST_MM_NUM_PROCS 100 // Well past the old limit of 6
+
+// Sets up a process with an address space of its own, like execute does before loading a program
+// Inputs: activate -- whether to switch to that address space too
+// Outputs: The process, NULL if it couldn't be set up
+static pcb_t* test_user_process_create(int32_t activate) {
+    pcb_t* pcb = process_allocate(NO_PARENT_PID);
+    if (!pcb) return NULL;
+    if (create_new_user_programpage(pcb->pid) || (activate && activate_existing_user_programpage(pcb->pid))) {
+        process_free(pcb->pid);
+        return NULL;
+    }
+    return pcb;
+}
+
+// Tears down a process from test_user_process_create
+// Inputs: pcb -- the process, mapped_pid -- whose address space to switch back to
+// Outputs: None
+static void test_user_process_destroy(pcb_t* pcb, uint32_t mapped_pid) {
+    destroy_user_programpage(pcb->pid);
+    process_free(pcb->pid);
+    activate_existing_user_programpage(mapped_pid);
+}
+
+int test_frame_alloc_free() {
+    uint32_t before = frame_num_free();
+    uint32_t a = frame_alloc();
+    uint32_t b = frame_alloc();
+    if (a == FRAME_NULL || b == FRAME_NULL || a == b) return FAIL;
+    if ((a & (FRAME_SIZE - 1)) || (b & (FRAME_SIZE - 1))) return FAIL;
+    if (a < frame_pool_begin() || b >= frame_pool_end()) return FAIL;
+    if (frame_num_free() != before - 2) return FAIL;
+    // The pool is identity mapped, so we can touch it
+    memset((void*)a, 0xAB, FRAME_SIZE);
+    frame_free(a);
+    frame_free(b);
+    if (frame_num_free() != before) return FAIL;
+    return PASS;
+}
+
+int test_frame_alloc_contig_aligned() {
+    uint32_t addr = frame_alloc_contig(4, 4);
+    if (addr == FRAME_NULL) return FAIL;
+    if (addr & (4 * FRAME_SIZE - 1)) return FAIL;
+    frame_free_contig(addr, 4);
+    return PASS;
+}
+
+int test_kmalloc_size_classes() {
+    uint32_t sizes[] = {1, 16, 17, 100, 1024, 1025, 3 * FRAME_SIZE};
+    uint32_t i;
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        uint8_t* ptr = kmalloc(sizes[i]);
+        if (!ptr) return FAIL;
+        if ((uint32_t)ptr & (KMEM_OBJ_ALIGN - 1)) return FAIL;
+        memset(ptr, 0x5A, sizes[i]);
+        kfree(ptr);
+    }
+    if (kmalloc(0) != NULL) return FAIL;
+    return PASS;
+}
+
+int test_kmem_cache_many_objects() {
+    static uint32_t* objs[TEST_MM_NUM_OBJS];
+    uint32_t i;
+    uint32_t before = frame_num_free();
+    kmem_cache_t* cache = kmem_cache_create("test_cache", 2 * sizeof(uint32_t));
+    if (!cache) return FAIL;
+    for (i = 0; i < TEST_MM_NUM_OBJS; i++) {
+        objs[i] = kmem_cache_alloc(cache);
+        if (!objs[i]) return FAIL;
+        objs[i][0] = i;
+        objs[i][1] = ~i;
+    }
+    if (cache->active_objs != TEST_MM_NUM_OBJS || cache->num_slabs < 2) return FAIL;
+    // Nothing got handed out twice
+    for (i = 0; i < TEST_MM_NUM_OBJS; i++) {
+        if (objs[i][0] != i || objs[i][1] != ~i) return FAIL;
+    }
+    // Not while anything is still allocated from it
+    if (kmem_cache_destroy(cache) != -1) return FAIL;
+    for (i = 0; i < TEST_MM_NUM_OBJS; i++) kmem_cache_free(cache, objs[i]);
+    if (cache->active_objs != 0 || cache->num_slabs != 1) return FAIL;
+    // Only the one cached empty slab (and possibly a cache_cache slab) stays around
+    if (before - frame_num_free() > 2) return FAIL;
+    return kmem_cache_destroy(cache) == 0 && before - frame_num_free() <= 1;
+}
+
+int test_slabinfo_registered() {
+    return kernfs_lookup("slabinfo") != -1 && kernfs_lookup("no_such_file") == -1;
+}
+
+int test_process_table_scales() {
+    static pcb_t* pcbs[TEST_MM_NUM_PROCS];
+    uint32_t i, j;
+    for (i = 0; i < TEST_MM_NUM_PROCS; i++) {
+        pcbs[i] = process_allocate(NO_PARENT_PID);
+        if (!pcbs[i]) return FAIL;
+        if (get_pcb(pcbs[i]->pid) != pcbs[i]) return FAIL;
+        // Anywhere on the kernel stack leads back to the owner
+        if ((uint32_t)pcbs[i]->kstack & (PROC_AREA_SIZE - 1)) return FAIL;
+        if (derive_pid_from_esplike(get_initial_esp0_of_process(pcbs[i]->pid)) != pcbs[i]->pid) return FAIL;
+        for (j = 0; j < i; j++) {
+            if (pcbs[j]->pid == pcbs[i]->pid) return FAIL;
+        }
+    }
+    for (i = 0; i < TEST_MM_NUM_PROCS; i++) {
+        uint32_t pid = pcbs[i]->pid;
+        if (process_free(pid) != NO_PARENT_PID) return FAIL;
+        if (get_pcb(pid) != NULL) return FAIL;
+    }
+    // The boot stack is PID 0
+    return derive_pid_from_esplike(KERNEL_END_ADDR - sizeof(uint32_t)) == 0;
+}
+
+int test_mmap_sbrk_demand_paging() {
+    uint32_t old_pid = current_universe_paging_state().current_mapped_pid;
+    uint32_t before, pid;
+    int32_t area, brk, result = PASS;
+    pcb_t* pcb = test_user_process_create(1);
+    if (!pcb) return FAIL;
+    pid = pcb->pid;
+    before = frame_num_free();
+
+    // Reserving costs nothing, touching costs a page (plus a page table)
+    area = mm_mmap(pid, 0, 3 * SIZEOF_4KBPAGE);
+    if (area < USER_MMAP_BEGIN_ADDR || frame_num_free() != before) result = FAIL;
+    ((uint8_t*)area)[SIZEOF_4KBPAGE] = 0x42;
+    if (before - frame_num_free() != 2 || ((uint8_t*)area)[SIZEOF_4KBPAGE + 1] != 0) result = FAIL;
+    // Splitting in the middle leaves both ends mapped
+    if (mm_munmap(pid, area + SIZEOF_4KBPAGE, SIZEOF_4KBPAGE) || before - frame_num_free() != 1) result = FAIL;
+    if (!mm_addr_is_valid(pcb->mm, area) || mm_addr_is_valid(pcb->mm, area + SIZEOF_4KBPAGE)) result = FAIL;
+    if (!mm_addr_is_valid(pcb->mm, area + 2 * SIZEOF_4KBPAGE)) result = FAIL;
+    if (mm_mmap(pid, area + SIZEOF_4KBPAGE, SIZEOF_4KBPAGE) != area + SIZEOF_4KBPAGE) result = FAIL;
+
+    brk = mm_sbrk(pid, 100);
+    if (brk != USER_HEAP_BEGIN_ADDR || mm_sbrk(pid, 0) != USER_HEAP_BEGIN_ADDR + 100) result = FAIL;
+    ((uint8_t*)brk)[99] = 1;
+    if (mm_sbrk(pid, -200) != -1 || mm_sbrk(pid, -100) != USER_HEAP_BEGIN_ADDR) result = FAIL;
+    if (mm_addr_is_valid(pcb->mm, USER_HEAP_BEGIN_ADDR)) result = FAIL;
+
+    test_user_process_destroy(pcb, old_pid);
+    return result;
+}
+
+int test_shm_shared_between_processes() {
+    uint32_t old_pid = current_universe_paging_state().current_mapped_pid;
+    int32_t addr_a, addr_b, result = PASS;
+    pcb_t* a = test_user_process_create(0);
+    pcb_t* b = test_user_process_create(0);
+    if (!a || !b) return FAIL;
+
+    activate_existing_user_programpage(a->pid);
+    // Offset the second attachment so the two land at different addresses
+    mm_mmap(b->pid, 0, SIZEOF_4KBPAGE);
+    addr_a = shm_create_segment(a->pid, "test_shm", 2 * SIZEOF_4KBPAGE);
+    if (addr_a == -1 || shm_create_segment(b->pid, "test_shm", SIZEOF_4KBPAGE) != -1) result = FAIL;
+    ((uint32_t*)addr_a)[0] = 0xC0FFEE;
+
+    activate_existing_user_programpage(b->pid);
+    addr_b = shm_attach_segment(b->pid, "test_shm");
+    if (addr_b == -1 || addr_b == addr_a || ((uint32_t*)addr_b)[0] != 0xC0FFEE) result = FAIL;
+    ((uint32_t*)addr_b)[1024] = 7;
+
+    // Outlives its creator, and is gone after the last detach
+    activate_existing_user_programpage(a->pid);
+    if (shm_detach_segment(a->pid, addr_a) || shm_detach_segment(a->pid, addr_a) != -1) result = FAIL;
+    activate_existing_user_programpage(b->pid);
+    if (((uint32_t*)addr_b)[1024] != 7) result = FAIL;
+    if (shm_detach_segment(b->pid, addr_b) || shm_attach_segment(b->pid, "test_shm") != -1) result = FAIL;
+
+    test_user_process_destroy(a, old_pid);
+    test_user_process_destroy(b, old_pid);
+    return result;
+}
+
+int test_zero_pool_hands_out_zeroed_frames() {
+    uint32_t i, frame, ready;
+    // Dirty some frames so the pool has something to clean
+    for (i = 0; i < ZERO_POOL_IDLE_BATCH; i++) {
+        frame = frame_alloc();
+        if (frame == FRAME_NULL) return FAIL;
+        memset((void*)frame, 0xEE, FRAME_SIZE);
+        frame_free(frame);
+    }
+    ready = zero_pool_size();
+    zero_pool_idle();
+    if (ready < ZERO_POOL_MAX_FRAMES && zero_pool_size() <= ready) return FAIL;
+    while (zero_pool_size()) {
+        frame = frame_alloc_zeroed();
+        for (i = 0; i < FRAME_SIZE / sizeof(uint32_t); i++) {
+            if (((uint32_t*)frame)[i]) return FAIL;
+        }
+        frame_free(frame);
+    }
+    // Falls back to zeroing on the spot
+    frame = frame_alloc_zeroed();
+    if (frame == FRAME_NULL || ((uint32_t*)frame)[FRAME_SIZE / sizeof(uint32_t) - 1]) return FAIL;
+    frame_free(frame);
+    return PASS;
+}
+
+int test_ksm_merges_identical_pages() {
+    uint32_t old_pid = current_universe_paging_state().current_mapped_pid;
+    uint32_t i, saved;
+    int32_t addr_a, addr_b, was_enabled, result = PASS;
+    pcb_t* a = test_user_process_create(0);
+    pcb_t* b = test_user_process_create(0);
+    if (!a || !b) return FAIL;
+    addr_a = mm_mmap(a->pid, 0, SIZEOF_4KBPAGE);
+    addr_b = mm_mmap(b->pid, 0, SIZEOF_4KBPAGE);
+    activate_existing_user_programpage(a->pid);
+    memset((void*)addr_a, 0x3C, SIZEOF_4KBPAGE);
+    activate_existing_user_programpage(b->pid);
+    memset((void*)addr_b, 0x3C, SIZEOF_4KBPAGE);
+
+    saved = ksm_frames_saved();
+    was_enabled = ksm_set_enabled(1);
+    for (i = 0; i < 10000 && get_user_pte(b->pid, addr_b)->read_write; i++) ksm_idle();
+    ksm_set_enabled(was_enabled);
+    if (get_user_pte(a->pid, addr_a)->base_addr != get_user_pte(b->pid, addr_b)->base_addr) result = FAIL;
+    if (ksm_frames_saved() <= saved) result = FAIL;
+
+    // Writing gets the process its own copy back
+    ((uint8_t*)addr_b)[5] = 0;
+    activate_existing_user_programpage(a->pid);
+    if (((uint8_t*)addr_a)[5] != 0x3C || get_user_pte(a->pid, addr_a)->read_write) result = FAIL;
+    if (get_user_pte(a->pid, addr_a)->base_addr == get_user_pte(b->pid, addr_b)->base_addr) result = FAIL;
+
+    test_user_process_destroy(a, old_pid);
+    test_user_process_destroy(b, old_pid);
+    return result;
+}
+
+int test_zswap_round_trip() {
+    uint32_t old_pid = current_universe_paging_state().current_mapped_pid;
+    uint32_t i, stored;
+    int32_t area, result = PASS;
+    pcb_t* pcb = test_user_process_create(1);
+    if (!pcb) return FAIL;
+    area = mm_mmap(pcb->pid, 0, 3 * SIZEOF_4KBPAGE);
+    for (i = 0; i < SIZEOF_4KBPAGE; i++) ((uint8_t*)area)[i] = i % 13;
+    ((uint32_t*)area)[2 * SIZEOF_4KBPAGE / sizeof(uint32_t)] = 0xFEED;
+    stored = zswap_num_stored();
+
+    // Compressing drops the frame, touching the page brings it back intact
+    if (zswap_swap_out(pcb->pid, area) || zswap_swap_out(pcb->pid, area) != -1) result = FAIL;
+    if (get_user_pte(pcb->pid, area)->present || zswap_num_stored() != stored + 1) result = FAIL;
+    for (i = 0; i < SIZEOF_4KBPAGE; i++) {
+        if (((uint8_t*)area)[i] != i % 13) result = FAIL;
+    }
+    if (zswap_num_stored() != stored) result = FAIL;
+    // Never touched pages can't be swapped out, exiting frees what's still compressed
+    if (zswap_swap_out(pcb->pid, area + SIZEOF_4KBPAGE) != -1) result = FAIL;
+    if (zswap_swap_out(pcb->pid, area + 2 * SIZEOF_4KBPAGE)) result = FAIL;
+
+    test_user_process_destroy(pcb, old_pid);
+    if (zswap_num_stored() != stored) result = FAIL;
+    return result;
+}
+
+int test_user_copy_recovers_from_faults() {
+    uint32_t old_pid = current_universe_paging_state().current_mapped_pid;
+    char kbuf[8];
+    int32_t area, result = PASS;
+    pcb_t* pcb = test_user_process_create(1);
+    if (!pcb) return FAIL;
+    area = mm_mmap(pcb->pid, 0, SIZEOF_4KBPAGE);
+
+    // Copies that end exactly at the end of the area are fine, one more byte isn't
+    if (copy_to_user((void*)(area + SIZEOF_4KBPAGE - 6), "hello", 6)) result = FAIL;
+    if (copy_from_user(kbuf, (void*)(area + SIZEOF_4KBPAGE - 6), 6) || strncmp((int8_t*)kbuf, (int8_t*)"hello", 6)) result = FAIL;
+    if (strncpy_from_user(kbuf, (char*)(area + SIZEOF_4KBPAGE - 6), sizeof(kbuf)) != 5) result = FAIL;
+    if (copy_from_user(kbuf, (void*)(area + SIZEOF_4KBPAGE - 6), 7) != -1) result = FAIL;
+    if (copy_to_user((void*)(area + SIZEOF_4KBPAGE), "x", 1) != -1) result = FAIL;
+    // Runs off the area before finding its end
+    if (copy_to_user((void*)(area + SIZEOF_4KBPAGE - 1), "!", 1)) result = FAIL;
+    if (strncpy_from_user(kbuf, (char*)(area + SIZEOF_4KBPAGE - 6), sizeof(kbuf)) != -1) result = FAIL;
+    // Outside the window altogether, or wrapping around
+    if (copy_from_user(kbuf, (void*)KERNEL_END_ADDR, 1) != -1) result = FAIL;
+    if (copy_from_user(kbuf, (void*)area, 0xFFFFFFFF) != -1) result = FAIL;
+
+    test_user_process_destroy(pcb, old_pid);
+    return result;
+}
+
+int test_user_stack_grows_down_to_guard() {
+    uint32_t old_pid = current_universe_paging_state().current_mapped_pid;
+    uint32_t before, addr, deep = USER_STACK_BEGIN_ADDR + SIZEOF_4KBPAGE;
+    int32_t result = PASS;
+    pcb_t* pcb = test_user_process_create(1);
+    if (!pcb) return FAIL;
+    before = frame_num_free();
+
+    // Only the pages touched (plus their page tables) cost anything
+    *(uint32_t*)get_initial_esp_of_process(pcb->pid) = 1;
+    if (before - frame_num_free() != 2 || pcb->mm->stack_low != USER_STACK_END_ADDR - SIZEOF_4KBPAGE) result = FAIL;
+    // Far below what's been used is a stray pointer, not the stack
+    if (copy_to_user((void*)deep, "x", 1) != -1 || mm_addr_is_valid(pcb->mm, deep)) result = FAIL;
+    for (addr = pcb->mm->stack_low - USER_STACK_GROWTH_GAP; addr >= deep; addr -= USER_STACK_GROWTH_GAP) {
+        if (copy_to_user((void*)addr, "x", 1) || pcb->mm->stack_low != addr) result = FAIL;
+    }
+    if (copy_to_user((void*)deep, "x", 1) || pcb->mm->stack_low != deep) result = FAIL;
+    // Nothing can be put in the guard page
+    if (copy_to_user((void*)USER_STACK_GUARD_ADDR, "x", 1) != -1) result = FAIL;
+    if (mm_mmap(pcb->pid, USER_STACK_GUARD_ADDR, SIZEOF_4KBPAGE) != -1) result = FAIL;
+
+    test_user_process_destroy(pcb, old_pid);
+    return result;
+}
+
+int test_huge_page_promotion() {
+    uint32_t old_pid = current_universe_paging_state().current_mapped_pid;
+    uint32_t i, idx = GET_10_MSB(USER_MMAP_BEGIN_ADDR - USER_WINDOW_BEGIN_ADDR);
+    uint32_t* words = (uint32_t*)USER_MMAP_BEGIN_ADDR;
+    uint32_t word;
+    int32_t result = PASS;
+    pcb_t* pcb = test_user_process_create(1);
+    if (!pcb) return FAIL;
+    if (mm_mmap(pcb->pid, USER_MMAP_BEGIN_ADDR, SIZEOF_PROGRAMPAGE) != USER_MMAP_BEGIN_ADDR) return FAIL;
+
+    // Not while a single page is missing
+    for (i = 1; i < SIZEOF_PROGRAMPAGE / SIZEOF_4KBPAGE; i++) words[i * SIZEOF_4KBPAGE / sizeof(uint32_t)] = i;
+    if (promote_huge_page(pcb->pid, idx) != -1) result = FAIL;
+    words[0] = 0;
+    if (promote_huge_page(pcb->pid, idx) || pcb->mm->huge_pages[idx] == FRAME_NULL) result = FAIL;
+    if (get_user_pte(pcb->pid, USER_MMAP_BEGIN_ADDR) != NULL) result = FAIL;
+    for (i = 0; i < SIZEOF_PROGRAMPAGE / SIZEOF_4KBPAGE; i++) {
+        if (words[i * SIZEOF_4KBPAGE / sizeof(uint32_t)] != i) result = FAIL;
+    }
+
+    // Unmapping part of it splits it again
+    if (mm_munmap(pcb->pid, USER_MMAP_BEGIN_ADDR + SIZEOF_4KBPAGE, SIZEOF_4KBPAGE)) result = FAIL;
+    if (pcb->mm->huge_pages[idx] != FRAME_NULL || pcb->mm->huge_demotions != 1) result = FAIL;
+    if (copy_from_user(&word, (void*)(USER_MMAP_BEGIN_ADDR + SIZEOF_4KBPAGE), sizeof(word)) != -1) result = FAIL;
+    if (words[2 * SIZEOF_4KBPAGE / sizeof(uint32_t)] != 2) result = FAIL;
+
+    test_user_process_destroy(pcb, old_pid);
+    return result;
+}
+
+int test_process_mem_stats() {
+    uint32_t old_pid = current_universe_paging_state().current_mapped_pid;
+    uint32_t word = 0;
+    int32_t area, result = PASS;
+    pcb_t* pcb = test_user_process_create(1);
+    if (!pcb) return FAIL;
+    area = mm_mmap(pcb->pid, 0, 2 * SIZEOF_4KBPAGE);
+    if (area == -1) return FAIL;
+    if (mm_virtual_size(pcb->mm) != SIZEOF_PROGRAMPAGE + 2 * SIZEOF_4KBPAGE) result = FAIL;
+
+    // First touches are minor, bringing a page back from compressed swap is major
+    if (copy_to_user((void*)area, &word, sizeof(word)) || copy_to_user((void*)(area + SIZEOF_4KBPAGE), &word, sizeof(word))) result = FAIL;
+    if (pcb->mem_stats.resident_pages != 2 || pcb->mem_stats.minor_faults != 2) result = FAIL;
+    if (zswap_swap_out(pcb->pid, area) || pcb->mem_stats.resident_pages != 1) result = FAIL;
+    if (copy_from_user(&word, (void*)area, sizeof(word)) || pcb->mem_stats.major_faults != 1) result = FAIL;
+    if (pcb->mem_stats.resident_pages != 2) result = FAIL;
+    if (mm_munmap(pcb->pid, area, 2 * SIZEOF_4KBPAGE) || pcb->mem_stats.resident_pages != 0) result = FAIL;
+
+    test_user_process_destroy(pcb, old_pid);
+    return result;
+}
+
+int test_elf_loader_maps_segments() {
+    uint32_t old_pid = current_universe_paging_state().current_mapped_pid;
+    executability_result_t exec_info = determine_executability("fish");
+    uint32_t entry = get_user_eip(exec_info);
+    uint8_t byte = 1;
+    page_table_entry_t* pte;
+    int32_t result = PASS;
+    pcb_t* pcb;
+    if (!exec_info.is_executable) return FAIL;
+    pcb = test_user_process_create(1);
+    if (!pcb) return FAIL;
+
+    // fish has one page of text and one page of data followed by a large .bss
+    if (load_executable_into_memory(exec_info, pcb->pid)) result = FAIL;
+    if (pcb->mem_stats.exec_pages_copied != 2 || pcb->mem_stats.resident_pages != 2) result = FAIL;
+    pte = get_user_pte(pcb->pid, entry);
+    if (!pte || !pte->present || pte->read_write || pte->custom != PTE_CUSTOM_READONLY) result = FAIL;
+    if (copy_to_user((void*)entry, &byte, 1) != -1) result = FAIL;
+    // .bss was never read from the file but is zero all the same
+    if (copy_from_user(&byte, (void*)(entry + 5 * SIZEOF_4KBPAGE), 1) || byte != 0) result = FAIL;
+    if (copy_to_user((void*)(entry + 5 * SIZEOF_4KBPAGE), &byte, 1)) result = FAIL;
+
+    test_user_process_destroy(pcb, old_pid);
+    return result;
+}
+
+int test_threads_share_process_and_take_turns() {
+    uint32_t old_pid = current_universe_paging_state().current_mapped_pid;
+    int32_t result = PASS;
+    pcb_t* pcb = test_user_process_create(0);
+    pcb_t* thread;
+    uint32_t tid, ready;
+    if (!pcb) return FAIL;
+    thread = process_allocate_thread(pcb);
+    if (!thread) return FAIL;
+    tid = thread->pid;
+
+    // Nothing made up here may actually get scheduled
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        // Linked in and queued like thread_start does
+        ready = sched_num_ready();
+        thread->next_thread = pcb->next_thread;
+        pcb->next_thread = thread;
+        if (sched_enqueue(tid) || sched_enqueue(pcb->pid)) result = FAIL;
+        if (sched_enqueue(tid) != -1 || sched_num_ready() != ready + 2) result = FAIL;
+
+        if (!is_thread_pid(tid) || is_thread_pid(pcb->pid) || get_thread_leader(tid) != pcb) result = FAIL;
+        if (thread->mm != pcb->mm || thread->fd_array != pcb->fd_array) result = FAIL;
+        if (get_canonical_pid(tid) != pcb->pid) result = FAIL;
+
+        // The process going away takes its threads (and their turns) with it, but not its files
+        if (sched_remove(pcb->pid) || sched_remove(pcb->pid) != -1) result = FAIL;
+        thread_kill_others(pcb);
+        if (get_pcb(tid) || pcb->next_thread || !pcb->fd_array) result = FAIL;
+        if (sched_num_ready() != ready) result = FAIL;
+    }
+
+    test_user_process_destroy(pcb, old_pid);
+    return result;
+}
+
+void launch_tests_mm() {
+    TEST_OUTPUT("Frames are allocated and freed", test_frame_alloc_free());
+    TEST_OUTPUT("Contiguous frames are aligned", test_frame_alloc_contig_aligned());
+    TEST_OUTPUT("kmalloc handles every size class", test_kmalloc_size_classes());
+    TEST_OUTPUT("Slab caches grow and shrink", test_kmem_cache_many_objects());
+    TEST_OUTPUT("slabinfo is a kernel file", test_slabinfo_registered());
+    TEST_OUTPUT("Process table holds more than 6 processes", test_process_table_scales());
+    TEST_OUTPUT("mmap and sbrk memory is backed on first touch", test_mmap_sbrk_demand_paging());
+    TEST_OUTPUT("Shared memory is shared between processes", test_shm_shared_between_processes());
+    TEST_OUTPUT("Zero pool hands out zeroed frames", test_zero_pool_hands_out_zeroed_frames());
+    TEST_OUTPUT("Identical pages are merged and copied on write", test_ksm_merges_identical_pages());
+    TEST_OUTPUT("Compressed swap gives pages back intact", test_zswap_round_trip());
+    TEST_OUTPUT("User copies fail cleanly on unmapped memory", test_user_copy_recovers_from_faults());
+    TEST_OUTPUT("User stack grows on demand down to its guard page", test_user_stack_grows_down_to_guard());
+    TEST_OUTPUT("Full page tables become 4MB pages and split on munmap", test_huge_page_promotion());
+    TEST_OUTPUT("Page faults and resident pages are counted per process", test_process_mem_stats());
+    TEST_OUTPUT("Programs are loaded segment by segment with read-only text", test_elf_loader_maps_segments());
+    TEST_OUTPUT("Threads share their process and take turns", test_threads_share_process_and_take_turns());
+}
@@ -0,0 +1,235 @@
+#include "tests.h"
+#include "../memfs/kernfs.h"
+#include "../process/process.h"
+#include "../sched/sched.h"
+#include "../sched/timer.h"
+#include "../sched/spinlock.h"
+#include "../sched/smp.h"
+#include "../sched/clock.h"
+
+int test_wait_queue_wakes_oldest_first() {
+    int32_t result = PASS;
+    wait_queue_t wq;
+    pcb_t* first = process_allocate(NO_PARENT_PID);
+    pcb_t* second = process_allocate(NO_PARENT_PID);
+    uint32_t ready;
+    if (!first || !second) return FAIL;
+    wait_queue_init(&wq);
+
+    // Nothing made up here may actually get scheduled
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        ready = sched_num_ready();
+        // Asleep like sleep_on leaves them
+        first->blocked = second->blocked = 1;
+        first->waiting_on = second->waiting_on = &wq;
+        first->wait_next = second;
+        second->wait_next = NULL;
+        wq.head = first;
+        wq.tail = second;
+
+        if (wake_up(&wq, 1) != 1 || first->blocked || !second->blocked) result = FAIL;
+        if (!first->on_run_queue || second->on_run_queue || sched_num_ready() != ready + 1) result = FAIL;
+        if (wq.head != second || wake_up_task(first) != -1) result = FAIL;
+        // A task that goes away stops waiting
+        process_free(second->pid);
+        if (wq.head || wq.tail || wake_up(&wq, WAKE_ALL) != 0) result = FAIL;
+        process_free(first->pid);
+        if (sched_num_ready() != ready) result = FAIL;
+    }
+    return result;
+}
+
+int test_idle_task_never_queues() {
+    uint32_t ready = sched_num_ready();
+    if (kernfs_lookup("schedstat") == -1) return FAIL;
+    // It only runs when nothing else can
+    if (sched_enqueue(SCHED_IDLE_PID) != -1 || sched_num_ready() != ready) return FAIL;
+    return PASS;
+}
+
+int test_woken_tasks_move_up_a_level() {
+    int32_t result = PASS;
+    pcb_t* pcb = process_allocate(NO_PARENT_PID);
+    if (!pcb) return FAIL;
+
+    // Nothing made up here may actually get scheduled
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        // A background task that used up its quanta, then slept
+        pcb->sched_level = SCHED_NUM_LEVELS - 1;
+        pcb->ticks_left = 0;
+        if (sched_wake(pcb->pid) || pcb->sched_level != SCHED_NUM_LEVELS - 2 || !pcb->on_run_queue) result = FAIL;
+        if (sched_wake(pcb->pid) != -1 || pcb->sched_level != SCHED_NUM_LEVELS - 2) result = FAIL;
+        process_free(pcb->pid);
+        if (pcb->on_run_queue) result = FAIL;
+    }
+    return result;
+}
+
+int test_ticks_only_when_sharing_the_cpu() {
+    int32_t result = PASS;
+    pcb_t* running = process_allocate(NO_PARENT_PID);
+    pcb_t* waiting = process_allocate(NO_PARENT_PID);
+    uint32_t now = tick_now();
+    if (!running || !waiting) return FAIL;
+
+    // Nothing made up here may actually get scheduled
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        running->ticks_left = SCHED_BASE_QUANTUM;
+        // The idle task never needs a tick, a task does once another one waits for the CPU
+        if (sched_next_event(SCHED_IDLE_PID, now) != 0) result = FAIL;
+        sched_enqueue(waiting->pid);
+        if (sched_next_event(running->pid, now) == 0 || sched_next_event(running->pid, now) > SCHED_BASE_QUANTUM) result = FAIL;
+        if (sched_next_event(SCHED_IDLE_PID, now) != 0) result = FAIL;
+        process_free(waiting->pid);
+        process_free(running->pid);
+    }
+    if (tick_now() < now) result = FAIL;
+    return result;
+}
+
+int test_tasks_pick_their_quantum() {
+    int32_t result = PASS;
+    pcb_t* pcb = process_allocate(NO_PARENT_PID);
+    if (!pcb) return FAIL;
+    if (pcb->quantum || sched_set_quantum(pcb->pid, SCHED_MAX_QUANTUM) || pcb->quantum != SCHED_MAX_QUANTUM) result = FAIL;
+    if (sched_set_quantum(pcb->pid, SCHED_MAX_QUANTUM + 1) != -1 || pcb->quantum != SCHED_MAX_QUANTUM) result = FAIL;
+    if (sched_set_quantum(SCHED_IDLE_PID, 1) != -1 || sched_set_quantum(pcb->pid, 0) || pcb->quantum) result = FAIL;
+    process_free(pcb->pid);
+    return result;
+}
+
+int test_idle_cpus_steal_tasks() {
+    int32_t result = PASS;
+    pcb_t* pcb = process_allocate(NO_PARENT_PID);
+    uint32_t ready;
+    if (!pcb) return FAIL;
+
+    // Nothing made up here may actually get scheduled
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        pcb->cpu = 1;
+        ready = sched_num_ready();
+        if (sched_enqueue(pcb->pid)) result = FAIL;
+        // CPU 1 is the busiest one left, and the task comes over as it is
+        if (sched_steal(0) != pcb->pid || pcb->cpu != 0 || !pcb->on_run_queue) result = FAIL;
+        if (sched_num_ready() != ready + 1 || sched_steal(SMP_MAX_CPUS) != FAIL_PID) result = FAIL;
+        sched_remove(pcb->pid);
+        if (sched_num_ready() != ready) result = FAIL;
+    }
+    process_free(pcb->pid);
+    return result;
+}
+
+int test_locks_count_and_queue() {
+    int32_t result = PASS;
+    // Static, the lockstat file keeps pointing at them
+    static lock_stats_t stats;
+    spinlock_t lock;
+    ticket_lock_t ticket;
+    uint32_t flags, garbage;
+    lock_stats_init(&stats, "test");
+    spin_lock_init(&lock, &stats);
+    ticket_lock_init(&ticket, &stats);
+    if (kernfs_lookup("lockstat") == -1) result = FAIL;
+
+    SPIN_LOCK_IRQSAVE(&lock, flags, garbage) {
+        // Taken, so trying again fails rather than spinning forever
+        if (!lock.locked || spin_trylock(&lock)) result = FAIL;
+    }
+    if (lock.locked || !spin_trylock(&lock)) result = FAIL;
+    spin_unlock(&lock);
+    TICKET_LOCK_IRQSAVE(&ticket, flags, garbage) {
+        if (ticket.next != 1 || ticket.owner != 0) result = FAIL;
+    }
+    // The next caller gets served next
+    if (ticket.next != 1 || ticket.owner != 1) result = FAIL;
+    if (stats.acquired != 3 || stats.contended || stats.hold_max > stats.hold_total) result = FAIL;
+    return result;
+}
+
+int test_clock_moves_forward() {
+    int32_t result = PASS;
+    timespec_t before, after;
+    uint32_t rem;
+    // 64-bit division without libgcc
+    if (div_u64_rem(10000000000ULL, 3, &rem) != 3333333333ULL || rem != 1) result = FAIL;
+    if (kernfs_lookup("clock") == -1) result = FAIL;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &before) || clock_gettime(CLOCK_MONOTONIC, &after)) result = FAIL;
+    if (before.nsec >= NSEC_PER_SEC || after.nsec >= NSEC_PER_SEC) result = FAIL;
+    if (after.sec < before.sec || (after.sec == before.sec && after.nsec < before.nsec)) result = FAIL;
+    if (clock_gettime(CLOCK_REALTIME, &after) || after.nsec >= NSEC_PER_SEC) result = FAIL;
+    if (clock_gettime(CLOCK_REALTIME + 1, &after) != -1 || clock_gettime(CLOCK_MONOTONIC, NULL) != -1) result = FAIL;
+    return result;
+}
+
+int test_cpu_time_accounting() {
+    int32_t result = PASS;
+    pcb_t* pcb = process_allocate(NO_PARENT_PID);
+    if (!pcb) return FAIL;
+    if (kernfs_lookup("top") == -1) result = FAIL;
+
+    // Fake timestamps, as if it waited 100 cycles, then spent 30 in user mode and 20 in the kernel
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        acct_ready(pcb, 1000);
+        acct_dispatch(pcb, 1100);
+        acct_charge(pcb, 1130, 0);
+        acct_charge(pcb, 1150, 1);
+        acct_stop(pcb);
+        // Nothing counts while it's stopped
+        acct_charge(pcb, 5000, 0);
+    }
+    if (pcb->acct.wait_cycles != 100 || pcb->acct.user_cycles != 30 || pcb->acct.sys_cycles != 20) result = FAIL;
+    if (pcb->acct.started != 1100 || pcb->acct.stamp != 5000) result = FAIL;
+    process_free(pcb->pid);
+    return result;
+}
+
+static void count_timer_run(uint32_t data) {
+    (*(uint32_t*)data)++;
+}
+
+int test_timer_wheel_add_cancel_run() {
+    int32_t result = PASS;
+    ktimer_t soon, later, due;
+    uint32_t runs = 0;
+    uint32_t pending = timer_num_pending();
+    timer_setup(&soon, count_timer_run, (uint32_t)&runs);
+    timer_setup(&later, count_timer_run, (uint32_t)&runs);
+    timer_setup(&due, count_timer_run, (uint32_t)&runs);
+
+    // Nothing made up here may actually run from the PIT
+    uint32_t flags, garbage;
+    CRITICAL_SECTION_FLAGSAVE(flags, garbage) {
+        uint32_t now = tick_now();
+        // One for the next few jiffies, one for the upper levels of the wheel
+        timer_add(&soon, now + 3);
+        timer_add(&later, now + 10 * TIMER_WHEEL_SIZE * TIMER_WHEEL_SIZE);
+        if (!timer_pending(&soon) || !timer_pending(&later) || timer_num_pending() != pending + 2) result = FAIL;
+        if (timer_next_event(now) == 0 || timer_next_event(now) > 3) result = FAIL;
+        if (timer_cancel(&soon) != 1 || timer_cancel(&soon) != 0 || timer_pending(&soon)) result = FAIL;
+        if (timer_cancel(&later) != 1 || timer_num_pending() != pending) result = FAIL;
+        // Due already, so it runs right away
+        timer_add(&due, now - 1);
+        timer_run(tick_now());
+        if (runs != 1 || timer_pending(&due)) result = FAIL;
+    }
+    return result;
+}
+
+void launch_tests_sched() {
+    TEST_OUTPUT("Wait queues wake the oldest sleeper first", test_wait_queue_wakes_oldest_first());
+    TEST_OUTPUT("The idle task stays off the run queue", test_idle_task_never_queues());
+    TEST_OUTPUT("Tasks that wake up move up a priority level", test_woken_tasks_move_up_a_level());
+    TEST_OUTPUT("The timer only ticks while tasks share the CPU", test_ticks_only_when_sharing_the_cpu());
+    TEST_OUTPUT("Timers are added, cancelled and run from the wheel", test_timer_wheel_add_cancel_run());
+    TEST_OUTPUT("Tasks pick their own quantum", test_tasks_pick_their_quantum());
+    TEST_OUTPUT("Idle CPUs steal tasks from busy ones", test_idle_cpus_steal_tasks());
+    TEST_OUTPUT("Locks count acquisitions and queue up in order", test_locks_count_and_queue());
+    TEST_OUTPUT("The clock only moves forward", test_clock_moves_forward());
+    TEST_OUTPUT("CPU time is split into user, system and waiting", test_cpu_time_accounting());
+}